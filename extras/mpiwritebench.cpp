@@ -0,0 +1,178 @@
+/**
+ * @file
+ *
+ * Measure the throughput of @ref BinaryWriterMPI when several ranks write
+ * interleaved, mixed-size pieces of one file, as the mlsgpu-mpi output stage
+ * does. Each run is timed with and without block aggregation (the
+ * equivalent of <tt>--mpi-aggregate-writes</tt>).
+ *
+ * Usage:
+ * <pre>
+ * mpirun -n 4 build/mpiwritebench [--total-size MiB] [--block-size bytes] output-file
+ * </pre>
+ * The output file is overwritten and then deleted. Point it at the
+ * filesystem of interest (e.g. a tmpfs, a local disk or a parallel
+ * filesystem); the figures are printed by rank 0.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <mpi.h>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include "src/binary_io_mpi.h"
+
+namespace
+{
+
+/// A piece of the output file, written by a single rank
+struct Piece
+{
+    BinaryWriter::offset_type offset;
+    std::size_t size;
+};
+
+/**
+ * Lay out the file as a sequence of pieces and deal them out to the ranks
+ * round-robin. Most pieces are small (as for the vertices of a thin chunk),
+ * with an occasional large one, so that pieces rarely align to blocks.
+ * The layout depends only on the arguments, so every rank agrees on it.
+ */
+std::vector<Piece> makePieces(
+    BinaryWriter::offset_type totalSize, int rank, int size,
+    BinaryWriter::offset_type &fileSize)
+{
+    std::vector<Piece> pieces;
+    unsigned int seed = 1;
+    BinaryWriter::offset_type offset = 0;
+    for (int i = 0; offset < totalSize; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        const unsigned int r = seed >> 8;
+        std::size_t pieceSize;
+        if (r % 16 == 0)
+            pieceSize = 65536 + r % (1024 * 1024);
+        else
+            pieceSize = 16 + r % 4096;
+        pieceSize = std::min<BinaryWriter::offset_type>(pieceSize, totalSize - offset);
+        if (i % size == rank)
+        {
+            Piece p;
+            p.offset = offset;
+            p.size = pieceSize;
+            pieces.push_back(p);
+        }
+        offset += pieceSize;
+    }
+    fileSize = offset;
+    return pieces;
+}
+
+/// Write the file once and return the elapsed time of the slowest rank
+double run(const std::string &filename, const std::vector<Piece> &pieces,
+           BinaryWriter::offset_type fileSize, std::size_t blockSize)
+{
+    MPI_Info info;
+    MPI_Info_create(&info);
+    if (blockSize > 0)
+        MPI_Info_set(info, const_cast<char *>("romio_cb_write"), const_cast<char *>("enable"));
+
+    std::size_t maxSize = 1;
+    for (std::size_t i = 0; i < pieces.size(); i++)
+        maxSize = std::max(maxSize, pieces[i].size);
+    std::vector<char> buffer(maxSize, 'x');
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start = MPI_Wtime();
+    {
+        BinaryWriterMPI writer(MPI_COMM_WORLD, info, blockSize);
+        writer.open(filename);
+        writer.resize(fileSize);
+        for (std::size_t i = 0; i < pieces.size(); i++)
+            writer.write(&buffer[0], pieces[i].size, pieces[i].offset);
+        writer.close();
+    }
+    double elapsed = MPI_Wtime() - start;
+    MPI_Info_free(&info);
+
+    double slowest;
+    MPI_Allreduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return slowest;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    BinaryWriter::offset_type totalMiB = 1024;
+    std::size_t blockSize = 1024 * 1024;
+    std::string filename;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; i++)
+    {
+        const std::string arg = argv[i];
+        try
+        {
+            if (arg == "--total-size" && i + 1 < argc)
+                totalMiB = boost::lexical_cast<BinaryWriter::offset_type>(argv[++i]);
+            else if (arg == "--block-size" && i + 1 < argc)
+                blockSize = boost::lexical_cast<std::size_t>(argv[++i]);
+            else if (filename.empty() && arg.substr(0, 2) != "--")
+                filename = arg;
+            else
+                valid = false;
+        }
+        catch (boost::bad_lexical_cast &e)
+        {
+            valid = false;
+        }
+    }
+    if (!valid || filename.empty() || totalMiB == 0 || blockSize == 0)
+    {
+        if (rank == 0)
+            std::cerr << "Usage: mpiwritebench [--total-size MiB] [--block-size bytes] output-file\n";
+        MPI_Finalize();
+        return 1;
+    }
+
+    int ret = 0;
+    try
+    {
+        BinaryWriter::offset_type fileSize;
+        const std::vector<Piece> pieces = makePieces(totalMiB * 1024 * 1024, rank, size, fileSize);
+        for (int aggregate = 0; aggregate < 2; aggregate++)
+        {
+            const double elapsed = run(filename, pieces, fileSize, aggregate ? blockSize : 0);
+            if (rank == 0)
+            {
+                std::cout << (aggregate ? "aggregated:  " : "independent: ")
+                    << std::fixed << std::setprecision(1)
+                    << fileSize / (1024.0 * 1024.0) / elapsed << " MiB/s ("
+                    << std::setprecision(3) << elapsed << "s)\n";
+            }
+        }
+        if (rank == 0)
+            std::remove(filename.c_str());
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        ret = 1;
+    }
+    MPI_Finalize();
+    return ret;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file
+ *
+ * Convert a file to a block-compressed container that mlsgpu can read
+ * directly.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <exception>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include "src/binary_io.h"
+
+int main(int argc, char **argv)
+{
+    std::size_t frameSize = 1024 * 1024;
+    int arg = 1;
+    if (argc == 5 && std::string(argv[1]) == "--frame-size")
+    {
+        try
+        {
+            frameSize = boost::lexical_cast<std::size_t>(argv[2]);
+        }
+        catch (boost::bad_lexical_cast &e)
+        {
+            frameSize = 0;
+        }
+        arg = 3;
+    }
+    if (argc - arg != 2 || frameSize == 0)
+    {
+        std::cerr << "Usage: plycompress [--frame-size bytes] input.ply output.ply\n";
+        return 1;
+    }
+
+    try
+    {
+        boost::scoped_ptr<BinaryReader> in(createReader(SYSCALL_READER));
+        boost::scoped_ptr<BinaryWriter> out(createWriter(SYSCALL_WRITER));
+        in->open(argv[arg]);
+        out->open(argv[arg + 1]);
+        writeCompressedContainer(*in, *out, frameSize);
+        out->close();
+        in->close();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -144,11 +144,14 @@ inline float3 interp(float iso0, float iso1, uint3 cell, uint3 offset0, uint3 of
  * Computes a key for coordinates. See @ref generateElements for the definition.
  * @param coords           Coordinates in .1 fixed-point format.
  * @param top              Coordinates that indicate an external vertices in .1 fixed-point format.
+ * @param slotBase         Lower corner of the slot holding the vertex, in .1 fixed-point format.
+ * @param slotTop          Upper corner of the region in the slot, in .1 fixed-point format.
  */
-ulong computeKey(uint3 coords, uint3 top)
+ulong computeKey(uint3 coords, uint3 top, uint3 slotBase, uint3 slotTop)
 {
     ulong key = ((ulong) coords.z << (2 * KEY_AXIS_BITS)) | ((ulong) coords.y << (KEY_AXIS_BITS)) | ((ulong) coords.x);
-    if (any(coords.xy == 0U) || any(coords == top))
+    if (any(coords.xy == 0U) || any(coords == top)
+        || any(coords == slotBase) || any(coords == slotTop))
         key |= KEY_EXTERNAL_FLAG;
     return key;
 }
@@ -162,6 +165,11 @@ ulong computeKey(uint3 coords, uint3 top)
  * maximum z will naturally sort to the end, so they do not get explicitly
  * marked as external (which cannot necessarily be done when there is a split).
  *
+ * When the volume is divided into slots (see @ref Marching::Slots), vertices
+ * on the faces of the region in each slot are also external. A slot holds a
+ * single region, so the slot is found from the cell, and @a gridOffset is
+ * replaced by the offset of that region.
+ *
  * The @a gridOffset parameter controls how cell coordinates are mapped to
  * global grid space to produce output vertices. For a cell with block-relative
  * coordinates xyz, the corresponding position in world space is
@@ -180,6 +188,10 @@ ulong computeKey(uint3 coords, uint3 top)
  * @param      gridOffset      Transformation from grid-local to grid-global coordinates.
  * @param      top             See above.
  * @param      lvertices       Scratch space of @ref NUM_EDGES elements per work item.
+ * @param      slotTable       Two elements per slot: the upper corner of its region relative to the slot in
+ *                             .1 fixed-point format, and the offset to apply to cells in the slot in place of @a gridOffset.
+ * @param      slotShift       Log base 2 of the side length of a slot, or 32 if there are no slots.
+ * @param      slotDims        Number of slots along each axis.
  */
 __kernel void generateElements(
     __global float4 *vertices,
@@ -195,15 +207,28 @@ __kernel void generateElements(
     int zBias,
     uint3 gridOffset,
     uint3 top,
-    __local float3 *lvertices)
+    __local float3 *lvertices,
+    __global const uint3 * restrict slotTable,
+    uint slotShift,
+    uint3 slotDims)
 {
     const uint gid = get_global_id(0);
     const uint lid = get_local_id(0);
     uint3 cell = cells[gid];
     const uint y0 = cell.z * zStride + zBias + cell.y;
     const uint y1 = y0 + zStride;
-    const uint3 globalCell = cell + gridOffset;
     __local float3 *lverts = lvertices + NUM_EDGES * lid;
+    uint3 globalCell = cell + gridOffset;
+    uint3 slotBase = (uint3) (UINT_MAX);
+    uint3 slotTop = (uint3) (UINT_MAX);
+    if (slotShift < 32)
+    {
+        const uint3 slot = cell >> slotShift;
+        const uint slotIndex = slot.x + slotDims.x * (slot.y + slotDims.y * slot.z);
+        slotBase = (slot << slotShift) * 2U;
+        slotTop = slotBase + slotTable[2 * slotIndex];
+        globalCell = cell + slotTable[2 * slotIndex + 1];
+    }
 
     float iso[8];
     iso[0] = read_imagef(isoImage, nearest, (int2) (cell.x    , y0)).x;
@@ -249,7 +274,7 @@ __kernel void generateElements(
         vertex.xyz = lverts[dataTable[start.x + i]];
         vertex.w = as_float(vNext + i);
         vertices[vNext + i] = vertex;
-        vertexKeys[vNext + i] = computeKey(2 * cell + keyTable[start.x + i], top);
+        vertexKeys[vNext + i] = computeKey(2 * cell + keyTable[start.x + i], top, slotBase, slotTop);
     }
     for (uint i = 0; i < end.y - start.y; i++)
     {
@@ -283,7 +308,7 @@ __kernel void countUniqueVertices(__global uint * restrict vertexUnique,
  * There is one work-item per input vertex.
  *
  * @param[out] outVertices     Output vertices, written as packed x,y,z triplets.
- * @param[out] outKeys         Vertex keys corresponding to @a outVertices, only written for external vertices, and with the high bit stripped off.
+ * @param[out] outKeys         Vertex keys corresponding to @a outVertices, only written for external vertices (unless @a internalKeys), and with the high bit stripped off.
  * @param[out] indexRemap      Table mapping original (pre-sorting) indices to output indices.
  * @param[out] firstExternal   The first output position that contains an external vertex.
  * @param      vertexUnique    Scan of the table emitted by @ref countUniqueVertices.
@@ -291,6 +316,7 @@ __kernel void countUniqueVertices(__global uint * restrict vertexUnique,
  * @param      inKeys          Vertex keys corresponding to @a inVertices (plus a sentinel @c ULONG_MAX).
  * @param      minExternalKey  Vertex keys >= @a minExternalKey are considered to be external vertices.
  * @param      keyOffset       Value added to keys on output (after comparison with @a minExternalKey).
+ * @param      internalKeys    If non-zero, keys are written for internal vertices too.
  */
 __kernel void compactVertices(
     __global float * restrict outVertices,
@@ -301,7 +327,8 @@ __kernel void compactVertices(
     __global const float4 * restrict inVertices,
     __global const ulong * restrict inKeys,
     ulong minExternalKey,
-    ulong keyOffset)
+    ulong keyOffset,
+    uint internalKeys)
 {
     const uint gid = get_global_id(0);
     const uint u = vertexUnique[gid];
@@ -312,9 +339,10 @@ __kernel void compactVertices(
     if (key != nextKey)
     {
         vstore3(v.xyz, u, outVertices);
+        if (ext || internalKeys)
+            outKeys[u] = (key & (KEY_EXTERNAL_FLAG - 1)) + keyOffset;
         if (ext)
         {
-            outKeys[u] = (key & (KEY_EXTERNAL_FLAG - 1)) + keyOffset;
             if (u == 0)
                 *firstExternal = 0;
         }
@@ -363,9 +391,9 @@ __kernel void copySlice(
 
 #if UNIT_TESTS
 
-__kernel void testComputeKey(__global ulong *out, uint3 coords, uint3 top)
+__kernel void testComputeKey(__global ulong *out, uint3 coords, uint3 top, uint3 slotBase, uint3 slotTop)
 {
-    *out = computeKey(coords, top);
+    *out = computeKey(coords, top, slotBase, slotTop);
 }
 
 #endif /* UNIT_TESTS */
@@ -288,13 +288,23 @@ inline float3 projectOriginPlane(const Plane * restrict plane)
  * @param      commands, start Encoded octree for the local bin
  * @param      startShift  Subsampling shift for octree, times 3.
  * @param      offset      Difference between global grid coordinates and the local region of interest.
+ * @param      treeOffset  Position of the local region of interest within the octree.
  * @param      zStride, zBias See @ref Marching::ImageParams
  * @param      boundaryFactor Value of \f$1 - \gamma^2\f$ where \f$\gamma\f$ is the maximum
  *                         normalised distance between the projection point and the weighted
  *                         center of the region.
+ * @param      slotTable   Two elements per slot: the value to use in place of @a offset for
+ *                         the slot, and the number of vertices in its region along each axis.
+ * @param      slotShift   Log base 2 of the side length of a slot, or 32 if there are no slots.
+ * @param      slotDims    Number of slots along each axis.
  *
  * The local ID is a one-dimension encoding of a 3D local ID (see @ref decode).
  * The group ID specifies which of these 3D blocks we are processing.
+ *
+ * When the region of interest is divided into slots (see @ref
+ * Marching::Slots), each slot holds a separate region, and vertices that
+ * lie outside the region in their slot are assigned NaN. A slot is a
+ * multiple of the workgroup size, so the whole workgroup is in one slot.
  */
 KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
 void processCorners(
@@ -304,9 +314,13 @@ void processCorners(
     __global const command_type * restrict start,
     uint startShift,
     int3 offset,
+    int3 treeOffset,
     uint zStride,
     int zBias,
-    float boundaryFactor)
+    float boundaryFactor,
+    __global const int3 * restrict slotTable,
+    uint slotShift,
+    uint3 slotDims)
 {
     __local command_type lSplatIds[MAX_BUCKET];
     __local float4 lPositionRadius[MAX_BUCKET];
@@ -315,9 +329,23 @@ void processCorners(
     wid.x = get_group_id(0) * WGS_X;
     wid.y = get_group_id(1) * WGS_Y;
     wid.z = get_group_id(2) * WGS_Z + get_global_offset(2);
-    uint code = makeCode(wid) >> startShift;
+    uint code = makeCode(wid + treeOffset) >> startShift;
     command_type pos = start[code];
 
+    int3 slotBase = (int3) (0);
+    int3 slotLimit = (int3) (INT_MAX);
+    if (slotShift < 32)
+    {
+        const uint3 slot = min(convert_uint3(wid) >> slotShift, slotDims - 1U);
+        const uint slotIndex = slot.x + slotDims.x * (slot.y + slotDims.y * slot.z);
+        slotBase = convert_int3(slot << slotShift);
+        offset = slotTable[2 * slotIndex];
+        slotLimit = slotTable[2 * slotIndex + 1];
+        // Skip the fit if the whole workgroup is outside the region
+        if (any(wid - slotBase >= slotLimit))
+            pos = -1;
+    }
+
     uint lid = get_local_id(0);
 
     float f = nan(0U);
@@ -428,6 +456,8 @@ void processCorners(
 
     int3 lid3 = decode(lid);
     int3 outCoord = wid + lid3;
+    if (any(outCoord - slotBase >= slotLimit))
+        f = nan(0U);
     outCoord.y += outCoord.z * zStride + zBias;
     write_imagef(corners, outCoord.xy, f);
 }
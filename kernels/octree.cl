@@ -145,7 +145,9 @@ inline uint makeCode(int3 xyz)
  * writes to slots [j][i] for j in 0..7. The number of splats is given by
  * <code>get_global_size(0)</code>.
  *
- * Each workitem corresponds to a single splat.
+ * Each workitem corresponds to a single splat. The global offset gives the
+ * position of the first entry to write, so that the splats of several
+ * regions of a batched octree can be written by separate launches.
  *
  * @param[out] keys        The cell codes for the entries.
  * @param[out] values      The splat IDs for the entries.
@@ -154,7 +156,7 @@ inline uint makeCode(int3 xyz)
  * @param levelOffsets     Values added to codes to give sort keys (allocated to hold @a maxShift + 1 values).
  * @param minShift         Minimum bit shift (determines subsampling of grid to give finest level).
  * @param maxShift         Maximum bit shift (determines base level).
- * @param firstSplat       Index of first splat to process within @a splats
+ * @param firstSplat       Index of first splat to process within @a splats (for the first workitem of the launch)
  */
 __kernel void writeEntries(
     __global uint *keys,
@@ -182,7 +184,7 @@ __kernel void writeEntries(
 
     uint gid = get_global_id(0);
     uint pos = gid * 8;
-    gid += firstSplat;
+    gid += firstSplat - get_global_offset(0);
 
     float4 positionRadius = splats[gid].positionRadius;
     int3 ilo;
@@ -35,18 +35,28 @@
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/progress.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/exception/all.hpp>
 #include "src/tr1_unordered_map.h"
 #include <iostream>
 #include <map>
 #include <vector>
+#include <deque>
+#include <sstream>
 #include <algorithm>
 #include <numeric>
+#include <limits>
+#include <cerrno>
 #include <mpi.h>
 #include "src/misc.h"
 #include "src/clh.h"
@@ -76,6 +86,7 @@
 #include "src/bucket_loader.h"
 #include "src/bucket_collector.h"
 #include "src/worker_group_mpi.h"
+#include "src/tags.h"
 #include "src/serialize.h"
 #include "src/mlsgpu_core.h"
 
@@ -97,7 +108,8 @@ void recvItem(MesherGroup::WorkItem &item, MPI_Comm comm, int dest)
 template<>
 std::size_t sizeItem(const MesherGroup::WorkItem &item)
 {
-    return item.work.mesh.getHostBytes();
+    // A zero size would signal shutdown, so bin completion markers need a dummy size
+    return std::max(item.work.mesh.getHostBytes(), sizeof(cl_ulong));
 }
 
 typedef SplatSet::FastBlobSetMPI<SplatSet::FileSet> Splats;
@@ -114,7 +126,10 @@ class Slave
 private:
     const std::vector<std::pair<cl::Context, cl::Device> > &devices;
     const po::variables_map &vm;
-    Splats &splats;
+    /// Input splats, or @c NULL if the splats are sent with the bins
+    Splats *splats;
+    const Grid grid;
+    const SplatSet::splat_id numSplats;
     MPI_Comm scatterComm;
     int scatterRoot;
     MPI_Comm gatherComm;
@@ -125,11 +140,11 @@ private:
 public:
     Slave(const std::vector<std::pair<cl::Context, cl::Device> > &devices,
           const po::variables_map &vm,
-          Splats &splats,
+          Splats *splats, const Grid &grid, SplatSet::splat_id numSplats,
           MPI_Comm scatterComm, int scatterRoot,
           MPI_Comm gatherComm, int gatherRoot,
           MPI_Comm progressComm, int progressRoot)
-        : devices(devices), vm(vm), splats(splats),
+        : devices(devices), vm(vm), splats(splats), grid(grid), numSplats(numSplats),
         scatterComm(scatterComm), scatterRoot(scatterRoot),
         gatherComm(gatherComm), gatherRoot(gatherRoot),
         progressComm(progressComm), progressRoot(progressRoot)
@@ -141,26 +156,128 @@ public:
 
 /**
  * Receives collections of bins from @ref BucketCollector and passes them over MPI.
+ *
+ * Batches are grouped into @em runs of consecutive batches from the same
+ * chunk. Since the bucketing recursion visits a chunk in octree (Morton)
+ * order, the bins in a run are spatially contiguous and share many of their
+ * input splats, so each run is queued for a single slave. A slave that asks
+ * for work while its own queue is empty is given a new run if one is
+ * starting, and otherwise steals the most recently queued batch from the
+ * slave with the most queued work.
+ *
+ * If the run size is zero, batches are instead given to whichever slave asks
+ * first.
+ *
+ * If splats are given to the constructor, the splats for each batch are
+ * loaded here and sent after the bins, so that the slaves never access the
+ * input files.
+ *
+ * The slaves can be paused once they have finished all the work sent so
+ * far, and later restarted. This is used to take checkpoints.
  */
 class Scatter
 {
 private:
+    typedef Statistics::Container::vector<BucketCollector::Bin> bins_type;
+
+    /// A batch of bins that has been queued for a slave
+    struct Batch
+    {
+        boost::shared_ptr<bins_type> bins;
+        SplatSet::splat_id numSplats;
+    };
+
     MPI_Comm comm;
     Timeplot::Worker &tworker;
 
+    /// Maximum number of splats in a run, or 0 for first-come assignment
+    SplatSet::splat_id runSplats;
+    /// Number of batches that may be queued before blocking for a request
+    std::size_t maxQueued;
+
+    std::vector<int> slaves;                    ///< Ranks of the slaves in @ref comm
+    std::vector<bool> idle;                     ///< Ranks with an outstanding request for work
+    std::vector<std::deque<Batch> > queues;     ///< Batches assigned to each rank
+    std::vector<SplatSet::splat_id> queuedSplats; ///< Splats in @ref queues, per rank
+    std::size_t numQueued;                      ///< Total batches in @ref queues
+
+    int runOwner;                               ///< Rank owning the current run, or -1
+    ChunkId::gen_type runChunk;                 ///< Chunk generation of the current run
+    SplatSet::splat_id runDone;                 ///< Splats assigned to the current run
+
+    /// Input splats to send with the bins, or @c NULL
+    const SplatSet::FileSet *payload;
+    /// Maximum number of splats in a payload
+    std::size_t maxLoadSplats;
+    /// Pipelined sender for payloads, if @ref payload is non-NULL
+    boost::scoped_ptr<Serialize::SplatSender> sender;
+
     Statistics::Variable &waitStat;
     Statistics::Variable &sendStat;
+    Statistics::Variable &loadStat;
+    Statistics::Variable &pauseStat;
+    Statistics::Counter &hitStat;
+    Statistics::Counter &stealStat;
+    std::vector<Statistics::Counter *> rankHitStat;
+    std::vector<Statistics::Counter *> rankStealStat;
+
+    /**
+     * Receive requests for work. If @a block is true, waits for at least
+     * one request, otherwise only receives those that are already pending.
+     */
+    void receive(bool block);
+
+    /**
+     * Send batches to idle slaves. Each idle slave is first given the head of
+     * its own queue. If @a steal is true, idle slaves with empty queues then
+     * take work from the tail of the longest queue.
+     */
+    void dispatch(bool steal);
+
+    /// Send a batch (or a shutdown message if @a bins is @c NULL) to @a dest.
+    void send(int dest, const bins_type *bins);
+
+    /// Choose the owner for a new run.
+    int chooseOwner() const;
+
+    /// Tell paused slaves whether to expect more work.
+    void release(bool more);
+
 public:
     typedef void result_type;
 
-    /// Constructor
-    Scatter(MPI_Comm comm, Timeplot::Worker &tworker);
+    /**
+     * Constructor.
+     *
+     * @param comm        Communicator for the scatter
+     * @param slaveMask   Non-zero for each rank in @a comm that runs a slave
+     * @param runSplats   Maximum splats per spatially coherent run (0 for first-come)
+     * @param payload     If non-NULL, splats to load and send with the bins
+     * @param maxLoadSplats Maximum number of splats in a batch
+     * @param compress    If true, compress the payloads
+     * @param tworker     Timeplot worker for the calling thread
+     */
+    Scatter(MPI_Comm comm, const std::vector<int> &slaveMask,
+            SplatSet::splat_id runSplats,
+            const SplatSet::FileSet *payload, std::size_t maxLoadSplats, bool compress,
+            Timeplot::Worker &tworker);
+
+    /// Queue the bins for a slave, sending work if slaves are ready
+    void operator()(const bins_type &bins);
+
+    /**
+     * Sends all remaining work, then waits until every slave has finished
+     * processing it and is waiting to be restarted.
+     *
+     * @return The total progress reported by the slaves since they were started
+     */
+    ProgressMeter::size_type pause();
 
-    /// Send the bins to a slave
-    void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins) const;
+    /// Restarts the slaves after @ref pause
+    void restart();
 
-    /// Shuts down the slaves
-    void stop(std::size_t numSlaves) const;
+    /// Sends all remaining work, then shuts down the slaves
+    void stop();
 };
 
 class GatherGroup : public WorkerGroupGather<MesherGroup::WorkItem, GatherGroup>
@@ -191,60 +308,562 @@ private:
     CircularBuffer meshBuffer;
 };
 
-Scatter::Scatter(MPI_Comm comm, Timeplot::Worker &tworker) :
+/// First line of a checkpoint file written by @ref Checkpointer
+static const char * const checkpointMagic = "mlsgpu-mpi-checkpoint 1";
+
+/**
+ * Header of a checkpoint file written by @ref Checkpointer. The file
+ * consists of @ref checkpointMagic on a line of its own, then a text archive
+ * containing the header followed by the state of the mesher.
+ */
+struct CheckpointHeader
+{
+    /// True if all bins were processed, so that only the output remains to be written
+    bool finished;
+    /// Number of input splats, used to check that resumption uses the same inputs
+    SplatSet::splat_id numSplats;
+    /// Number of bins (in the order produced by @ref BucketCollector) that are complete
+    std::tr1::uint64_t completedBins;
+    /// Progress reported for @ref completedBins
+    ProgressMeter::size_type completedProgress;
+
+    CheckpointHeader() : finished(false), numSplats(0), completedBins(0), completedProgress(0) {}
+
+    template<typename Archive>
+    void serialize(Archive &ar, const unsigned int)
+    {
+        ar & finished;
+        ar & numSplats;
+        ar & completedBins;
+        ar & completedProgress;
+    }
+};
+
+/**
+ * Sits between @ref BucketCollector and @ref Scatter on the master to make
+ * a run restartable. When resuming, bins that were completed before the
+ * checkpoint are dropped. When checkpointing periodically, the slaves are
+ * paused after each interval, the mesher state is saved, and the slaves are
+ * restarted.
+ *
+ * Because the bucketing is deterministic, bins are identified by their
+ * position in the sequence produced by the collector: at a checkpoint, all
+ * bins that have been passed to the scatter are complete and none of the
+ * others have been started.
+ *
+ * This class also owns the thread receiving meshes from the slaves, since
+ * it has to be drained to take a checkpoint.
+ */
+class Checkpointer
+{
+private:
+    typedef Statistics::Container::vector<BucketCollector::Bin> bins_type;
+    typedef ReceiverGather<MesherGroup::WorkItem, MesherGroup> receiver_type;
+
+    Scatter &scatter;
+    receiver_type &receiver;
+    MesherGroup &mesherGroup;
+    OOCMesherMPI &mesher;
+    Timeplot::Worker &tworker;
+
+    boost::filesystem::path path;           ///< Checkpoint file, or empty for none
+    SplatSet::splat_id interval;            ///< Splats between checkpoints, or 0 for none
+    SplatSet::splat_id numSplats;           ///< Total number of input splats
+
+    std::tr1::uint64_t skipBins;            ///< Bins completed before resumption
+    std::tr1::uint64_t seenBins;            ///< Bins received from the collector
+    ProgressMeter::size_type skipProgress;  ///< Progress for @ref skipBins
+    SplatSet::splat_id pending;             ///< Splats scattered since the last checkpoint
+
+    boost::scoped_ptr<boost::thread> receiverThread;
+
+    /// Write the checkpoint file
+    void save(bool finished, ProgressMeter::size_type progress);
+
+    /// Pause the slaves and the mesher, save a checkpoint and restart.
+    void checkpoint();
+
+public:
+    typedef void result_type;
+
+    /**
+     * Constructor.
+     *
+     * @param scatter     Scatter to pass the bins to
+     * @param receiver    Receiver for meshes from the slaves
+     * @param mesherGroup Group consuming meshes from @a receiver
+     * @param mesher      Mesher whose state is saved
+     * @param path        Checkpoint file, or empty to not write checkpoints
+     * @param interval    Splats to scatter between checkpoints, or 0 to only
+     *                    write a checkpoint at the end
+     * @param numSplats   Total number of input splats
+     * @param tworker     Timeplot worker for the calling thread
+     */
+    Checkpointer(Scatter &scatter, receiver_type &receiver,
+                 MesherGroup &mesherGroup, OOCMesherMPI &mesher,
+                 const boost::filesystem::path &path,
+                 SplatSet::splat_id interval, SplatSet::splat_id numSplats,
+                 Timeplot::Worker &tworker);
+
+    /**
+     * Skip the bins recorded as completed in a checkpoint.
+     *
+     * @pre @a header was loaded for the same input splats.
+     */
+    void resume(const CheckpointHeader &header);
+
+    /// Progress already made before the run was resumed
+    ProgressMeter::size_type getSkipProgress() const { return skipProgress; }
+
+    /// Start the receiver and mesher
+    void start();
+
+    /// Scatter the bins that are not already complete
+    void operator()(const bins_type &bins);
+
+    /// Shut down the slaves, receiver and mesher
+    void stop();
+
+    /**
+     * Write a checkpoint recording that all bins have been processed.
+     *
+     * @pre @ref stop has been called.
+     */
+    void finish();
+};
+
+static std::string rankStatName(int rank, const std::string &name)
+{
+    std::ostringstream s;
+    s << "rank" << rank << "." << name;
+    return s.str();
+}
+
+Scatter::Scatter(MPI_Comm comm, const std::vector<int> &slaveMask,
+                 SplatSet::splat_id runSplats,
+                 const SplatSet::FileSet *payload, std::size_t maxLoadSplats, bool compress,
+                 Timeplot::Worker &tworker) :
     comm(comm),
     tworker(tworker),
+    runSplats(runSplats),
+    idle(slaveMask.size()),
+    queues(slaveMask.size()),
+    queuedSplats(slaveMask.size()),
+    numQueued(0),
+    runOwner(-1),
+    runChunk(0),
+    runDone(0),
+    payload(payload),
+    maxLoadSplats(maxLoadSplats),
     waitStat(Statistics::getStatistic<Statistics::Variable>("scatter.get")),
-    sendStat(Statistics::getStatistic<Statistics::Variable>("scatter.push"))
+    sendStat(Statistics::getStatistic<Statistics::Variable>("scatter.push")),
+    loadStat(Statistics::getStatistic<Statistics::Variable>("scatter.load")),
+    pauseStat(Statistics::getStatistic<Statistics::Variable>("scatter.pause")),
+    hitStat(Statistics::getStatistic<Statistics::Counter>("scatter.hits")),
+    stealStat(Statistics::getStatistic<Statistics::Counter>("scatter.steals")),
+    rankHitStat(slaveMask.size()),
+    rankStealStat(slaveMask.size())
 {
+    for (std::size_t i = 0; i < slaveMask.size(); i++)
+    {
+        if (slaveMask[i])
+            slaves.push_back(i);
+        rankHitStat[i] = &Statistics::getStatistic<Statistics::Counter>(rankStatName(i, "scatter.hits"));
+        rankStealStat[i] = &Statistics::getStatistic<Statistics::Counter>(rankStatName(i, "scatter.steals"));
+    }
+    // Allow each slave to have one batch in hand while the next is queued
+    maxQueued = runSplats > 0 ? 2 * slaves.size() : 0;
+    // Two slots allow the next payload to be loaded while one is in flight
+    if (payload != NULL)
+        sender.reset(new Serialize::SplatSender(maxLoadSplats, 2, compress));
 }
 
-void Scatter::operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins) const
+void Scatter::receive(bool block)
 {
-    if (bins.empty())
-        return;
-
     int needsWork;
     MPI_Status status;
+    if (block)
     {
         Timeplot::Action timer("wait", tworker, waitStat);
         MPI_Recv(&needsWork, 1, MPI_INT, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, &status);
+        idle[status.MPI_SOURCE] = true;
     }
 
+    while (true)
+    {
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, &flag, &status);
+        if (!flag)
+            break;
+        MPI_Recv(&needsWork, 1, MPI_INT, status.MPI_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, MPI_STATUS_IGNORE);
+        idle[status.MPI_SOURCE] = true;
+    }
+}
+
+void Scatter::send(int dest, const bins_type *bins)
+{
     {
         Timeplot::Action timer("send", tworker, sendStat);
-        int dest = status.MPI_SOURCE;
-        std::size_t workSize = bins.size();
+        std::size_t workSize = bins != NULL ? bins->size() : 0; // 0 signals shutdown
         MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(),
                  dest, MLSGPU_TAG_SCATTER_HAS_WORK, comm);
-        for (std::size_t i = 0; i < bins.size(); i++)
+        for (std::size_t i = 0; i < workSize; i++)
+        {
+            Serialize::send((*bins)[i], comm, dest);
+        }
+    }
+    idle[dest] = false;
+
+    if (payload != NULL && bins != NULL)
+    {
+        Splat *splats = sender->get();
+        std::size_t numSplats;
+        {
+            Timeplot::Action timer("load", tworker, loadStat);
+            numSplats = BucketLoader::load(*payload, *bins, splats, maxLoadSplats);
+        }
+        sender->send(numSplats, comm, dest);
+    }
+}
+
+void Scatter::dispatch(bool steal)
+{
+    BOOST_FOREACH(int dest, slaves)
+    {
+        if (!idle[dest] || queues[dest].empty())
+            continue;
+        Batch batch = queues[dest].front();
+        queues[dest].pop_front();
+        queuedSplats[dest] -= batch.numSplats;
+        numQueued--;
+        send(dest, batch.bins.get());
+        hitStat.add();
+        rankHitStat[dest]->add();
+    }
+
+    if (!steal)
+        return;
+    BOOST_FOREACH(int dest, slaves)
+    {
+        if (!idle[dest] || numQueued == 0)
+            continue;
+        int victim = -1;
+        BOOST_FOREACH(int r, slaves)
         {
-            Serialize::send(bins[i], comm, dest);
+            if (!queues[r].empty() && (victim == -1 || queuedSplats[r] > queuedSplats[victim]))
+                victim = r;
         }
+        assert(victim != -1);
+        Batch batch = queues[victim].back();
+        queues[victim].pop_back();
+        queuedSplats[victim] -= batch.numSplats;
+        numQueued--;
+        send(dest, batch.bins.get());
+        stealStat.add();
+        rankStealStat[dest]->add();
     }
 }
 
-void Scatter::stop(std::size_t numSlaves) const
+int Scatter::chooseOwner() const
 {
-    for (std::size_t i = 0; i < numSlaves; i++)
+    /* Prefer a slave that is idle with nothing queued, then the one with the
+     * least queued work. Ties are broken round-robin from the previous owner
+     * so that runs are spread across the slaves.
+     */
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < slaves.size(); i++)
+        if (slaves[i] == runOwner)
+            start = i + 1;
+
+    int best = -1;
+    bool bestStarved = false;
+    for (std::size_t i = 0; i < slaves.size(); i++)
     {
-        int needsWork;
-        MPI_Status status;
+        int r = slaves[(start + i) % slaves.size()];
+        bool starved = idle[r] && queues[r].empty();
+        if (best == -1
+            || (starved && !bestStarved)
+            || (starved == bestStarved && queuedSplats[r] < queuedSplats[best]))
         {
-            Timeplot::Action timer("wait", tworker, waitStat);
-            MPI_Recv(&needsWork, 1, MPI_INT, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, &status);
+            best = r;
+            bestStarved = starved;
         }
+    }
+    return best;
+}
+
+void Scatter::operator()(const bins_type &bins)
+{
+    if (bins.empty())
+        return;
+
+    Batch batch;
+    batch.bins = boost::make_shared<bins_type>(bins);
+    batch.numSplats = 0;
+    BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
+        batch.numSplats += bin.ranges.numSplats();
+
+    receive(false);
+
+    bool starved = false;
+    BOOST_FOREACH(int r, slaves)
+        if (idle[r] && queues[r].empty())
+            starved = true;
+
+    /* Start a new run if the chunk changes, the run is full, or the owner
+     * already has work in hand while another slave is waiting for work.
+     */
+    const ChunkId::gen_type chunk = bins.front().chunkId.gen;
+    if (runOwner == -1 || runSplats == 0
+        || chunk != runChunk || runDone >= runSplats
+        || (starved && !queues[runOwner].empty()))
+    {
+        runOwner = chooseOwner();
+        runChunk = chunk;
+        runDone = 0;
+    }
+    runDone += batch.numSplats;
+    queues[runOwner].push_back(batch);
+    queuedSplats[runOwner] += batch.numSplats;
+    numQueued++;
+
+    dispatch(false);
+    while (numQueued > maxQueued)
+    {
+        dispatch(true);
+        if (numQueued <= maxQueued)
+            break;
+        receive(true);
+    }
+}
+
+ProgressMeter::size_type Scatter::pause()
+{
+    // Drain the queues
+    while (numQueued > 0)
+    {
+        dispatch(true);
+        if (numQueued == 0)
+            break;
+        receive(true);
+    }
+
+    if (sender)
+        sender->flush();
+
+    // Tell the slaves that there is no more work for now
+    std::size_t remaining = slaves.size();
+    while (true)
+    {
+        BOOST_FOREACH(int dest, slaves)
+        {
+            if (idle[dest])
+            {
+                send(dest, NULL);
+                remaining--;
+            }
+        }
+        if (remaining == 0)
+            break;
+        receive(true);
+    }
+
+    // Wait for them to finish the work they already have
+    ProgressMeter::size_type done = 0;
+    {
+        Timeplot::Action timer("pause", tworker, pauseStat);
+        for (std::size_t i = 0; i < slaves.size(); i++)
+        {
+            long long slaveDone;
+            MPI_Recv(&slaveDone, 1, MPI_LONG_LONG, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_PAUSED,
+                     comm, MPI_STATUS_IGNORE);
+            done += slaveDone;
+        }
+    }
+    runOwner = -1;
+    return done;
+}
+
+void Scatter::release(bool more)
+{
+    int flag = more ? 1 : 0;
+    BOOST_FOREACH(int dest, slaves)
+    {
+        MPI_Send(&flag, 1, MPI_INT, dest, MLSGPU_TAG_SCATTER_HAS_WORK, comm);
+    }
+}
+
+void Scatter::restart()
+{
+    release(true);
+}
+
+void Scatter::stop()
+{
+    pause();
+    release(false);
+
+    BOOST_FOREACH(int r, slaves)
+    {
+        unsigned long long hits = rankHitStat[r]->getTotal();
+        unsigned long long steals = rankStealStat[r]->getTotal();
+        if (hits + steals > 0)
+            Statistics::getStatistic<Statistics::Variable>(rankStatName(r, "scatter.hitrate"))
+                .add(double(hits) / (hits + steals));
+    }
+}
+
+Checkpointer::Checkpointer(
+    Scatter &scatter, receiver_type &receiver,
+    MesherGroup &mesherGroup, OOCMesherMPI &mesher,
+    const boost::filesystem::path &path,
+    SplatSet::splat_id interval, SplatSet::splat_id numSplats,
+    Timeplot::Worker &tworker)
+    : scatter(scatter), receiver(receiver), mesherGroup(mesherGroup), mesher(mesher),
+    tworker(tworker), path(path), interval(interval), numSplats(numSplats),
+    skipBins(0), seenBins(0), skipProgress(0), pending(0)
+{
+}
+
+void Checkpointer::resume(const CheckpointHeader &header)
+{
+    skipBins = header.completedBins;
+    skipProgress = header.completedProgress;
+}
+
+void Checkpointer::start()
+{
+    mesherGroup.start();
+    receiverThread.reset(new boost::thread(boost::ref(receiver)));
+}
+
+void Checkpointer::operator()(const bins_type &bins)
+{
+    const std::tr1::uint64_t first = seenBins;
+    seenBins += bins.size();
+    if (seenBins <= skipBins)
+        return;
+    if (first < skipBins)
+    {
+        /* Only part of the batch is complete. This only happens if the
+         * batching differs from the original run.
+         */
+        bins_type tail("mem.BucketCollector.bins");
+        tail.assign(bins.begin() + (skipBins - first), bins.end());
+        scatter(tail);
+        BOOST_FOREACH(const BucketCollector::Bin &bin, tail)
+            pending += bin.ranges.numSplats();
+    }
+    else
+    {
+        scatter(bins);
+        BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
+            pending += bin.ranges.numSplats();
+    }
+
+    if (interval > 0 && pending >= interval)
+        checkpoint();
+}
+
+void Checkpointer::checkpoint()
+{
+    Timeplot::Action timer("checkpoint", tworker, "checkpoint.time");
+
+    ProgressMeter::size_type progress = scatter.pause();
+    receiverThread->join();
+    mesherGroup.stop();
 
+    save(false, skipProgress + progress);
+    Log::log[Log::info] << "\nCheckpoint written after " << seenBins << " bins\n";
+
+    start();
+    scatter.restart();
+    pending = 0;
+}
+
+void Checkpointer::stop()
+{
+    scatter.stop();
+    receiverThread->join();
+    mesherGroup.stop();
+}
+
+void Checkpointer::finish()
+{
+    save(true, 0);
+}
+
+void Checkpointer::save(bool finished, ProgressMeter::size_type progress)
+{
+    CheckpointHeader header;
+    header.finished = finished;
+    header.numSplats = numSplats;
+    header.completedBins = seenBins;
+    header.completedProgress = progress;
+
+    /* Write to a temporary file first, so that the previous checkpoint
+     * survives if we are killed while writing this one.
+     */
+    const boost::filesystem::path tmpPath(path.string() + ".tmp");
+    try
+    {
+        boost::filesystem::ofstream dump(tmpPath);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        dump << checkpointMagic << '\n';
         {
-            Timeplot::Action timer("send", tworker, sendStat);
-            int dest = status.MPI_SOURCE;
-            std::size_t workSize = 0; // signals shutdown
-            MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(),
-                     dest, MLSGPU_TAG_SCATTER_HAS_WORK, comm);
+            boost::archive::text_oarchive archive(dump);
+            archive << header;
+            mesher.checkpointPartial(tworker, archive);
         }
+        dump.close();
+        if (!dump)
+            throw std::ios::failure("Could not write file");
+        boost::filesystem::rename(tmpPath, path);
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(tmpPath.string());
     }
 }
 
+/**
+ * Read a checkpoint written by @ref Checkpointer.
+ *
+ * @param path      Checkpoint file
+ * @param[out] header Header read from the file
+ * @param mesher    If non-NULL, the state is restored into it
+ * @return @c false if @a path is not a checkpoint written by @ref Checkpointer
+ * (it may be one written by the non-MPI program), otherwise @c true.
+ */
+static bool readCheckpoint(const boost::filesystem::path &path, CheckpointHeader &header, OOCMesherMPI *mesher)
+{
+    try
+    {
+        boost::filesystem::ifstream dump(path);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        std::string magic;
+        std::getline(dump, magic);
+        if (magic != checkpointMagic)
+            return false;
+
+        boost::archive::text_iarchive archive(dump);
+        archive >> header;
+        if (mesher != NULL)
+            mesher->restorePartial(archive);
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+    return true;
+}
+
 void Slave::operator()() const
 {
     Timeplot::Worker tworker("slave");
@@ -252,46 +871,90 @@ void Slave::operator()() const
     Statistics::Variable &popStat = Statistics::getStatistic<Statistics::Variable>("slave.pop");
     Statistics::Variable &recvStat = Statistics::getStatistic<Statistics::Variable>("slave.recv");
 
+    int rank;
+    MPI_Comm_rank(scatterComm, &rank);
+    /* The blob pass has already read from the files, so only count the
+     * bytes read from here on.
+     */
+    Statistics::Counter &readBytesStat = Statistics::getStatistic<Statistics::Counter>("files.read.bytes");
+    const unsigned long long startReadBytes = readBytesStat.getTotal();
+    Statistics::Counter &binSplatsStat = Statistics::getStatistic<Statistics::Counter>(rankStatName(rank, "slave.splats"));
+
     const std::size_t memGather = vm[Option::memGather].as<Capacity>();
 
     GatherGroup gatherGroup(gatherComm, gatherRoot, memGather);
-    SlaveWorkers slaveWorkers(tworker, vm, devices, makeOutputGenerator(gatherGroup));
+    SlaveWorkers slaveWorkers(tworker, vm, devices,
+                              makeOutputGenerator(gatherGroup), makeBinDone(gatherGroup));
+
+    // Used only when the splats are sent with the bins
+    const std::size_t maxLoadSplats = splats == NULL ? getMaxLoadSplats(vm) : 0;
+    Statistics::Container::PODBuffer<Splat> splatBuffer("mem.Slave.splats", maxLoadSplats);
+    Statistics::Container::PODBuffer<char> splatScratch("mem.Slave.scratch");
 
     /* NB: this does not yet support multi-pass algorithms. Currently there
      * are none, however.
      */
 
-    ProgressMPI progress(NULL, splats.numSplats(), progressComm, progressRoot);
-    slaveWorkers.start(splats, splats.getBoundingGrid(), &progress);
-    gatherGroup.start();
+    ProgressMPI progress(NULL, numSplats, progressComm, progressRoot);
 
     bool first = true;
-    while (true)
+    bool more = true;
+    while (more)
     {
-        int needWork = 1;
-        std::size_t workSize;
-        {
-            Timeplot::Action timer("pop", tworker, first ? firstPopStat : popStat);
-            MPI_Sendrecv(&needWork, 1, MPI_INT, scatterRoot, MLSGPU_TAG_SCATTER_NEED_WORK,
-                         &workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(), scatterRoot, MLSGPU_TAG_SCATTER_HAS_WORK,
-                         scatterComm, MPI_STATUS_IGNORE);
-            if (workSize == 0)
-                break;
-        }
+        if (splats != NULL)
+            slaveWorkers.start(*splats, grid, &progress);
+        else
+            slaveWorkers.start(grid, &progress);
+        gatherGroup.start();
 
-        Statistics::Container::vector<BucketCollector::Bin> bins("mem.BucketCollector.bins", workSize);
+        while (true)
         {
-            Timeplot::Action timer("recv", tworker, recvStat);
-            for (std::size_t i = 0; i < bins.size(); i++)
-                Serialize::recv(bins[i], scatterComm, scatterRoot);
+            int needWork = 1;
+            std::size_t workSize;
+            {
+                Timeplot::Action timer("pop", tworker, first ? firstPopStat : popStat);
+                MPI_Sendrecv(&needWork, 1, MPI_INT, scatterRoot, MLSGPU_TAG_SCATTER_NEED_WORK,
+                             &workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(), scatterRoot, MLSGPU_TAG_SCATTER_HAS_WORK,
+                             scatterComm, MPI_STATUS_IGNORE);
+                if (workSize == 0)
+                    break;
+            }
+
+            Statistics::Container::vector<BucketCollector::Bin> bins("mem.BucketCollector.bins", workSize);
+            std::size_t numLoaded = 0;
+            {
+                Timeplot::Action timer("recv", tworker, recvStat);
+                for (std::size_t i = 0; i < bins.size(); i++)
+                    Serialize::recv(bins[i], scatterComm, scatterRoot);
+                if (splats == NULL)
+                    numLoaded = Serialize::recvSplats(splatBuffer.data(), maxLoadSplats, splatScratch,
+                                                      scatterComm, scatterRoot);
+            }
+            BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
+                binSplatsStat.add(bin.ranges.numSplats());
+            if (splats != NULL)
+                (*slaveWorkers.loader)(bins);
+            else
+                (*slaveWorkers.loader)(bins, splatBuffer.data(), numLoaded);
         }
-        (*slaveWorkers.loader)(bins);
-    }
 
-    slaveWorkers.stop();
-    gatherGroup.stop();
-    progress.sync();
+        /* Finish all the work we have before reporting back, so that the
+         * master can take a checkpoint before restarting us.
+         */
+        slaveWorkers.stop();
+        gatherGroup.stop();
+        progress.sync();
+
+        long long done = progress.count();
+        int flag;
+        MPI_Sendrecv(&done, 1, MPI_LONG_LONG, scatterRoot, MLSGPU_TAG_SCATTER_PAUSED,
+                     &flag, 1, MPI_INT, scatterRoot, MLSGPU_TAG_SCATTER_HAS_WORK,
+                     scatterComm, MPI_STATUS_IGNORE);
+        more = flag;
+    }
 
+    Statistics::getStatistic<Statistics::Counter>(rankStatName(rank, "files.read.bytes"))
+        .add(readBytesStat.getTotal() - startReadBytes);
     Statistics::finalizeEventTimes();
 }
 
@@ -339,7 +1002,43 @@ static void doStatistics(const po::variables_map &vm, MPI_Comm comm, int root)
 }
 
 /**
- * Execution in @c --resume mode
+ * Apply the MPI-IO options from the command line to @a writer.
+ */
+static void setWriterStriping(const po::variables_map &vm, FastPly::WriterMPI &writer)
+{
+    writer.setStriping(vm[Option::mpiStripeSize].as<Capacity>(),
+                       vm[Option::mpiStripeCount].as<int>(),
+                       vm.count(Option::mpiAggregateWrites));
+}
+
+/**
+ * Determine whether the @c --resume checkpoint was taken before all the bins
+ * were processed, in which case @ref run must be used to finish them.
+ * Otherwise, @ref runResume can write the output.
+ *
+ * @param comm            Communicator indicating the group to run on
+ * @param vm              Command-line options
+ */
+static bool resumeIsPartial(MPI_Comm comm, const po::variables_map &vm)
+{
+    const int root = 0;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    int partial = 0;
+    if (rank == root)
+    {
+        boost::filesystem::path path(vm[Option::resume].as<std::string>());
+        CheckpointHeader header;
+        if (readCheckpoint(path, header, NULL))
+            partial = !header.finished;
+    }
+    MPI_Bcast(&partial, 1, MPI_INT, root, comm);
+    return partial;
+}
+
+/**
+ * Execution in @c --resume mode, when all bins have been processed.
  *
  * @param comm            Communicator indicating the group to run on
  * @param out             Output filename or basename
@@ -360,11 +1059,23 @@ static std::size_t runResume(
 
         boost::scoped_ptr<FastPly::WriterMPI> writer(new FastPly::WriterMPI);
         setWriterComments(vm, *writer);
-        boost::scoped_ptr<MesherBase> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
+        setWriterStriping(vm, *writer);
+        boost::scoped_ptr<OOCMesherMPI> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
         setMesherOptions(vm, *mesher);
 
         boost::filesystem::path path(vm[Option::resume].as<std::string>());
-        ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
+        // Checkpoints from the non-MPI program are handled by OOCMesher::resume
+        int own = 0;
+        if (rank == root)
+        {
+            CheckpointHeader header;
+            own = readCheckpoint(path, header, mesher.get());
+        }
+        MPI_Bcast(&own, 1, MPI_INT, root, comm);
+        if (own)
+            ret = mesher->write(mainWorker, &Log::log[Log::info]);
+        else
+            ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
     }
 
     doStatistics(vm, comm, root);
@@ -408,23 +1119,49 @@ static std::size_t run(
     vector<int> slaveMask(size);
     MPI_Gather(&isSlave, 1, MPI_INT, &slaveMask[0], 1, MPI_INT, root, comm);
 
+    const bool scatterSplats = vm.count(Option::mpiScatterSplats);
+    const unsigned int blobReaders = vm[Option::mpiBlobReaders].as<int>();
     Splats splats;
-    doComputeBlobs(mainWorker, vm, splats,
-                   boost::bind(&SplatSet::FastBlobSetMPI<SplatSet::FileSet>::computeBlobs,
-                               &splats, comm, root, _1, _2, &Log::log[Log::info], true));
+    Grid fullGrid;
+    SplatSet::splat_id numSplats = 0;
+    if (!scatterSplats)
+    {
+        doComputeBlobs(mainWorker, vm, splats,
+                       boost::bind(&SplatSet::FastBlobSetMPI<SplatSet::FileSet>::computeBlobs,
+                                   &splats, comm, root, _1, _2, &Log::log[Log::info], true, blobReaders));
+        fullGrid = splats.getBoundingGrid();
+        numSplats = splats.numSplats();
+    }
+    else
+    {
+        // Only the root touches the input files
+        if (rank == root)
+        {
+            doComputeBlobs(mainWorker, vm, splats,
+                           boost::bind(&SplatSet::FastBlobSetMPI<SplatSet::FileSet>::computeBlobs,
+                                       &splats, MPI_COMM_SELF, 0, _1, _2, &Log::log[Log::info], true, blobReaders));
+            fullGrid = splats.getBoundingGrid();
+            numSplats = splats.numSplats();
+        }
+        Serialize::broadcast(fullGrid, comm, root);
+        MPI_Bcast(&numSplats, 1, Serialize::mpi_type_traits<SplatSet::splat_id>::type(), root, comm);
+    }
+    // Every rank aligns the grid to the chunks in the same way
+    const unsigned int chunkCells = postprocessGrid(vm, fullGrid);
 
     boost::scoped_ptr<boost::thread> slaveThread;
     if (!devices.empty())
     {
         slaveThread.reset(new boost::thread(Slave(
-                    devices, vm, splats,
+                    devices, vm, scatterSplats ? NULL : &splats, fullGrid, numSplats,
                     scatterComm, root, gatherComm, root,
                     progressComm, root)));
     }
 
     boost::scoped_ptr<FastPly::WriterMPI> writer(new FastPly::WriterMPI);
     setWriterComments(vm, *writer);
-    boost::scoped_ptr<MesherBase> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
+    setWriterStriping(vm, *writer);
+    boost::scoped_ptr<OOCMesherMPI> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
     setMesherOptions(vm, *mesher);
 
     if (rank == root)
@@ -432,9 +1169,14 @@ static std::size_t run(
         const int numSlaves = accumulate(slaveMask.begin(), slaveMask.end(), 0);
         const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
         const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
+        const SplatSet::splat_id runSplats = vm[Option::mpiScatterRun].as<Capacity>() / sizeof(Splat);
+        const SplatSet::splat_id checkpointSplats = vm[Option::mpiCheckpointInterval].as<Capacity>() / sizeof(Splat);
 
-        const Grid grid = splats.getBoundingGrid();
-        const unsigned int chunkCells = postprocessGrid(vm, grid);
+        const Grid &grid = fullGrid;
+
+        boost::filesystem::path checkpointPath;
+        if (vm.count(Option::checkpoint))
+            checkpointPath = vm[Option::checkpoint].as<std::string>();
 
         {
             // Open a scope so that objects will be released before finalization
@@ -442,8 +1184,23 @@ static std::size_t run(
 
             MesherGroup mesherGroup(memMesh);
             ReceiverGather<MesherGroup::WorkItem, MesherGroup> receiver("receiver", mesherGroup, gatherComm, numSlaves);
-            Scatter scatter(scatterComm, mainWorker);
-            BucketCollector collector(maxLoadSplats, scatter);
+            Scatter scatter(scatterComm, slaveMask, runSplats,
+                            scatterSplats ? &splats : NULL, maxLoadSplats,
+                            vm.count(Option::mpiCompress), mainWorker);
+            Checkpointer checkpointer(scatter, receiver, mesherGroup, *mesher,
+                                      checkpointPath, checkpointSplats, numSplats, mainWorker);
+            BucketCollector collector(maxLoadSplats, boost::ref(checkpointer));
+
+            if (vm.count(Option::resume))
+            {
+                boost::filesystem::path path(vm[Option::resume].as<std::string>());
+                CheckpointHeader header;
+                readCheckpoint(path, header, mesher.get());
+                if (header.numSplats != numSplats)
+                    throw std::runtime_error("Checkpoint " + path.string() + " does not match the input files");
+                checkpointer.resume(header);
+                Log::log[Log::info] << "Resuming after " << header.completedBins << " bins\n";
+            }
 
             initTimer.reset();
 
@@ -455,13 +1212,14 @@ static std::size_t run(
                 Statistics::Timer timer(passName.str());
 
                 ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
-                ProgressMPI progressMPI(&progress, splats.numSplats(), progressComm, 0);
+                progress += checkpointer.getSkipProgress();
+                ProgressMPI progressMPI(&progress, splats.numSplats() - checkpointer.getSkipProgress(),
+                                        progressComm, 0);
 
                 mesherGroup.setInputFunctor(mesher->functor(pass));
 
                 // Start threads
-                boost::thread receiverThread(boost::ref(receiver));
-                mesherGroup.start();
+                checkpointer.start();
                 boost::thread progressThread(boost::ref(progressMPI));
 
                 try
@@ -473,9 +1231,7 @@ static std::size_t run(
                     // This can't be handled using unwinding, because that would operate in
                     // the wrong order
                     collector.flush();
-                    scatter.stop(numSlaves);
-                    receiverThread.join();
-                    mesherGroup.stop();
+                    checkpointer.stop();
                     progressMPI.sync();
                     progressThread.interrupt();
                     progressThread.join();
@@ -487,18 +1243,21 @@ static std::size_t run(
                  * are terminated.
                  */
                 collector.flush();
-                scatter.stop(numSlaves);
-                receiverThread.join();
-                mesherGroup.stop();
+                checkpointer.stop();
                 progressMPI.sync();
                 progressThread.join();
             }
+
+            if (!checkpointPath.empty())
+                checkpointer.finish();
         }
     }
     if (slaveThread)
         slaveThread->join();
 
-    std::size_t ret = mesher->write(mainWorker, &Log::log[Log::info]);
+    std::size_t ret = 0;
+    if (!vm.count(Option::checkpoint))
+        ret = mesher->write(mainWorker, &Log::log[Log::info]);
 
     grandTotalTimer.reset();
     doStatistics(vm, comm, root);
@@ -551,6 +1310,43 @@ int main(int argc, char **argv)
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
     }
+
+    if (vm.count(Option::memAuto))
+    {
+        /* Every rank must arrive at the same plan, since the buckets are
+         * formed on the root and processed on the slaves. Plan for the most
+         * constrained node.
+         */
+        unsigned long long limits[2] =
+        {
+            hostMemoryLimit(),
+            deviceBucketLimit(vm, devices)
+        };
+        if (limits[0] == 0)
+            limits[0] = std::numeric_limits<unsigned long long>::max();
+        unsigned long long planLimits[2];
+        int maxDevices;
+        MPI_Allreduce(limits, planLimits, 2, MPI_UNSIGNED_LONG_LONG, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(&numDevices, &maxDevices, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        if (planLimits[0] == std::numeric_limits<unsigned long long>::max())
+            planLimits[0] = 0;
+
+        try
+        {
+            planMemory(vm, planLimits[0], planLimits[1], maxDevices, true);
+            if (rank == 0)
+            {
+                validateOptions(vm, true);
+                logMemoryPlan(vm, true);
+            }
+        }
+        catch (invalid_option &e)
+        {
+            if (rank == 0)
+                cerr << e.what() << endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
     CLH::ResourceUsage totalUsage = resourceUsage(vm);
 
     if (rank == 0)
@@ -597,7 +1393,7 @@ int main(int argc, char **argv)
         }
 
         std::size_t filesWritten;
-        if (vm.count(Option::resume))
+        if (vm.count(Option::resume) && !resumeIsPartial(MPI_COMM_WORLD, vm))
             filesWritten = runResume(MPI_COMM_WORLD, vm[Option::outputFile].as<string>(), vm);
         else
             filesWritten = run(MPI_COMM_WORLD, cd, vm[Option::outputFile].as<string>(), vm);
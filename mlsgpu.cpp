@@ -68,6 +68,7 @@
 #include "src/bucket_collector.h"
 #include "src/bucket_loader.h"
 #include "src/mlsgpu_core.h"
+#include "src/field_cache.h"
 
 namespace po = boost::program_options;
 using namespace std;
@@ -99,7 +100,7 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
         boost::scoped_ptr<FastPly::Writer> writer(new FastPly::Writer(writerType));
         setWriterComments(vm, *writer);
 
-        boost::scoped_ptr<MesherBase> mesher(new OOCMesher(*writer, getNamer(vm, out)));
+        boost::scoped_ptr<OOCMesher> mesher(new OOCMesher(*writer, getNamer(vm, out)));
         setMesherOptions(vm, *mesher);
 
         if (vm.count(Option::resume))
@@ -107,65 +108,110 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
             boost::filesystem::path path(vm[Option::resume].as<std::string>());
             ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
         }
+        else if (vm.count(Option::extractField))
+        {
+            doExtractField(mainWorker, vm, devices[0], *writer, *mesher);
+            ret = mesher->write(mainWorker, &Log::log[Log::info]);
+        }
         else
         {
+            boost::scoped_ptr<IncrementalBuild> incremental;
+            boost::scoped_ptr<FieldCacheWriter> fieldCache;
             {
                 // Open a scope so that objects will be released before finalization
 
                 boost::scoped_ptr<Timeplot::Action> initTimer(new Timeplot::Action("init", mainWorker, "init.time"));
 
                 Log::log[Log::info] << "Initializing...\n";
-                MesherGroup mesherGroup(memMesh);
+                // Shared by the splat and mesh queues, so it must outlive both
+                boost::scoped_ptr<CircularBufferArena> arena(createBrokerArena(vm));
+                MesherGroup mesherGroup(memMesh, arena.get());
                 SlaveWorkers slaveWorkers(
                     mainWorker, vm, devices,
-                    makeOutputGenerator(mesherGroup));
-                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                    makeOutputGenerator(mesherGroup),
+                    makeBinDone(mesherGroup),
+                    arena.get());
 
                 Splats splats;
+                InputSources sources;
                 doComputeBlobs(mainWorker, vm, splats,
-                               boost::bind(&Splats::computeBlobs, &splats, _1, _2, &Log::log[Log::info], true));
+                               boost::bind(&Splats::computeBlobs, &splats, _1, _2, &Log::log[Log::info], true),
+                               &sources);
+                doRemoveOutliers(mainWorker, vm, splats);
                 Grid grid = splats.getBoundingGrid();
                 unsigned int chunkCells = postprocessGrid(vm, grid);
+                if (vm.count(Option::incremental))
+                {
+                    incremental.reset(new IncrementalBuild(vm, splats, sources, grid, chunkCells));
+                    incremental->setupMesher(*mesher);
+                }
+                if (vm.count(Option::saveField))
+                    fieldCache.reset(createFieldCache(vm, grid));
+
+                // The devices were being set up while the input was read
+                slaveWorkers.wait();
+                boost::scoped_ptr<MemoryBroker> broker;
+                if (vm.count(Option::memBroker))
+                    broker.reset(createMemoryBroker(vm, slaveWorkers, mesherGroup));
+                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                collector.setReadAhead(vm[Option::readAhead].as<int>(),
+                                       boost::bind(&BucketLoader::prefetch, boost::ref(*slaveWorkers.loader), _1));
+                collector.setFileOrder(vm.count(Option::binFileOrder));
 
                 initTimer.reset();
 
-                for (unsigned int pass = 0; pass < mesher->numPasses(); pass++)
+                while (true)
                 {
-                    Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher->numPasses() << endl;
-                    ostringstream passName;
-                    passName << "pass" << pass + 1 << ".time";
-                    Statistics::Timer timer(passName.str());
-
-                    ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
-
-                    mesherGroup.setInputFunctor(mesher->functor(pass));
-
-                    // Start threads
-                    slaveWorkers.start(splats, grid, &progress);
-                    mesherGroup.start();
-
-                    try
-                    {
-                        doBucket(mainWorker, vm, splats, grid, chunkCells, collector);
-                    }
-                    catch (...)
+                    for (unsigned int pass = 0; pass < mesher->numPasses(); pass++)
                     {
-                        // This can't be handled using unwinding, because that would operate in
-                        // the wrong order
+                        Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher->numPasses() << endl;
+                        ostringstream passName;
+                        passName << "pass" << pass + 1 << ".time";
+                        Statistics::Timer timer(passName.str());
+
+                        ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
+
+                        mesherGroup.setInputFunctor(mesher->functor(pass));
+                        // The field is the same on every pass, so it is only recorded once
+                        slaveWorkers.setFieldCache(pass == 0 ? fieldCache.get() : NULL);
+
+                        // Start threads
+                        slaveWorkers.start(splats, grid, &progress);
+                        mesherGroup.start();
+
+                        try
+                        {
+                            doBucket(mainWorker, vm, splats, grid, chunkCells, collector,
+                                     incremental ? incremental->getChunkFilter() : Bucket::ChunkFilter());
+                        }
+                        catch (...)
+                        {
+                            // This can't be handled using unwinding, because that would operate in
+                            // the wrong order
+                            collector.flush();
+                            slaveWorkers.stop();
+                            mesherGroup.stop();
+                            throw;
+                        }
+
+                        /* Shut down threads. Note that it has to be done in forward order to
+                         * satisfy the requirement that stop() is only called after producers
+                         * are terminated.
+                         */
                         collector.flush();
                         slaveWorkers.stop();
                         mesherGroup.stop();
-                        throw;
                     }
 
-                    /* Shut down threads. Note that it has to be done in forward order to
-                     * satisfy the requirement that stop() is only called after producers
-                     * are terminated.
-                     */
-                    collector.flush();
-                    slaveWorkers.stop();
-                    mesherGroup.stop();
+                    if (!incremental || incremental->checkPrune(*mesher))
+                        break;
+                    // Some chunks left in place would be pruned differently, so mesh them too
+                    mesher.reset(new OOCMesher(*writer, getNamer(vm, out)));
+                    setMesherOptions(vm, *mesher);
+                    incremental->setupMesher(*mesher);
                 }
+                if (fieldCache)
+                    fieldCache->close();
             }
 
             if (vm.count(Option::checkpoint))
@@ -174,7 +220,11 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 mesher->checkpoint(mainWorker, path);
             }
             else
+            {
                 ret = mesher->write(mainWorker, &Log::log[Log::info]);
+                if (incremental)
+                    incremental->finish(*mesher);
+            }
         }
     } // ends scope for grandTotalTimer
 
@@ -200,6 +250,12 @@ int main(int argc, char **argv)
     try
     {
         validateOptions(vm, false);
+        if (vm.count(Option::memAuto))
+        {
+            planMemory(vm, hostMemoryLimit(), deviceBucketLimit(vm, devices), devices.size(), false);
+            validateOptions(vm, false);
+            logMemoryPlan(vm, false);
+        }
     }
     catch (invalid_option &e)
     {
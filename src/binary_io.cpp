@@ -46,8 +46,18 @@
 #include <boost/exception/all.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/exception_ptr.hpp>
+#include <vector>
+#include <list>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include "tr1_cstdint.h"
 #include "errors.h"
 #include "binary_io.h"
+#include "compress.h"
 
 #if HAVE_OPEN && HAVE_CLOSE && HAVE_PREAD && HAVE_PWRITE
 # define SYSCALL_IO_POSIX 1
@@ -147,6 +157,29 @@ BinaryIO::offset_type BinaryReader::size() const
     }
 }
 
+void BinaryReader::willNeed(offset_type offset, offset_type count) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    if (count > 0)
+        willNeedImpl(offset, count);
+}
+
+void BinaryReader::willNeedImpl(offset_type offset, offset_type count) const
+{
+    (void) offset;
+    (void) count;
+}
+
+bool BinaryReader::canWillNeed() const
+{
+    return canWillNeedImpl();
+}
+
+bool BinaryReader::canWillNeedImpl() const
+{
+    return false;
+}
+
 std::size_t BinaryWriter::write(const void *buf, std::size_t count, offset_type offset) const
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -356,6 +389,10 @@ private:
     virtual void closeImpl();
     virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
     virtual offset_type sizeImpl() const;
+#if SYSCALL_IO_POSIX && HAVE_POSIX_FADVISE
+    virtual void willNeedImpl(offset_type offset, offset_type count) const;
+    virtual bool canWillNeedImpl() const;
+#endif
 
 public:
     virtual ~SyscallReader();
@@ -468,6 +505,19 @@ std::size_t SyscallReader::readImpl(void *buf, size_t count, offset_type offset)
     return count;
 }
 
+#if HAVE_POSIX_FADVISE
+void SyscallReader::willNeedImpl(offset_type offset, offset_type count) const
+{
+    // Failure only means the data will be read cold, so it is not reported
+    (void) posix_fadvise(fd, offset, count, POSIX_FADV_WILLNEED);
+}
+
+bool SyscallReader::canWillNeedImpl() const
+{
+    return true;
+}
+#endif
+
 std::size_t SyscallWriter::writeImpl(const void *buf, size_t count, offset_type offset) const
 {
     size_t remain = count;
@@ -693,6 +743,248 @@ std::streampos BinaryReaderSource::seek(boost::iostreams::stream_offset offset,
     return boost::iostreams::offset_to_position(this->offset);
 }
 
+/**
+ * Implementation of @ref BinaryReader for block-compressed containers.
+ *
+ * The container consists of a header (see @ref Header), the independently
+ * compressed frames, and finally an array of <i>n</i>+1 file offsets giving
+ * the start of each of the <i>n</i> frames and the end of the last one. All
+ * values are in host byte order. A frame whose stored size equals its
+ * uncompressed size is stored without compression.
+ */
+class CompressedReader : public BinaryReader
+{
+public:
+    /// Fixed-size header at the start of the container
+    struct Header
+    {
+        char magic[8];                        ///< Set to @ref magic
+        std::tr1::uint64_t frameSize;         ///< Uncompressed bytes per frame (except the last)
+        std::tr1::uint64_t size;              ///< Total uncompressed size
+        std::tr1::uint64_t frames;            ///< Number of frames
+    };
+
+    /// Signature at the start of a container
+    static const char magic[8];
+
+    explicit CompressedReader(BinaryReader *base) : base(base) {}
+    virtual ~CompressedReader();
+
+private:
+    typedef boost::shared_ptr<std::vector<char> > frame_ptr;
+
+    /// Number of decompressed frames to keep for reuse
+    static const std::size_t cacheFrames = 4;
+
+    boost::scoped_ptr<BinaryReader> base;     ///< Reader for the container
+    Header header;                            ///< Header read from the container
+    std::vector<offset_type> frameOffsets;    ///< Positions of frames in the container
+
+    mutable boost::mutex mutex;               ///< Protects @ref cache
+    /// Recently used frames, most recent first
+    mutable std::list<std::pair<offset_type, frame_ptr> > cache;
+
+    /// Uncompressed size of a frame
+    std::size_t frameBytes(offset_type frame) const;
+
+    /// Decompress a frame from the container
+    frame_ptr loadFrame(offset_type frame) const;
+
+    /// Decompress a frame, capturing any exception in @a error
+    void loadFrame(offset_type frame, frame_ptr &out, boost::exception_ptr &error) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+    virtual void willNeedImpl(offset_type offset, offset_type count) const;
+    virtual bool canWillNeedImpl() const;
+};
+
+const char CompressedReader::magic[8] = {'M', 'L', 'S', 'G', 'P', 'U', 'Z', '1'};
+
+CompressedReader::~CompressedReader()
+{
+    if (isOpen())
+        close();
+}
+
+void CompressedReader::openImpl(const boost::filesystem::path &path)
+{
+    base->open(path);
+    try
+    {
+        if (base->read(&header, sizeof(header), 0) != sizeof(header)
+            || std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+            throw boost::enable_error_info(std::ios::failure("Not a compressed container"));
+        if (header.frameSize == 0
+            || header.frames != (header.size + header.frameSize - 1) / header.frameSize)
+            throw boost::enable_error_info(std::ios::failure("Corrupt compressed container header"));
+
+        const offset_type indexBytes = (header.frames + 1) * sizeof(offset_type);
+        const offset_type fileSize = base->size();
+        if (fileSize < sizeof(header) + indexBytes)
+            throw boost::enable_error_info(std::ios::failure("Compressed container is truncated"));
+        frameOffsets.resize(header.frames + 1);
+        if (base->read(&frameOffsets[0], indexBytes, fileSize - indexBytes) != indexBytes)
+            throw boost::enable_error_info(std::ios::failure("Compressed container is truncated"));
+        for (offset_type i = 0; i < header.frames; i++)
+            if (frameOffsets[i] > frameOffsets[i + 1] || frameOffsets[i + 1] > fileSize - indexBytes)
+                throw boost::enable_error_info(std::ios::failure("Corrupt compressed container index"));
+    }
+    catch (...)
+    {
+        base->close();
+        throw;
+    }
+}
+
+void CompressedReader::closeImpl()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        cache.clear();
+    }
+    frameOffsets.clear();
+    base->close();
+}
+
+BinaryIO::offset_type CompressedReader::sizeImpl() const
+{
+    return header.size;
+}
+
+void CompressedReader::willNeedImpl(offset_type offset, offset_type count) const
+{
+    if (offset >= header.size)
+        return;
+    count = std::min(count, header.size - offset);
+
+    // Hint the stored bytes of the frames that the range overlaps
+    const offset_type firstFrame = offset / header.frameSize;
+    const offset_type lastFrame = (offset + count - 1) / header.frameSize + 1;
+    base->willNeed(frameOffsets[firstFrame], frameOffsets[lastFrame] - frameOffsets[firstFrame]);
+}
+
+bool CompressedReader::canWillNeedImpl() const
+{
+    return base->canWillNeed();
+}
+
+std::size_t CompressedReader::frameBytes(offset_type frame) const
+{
+    return std::min(header.frameSize, header.size - frame * header.frameSize);
+}
+
+CompressedReader::frame_ptr CompressedReader::loadFrame(offset_type frame) const
+{
+    const std::size_t bytes = frameBytes(frame);
+    const std::size_t stored = frameOffsets[frame + 1] - frameOffsets[frame];
+    frame_ptr out(new std::vector<char>(bytes));
+    if (stored == bytes)
+    {
+        if (base->read(&(*out)[0], bytes, frameOffsets[frame]) != bytes)
+            throw boost::enable_error_info(std::ios::failure("Compressed container is truncated"));
+    }
+    else
+    {
+        std::vector<char> in(stored);
+        if (base->read(&in[0], stored, frameOffsets[frame]) != stored)
+            throw boost::enable_error_info(std::ios::failure("Compressed container is truncated"));
+        try
+        {
+            decompressBuffer(&in[0], stored, &(*out)[0], bytes);
+        }
+        catch (std::runtime_error &e)
+        {
+            throw boost::enable_error_info(std::ios::failure(e.what()));
+        }
+    }
+    return out;
+}
+
+void CompressedReader::loadFrame(offset_type frame, frame_ptr &out, boost::exception_ptr &error) const
+{
+    try
+    {
+        out = loadFrame(frame);
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
+std::size_t CompressedReader::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    if (offset >= header.size)
+        return 0;
+    count = std::min(offset_type(count), header.size - offset);
+    if (count == 0)
+        return 0;
+
+    const offset_type firstFrame = offset / header.frameSize;
+    const offset_type lastFrame = (offset + count - 1) / header.frameSize + 1;
+    const std::size_t nFrames = lastFrame - firstFrame;
+    std::vector<frame_ptr> frames(nFrames);
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        for (std::list<std::pair<offset_type, frame_ptr> >::iterator i = cache.begin(); i != cache.end(); ++i)
+            if (i->first >= firstFrame && i->first < lastFrame)
+                frames[i->first - firstFrame] = i->second;
+    }
+
+    std::vector<offset_type> missing;
+    for (std::size_t i = 0; i < nFrames; i++)
+        if (!frames[i])
+            missing.push_back(i);
+
+    std::vector<boost::exception_ptr> errors(missing.size());
+    const long nMissing = missing.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if (nMissing > 1)
+#endif
+    for (long i = 0; i < nMissing; i++)
+        loadFrame(firstFrame + missing[i], frames[missing[i]], errors[i]);
+    for (std::size_t i = 0; i < errors.size(); i++)
+        if (errors[i])
+            boost::rethrow_exception(errors[i]);
+
+    char *out = static_cast<char *>(buf);
+    for (std::size_t i = 0; i < nFrames; i++)
+    {
+        const offset_type frameStart = (firstFrame + i) * header.frameSize;
+        const offset_type start = std::max(offset, frameStart);
+        const offset_type end = std::min(offset + count, frameStart + frames[i]->size());
+        std::memcpy(out + (start - offset), &(*frames[i])[start - frameStart], end - start);
+    }
+
+    /* Only the frames at the ends of the range are likely to be needed again,
+     * since readers generally proceed through the file in order.
+     */
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        const offset_type keep[2] = { firstFrame, lastFrame - 1 };
+        for (int k = 0; k < 2; k++)
+        {
+            if (k == 1 && keep[1] == keep[0])
+                break;
+            std::list<std::pair<offset_type, frame_ptr> >::iterator i;
+            for (i = cache.begin(); i != cache.end(); ++i)
+                if (i->first == keep[k])
+                    break;
+            if (i != cache.end())
+                cache.splice(cache.begin(), cache, i);
+            else
+                cache.push_front(std::make_pair(keep[k], frames[keep[k] - firstFrame]));
+        }
+        while (cache.size() > cacheFrames)
+            cache.pop_back();
+    }
+    return count;
+}
+
 std::map<std::string, ReaderType> ReaderTypeWrapper::getNameMap()
 {
     std::map<std::string, ReaderType> ans;
@@ -734,3 +1026,57 @@ BinaryWriter *createWriter(WriterType type)
         return NULL;
     }
 }
+
+BinaryReader *createCompressedReader(ReaderType type)
+{
+    return new CompressedReader(createReader(type));
+}
+
+bool isCompressedContainer(const BinaryReader &reader)
+{
+    char magic[sizeof(CompressedReader::magic)];
+    return reader.read(magic, sizeof(magic), 0) == sizeof(magic)
+        && std::memcmp(magic, CompressedReader::magic, sizeof(magic)) == 0;
+}
+
+void writeCompressedContainer(const BinaryReader &in, const BinaryWriter &out, std::size_t frameSize)
+{
+    MLSGPU_ASSERT(frameSize > 0, std::invalid_argument);
+
+    CompressedReader::Header header;
+    std::memcpy(header.magic, CompressedReader::magic, sizeof(header.magic));
+    header.frameSize = frameSize;
+    header.size = in.size();
+    header.frames = (header.size + frameSize - 1) / frameSize;
+
+    std::vector<BinaryIO::offset_type> frameOffsets;
+    frameOffsets.reserve(header.frames + 1);
+    std::vector<char> raw(frameSize);
+    std::vector<char> compressed(compressBufferBound(frameSize));
+    BinaryIO::offset_type pos = sizeof(header);
+    for (std::tr1::uint64_t i = 0; i < header.frames; i++)
+    {
+        const std::size_t bytes = std::min(BinaryIO::offset_type(frameSize), header.size - i * frameSize);
+        if (in.read(&raw[0], bytes, i * frameSize) != bytes)
+            throw boost::enable_error_info(std::ios::failure("Unexpected end of file"));
+        std::size_t stored = compressBuffer(&raw[0], bytes, &compressed[0], compressed.size());
+        const char *data = &compressed[0];
+        if (stored >= bytes)
+        {
+            stored = bytes;
+            data = &raw[0];
+        }
+        frameOffsets.push_back(pos);
+        if (out.write(data, stored, pos) != stored)
+            throw boost::enable_error_info(std::ios::failure("Short write"));
+        pos += stored;
+    }
+    frameOffsets.push_back(pos);
+
+    const std::size_t indexBytes = frameOffsets.size() * sizeof(BinaryIO::offset_type);
+    if (out.write(&frameOffsets[0], indexBytes, pos) != indexBytes)
+        throw boost::enable_error_info(std::ios::failure("Short write"));
+    // The header is written last so that an incomplete file is not recognized
+    if (out.write(&header, sizeof(header), 0) != sizeof(header))
+        throw boost::enable_error_info(std::ios::failure("Short write"));
+}
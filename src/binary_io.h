@@ -162,6 +162,26 @@ public:
      */
     offset_type size() const;
 
+    /**
+     * Advise the operating system that a range of the file will be read
+     * soon, so that it can start loading it into the cache. This is only a
+     * hint: it returns immediately, and does nothing if the reader or the
+     * platform has no way to act on it.
+     *
+     * @param offset   Position in file of the start of the range
+     * @param count    Number of bytes in the range
+     *
+     * @pre The file is open.
+     */
+    void willNeed(offset_type offset, offset_type count) const;
+
+    /**
+     * Whether @ref willNeed has any effect for this kind of reader. This
+     * does not require the file to be open, so that callers can avoid
+     * opening files just to issue hints that will be ignored.
+     */
+    bool canWillNeed() const;
+
 private:
     /**
      * Implements @ref read. It does not need to check whether the file is
@@ -174,6 +194,17 @@ private:
      * open or put the filename into exceptions.
      */
     virtual offset_type sizeImpl() const = 0;
+
+    /**
+     * Implements @ref willNeed. The default implementation does nothing.
+     */
+    virtual void willNeedImpl(offset_type offset, offset_type count) const;
+
+    /**
+     * Implements @ref canWillNeed. The default implementation returns @c false,
+     * and must be overridden by readers that override @ref willNeedImpl.
+     */
+    virtual bool canWillNeedImpl() const;
 };
 
 /**
@@ -249,4 +280,34 @@ BinaryReader *createReader(ReaderType type);
  */
 BinaryWriter *createWriter(WriterType type);
 
+/**
+ * Factory function to create a reader for a block-compressed container
+ * (see @ref writeCompressedContainer). The reader presents the uncompressed
+ * contents, and uses a reader of type @a type to access the container.
+ *
+ * Only the frames that overlap a read are decompressed. Reads that span
+ * several frames decompress them in parallel, and a few recently used frames
+ * are cached so that adjacent reads do not decompress the shared frame twice.
+ */
+BinaryReader *createCompressedReader(ReaderType type);
+
+/**
+ * Determine whether an open file is a block-compressed container, by
+ * checking for the signature.
+ */
+bool isCompressedContainer(const BinaryReader &reader);
+
+/**
+ * Write the contents of @a in to @a out as a block-compressed container.
+ * The data is split into frames of @a frameSize bytes, which are compressed
+ * independently with @ref compressBuffer (frames that do not compress are
+ * stored as is), followed by an index of the frame positions. This allows
+ * random access without decompressing the whole file.
+ *
+ * @throw std::runtime_error if compression is not supported.
+ * @throw std::ios::failure on I/O errors.
+ * @pre Both files are open.
+ */
+void writeCompressedContainer(const BinaryReader &in, const BinaryWriter &out, std::size_t frameSize);
+
 #endif /* !BINARY_IO_H */
@@ -28,41 +28,190 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <map>
 #include <boost/filesystem/path.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/foreach.hpp>
 #include <mpi.h>
 #include "binary_io_mpi.h"
+#include "statistics.h"
 
-BinaryWriterMPI::BinaryWriterMPI(MPI_Comm comm)
-    : comm(comm)
+const std::size_t BinaryWriterMPI::maxBlocks = 16;
+
+BinaryWriterMPI::Block::Block(std::size_t size)
+    : data("mem.BinaryWriterMPI::Block::data", size), filled(0)
 {
 }
 
+BinaryWriterMPI::BinaryWriterMPI(MPI_Comm comm, MPI_Info info, std::size_t blockSize)
+    : comm(comm), info(MPI_INFO_NULL), blockSize(blockSize), fileSize(0)
+{
+    if (info != MPI_INFO_NULL)
+        MPI_Info_dup(info, &this->info);
+}
+
 BinaryWriterMPI::~BinaryWriterMPI()
 {
     if (isOpen())
         close();
+    if (info != MPI_INFO_NULL)
+        MPI_Info_free(&info);
 }
 
 void BinaryWriterMPI::openImpl(const boost::filesystem::path &path)
 {
     MPI_File_open(comm, const_cast<char *>(path.string().c_str()),
-                  MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &handle);
+                  MPI_MODE_WRONLY | MPI_MODE_CREATE, info, &handle);
     MPI_File_set_atomicity(handle, false);
+    fileSize = 0;
 }
 
 void BinaryWriterMPI::closeImpl()
 {
+    if (blockSize > 0)
+        flushCollective();
     MPI_File_close(&handle);
 }
 
+std::size_t BinaryWriterMPI::blockExtent(offset_type index) const
+{
+    const offset_type start = index * blockSize;
+    if (fileSize > start && fileSize - start < blockSize)
+        return fileSize - start;
+    else
+        return blockSize;
+}
+
+void BinaryWriterMPI::flushBlock(block_map::iterator pos) const
+{
+    const offset_type start = pos->first * blockSize;
+    const Block &block = *pos->second;
+    typedef std::pair<std::size_t, std::size_t> range;
+    BOOST_FOREACH(const range &r, block.ranges)
+    {
+        MPI_File_write_at(handle, start + r.first, const_cast<char *>(&block.data[r.first]),
+                          r.second - r.first, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    blocks.erase(pos);
+}
+
 std::size_t BinaryWriterMPI::writeImpl(const void *buf, std::size_t count, offset_type offset) const
 {
-    MPI_File_write_at(handle, offset, const_cast<void *>(buf), count, MPI_BYTE, MPI_STATUS_IGNORE);
+    if (blockSize == 0)
+    {
+        MPI_File_write_at(handle, offset, const_cast<void *>(buf), count, MPI_BYTE, MPI_STATUS_IGNORE);
+        return count;
+    }
+
+    Statistics::Counter &alignedStat = Statistics::getStatistic<Statistics::Counter>("writer.mpi.aligned.bytes");
+    boost::lock_guard<boost::mutex> lock(mutex);
+    const char *ptr = static_cast<const char *>(buf);
+    std::size_t rem = count;
+    while (rem > 0)
+    {
+        const offset_type index = offset / blockSize;
+        const std::size_t first = offset - index * blockSize;
+        const std::size_t extent = blockExtent(index);
+        const std::size_t n = std::min(rem, extent - first);
+
+        block_map::iterator pos = blocks.find(index);
+        if (pos == blocks.end() && n == extent)
+        {
+            // Whole block, so there is no need to copy it
+            MPI_File_write_at(handle, offset, const_cast<char *>(ptr), n, MPI_BYTE, MPI_STATUS_IGNORE);
+            alignedStat.add(n);
+        }
+        else
+        {
+            if (pos == blocks.end())
+            {
+                if (blocks.size() >= maxBlocks)
+                    flushBlock(blocks.begin());
+                pos = blocks.insert(std::make_pair(index, boost::make_shared<Block>(blockSize))).first;
+            }
+            Block &block = *pos->second;
+            std::memcpy(&block.data[first], ptr, n);
+
+            // Record the range, merging it with its neighbours
+            std::size_t last = first + n;
+            std::map<std::size_t, std::size_t>::iterator next = block.ranges.find(last);
+            if (next != block.ranges.end())
+            {
+                last = next->second;
+                block.ranges.erase(next);
+            }
+            std::map<std::size_t, std::size_t>::iterator r = block.ranges.insert(std::make_pair(first, last)).first;
+            if (r != block.ranges.begin())
+            {
+                std::map<std::size_t, std::size_t>::iterator prev = r;
+                --prev;
+                if (prev->second == first)
+                {
+                    prev->second = last;
+                    block.ranges.erase(r);
+                }
+            }
+            block.filled += n;
+
+            if (block.filled == extent)
+            {
+                flushBlock(pos);
+                alignedStat.add(extent);
+            }
+        }
+        ptr += n;
+        offset += n;
+        rem -= n;
+    }
     return count;
 }
 
+void BinaryWriterMPI::flushCollective()
+{
+    /* Build a file view covering just the pieces we hold, and pack the data
+     * to match, so that a single collective write handles everything.
+     */
+    std::vector<int> lengths;
+    std::vector<MPI_Aint> displacements;
+    std::vector<char> packed;
+    typedef std::pair<std::size_t, std::size_t> range;
+    for (block_map::const_iterator i = blocks.begin(); i != blocks.end(); ++i)
+    {
+        const offset_type start = i->first * blockSize;
+        const Block &block = *i->second;
+        BOOST_FOREACH(const range &r, block.ranges)
+        {
+            lengths.push_back(r.second - r.first);
+            displacements.push_back(start + r.first);
+            packed.insert(packed.end(), &block.data[r.first], &block.data[0] + r.second);
+        }
+    }
+    blocks.clear();
+
+    // Processes with nothing to write must still take part
+    MPI_Datatype fileType = MPI_BYTE;
+    if (!lengths.empty())
+    {
+        MPI_Type_create_hindexed(lengths.size(), &lengths[0], &displacements[0], MPI_BYTE, &fileType);
+        MPI_Type_commit(&fileType);
+    }
+    MPI_File_set_view(handle, 0, MPI_BYTE, fileType, const_cast<char *>("native"), MPI_INFO_NULL);
+    MPI_File_write_at_all(handle, 0, packed.empty() ? NULL : &packed[0], packed.size(),
+                          MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_set_view(handle, 0, MPI_BYTE, MPI_BYTE, const_cast<char *>("native"), MPI_INFO_NULL);
+    if (fileType != MPI_BYTE)
+        MPI_Type_free(&fileType);
+
+    Statistics::getStatistic<Statistics::Counter>("writer.mpi.collective.bytes").add(packed.size());
+}
+
 void BinaryWriterMPI::resizeImpl(offset_type size) const
 {
     MPI_File_set_size(handle, size);
     MPI_File_sync(handle);
+    fileSize = size;
 }
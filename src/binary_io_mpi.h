@@ -31,24 +31,80 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <map>
 #include <boost/filesystem/path.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <mpi.h>
 #include "binary_io.h"
+#include "allocator.h"
 
 /**
  * Binary writer for MPI. The @ref open, @ref close and @ref resize operations
  * are collective, while writes may be made independently. Atomic mode is not
  * used, so to guarantee consistency it is required that no writes overlap.
+ *
+ * If a block size is given, writes are aggregated into blocks aligned to
+ * multiples of that size (normally the filesystem stripe size), so that
+ * the filesystem sees large aligned requests rather than many small ones.
+ * Once a block has been filled it is written independently. Blocks that
+ * are only partially filled by this process, which are typically those
+ * shared with another process, are held back and written by a single
+ * collective operation in @ref close, which allows the MPI-IO layer to
+ * merge the contributions from all the processes.
  */
 class BinaryWriterMPI : public BinaryWriter
 {
 public:
-    explicit BinaryWriterMPI(MPI_Comm comm);
+    /**
+     * Constructor.
+     *
+     * @param comm       Communicator used to open the file
+     * @param info       Hints to pass when opening the file, or @c MPI_INFO_NULL.
+     *                   It is duplicated, so the caller retains ownership.
+     * @param blockSize  Size of aggregated blocks, or 0 to pass writes straight through
+     */
+    explicit BinaryWriterMPI(MPI_Comm comm, MPI_Info info = MPI_INFO_NULL, std::size_t blockSize = 0);
     virtual ~BinaryWriterMPI();
 
 private:
-    MPI_Comm comm;    ///< Communicator that will be used to open the file
-    MPI_File handle;  ///< File handle when it is open
+    /// A partially filled aggregation block
+    struct Block
+    {
+        Statistics::Container::vector<char> data;
+        /// Filled ranges, as a map from start to end (relative to the block)
+        std::map<std::size_t, std::size_t> ranges;
+        /// Total number of bytes in @ref ranges
+        std::size_t filled;
+
+        explicit Block(std::size_t size);
+    };
+
+    typedef std::map<offset_type, boost::shared_ptr<Block> > block_map;
+
+    /**
+     * Maximum number of partial blocks to hold. Beyond this, the lowest
+     * block is written independently, even though it is incomplete.
+     */
+    static const std::size_t maxBlocks;
+
+    MPI_Comm comm;           ///< Communicator that will be used to open the file
+    MPI_Info info;           ///< Hints for opening the file
+    MPI_File handle;         ///< File handle when it is open
+    const std::size_t blockSize;  ///< Size of aggregation blocks, or 0 for no aggregation
+
+    mutable block_map blocks;       ///< Partial blocks, indexed by block number
+    mutable offset_type fileSize;   ///< Size set by @ref resize, or 0 if not known
+    mutable boost::mutex mutex;     ///< Mutex protecting @ref blocks
+
+    /// Number of bytes in block @a index that lie inside the file
+    std::size_t blockExtent(offset_type index) const;
+
+    /// Write the filled ranges of a block independently, and remove it
+    void flushBlock(block_map::iterator pos) const;
+
+    /// Write all partial blocks with a collective operation
+    void flushCollective();
 
     virtual void openImpl(const boost::filesystem::path &path);
     virtual void closeImpl();
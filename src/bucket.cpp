@@ -308,7 +308,8 @@ BucketStateSet::BucketStateSet(
     const BucketParameters &params,
     const Grid &grid,
     Grid::size_type microSize,
-    int macroLevels)
+    int macroLevels,
+    const boost::array<Grid::difference_type, 3> &firstChunk)
     : Statistics::Container::multi_array<boost::shared_ptr<BucketState>, 3>("mem.BucketStateSet", chunks),
     chunkRatio(chunkCells / microSize),
     chunkDivider(chunkRatio)
@@ -320,6 +321,7 @@ BucketStateSet::BucketStateSet(
             for (chunkCoord[0] = 0; chunkCoord[0] < chunks[0]; chunkCoord[0]++)
             {
                 Grid sub = grid;
+                boost::array<Grid::difference_type, 3> chunk;
                 for (unsigned int i = 0; i < 3; i++)
                 {
                     Grid::difference_type low = grid.getExtent(i).first;
@@ -327,8 +329,10 @@ BucketStateSet::BucketStateSet(
                     Grid::difference_type offset = chunkCoord[i] * chunkCells;
                     sub.setExtent(i, low + offset,
                                   std::min(low + offset + chunkCells, high));
+                    chunk[i] = firstChunk[i] + chunkCoord[i];
                 }
-                (*this)(chunkCoord) = boost::make_shared<BucketState>(params, sub, microSize, macroLevels);
+                if (params.selectChunk(chunk, sub))
+                    (*this)(chunkCoord) = boost::make_shared<BucketState>(params, sub, microSize, macroLevels);
             }
 }
 
@@ -377,6 +381,45 @@ Grid::size_type chooseMicroSize(
     return microSize;
 }
 
+Grid::size_type coarsenMicroSize(
+    const Grid::size_type dims[3],
+    Grid::size_type microSize,
+    std::size_t maxSplit)
+{
+    while (true)
+    {
+        std::size_t microBlocks = 1;
+        for (unsigned int i = 0; i < 3; i++)
+            microBlocks = mulSat(microBlocks, std::size_t(divUp(dims[i], microSize)));
+        if (microBlocks <= maxSplit)
+            return microSize;
+        microSize *= 2;
+    }
+}
+
 } // namespace detail
 
+Grid::size_type chunkSize(Grid::size_type chunkCells, Grid::size_type microCells)
+{
+    MLSGPU_ASSERT(chunkCells > 0 && microCells > 0, std::invalid_argument);
+    Grid::size_type grain = microCells;
+    while (grain <= chunkCells / 2)
+        grain *= 2;
+    return divUp(chunkCells, grain) * grain;
+}
+
+bool ownsPosition(const Grid &grid, const float position[3])
+{
+    const float *ref = grid.getReference();
+    const float spacing = grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const float cell = std::floor((position[i] - ref[i]) / spacing);
+        const Grid::extent_type &extent = grid.getExtent(i);
+        if (!(cell >= extent.first && cell < extent.second))
+            return false;
+    }
+    return true;
+}
+
 } // namespace Bucket
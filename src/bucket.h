@@ -79,7 +79,11 @@ struct Recursion
 {
     unsigned int depth;              ///< Current depth of recursion.
     std::size_t totalRanges;         ///< Blob ranges held in memory at all levels.
-    boost::array<Grid::size_type, 3> chunk; ///< Output file chunk.
+    /**
+     * Output file chunk, as a position on the lattice of chunks. Chunk
+     * (0, 0, 0) starts at the reference point, so coordinates may be negative.
+     */
+    boost::array<Grid::difference_type, 3> chunk;
 
     Recursion() : depth(0), totalRanges(0)
     {
@@ -108,6 +112,37 @@ public:
         const Recursion &recursionState)> type;
 };
 
+/**
+ * Type for a callback that selects which output chunks @ref bucket processes.
+ * The parameters are the chunk coordinates (as in @ref Recursion::chunk) and a
+ * grid covering the chunk. Chunks for which it returns @c false are skipped
+ * entirely: no splats are counted for them and the processing function is not
+ * called for any part of them.
+ */
+typedef boost::function<bool(const boost::array<Grid::difference_type, 3> &, const Grid &)> ChunkFilter;
+
+/**
+ * Choose the side length of the output chunks to pass to @ref bucket. It
+ * depends only on the arguments and not on the region, so the chunks form a
+ * fixed lattice anchored at the reference point, and a growing model only
+ * adds chunks. The result is at least @a chunkCells and less than twice as
+ * big (unless @a microCells is bigger). It is a multiple of @a microCells
+ * times the largest power of two that keeps this within @a chunkCells, so
+ * that the microblocks still tile the chunks when @ref bucket coarsens them.
+ *
+ * @pre @a chunkCells and @a microCells are non-zero.
+ */
+Grid::size_type chunkSize(Grid::size_type chunkCells, Grid::size_type microCells);
+
+/**
+ * Determine whether a position lies inside the cells of a bucket. Cells are
+ * computed relative to the reference point rather than the bucket, so that
+ * a position on the boundary between two buckets of the same region is owned
+ * by exactly one of them. This is useful for processors that need to handle
+ * each splat once even though it may be passed to several buckets.
+ */
+bool ownsPosition(const Grid &grid, const float position[3]);
+
 /**
  * Subdivide a grid and the splats it contains into buckets with a maximum size
  * and splat count, and call a user callback function for each. This function
@@ -117,9 +152,10 @@ public:
  * @param region     The region to process.
  * @param maxSplats  The maximum number of splats that may occur in a bucket.
  * @param maxCells   The maximum side length of a bucket, in grid cells.
- * @param chunkCells The output regions will be aligned on a regular grid of
- *                   approximately this granularity ("approximately" because it
- *                   will be rounded up to a multiple of the microblock size).
+ * @param chunkCells The output regions will be aligned on a regular lattice
+ *                   with this spacing, starting from the reference point. The
+ *                   lower extents of @a region must be multiples of it, and
+ *                   it should be a value returned by @ref chunkSize.
  *                   To disable this chunking, pass 0.
  * @param microCells The side length of a microblock. The implementation may
  *                   use coarser microCells if forced by @a maxSplit, but if so
@@ -132,9 +168,14 @@ public:
  * @param recursionState Optional parameter indicating recursion statistics
  *                   on entry. This is intended for use when the processing
  *                   callback calls this function again.
+ * @param chunkFilter Optional selection of output chunks to process. It is
+ *                   only consulted when @a chunkCells is non-zero. If empty,
+ *                   all chunks are processed.
  *
  * @throw DensityError If any single grid cell conservatively intersects more
  *                     than @a maxSplats splats.
+ * @throw std::invalid_argument If @a chunkCells is non-zero and @a region
+ *                     does not start on a chunk boundary.
  *
  * @note If any splat falls completely outside of @a region, it is undefined
  * whether it will be passed to the processing function at all.
@@ -186,7 +227,8 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState = Recursion());
+            const Recursion &recursionState = Recursion(),
+            const ChunkFilter &chunkFilter = ChunkFilter());
 
 } // namespace Bucket
 
@@ -29,6 +29,8 @@
 #endif
 #include <boost/function.hpp>
 #include <boost/ref.hpp>
+#include <algorithm>
+#include <utility>
 #include "splat_set.h"
 #include "statistics.h"
 #include "allocator.h"
@@ -40,20 +42,35 @@
 BucketCollector::BucketCollector(SplatSet::splat_id maxSplats, Functor functor)
     : maxSplats(maxSplats), functor(functor),
     bins("mem.BucketCollector.bins"), numSplats(0),
+    readAhead(0), hinted(0), fileOrder(false),
     binsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.bins")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.splats"))
 {
 }
 
+void BucketCollector::setReadAhead(std::size_t bins, const HintFunctor &hint)
+{
+    readAhead = bins;
+    this->hint = hint;
+}
+
+void BucketCollector::setFileOrder(bool fileOrder)
+{
+    flush();
+    this->fileOrder = fileOrder;
+}
+
 void BucketCollector::operator()(
     const SplatSet::SubsetBase &splats,
     const Grid &grid,
     const Bucket::Recursion &recursionState)
 {
-    if (numSplats + splats.numSplats() > maxSplats)
+    const bool newChunk = recursionState.chunk != curChunkId.coords;
+    const SplatSet::splat_id limit = fileOrder ? maxSplats * FILE_ORDER_BATCHES : maxSplats;
+    if (numSplats + splats.numSplats() > limit || (fileOrder && newChunk))
         flush();
 
-    if (recursionState.chunk != curChunkId.coords)
+    if (newChunk)
     {
         curChunkId.gen++;
         curChunkId.coords = recursionState.chunk;
@@ -66,6 +83,20 @@ void BucketCollector::operator()(
     bin.chunkId = curChunkId;
 
     numSplats += splats.numSplats();
+
+    if (hinted < readAhead && hint)
+    {
+        hinted++;
+        hint(bin);
+    }
+}
+
+void BucketCollector::emit(const Statistics::Container::vector<Bin> &batch, SplatSet::splat_id batchSplats)
+{
+    binsStat.add(batch.size());
+    splatsStat.add(batchSplats);
+
+    boost::unwrap_ref(functor)(batch);
 }
 
 void BucketCollector::flush()
@@ -73,11 +104,39 @@ void BucketCollector::flush()
     if (bins.empty())
         return;
 
-    binsStat.add(bins.size());
-    splatsStat.add(numSplats);
+    if (!fileOrder)
+        emit(bins, numSplats);
+    else
+    {
+        typedef std::pair<SplatSet::splat_id, std::size_t> key_type;
+        Statistics::Container::vector<key_type> order("mem.BucketCollector.order");
+        order.reserve(bins.size());
+        for (std::size_t i = 0; i < bins.size(); i++)
+        {
+            const SplatSet::SubsetBase &ranges = bins[i].ranges;
+            order.push_back(key_type(ranges.numSplats() > 0 ? ranges.begin()->first : 0, i));
+        }
+        std::sort(order.begin(), order.end());
 
-    boost::unwrap_ref(functor)(bins);
+        Statistics::Container::vector<Bin> batch("mem.BucketCollector.bins");
+        SplatSet::splat_id batchSplats = 0;
+        for (std::size_t i = 0; i < order.size(); i++)
+        {
+            const Bin &bin = bins[order[i].second];
+            const SplatSet::splat_id binSplats = bin.ranges.numSplats();
+            if (!batch.empty() && batchSplats + binSplats > maxSplats)
+            {
+                emit(batch, batchSplats);
+                batch.clear();
+                batchSplats = 0;
+            }
+            batch.push_back(bin);
+            batchSplats += binSplats;
+        }
+        emit(batch, batchSplats);
+    }
 
     bins.clear();
     numSplats = 0;
+    hinted = 0;
 }
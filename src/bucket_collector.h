@@ -56,6 +56,10 @@ public:
     };
 
     typedef boost::function<void(const Statistics::Container::vector<Bin> &bins)> Functor;
+    typedef boost::function<void(const Bin &bin)> HintFunctor;
+
+    /// Multiple of the splat limit that is pooled for sorting (see @ref setFileOrder)
+    static const unsigned int FILE_ORDER_BATCHES = 4;
 
     void operator()(
         const SplatSet::SubsetBase &splats,
@@ -70,6 +74,23 @@ public:
      */
     BucketCollector(SplatSet::splat_id maxSplats, Functor functor);
 
+    /**
+     * Pass each of the first @a bins bins collected between flushes to @a
+     * hint as soon as it is collected, so that its splats can be fetched from
+     * disk while the rest are bucketed. Zero disables the hints.
+     */
+    void setReadAhead(std::size_t bins, const HintFunctor &hint);
+
+    /**
+     * If enabled, bins are pooled until the chunk changes or the pool holds
+     * @ref FILE_ORDER_BATCHES times the splat limit. The pool is then sorted
+     * by first splat ID, which follows the position in the files, and split
+     * into batches. Each batch thus reads a compact region of the files and
+     * successive batches sweep forward through them. The order of chunks is
+     * unchanged.
+     */
+    void setFileOrder(bool fileOrder);
+
     void flush(); ///< Flush any partial bins to the output
 
 private:
@@ -79,6 +100,14 @@ private:
     Statistics::Container::vector<Bin> bins;  ///< Buffer of splat ranges
     SplatSet::splat_id numSplats; ///< Splats collected in @ref bins
 
+    std::size_t readAhead;        ///< Bins to pass to @ref hint between flushes
+    std::size_t hinted;           ///< Bins passed to @ref hint since the last flush
+    HintFunctor hint;             ///< Read-ahead callback
+    bool fileOrder;               ///< Whether to sort bins (see @ref setFileOrder)
+
+    /// Pass one batch to @ref functor
+    void emit(const Statistics::Container::vector<Bin> &batch, SplatSet::splat_id batchSplats);
+
     Statistics::Variable &binsStat;   ///< Number of bins per flush
     Statistics::Variable &splatsStat; ///< Number of splats per flush
 };
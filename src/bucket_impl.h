@@ -113,12 +113,20 @@ struct BucketParameters
     std::tr1::uint64_t maxSplats;       ///< Maximum splats permitted for processing
     Grid::size_type maxCells;           ///< Maximum cells along any dimension
     std::size_t maxSplit;               ///< Maximum fan-out for recursion
+    ChunkFilter chunkFilter;            ///< Selection of output chunks (empty for all)
 
     BucketParameters(std::tr1::uint64_t maxSplats,
                      Grid::size_type maxCells,
-                     std::size_t maxSplit)
+                     std::size_t maxSplit,
+                     const ChunkFilter &chunkFilter = ChunkFilter())
         : maxSplats(maxSplats), maxCells(maxCells),
-        maxSplit(maxSplit) {}
+        maxSplit(maxSplit), chunkFilter(chunkFilter) {}
+
+    /// Determine whether an output chunk should be processed
+    bool selectChunk(const boost::array<Grid::difference_type, 3> &chunk, const Grid &grid) const
+    {
+        return chunkFilter.empty() || chunkFilter(chunk, grid);
+    }
 };
 
 /**
@@ -314,16 +322,32 @@ void BucketState::doCallbacks(
     }
 }
 
+/**
+ * The states for the output chunks of a region. Chunks rejected by @ref
+ * BucketParameters::selectChunk have a null state.
+ */
 class BucketStateSet : public Statistics::Container::multi_array<boost::shared_ptr<BucketState>, 3>
 {
 public:
+    /**
+     * Constructor.
+     *
+     * @param chunks       Number of chunks along each axis.
+     * @param chunkCells   Side length of a chunk.
+     * @param params       Bucketing parameters, used to select chunks.
+     * @param grid         Grid covering the region.
+     * @param microSize    Side length of a microblock.
+     * @param macroLevels  Levels in the octree of each chunk.
+     * @param firstChunk   Coordinates of the first chunk, for the chunk filter.
+     */
     BucketStateSet(
         const boost::array<Grid::difference_type, 3> &chunks,
         Grid::difference_type chunkCells,
         const BucketParameters &params,
         const Grid &grid,
         Grid::size_type microSize,
-        int macroLevels);
+        int macroLevels,
+        const boost::array<Grid::difference_type, 3> &firstChunk);
 
     template<typename F>
     void processBlob(const SplatSet::BlobInfo &blob, const F &func);
@@ -345,12 +369,17 @@ void BucketStateSet::processBlob(const SplatSet::BlobInfo &blob, const F &func)
         Grid::difference_type u = chunkDivider(blob.upper[i]);
         chunkLower[i] = std::max(l, Grid::difference_type(0));
         chunkUpper[i] = std::min(u, Grid::difference_type(shape()[i] - 1));
+        if (chunkLower[i] > chunkUpper[i])
+            return; // blob lies entirely outside the region
     }
     boost::array<Grid::difference_type, 3> chunkCoord;
     for (chunkCoord[0] = chunkLower[0]; chunkCoord[0] <= chunkUpper[0]; chunkCoord[0]++)
         for (chunkCoord[1] = chunkLower[1]; chunkCoord[1] <= chunkUpper[1]; chunkCoord[1]++)
             for (chunkCoord[2] = chunkLower[2]; chunkCoord[2] <= chunkUpper[2]; chunkCoord[2]++)
             {
+                const boost::shared_ptr<BucketState> &state = (*this)(chunkCoord);
+                if (!state)
+                    continue;
                 SplatSet::BlobInfo subBlob = blob;
                 for (unsigned int i = 0; i < 3; i++)
                 {
@@ -358,7 +387,7 @@ void BucketStateSet::processBlob(const SplatSet::BlobInfo &blob, const F &func)
                     subBlob.lower[i] -= bias;
                     subBlob.upper[i] -= bias;
                 }
-                boost::unwrap_ref(func)((*this)(chunkCoord), subBlob);
+                boost::unwrap_ref(func)(state, subBlob);
             }
 }
 
@@ -402,6 +431,19 @@ Grid::size_type chooseMicroSize(
     std::tr1::uint64_t maxSplats,
     Grid::size_type maxCells);
 
+/**
+ * Coarsen a microblock size by powers of 2 until a region is divided into at
+ * most @a maxSplit microblocks.
+ *
+ * @param dims      Number of cells in each dimension of the region
+ * @param microSize Initial microblock size
+ * @param maxSplit  Maximum number of microblocks
+ */
+Grid::size_type coarsenMicroSize(
+    const Grid::size_type dims[3],
+    Grid::size_type microSize,
+    std::size_t maxSplit);
+
 template<typename Splats>
 bool bucketCallback(const Splats &, const Grid &,
                     const typename ProcessorType<Splats>::type &,
@@ -429,9 +471,9 @@ bool bucketCallback(const Splats &splats, const Grid &grid,
  * @param process         Function to call for each final bucket.
  * @param grid            Sub-grid on which the recursion is being done.
  * @param params          User parameters.
- * @param chunkCells      Approximate size for output chunks (the
- *                        implementation may round it for alignment). If 0, alignment
- *                        is disabled (this is always done below the top level).
+ * @param chunkCells      Size of the output chunks, which start at the lower
+ *                        corner of @a grid. If 0, alignment is disabled (this is
+ *                        always done below the top level).
  * @param microCells      Requested microblock size.
  * @param recursionState  Statistics about what is already held on the stack.
  */
@@ -453,7 +495,12 @@ void bucketRecurse(
         cellDims[i] = grid.numCells(i);
     Grid::size_type maxCellDim = std::max(std::max(cellDims[0], cellDims[1]), cellDims[2]);
 
-    if (splats.maxSplats() <= params.maxSplats
+    if (chunkCells != 0 && chunkCells >= maxCellDim
+        && !params.selectChunk(recursionState.chunk, grid))
+    {
+        // The whole region is a single output chunk, which was not selected
+    }
+    else if (splats.maxSplats() <= params.maxSplats
         && (maxCellDim <= params.maxCells)
         && (chunkCells == 0 || chunkCells >= maxCellDim)
         && bucketCallback(splats, grid, process, recursionState,
@@ -479,35 +526,23 @@ void bucketRecurse(
             microSize = chooseMicroSize(cellDims, params.maxSplit, splats.maxSplats(), params.maxSplats, params.maxCells);
         }
 
-        /* Coarsen until we have sufficiently few microblocks */
-        std::size_t subDims[3];
-        while (true)
+        microSize = coarsenMicroSize(cellDims, microSize, params.maxSplit);
+
+        if (chunkCells == 0 || chunkCells >= maxCellDim)
         {
-            std::size_t microBlocks = 1;
-            for (unsigned int i = 0; i < 3; i++)
-            {
-                subDims[i] = divUp(cellDims[i], microSize);
-                microBlocks = mulSat(microBlocks, subDims[i]);
-            }
-            if (microBlocks <= params.maxSplit)
-                break;
-            microSize *= 2;
+            // A single chunk covers the region
+            chunkCells = divUp(maxCellDim, microSize) * microSize;
         }
-        Statistics::getStatistic<Statistics::Peak>("bucket.microsize.peak") = microSize;
-
-        if (chunkCells == 0)
-            chunkCells = maxCellDim;
-        else
-            chunkCells = std::min(maxCellDim, chunkCells);
-        if (chunkCells > params.maxCells)
+        else if (chunkCells % microSize != 0)
         {
-            std::size_t grain = params.maxCells / microSize * microSize;
-            if (grain == 0)
-                grain = microSize;
-            chunkCells = divUp(chunkCells, grain) * grain;
+            /* Coarsening has made the microblocks too big to tile the chunks,
+             * so make each chunk a single microblock. There are still no more
+             * microblocks than with the coarsened size.
+             */
+            microSize = chunkCells;
         }
-        else
-            chunkCells = divUp(chunkCells, microSize) * microSize;
+        Statistics::getStatistic<Statistics::Peak>("bucket.microsize.peak") = microSize;
+
         boost::array<Grid::difference_type, 3> chunks;
         for (int i = 0; i < 3; i++)
             chunks[i] = divUp(cellDims[i], chunkCells);
@@ -517,7 +552,8 @@ void bucketRecurse(
         while (microSize << (macroLevels - 1) < Grid::size_type(chunkCells))
             macroLevels++;
 
-        BucketStateSet states(chunks, chunkCells, params, grid, microSize, macroLevels);
+        BucketStateSet states(chunks, chunkCells, params, grid, microSize, macroLevels,
+                              recursionState.chunk);
 
         /* Create histogram */
         boost::scoped_ptr<SplatSet::BlobStream> blobs(splats.makeBlobStream(grid, microSize));
@@ -536,9 +572,12 @@ void bucketRecurse(
             for (chunkCoord[1] = 0; chunkCoord[1] < chunks[1]; chunkCoord[1]++)
                 for (chunkCoord[2] = 0; chunkCoord[2] < chunks[2]; chunkCoord[2]++)
                 {
-                    BucketState &state = *states(chunkCoord);
-                    state.upsweepCounts();
-                    state.pickNodes();
+                    if (states(chunkCoord))
+                    {
+                        BucketState &state = *states(chunkCoord);
+                        state.upsweepCounts();
+                        state.pickNodes();
+                    }
                 }
 
         /* Do the bucketing. */
@@ -554,7 +593,8 @@ void bucketRecurse(
             for (chunkCoord[1] = 0; chunkCoord[1] < chunks[1]; chunkCoord[1]++)
                 for (chunkCoord[2] = 0; chunkCoord[2] < chunks[2]; chunkCoord[2]++)
                 {
-                    states(chunkCoord)->doCallbacks(splats, process, recursionState, chunkCoord);
+                    if (states(chunkCoord))
+                        states(chunkCoord)->doCallbacks(splats, process, recursionState, chunkCoord);
                 }
     }
 }
@@ -570,10 +610,22 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState)
+            const Recursion &recursionState,
+            const ChunkFilter &chunkFilter)
 {
-    detail::BucketParameters params(maxSplats, maxCells, maxSplit);
-    detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, recursionState);
+    detail::BucketParameters params(maxSplats, maxCells, maxSplit, chunkFilter);
+    Recursion state = recursionState;
+    if (chunkCells != 0)
+    {
+        // Number the chunks on the lattice anchored at the reference point
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const Grid::difference_type lower = region.getExtent(i).first;
+            MLSGPU_ASSERT(lower % Grid::difference_type(chunkCells) == 0, std::invalid_argument);
+            state.chunk[i] = lower / Grid::difference_type(chunkCells);
+        }
+    }
+    detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, state);
 }
 
 } // namespace Bucket
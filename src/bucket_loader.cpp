@@ -37,6 +37,7 @@
 #include "splat_set.h"
 #include "timeplot.h"
 #include "bucket_loader.h"
+#include "errors.h"
 
 BucketLoader::BucketLoader(
     std::size_t maxItemSplats, CopyGroup &outGroup, Timeplot::Worker &tworker)
@@ -48,37 +49,92 @@ BucketLoader::BucketLoader(
     splatBuffer("mem.BucketLoader.splatBuffer"),
     computeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.compute")),
     loadStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.load")),
-    writeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.write"))
+    writeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.write")),
+    prefetchStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.prefetch"))
 {
     splatBuffer.reserve(maxItemSplats);
 }
 
+void BucketLoader::mergeRanges(
+    const Statistics::Container::vector<BucketCollector::Bin> &bins,
+    Statistics::Container::vector<range_type> &ranges)
+{
+    BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
+    {
+        Statistics::Container::vector<range_type> tmp("mem.BucketLoader.ranges");
+        SplatSet::merge(bin.ranges.begin(), bin.ranges.end(),
+                        ranges.begin(), ranges.end(), std::back_inserter(tmp));
+        tmp.swap(ranges);
+    }
+}
+
+std::size_t BucketLoader::load(
+    const Splats &super,
+    const Statistics::Container::vector<BucketCollector::Bin> &bins,
+    Splat *splats, std::size_t maxSplats)
+{
+    Statistics::Container::vector<range_type> ranges("mem.BucketLoader.ranges");
+    mergeRanges(bins, ranges);
+    boost::scoped_ptr<SplatSet::SplatStream> splatStream(super.makeSplatStream(ranges.begin(), ranges.end()));
+    return splatStream->read(splats, NULL, maxSplats);
+}
+
 void BucketLoader::operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins)
 {
     if (bins.empty())
         return;
 
+    MLSGPU_ASSERT(super != NULL, state_error);
     Statistics::Container::vector<range_type> ranges("mem.BucketLoader.ranges");
     {
         Timeplot::Action timer("compute", tworker, computeStat);
-        /* Compute merged ranges */
-        BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
-        {
-            Statistics::Container::vector<range_type> tmp("mem.BucketLoader.ranges");
-            SplatSet::merge(bin.ranges.begin(), bin.ranges.end(),
-                            ranges.begin(), ranges.end(), std::back_inserter(tmp));
-            tmp.swap(ranges);
-        }
+        mergeRanges(bins, ranges);
     }
 
+    std::size_t numRead;
     {
         Timeplot::Action timer("load", tworker, loadStat);
         boost::scoped_ptr<SplatSet::SplatStream> splatStream(super->makeSplatStream(ranges.begin(), ranges.end()));
+        numRead = splatStream->read(&splatBuffer[0], NULL, maxItemSplats);
+    }
+    process(bins, ranges, &splatBuffer[0], numRead);
+}
+
+void BucketLoader::prefetch(const BucketCollector::Bin &bin)
+{
+    if (super != NULL)
+    {
+        Statistics::Timer timer(prefetchStat);
+        super->willNeed(bin.ranges.begin(), bin.ranges.end());
+    }
+}
+
+void BucketLoader::operator()(
+    const Statistics::Container::vector<BucketCollector::Bin> &bins,
+    Splat *splats, std::size_t numSplats)
+{
+    if (bins.empty())
+        return;
+
+    Statistics::Container::vector<range_type> ranges("mem.BucketLoader.ranges");
+    {
+        Timeplot::Action timer("compute", tworker, computeStat);
+        mergeRanges(bins, ranges);
+    }
+    process(bins, ranges, splats, numSplats);
+}
+
+void BucketLoader::process(
+    const Statistics::Container::vector<BucketCollector::Bin> &bins,
+    const Statistics::Container::vector<range_type> &ranges,
+    Splat *splats, std::size_t numSplats)
+{
+    {
+        Timeplot::Action timer("load", tworker, loadStat);
         float invSpacing = 1.0f / fullGrid.getSpacing();
-        std::size_t numRead = splatStream->read(&splatBuffer[0], NULL, maxItemSplats);
-        for (std::size_t i = 0; i < numRead; i++)
+        for (std::size_t i = 0; i < numSplats; i++)
         {
-            Splat &splat = splatBuffer[i];
+            Splat &splat = splats[i];
             /* Transform the splats into the grid's coordinate system */
             fullGrid.worldToVertex(splat.position, splat.position);
             splat.radius *= invSpacing;
@@ -104,6 +160,7 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
         boost::shared_ptr<CopyGroup::WorkItem> item = outGroup.get(tworker, bin.ranges.numSplats());
         item->chunkId = bin.chunkId;
         item->grid = subGrid;
+        item->ranges = bin.ranges;
 
         Timeplot::Action timer("write", tworker, writeStat);
         timer.setValue(bin.ranges.numSplats() * sizeof(Splat));
@@ -119,7 +176,8 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
                 ++p;
             }
             assert(p->first <= q->first && p->second >= q->second);
-            std::memcpy(splatPtr, &splatBuffer[pos + (q->first - p->first)],
+            assert(pos + (q->second - p->first) <= numSplats);
+            std::memcpy(splatPtr, &splats[pos + (q->first - p->first)],
                    (q->second - q->first) * sizeof(Splat));
             splatPtr += q->second - q->first;
         }
@@ -132,3 +190,9 @@ void BucketLoader::start(const Splats &super, const Grid &fullGrid)
     this->fullGrid = fullGrid;
     this->super = &super;
 }
+
+void BucketLoader::start(const Grid &fullGrid)
+{
+    this->fullGrid = fullGrid;
+    this->super = NULL;
+}
@@ -61,8 +61,50 @@ public:
     /// Prepares for a pass
     void start(const Splats &super, const Grid &fullGrid);
 
+    /**
+     * Prepares for a pass in which the splats are loaded elsewhere, and so
+     * only the three-argument form of @ref operator() may be used.
+     */
+    void start(const Grid &fullGrid);
+
     /// Callback for @ref BucketCollector
     void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins);
+
+    /**
+     * Hint that the splats of a bin will be loaded soon, so that the
+     * operating system can start reading them into its cache. This is
+     * intended to be passed to @ref BucketCollector::setReadAhead. It does
+     * nothing if the splats are loaded elsewhere.
+     */
+    void prefetch(const BucketCollector::Bin &bin);
+
+    /**
+     * Process bins whose splats have already been loaded, for example by
+     * @ref load on another node.
+     *
+     * @param bins       The bins to process.
+     * @param splats     Splats in the merged ranges of @a bins, in world space.
+     *                   They are transformed in place.
+     * @param numSplats  Number of splats in @a splats.
+     */
+    void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins,
+                    Splat *splats, std::size_t numSplats);
+
+    /**
+     * Load the splats for a set of bins, in the form expected by the
+     * three-argument form of @ref operator().
+     *
+     * @param super      Source of the splats.
+     * @param bins       The bins to load.
+     * @param splats     Buffer to receive the splats.
+     * @param maxSplats  Capacity of @a splats.
+     * @return The number of splats loaded.
+     */
+    static std::size_t load(
+        const Splats &super,
+        const Statistics::Container::vector<BucketCollector::Bin> &bins,
+        Splat *splats, std::size_t maxSplats);
+
 private:
     const std::size_t maxItemSplats;
     CopyGroup &outGroup;
@@ -76,6 +118,18 @@ private:
     Statistics::Variable &computeStat;
     Statistics::Variable &loadStat;
     Statistics::Variable &writeStat;
+    Statistics::Variable &prefetchStat;
+
+    /// Merge the ranges of all the bins
+    static void mergeRanges(
+        const Statistics::Container::vector<BucketCollector::Bin> &bins,
+        Statistics::Container::vector<range_type> &ranges);
+
+    /// Transform splats to grid space and pass the bins to @ref outGroup
+    void process(
+        const Statistics::Container::vector<BucketCollector::Bin> &bins,
+        const Statistics::Container::vector<range_type> &ranges,
+        Splat *splats, std::size_t numSplats);
 };
 
 #endif /* !COARSE_BUCKET_H */
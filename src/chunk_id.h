@@ -45,10 +45,11 @@ struct ChunkIdPod
     /// Monotonically increasing generation number
     gen_type gen;
     /**
-     * Chunk coordinates. The chunks form a regular grid and the coordinates
-     * give the position within the grid, starting from (0,0,0).
+     * Chunk coordinates. The chunks form a regular lattice anchored at the
+     * world origin and the coordinates give the position within it (see
+     * @ref Bucket::Recursion::chunk), so they may be negative.
      */
-    boost::array<Grid::size_type, 3> coords;
+    boost::array<Grid::difference_type, 3> coords;
 };
 
 /**
@@ -59,10 +59,42 @@ CircularBufferBase::Allocation::Allocation()
 {
 }
 
-CircularBufferBase::CircularBufferBase(const std::string &name, std::size_t size)
-    : bufferSize(size), firstFree(0), allocPoints(name)
+CircularBufferBase::CircularBufferBase(const std::string &name, std::size_t size, std::size_t capacity)
+    : bufferCapacity(capacity == 0 ? size : capacity),
+    bufferSize(size), targetSize(size), firstFree(0), allocPoints(name)
 {
     MLSGPU_ASSERT(size > 0, std::invalid_argument);
+    MLSGPU_ASSERT(capacity == 0 || capacity >= size, std::invalid_argument);
+}
+
+bool CircularBufferBase::applyResize()
+{
+    if (targetSize == bufferSize)
+        return false;
+    else if (targetSize > bufferSize)
+    {
+        bufferSize = targetSize;
+        return true;
+    }
+    else if (allocPoints.empty())
+    {
+        bufferSize = targetSize;
+        firstFree = std::min(firstFree, bufferSize);
+    }
+    else if (allocPoints.front() < firstFree && firstFree <= targetSize)
+        bufferSize = targetSize;
+    return false;
+}
+
+void CircularBufferBase::resize(std::size_t newSize)
+{
+    MLSGPU_ASSERT(newSize > 0, std::invalid_argument);
+    MLSGPU_ASSERT(newSize <= bufferCapacity, std::out_of_range);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    targetSize = newSize;
+    if (applyResize())
+        spaceCondition.notify_one();
 }
 
 CircularBufferBase::Allocation CircularBufferBase::allocate(
@@ -70,16 +102,20 @@ CircularBufferBase::Allocation CircularBufferBase::allocate(
     Statistics::Variable *stat)
 {
     MLSGPU_ASSERT(n > 0, std::invalid_argument);
-    MLSGPU_ASSERT(n <= bufferSize, std::out_of_range);
 
     Timeplot::Action action("get", tworker, stat);
     action.setValue(n);
 
     boost::lock_guard<boost::mutex> allocLock(allocMutex);
     boost::unique_lock<boost::mutex> lock(mutex);
-    std::size_t pos = bufferSize; // sentinel invalid value
+    std::size_t pos = bufferCapacity; // sentinel invalid value
 
 retry:
+    /* This is checked with the lock held, since the size may change. The
+     * buffer is not grown to fit, because the memory beyond the size may
+     * have been lent elsewhere (see MemoryBroker).
+     */
+    MLSGPU_ASSERT(n <= std::min(bufferSize, targetSize), std::out_of_range);
     if (allocPoints.empty())
         pos = 0;
     else
@@ -92,14 +128,16 @@ retry:
         }
         else
         {
-            if (bufferSize - firstFree >= n)
+            // Do not extend past a pending shrink, so that it can complete
+            const std::size_t limit = std::min(bufferSize, targetSize);
+            if (firstFree <= limit && limit - firstFree >= n)
                 pos = firstFree;
             else if (end >= n)
                 pos = 0;
         }
     }
 
-    if (pos == bufferSize)
+    if (pos == bufferCapacity)
     {
         spaceCondition.wait(lock);
         goto retry;
@@ -115,7 +153,10 @@ void CircularBufferBase::free(const Allocation &alloc)
     bool first = allocPoints.begin() == alloc.point;
     allocPoints.erase(alloc.point);
     if (first)
+    {
+        applyResize();
         spaceCondition.notify_one();
+    }
 }
 
 std::size_t CircularBufferBase::size() const
@@ -123,6 +164,11 @@ std::size_t CircularBufferBase::size() const
     return bufferSize;
 }
 
+std::size_t CircularBufferBase::capacity() const
+{
+    return bufferCapacity;
+}
+
 std::size_t CircularBufferBase::unallocated()
 {
     if (allocPoints.empty())
@@ -144,7 +190,10 @@ CircularBuffer::Allocation CircularBuffer::allocate(
 {
     Allocation ans;
     ans.base = CircularBufferBase::allocate(tworker, bytes, stat);
-    ans.ptr = buffer + ans.base.get();
+    if (reversed)
+        ans.ptr = buffer + capacity() - ans.base.get() - bytes;
+    else
+        ans.ptr = buffer + ans.base.get();
     return ans;
 }
 
@@ -163,16 +212,45 @@ void CircularBuffer::free(const Allocation &alloc)
     CircularBufferBase::free(alloc.base);
 }
 
-CircularBuffer::CircularBuffer(const std::string &name, std::size_t size)
+CircularBuffer::CircularBuffer(const std::string &name, std::size_t size, std::size_t capacity)
     :
-    CircularBufferBase(name, size),
+    CircularBufferBase(name, size, capacity),
     allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
-    buffer(NULL)
+    buffer(NULL), shared(false), reversed(false)
 {
-    buffer = allocator.allocate(size);
+    buffer = allocator.allocate(this->capacity());
+}
+
+CircularBuffer::CircularBuffer(
+    const std::string &name, std::size_t size,
+    CircularBufferArena *arena, CircularBufferArena::Side side)
+    :
+    CircularBufferBase(name, size, arena != NULL ? arena->size() : 0),
+    allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
+    buffer(NULL), shared(arena != NULL), reversed(arena != NULL && side == CircularBufferArena::UPPER)
+{
+    if (arena != NULL)
+        buffer = arena->get();
+    else
+        buffer = allocator.allocate(this->capacity());
 }
 
 CircularBuffer::~CircularBuffer()
 {
-    allocator.deallocate(buffer, size());
+    if (!shared)
+        allocator.deallocate(buffer, capacity());
+}
+
+CircularBufferArena::CircularBufferArena(const std::string &name, std::size_t size)
+    :
+    allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
+    storage(NULL), bytes(size)
+{
+    MLSGPU_ASSERT(size > 0, std::invalid_argument);
+    storage = allocator.allocate(bytes);
+}
+
+CircularBufferArena::~CircularBufferArena()
+{
+    allocator.deallocate(storage, bytes);
 }
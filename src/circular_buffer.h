@@ -73,9 +73,18 @@ private:
     /// Condition signalled when it may be possible to allocate more memory
     boost::condition_variable spaceCondition;
 
-    /// Total number of elements
+    /// Number of elements of backing storage, which bounds @ref bufferSize
+    std::size_t bufferCapacity;
+
+    /// Number of elements currently in use as the ring
     std::size_t bufferSize;
 
+    /**
+     * Size requested by @ref resize. It differs from @ref bufferSize only
+     * while a shrink is waiting for live allocations to move out of the way.
+     */
+    std::size_t targetSize;
+
     /**
      * First free position. It is legal for this to be anything in the range
      * [0, @ref bufferSize]. The two end-points are equivalent.
@@ -85,6 +94,16 @@ private:
     /// Start positions of all live allocations.
     Statistics::Container::list<std::size_t> allocPoints;
 
+    /**
+     * Apply @ref targetSize if it is safe to do so. Growing is always safe,
+     * since the new space lies beyond every live allocation. Shrinking must
+     * wait until the live allocations do not wrap around and end before the
+     * new size. The caller must hold @ref mutex.
+     *
+     * @return @c true if the size grew.
+     */
+    bool applyResize();
+
 public:
     /**
      * Metadata about an allocation. This contains both public information
@@ -116,14 +135,31 @@ public:
      *
      * @param name       Name for allocator used for internal metadata.
      * @param size       Number of elements in the buffer.
+     * @param capacity   Largest size the buffer may later be given with @ref resize
+     *                   (0 to use @a size).
      *
-     * @pre @a size &gt; 0
+     * @pre @a size &gt; 0 and @a capacity is 0 or at least @a size.
      */
-    explicit CircularBufferBase(const std::string &name, std::size_t size);
+    explicit CircularBufferBase(const std::string &name, std::size_t size, std::size_t capacity = 0);
 
     /// Return number of elements in the buffer
     std::size_t size() const;
 
+    /// Return the largest size the buffer can be given
+    std::size_t capacity() const;
+
+    /**
+     * Change the number of elements in use. Growing takes effect immediately
+     * and wakes any blocked @ref allocate. Shrinking takes effect once the
+     * live allocations allow it; in the meantime, new allocations are placed
+     * so that it can happen.
+     *
+     * @param newSize    New number of elements.
+     *
+     * @pre 0 &lt; @a newSize &lt;= @ref capacity().
+     */
+    void resize(std::size_t newSize);
+
     /**
      * Return number of unallocated elements in the buffer. This should be
      * considered immediately stale in a multithreaded environment, but may
@@ -139,7 +175,8 @@ public:
      * @param n              Number of items to allocate.
      * @param stat           Statistic to which the waiting time will be recorded (may be @c NULL).
      *
-     * @pre 0 &lt; @a n &lt; @ref size().
+     * @pre 0 &lt; @a n &lt;= @ref size(), and @a n does not exceed the size
+     * requested by any pending @ref resize.
      */
     Allocation allocate(Timeplot::Worker &tworker, std::size_t n, Statistics::Variable *stat = NULL);
 
@@ -154,6 +191,49 @@ public:
     void free(const Allocation &alloc);
 };
 
+/**
+ * Storage shared by two @ref CircularBuffer objects, so that memory can be
+ * moved between them (see @ref MemoryBroker) without reserving it twice. One
+ * buffer occupies the start of the arena and the other the end, so they are
+ * disjoint as long as their sizes sum to at most the arena size.
+ */
+class CircularBufferArena : public boost::noncopyable
+{
+private:
+    /// Allocator used to allocate and free @ref storage
+    Statistics::Allocator<std::allocator<char> > allocator;
+    /// Memory backing the buffers
+    char *storage;
+    /// Bytes in @ref storage
+    std::size_t bytes;
+public:
+    /// Part of the arena used by a buffer
+    enum Side
+    {
+        LOWER,     ///< Positions are counted up from the start of the arena
+        UPPER      ///< Positions are counted down from the end of the arena
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param name      Name used for memory statistic.
+     * @param size      Bytes of storage to allocate.
+     *
+     * @pre @a size &gt; 0
+     */
+    CircularBufferArena(const std::string &name, std::size_t size);
+
+    /// Destructor. The buffers using the arena must already have been destroyed.
+    ~CircularBufferArena();
+
+    /// Return the number of bytes of storage
+    std::size_t size() const { return bytes; }
+
+    /// Return the start of the storage
+    char *get() const { return storage; }
+};
+
 /**
  * Thread-safe circular buffer for pipelining variable-sized data chunks.
  *
@@ -167,6 +247,10 @@ private:
     Statistics::Allocator<std::allocator<char> > allocator;
     /// Memory backing the buffer
     char *buffer;
+    /// Whether @ref buffer belongs to a @ref CircularBufferArena rather than to this object
+    bool shared;
+    /// Whether positions are counted down from the end of @ref buffer
+    bool reversed;
 public:
     /**
      * Information about an allocation from @ref allocate
@@ -183,8 +267,13 @@ public:
     };
 
     using CircularBufferBase::size;
+    using CircularBufferBase::capacity;
+    using CircularBufferBase::resize;
     using CircularBufferBase::unallocated;
 
+    /// Access the underlying manager, for example to register it with a @ref MemoryBroker.
+    CircularBufferBase &base() { return *this; }
+
     /**
      * Allocate some memory from the buffer. If the memory is not yet
      * available, this will block until it is.
@@ -235,11 +324,34 @@ public:
      * Constructor.
      *
      * @param name      Buffer name used for memory statistic.
-     * @param size      Bytes of storage to reserve.
+     * @param size      Bytes of storage to use initially.
+     * @param capacity  Bytes of storage to reserve (0 to use @a size). The
+     *                  buffer can be grown up to this size with @ref resize.
      *
-     * @pre @a size &gt; 0
+     * @pre @a size &gt; 0 and @a capacity is 0 or at least @a size.
+     */
+    CircularBuffer(const std::string &name, std::size_t size, std::size_t capacity = 0);
+
+    /**
+     * Constructor for a buffer that may use one side of an arena. With an
+     * arena, the capacity is the whole arena, and it is the caller's
+     * responsibility to keep the sizes of the two buffers on it from summing
+     * to more than its size.
+     *
+     * If @a side is @ref CircularBufferArena::UPPER, the alignment guarantee
+     * of @ref allocate only holds if the size of @a arena is a multiple of
+     * the element size.
+     *
+     * @param name      Buffer name used for memory statistic.
+     * @param size      Bytes of storage to use initially.
+     * @param arena     Storage to use, which must outlive the buffer, or @c NULL to
+     *                  allocate @a size bytes as for the other constructor.
+     * @param side      Part of @a arena to use.
+     *
+     * @pre @a size &gt; 0, and at most @a arena-&gt;size() if @a arena is not @c NULL.
      */
-    CircularBuffer(const std::string &name, std::size_t size);
+    CircularBuffer(const std::string &name, std::size_t size,
+                   CircularBufferArena *arena, CircularBufferArena::Side side);
 
     /// Destructor
     ~CircularBuffer();
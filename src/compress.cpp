@@ -0,0 +1,103 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Lossless compression of in-memory buffers.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdexcept>
+#include "compress.h"
+
+#if HAVE_ZLIB
+
+#include <zlib.h>
+
+bool compressSupported()
+{
+    return true;
+}
+
+std::size_t compressBufferBound(std::size_t bytes)
+{
+    return ::compressBound(bytes);
+}
+
+std::size_t compressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes)
+{
+    uLongf written = outBytes;
+    /* Speed matters more than ratio, since the compressed data is
+     * generally consumed immediately.
+     */
+    int status = compress2(
+        static_cast<Bytef *>(out), &written,
+        static_cast<const Bytef *>(in), inBytes, Z_BEST_SPEED);
+    if (status != Z_OK)
+        throw std::runtime_error("Compression failed");
+    return written;
+}
+
+void decompressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes)
+{
+    uLongf written = outBytes;
+    int status = uncompress(
+        static_cast<Bytef *>(out), &written,
+        static_cast<const Bytef *>(in), inBytes);
+    if (status != Z_OK || written != outBytes)
+        throw std::runtime_error("Compressed data is corrupt");
+}
+
+#else /* !HAVE_ZLIB */
+
+bool compressSupported()
+{
+    return false;
+}
+
+std::size_t compressBufferBound(std::size_t bytes)
+{
+    return bytes;
+}
+
+std::size_t compressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes)
+{
+    (void) in;
+    (void) inBytes;
+    (void) out;
+    (void) outBytes;
+    throw std::runtime_error("Compression is not supported in this build");
+}
+
+void decompressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes)
+{
+    (void) in;
+    (void) inBytes;
+    (void) out;
+    (void) outBytes;
+    throw std::runtime_error("Compression is not supported in this build");
+}
+
+#endif
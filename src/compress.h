@@ -0,0 +1,73 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Lossless compression of in-memory buffers.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+
+/**
+ * Indicates whether this build supports compression. If it is not supported,
+ * the other functions in this file throw @c std::runtime_error.
+ */
+bool compressSupported();
+
+/**
+ * Upper bound on the compressed size of @a bytes bytes of input.
+ */
+std::size_t compressBufferBound(std::size_t bytes);
+
+/**
+ * Compress a buffer.
+ *
+ * @param in         Data to compress.
+ * @param inBytes    Number of bytes in @a in.
+ * @param out        Output buffer.
+ * @param outBytes   Size of @a out, which should be at least @ref compressBufferBound(@a inBytes).
+ * @return The number of bytes written to @a out.
+ *
+ * @throw std::runtime_error if compression is not supported or failed.
+ */
+std::size_t compressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes);
+
+/**
+ * Decompress a buffer produced by @ref compressBuffer.
+ *
+ * @param in         Compressed data.
+ * @param inBytes    Number of bytes in @a in.
+ * @param out        Output buffer.
+ * @param outBytes   Expected size of the decompressed data.
+ *
+ * @throw std::runtime_error if compression is not supported, the data is
+ * corrupt, or it does not decompress to exactly @a outBytes bytes.
+ */
+void decompressBuffer(const void *in, std::size_t inBytes, void *out, std::size_t outBytes);
+
+#endif /* !COMPRESS_H */
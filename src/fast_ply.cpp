@@ -47,17 +47,30 @@
 #include <cerrno>
 #include <memory>
 #include <locale>
+#include <cmath>
+#include <ctime>
+#include <cassert>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/utility.hpp>
 #include "fast_ply.h"
 #include "splat.h"
 #include "errors.h"
 #include "binary_io.h"
+#include "logging.h"
 
 namespace FastPly
 {
@@ -132,6 +145,48 @@ static Reader::size_type fieldSize(const FieldType f)
     return 0;
 }
 
+/**
+ * Position of each @ref Reader::Property within a @ref Splat, counted in
+ * floats, so that a @ref Reader::BlockConverter can write one member of a
+ * run of splats.
+ */
+static const std::size_t splatFields[] = { 0, 1, 2, 4, 5, 6, 3 };
+static const std::size_t splatStride = sizeof(Splat) / sizeof(float);
+BOOST_STATIC_ASSERT(sizeof(Splat) == 8 * sizeof(float));
+
+/**
+ * Load a property of type @a T from @a count consecutive vertices, apply the
+ * scale and offset, and store it to the corresponding member of @a count
+ * splats. This is instantiated for each PLY type to produce a @ref
+ * Reader::BlockConverter, so the loop body has no branches or indirect
+ * calls. The arithmetic is done in double precision so that large offsets do
+ * not lose accuracy.
+ */
+template<typename T>
+static void convertFields(
+    const char *in, std::size_t inStride, std::size_t count,
+    double scale, double shift, float *out)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        T value;
+        std::memcpy(&value, in + i * inStride, sizeof(T));
+        out[i * splatStride] = value * scale + shift;
+    }
+}
+
+/**
+ * Specialisation of @ref convertFields for FLOAT32 properties with no scale
+ * or offset, which are just copied.
+ */
+static void copyFields(
+    const char *in, std::size_t inStride, std::size_t count,
+    double, double, float *out)
+{
+    for (std::size_t i = 0; i < count; i++)
+        std::memcpy(out + i * splatStride, in + i * inStride, sizeof(float));
+}
+
 /**
  * Retrieve a line from the header, throwing a suitable exception on failure.
  *
@@ -188,8 +243,17 @@ void Reader::readHeader(std::istream &in)
         };
 
         vertexSize = 0;
+        ascii = false;
+        haveScanner = false;
+        numFields = 0;
         size_type elements = 0;
         bool haveProperty[numProperties] = {};
+        FieldType types[numProperties];
+        for (unsigned int i = 0; i < numProperties; i++)
+        {
+            scales[i] = 1.0;
+            shifts[i] = 0.0;
+        }
 
         std::string line = getHeaderLine(in);
         if (line != "ply")
@@ -213,7 +277,7 @@ void Reader::readHeader(std::istream &in)
                     throw boost::enable_error_info(FormatError("Malformed format line"));
 
                 if (tokens[1] == "ascii")
-                    throw boost::enable_error_info(FormatError("PLY ASCII format not supported"));
+                    ascii = true;
                 else if (tokens[1] == "binary_big_endian")
                 {
                     if (!cpuBigEndian())
@@ -258,6 +322,42 @@ void Reader::readHeader(std::istream &in)
                 }
                 elements++;
             }
+            else if (tokens[0] == "comment" && tokens.size() == 4
+                     && (tokens[1] == "scale" || tokens[1] == "offset"))
+            {
+                for (unsigned int i = 0; i < numProperties; i++)
+                {
+                    if (tokens[2] == propertyNames[i])
+                    {
+                        double value;
+                        try
+                        {
+                            value = boost::lexical_cast<double>(tokens[3]);
+                        }
+                        catch (boost::bad_lexical_cast &e)
+                        {
+                            throw boost::enable_error_info(FormatError("Malformed " + tokens[1] + " for " + tokens[2]));
+                        }
+                        if (tokens[1] == "scale")
+                            scales[i] = value;
+                        else
+                            shifts[i] = value;
+                    }
+                }
+            }
+            else if (tokens[0] == "comment" && tokens.size() == 5 && tokens[1] == "scanner")
+            {
+                try
+                {
+                    for (unsigned int i = 0; i < 3; i++)
+                        scanner[i] = boost::lexical_cast<float>(tokens[2 + i]);
+                }
+                catch (boost::bad_lexical_cast &e)
+                {
+                    throw boost::enable_error_info(FormatError("Malformed scanner position"));
+                }
+                haveScanner = true;
+            }
             else if (tokens[0] == "property")
             {
                 if (tokens.size() < 3)
@@ -300,14 +400,16 @@ void Reader::readHeader(std::istream &in)
                         {
                             if (haveProperty[i])
                                 throw boost::enable_error_info(FormatError("Duplicate property " + name));
-                            if (valueType != FLOAT32)
-                                throw boost::enable_error_info(FormatError("Property " + name + " must be FLOAT32"));
                             haveProperty[i] = true;
+                            // ASCII values are parsed straight to float
+                            types[i] = ascii ? FLOAT32 : valueType;
                             offsets[i] = vertexSize;
+                            fields[i] = numFields;
                             break;
                         }
                     }
                     vertexSize += fieldSize(valueType);
+                    numFields++;
                 }
             }
         }
@@ -318,10 +420,43 @@ void Reader::readHeader(std::istream &in)
         if (elements < 1)
             throw boost::enable_error_info(FormatError("No elements found"));
 
-        for (unsigned int i = 0; i < numProperties; i++)
+        // Either all the properties must be present, or just the positions
+        normals = false;
+        for (unsigned int i = NX; i < numProperties; i++)
+            normals = normals || haveProperty[i];
+        const unsigned int present = normals ? numProperties : (unsigned int) NX;
+        for (unsigned int i = 0; i < present; i++)
             if (!haveProperty[i])
                 throw boost::enable_error_info(FormatError(std::string("Property ") + propertyNames[i] + " not found"));
 
+        for (unsigned int i = 0; i < present; i++)
+        {
+            switch (types[i])
+            {
+            case INT8:    converters[i] = &convertFields<std::tr1::int8_t>; break;
+            case UINT8:   converters[i] = &convertFields<std::tr1::uint8_t>; break;
+            case INT16:   converters[i] = &convertFields<std::tr1::int16_t>; break;
+            case UINT16:  converters[i] = &convertFields<std::tr1::uint16_t>; break;
+            case INT32:   converters[i] = &convertFields<std::tr1::int32_t>; break;
+            case UINT32:  converters[i] = &convertFields<std::tr1::uint32_t>; break;
+            case FLOAT32: converters[i] = &convertFields<float>; break;
+            case FLOAT64: converters[i] = &convertFields<double>; break;
+            }
+            if (types[i] == FLOAT32 && scales[i] == 1.0 && shifts[i] == 0.0)
+                converters[i] = &copyFields;
+        }
+
+        if (ascii)
+        {
+            // Lines are parsed into FLOAT32 values in the order of Property
+            vertexSize = numProperties * sizeof(float);
+            for (unsigned int i = 0; i < numProperties; i++)
+                offsets[i] = i * sizeof(float);
+        }
+
+        // A header with no trailing newline leaves the stream at EOF
+        if (in.eof())
+            in.clear();
         headerSize = in.tellg();
     }
     catch (boost::exception &e)
@@ -333,51 +468,574 @@ void Reader::readHeader(std::istream &in)
 
 Splat Reader::decode(const char *buffer, std::size_t offset) const
 {
-    buffer += offset * getVertexSize();
-
     Splat ans;
-    std::memcpy(&ans.position[0], buffer + offsets[X], sizeof(float));
-    std::memcpy(&ans.position[1], buffer + offsets[Y], sizeof(float));
-    std::memcpy(&ans.position[2], buffer + offsets[Z], sizeof(float));
-    std::memcpy(&ans.radius,      buffer + offsets[RADIUS], sizeof(float));
-    std::memcpy(&ans.normal[0],   buffer + offsets[NX], sizeof(float));
-    std::memcpy(&ans.normal[1],   buffer + offsets[NY], sizeof(float));
-    std::memcpy(&ans.normal[2],   buffer + offsets[NZ], sizeof(float));
-    ans.radius = std::min(ans.radius, maxRadius);
-    ans.radius *= smooth;
-    ans.quality = 1.0 / (ans.radius * ans.radius);
+    decode(buffer, offset, 1, &ans);
     return ans;
 }
 
+void Reader::decode(const char *buffer, std::size_t offset, std::size_t count, Splat *out) const
+{
+    buffer += offset * getVertexSize();
+
+    float *base = &out->position[0];
+    const unsigned int present = normals ? numProperties : (unsigned int) NX;
+    for (unsigned int i = 0; i < present; i++)
+        converters[i](buffer + offsets[i], vertexSize, count, scales[i], shifts[i], base + splatFields[i]);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        Splat &splat = out[i];
+        if (!normals)
+        {
+            splat.normal[0] = splat.normal[1] = splat.normal[2] = 0.0f;
+            splat.radius = maxRadius;
+        }
+        splat.radius = std::min(splat.radius, maxRadius);
+        splat.radius *= smooth;
+        splat.quality = 1.0 / (splat.radius * splat.radius);
+    }
+}
+
 Reader::Reader(
     ReaderType readerType,
     const boost::filesystem::path &path,
-    float smooth, float maxRadius)
-    : readerFactory(boost::bind(createReader, readerType)), path(path), smooth(smooth), maxRadius(maxRadius)
+    float smooth, float maxRadius,
+    bool cacheIndex)
+    : readerFactory(boost::bind(createReader, readerType)), path(path), smooth(smooth), maxRadius(maxRadius),
+    compressed(false), prefetchable(false)
 {
-    boost::scoped_ptr<BinaryReader> reader(readerFactory());
-    reader->open(path);
-    boost::iostreams::stream<BinaryReaderSource> in(*reader);
-    readHeader(in);
+    {
+        boost::scoped_ptr<BinaryReader> reader(readerFactory());
+        reader->open(path);
+        if (isCompressedContainer(*reader))
+        {
+            readerFactory = boost::bind(createCompressedReader, readerType);
+            compressed = true;
+        }
+    }
+    init(cacheIndex);
 }
 
 Reader::Reader(
     boost::function<BinaryReader *()> readerFactory,
     const boost::filesystem::path &path,
     float smooth, float maxRadius)
-    : readerFactory(readerFactory), path(path), smooth(smooth), maxRadius(maxRadius)
+    : readerFactory(readerFactory), path(path), smooth(smooth), maxRadius(maxRadius),
+    compressed(false), prefetchable(false)
+{
+    init(false);
+}
+
+Reader::Reader(
+    ReaderType readerType,
+    const boost::filesystem::path &path,
+    const Layout &layout,
+    float smooth, float maxRadius,
+    bool cacheIndex)
+    : readerFactory(boost::bind(layout.compressed ? createCompressedReader : createReader, readerType)),
+    path(path), smooth(smooth), maxRadius(maxRadius),
+    compressed(layout.compressed), prefetchable(false), header(layout.header)
+{
+    {
+        std::istringstream in(header);
+        readHeader(in);
+    }
+
+    boost::scoped_ptr<BinaryReader> reader(readerFactory());
+    prefetchable = !ascii && reader->canWillNeed();
+    if (ascii)
+    {
+        reader->open(path);
+        indexAscii(*reader, cacheIndex);
+    }
+}
+
+Reader::Layout Reader::getLayout() const
+{
+    Layout layout;
+    layout.header = header;
+    layout.compressed = compressed;
+    return layout;
+}
+
+void Reader::init(bool cacheIndex)
 {
     boost::scoped_ptr<BinaryReader> reader(readerFactory());
     reader->open(path);
-    boost::iostreams::stream<BinaryReaderSource> in(*reader);
-    readHeader(in);
+    {
+        boost::iostreams::stream<BinaryReaderSource> in(*reader);
+        readHeader(in);
+    }
+
+    // Keep the raw header so that the reader can be recreated without the file
+    header.resize(headerSize);
+    if (headerSize > 0 && reader->read(&header[0], headerSize, 0) != headerSize)
+        throw boost::enable_error_info(FormatError("Failed to reread PLY header"))
+            << boost::errinfo_file_name(path.string());
+
+    prefetchable = !ascii && reader->canWillNeed();
+    if (ascii)
+        indexAscii(*reader, cacheIndex);
+}
+
+void Reader::indexAscii(const BinaryReader &reader, bool cacheIndex)
+{
+    try
+    {
+        if (!cacheIndex || !loadLineIndex(reader))
+        {
+            buildLineIndex(reader);
+            if (cacheIndex)
+                saveLineIndex(reader);
+        }
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(path.string());
+        throw;
+    }
+}
+
+void Reader::indexRange(
+    const BinaryReader &reader, size_type first, size_type last,
+    std::vector<size_type> &starts, size_type &lines,
+    boost::exception_ptr &error) const
+{
+    try
+    {
+        static const std::size_t bufferSize = 1024 * 1024;
+        boost::scoped_array<char> buffer(new char[bufferSize]);
+
+        lines = 0;
+        bool atStart = true;
+        if (first > headerSize)
+        {
+            char prev;
+            if (reader.read(&prev, 1, first - 1) != 1)
+                throw boost::enable_error_info(FormatError("Unexpected end of file"));
+            atStart = (prev == '\n');
+        }
+
+        size_type pos = first;
+        while (pos < last)
+        {
+            const std::size_t count = std::min(size_type(bufferSize), last - pos);
+            if (reader.read(buffer.get(), count, pos) != count)
+                throw boost::enable_error_info(FormatError("Unexpected end of file"));
+            const char *p = buffer.get();
+            const char *end = p + count;
+            while (p < end)
+            {
+                if (atStart)
+                {
+                    if (lines % asciiIndexStride == 0)
+                        starts.push_back(pos + (p - buffer.get()));
+                    lines++;
+                }
+                const char *nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+                if (nl == NULL)
+                {
+                    atStart = false;
+                    break;
+                }
+                p = nl + 1;
+                atStart = true;
+            }
+            pos += count;
+        }
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
+void Reader::buildLineIndex(const BinaryReader &reader)
+{
+    static const size_type minSegment = 4 * 1024 * 1024;
+
+    const size_type fileSize = reader.size();
+    const size_type total = fileSize > headerSize ? fileSize - headerSize : 0;
+    unsigned int segments = std::max(1U, boost::thread::hardware_concurrency());
+    if (total / minSegment < segments)
+        segments = std::max(size_type(1), total / minSegment);
+
+    std::vector<std::vector<size_type> > starts(segments);
+    std::vector<size_type> lines(segments);
+    std::vector<boost::exception_ptr> errors(segments);
+    std::vector<size_type> bounds(segments + 1);
+    for (unsigned int i = 0; i < segments; i++)
+        bounds[i] = headerSize + total / segments * i;
+    bounds[segments] = headerSize + total;
+
+    {
+        // The calling thread handles the first segment
+        boost::ptr_vector<boost::thread> threads;
+        for (unsigned int i = 1; i < segments; i++)
+            threads.push_back(new boost::thread(
+                    &Reader::indexRange, this, boost::cref(reader),
+                    bounds[i], bounds[i + 1],
+                    boost::ref(starts[i]), boost::ref(lines[i]), boost::ref(errors[i])));
+        indexRange(reader, bounds[0], bounds[1], starts[0], lines[0], errors[0]);
+        for (std::size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+    for (unsigned int i = 0; i < segments; i++)
+        if (errors[i])
+            boost::rethrow_exception(errors[i]);
+
+    lineIndex.clear();
+    size_type base = 0;
+    for (unsigned int i = 0; i < segments && base < vertexCount; i++)
+    {
+        for (std::size_t j = 0; j < starts[i].size(); j++)
+        {
+            const size_type line = base + j * asciiIndexStride;
+            if (line >= vertexCount)
+                break;
+            lineIndex.push_back(std::make_pair(line, starts[i][j]));
+        }
+        base += lines[i];
+    }
+    if (base < vertexCount)
+        throw boost::enable_error_info(FormatError("File is too small to contain all its vertices"));
+}
+
+/// Identifies the format of the line index cache
+static const char * const indexCacheMagic = "mlsgpu-ply-index-1";
+
+boost::filesystem::path Reader::indexCachePath() const
+{
+    return path.string() + ".idx";
+}
+
+bool Reader::loadLineIndex(const BinaryReader &reader)
+{
+    boost::filesystem::ifstream in(indexCachePath());
+    if (!in)
+        return false;
+
+    try
+    {
+        boost::system::error_code ec;
+        const std::time_t mtime = boost::filesystem::last_write_time(path, ec);
+        if (ec)
+            return false;
+
+        boost::archive::text_iarchive archive(in);
+        std::string magic;
+        size_type cachedSize, cachedHeader, cachedCount, cachedStride;
+        std::time_t cachedTime;
+        archive >> magic >> cachedSize >> cachedTime >> cachedHeader >> cachedCount >> cachedStride;
+        if (magic != indexCacheMagic
+            || cachedSize != reader.size()
+            || cachedTime != mtime
+            || cachedHeader != headerSize
+            || cachedCount != vertexCount
+            || cachedStride != asciiIndexStride)
+            return false;
+
+        std::vector<std::pair<size_type, size_type> > index;
+        archive >> index;
+        if (vertexCount > 0 && (index.empty() || index[0].first != 0))
+            return false;
+        lineIndex.swap(index);
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Ignoring invalid index cache " << indexCachePath().string() << ": " << e.what() << '\n';
+        return false;
+    }
+}
+
+void Reader::saveLineIndex(const BinaryReader &reader) const
+{
+    const boost::filesystem::path cachePath = indexCachePath();
+    const boost::filesystem::path tmpPath = cachePath.string() + ".tmp";
+    try
+    {
+        const std::time_t mtime = boost::filesystem::last_write_time(path);
+        {
+            boost::filesystem::ofstream out(tmpPath);
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            boost::archive::text_oarchive archive(out);
+            const std::string magic = indexCacheMagic;
+            const size_type fileSize = reader.size();
+            const size_type stride = asciiIndexStride;
+            archive << magic << fileSize << mtime << headerSize << vertexCount << stride;
+            archive << lineIndex;
+        }
+        // Rename into place so that a concurrent reader never sees a partial file
+        boost::filesystem::rename(tmpPath, cachePath);
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Could not write index cache " << cachePath.string() << ": " << e.what() << '\n';
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmpPath, ec);
+    }
+}
+
+namespace
+{
+
+/**
+ * Reads a range of a file line by line, with buffering. The lines that are
+ * returned do not include the newline.
+ */
+class LineReader : public boost::noncopyable
+{
+private:
+    const BinaryReader &reader;
+    BinaryReader::offset_type pos;   ///< File position of the end of the buffered data
+    BinaryReader::offset_type end;   ///< End of the file
+    std::vector<char> buffer;        ///< Buffered data
+    std::size_t head;                ///< Start of unconsumed data in @ref buffer
+    std::size_t tail;                ///< End of valid data in @ref buffer
+
+public:
+    LineReader(const BinaryReader &reader, BinaryReader::offset_type start)
+        : reader(reader), pos(start), end(reader.size()),
+        buffer(65536), head(0), tail(0)
+    {
+    }
+
+    /**
+     * Retrieve the next line.
+     *
+     * @param[out] first,last   The extent of the line.
+     * @return @c false if there are no more lines.
+     */
+    bool next(const char *&first, const char *&last)
+    {
+        std::size_t scanned = head;
+        while (true)
+        {
+            const char *nl = static_cast<const char *>(
+                std::memchr(&buffer[0] + scanned, '\n', tail - scanned));
+            if (nl != NULL)
+            {
+                first = &buffer[0] + head;
+                last = nl;
+                head = nl - &buffer[0] + 1;
+                return true;
+            }
+            if (pos == end)
+            {
+                // Final line without a newline
+                if (head == tail)
+                    return false;
+                first = &buffer[0] + head;
+                last = &buffer[0] + tail;
+                head = tail;
+                return true;
+            }
+
+            // Move the partial line to the front and read more
+            std::memmove(&buffer[0], &buffer[0] + head, tail - head);
+            tail -= head;
+            head = 0;
+            if (tail == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            scanned = tail;
+            const std::size_t count = std::min(BinaryReader::offset_type(buffer.size() - tail), end - pos);
+            if (reader.read(&buffer[0] + tail, count, pos) != count)
+                throw boost::enable_error_info(FormatError("Unexpected end of file"));
+            pos += count;
+            tail += count;
+        }
+    }
+};
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Parse a decimal floating-point value, starting at @a p and not going past
+ * @a end. This avoids the locale handling and generality of @c strtod in the
+ * common case, and falls back to @c strtod for anything unusual (such as
+ * special values). Unlike @c strtod, the result may occasionally differ from
+ * the correctly rounded value in the last bit.
+ *
+ * @return A pointer past the parsed token, or @c NULL if it is not a number.
+ */
+static const char *parseFloat(const char *p, const char *end, float &out)
+{
+    static const double powers[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const int maxDigits = 19;
+
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    std::tr1::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (digits < maxDigits)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0)
+                digits++;
+        }
+        else
+            exponent++;
+        p++;
+        any = true;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (digits < maxDigits)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    digits++;
+                exponent--;
+            }
+            p++;
+            any = true;
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negativeExp = (*p == '-');
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9')
+            any = false;
+        int e = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negativeExp ? -e : e;
+    }
+
+    if (!any || (p < end && !isSpace(*p)))
+    {
+        // Not a plain decimal number: let the C library deal with it
+        p = start;
+        while (p < end && !isSpace(*p))
+            p++;
+        std::string token(start, p);
+        char *tokenEnd;
+        const double value = std::strtod(token.c_str(), &tokenEnd);
+        if (token.empty() || *tokenEnd != '\0')
+            return NULL;
+        out = value;
+        return p;
+    }
+
+    double value = double(mantissa);
+    if (exponent < 0)
+    {
+        if (exponent >= -22)
+            value /= powers[-exponent];
+        else
+            value *= std::pow(10.0, exponent);
+    }
+    else if (exponent > 0)
+    {
+        if (exponent <= 22)
+            value *= powers[exponent];
+        else
+            value *= std::pow(10.0, exponent);
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+} // anonymous namespace
+
+void Reader::readAscii(const BinaryReader &reader, size_type first, size_type last, char *buffer) const
+{
+    if (first == last)
+        return;
+
+    // Map field positions on a line to properties
+    std::vector<int> fieldProperty(numFields, -1);
+    size_type usedFields = 0;
+    const unsigned int present = normals ? numProperties : (unsigned int) NX;
+    for (unsigned int i = 0; i < present; i++)
+    {
+        fieldProperty[fields[i]] = i;
+        usedFields = std::max(usedFields, fields[i] + 1);
+    }
+
+    std::vector<std::pair<size_type, size_type> >::const_iterator entry;
+    entry = std::upper_bound(lineIndex.begin(), lineIndex.end(),
+                             std::make_pair(first, std::numeric_limits<size_type>::max()));
+    assert(entry != lineIndex.begin());
+    --entry;
+
+    LineReader lines(reader, entry->second);
+    const char *lineStart, *lineEnd;
+    for (size_type i = entry->first; i < first; i++)
+        if (!lines.next(lineStart, lineEnd))
+            throw boost::enable_error_info(FormatError("Unexpected end of file"))
+                << boost::errinfo_file_name(path.string());
+
+    for (size_type i = first; i < last; i++)
+    {
+        if (!lines.next(lineStart, lineEnd))
+            throw boost::enable_error_info(FormatError("Unexpected end of file"))
+                << boost::errinfo_file_name(path.string());
+        const char *p = lineStart;
+        char *out = buffer + (i - first) * vertexSize;
+        for (size_type j = 0; j < usedFields; j++)
+        {
+            while (p < lineEnd && isSpace(*p))
+                p++;
+            if (p == lineEnd)
+                throw boost::enable_error_info(FormatError("Too few values on vertex line"))
+                    << boost::errinfo_file_name(path.string());
+            if (fieldProperty[j] >= 0)
+            {
+                float value;
+                p = parseFloat(p, lineEnd, value);
+                if (p == NULL)
+                    throw boost::enable_error_info(FormatError("Invalid number on vertex line"))
+                        << boost::errinfo_file_name(path.string());
+                std::memcpy(out + offsets[fieldProperty[j]], &value, sizeof(float));
+            }
+            else
+            {
+                while (p < lineEnd && !isSpace(*p))
+                    p++;
+            }
+        }
+    }
 }
 
 Reader::Handle::Handle(const Reader &owner)
     : owner(owner), reader(owner.readerFactory())
 {
     reader->open(owner.path);
-    if ((reader->size() - owner.getHeaderSize()) / owner.getVertexSize() < owner.size())
+    // ASCII files are checked when the index is built
+    if (!owner.isAscii()
+        && (reader->size() - owner.getHeaderSize()) / owner.getVertexSize() < owner.size())
         throw boost::enable_error_info(std::ios::failure("File is too small to contain all its vertices"))
             << boost::errinfo_file_name(owner.path.string());
 }
@@ -386,8 +1044,23 @@ void Reader::Handle::readRaw(size_type first, size_type last, char *buffer) cons
 {
     MLSGPU_ASSERT(first <= last, std::invalid_argument);
     MLSGPU_ASSERT(buffer != NULL, std::invalid_argument);
-    const std::size_t vertexSize = owner.getVertexSize();
-    reader->read(buffer, (last - first) * vertexSize, owner.getHeaderSize() + first * vertexSize);
+    if (owner.isAscii())
+        owner.readAscii(*reader, first, last, buffer);
+    else
+    {
+        const std::size_t vertexSize = owner.getVertexSize();
+        reader->read(buffer, (last - first) * vertexSize, owner.getHeaderSize() + first * vertexSize);
+    }
+}
+
+void Reader::Handle::willNeed(size_type first, size_type last) const
+{
+    MLSGPU_ASSERT(first <= last, std::invalid_argument);
+    if (owner.canWillNeed())
+    {
+        const std::size_t vertexSize = owner.getVertexSize();
+        reader->willNeed(owner.getHeaderSize() + first * vertexSize, (last - first) * vertexSize);
+    }
 }
 
 
@@ -52,6 +52,7 @@
 #include <boost/type_traits/is_pointer.hpp>
 #include <boost/ref.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/exception_ptr.hpp>
 #include "splat.h"
 #include "errors.h"
 #include "allocator.h"
@@ -82,15 +83,35 @@ public:
 /**
  * Base class for quickly reading a subset of PLY files.
  * It only supports the following:
- * - Binary files, endianness matching the host.
+ * - Binary files, endianness matching the host, or ASCII files.
  * - Only the "vertex" element is loaded.
  * - The "vertex" element must be the first element in the file.
- * - The x, y, z, nx, ny, nz, radius elements must all be present and FLOAT32.
+ * - The x, y, z, nx, ny, nz, radius elements must all be present, or else
+ *   only x, y, z (see @ref hasNormals). They may have any numeric type, and
+ *   are converted to float.
  * - The vertex element must not contain any lists.
+ * - ASCII files must have exactly one vertex per line.
  *
  * An instance of this class just holds the metadata, but no OS resources or
  * buffers. To actually read the data, one creates a @ref Handle,
  * at which point the file is opened.
+ *
+ * Comments of the form <code>comment scale <i>property</i> <i>value</i></code>
+ * and <code>comment offset <i>property</i> <i>value</i></code> in the header
+ * cause the stored value of that property to be multiplied by the scale and
+ * then have the offset added. This allows quantized values to be stored as
+ * integers.
+ *
+ * A comment of the form <code>comment scanner <i>x</i> <i>y</i> <i>z</i></code>
+ * records the position from which the points were captured (see
+ * @ref getScanner).
+ *
+ * ASCII files cannot be randomly accessed by vertex number, so the constructor
+ * makes a pass over the file (in parallel) to record the starting offset of
+ * every @ref asciiIndexStride th line. Reads then start from the nearest
+ * recorded line, and the text is parsed into the same layout as a binary file
+ * containing just the seven FLOAT32 properties, so that @ref decode and
+ * @ref getVertexSize behave identically for both formats.
  */
 class Reader
 {
@@ -120,7 +141,9 @@ public:
         /**
          * Low-level read access. The vertices are copied to @a buffer, in
          * exactly the form they exist in the file i.e. just a byte-level copy
-         * of the relevant data, without selecting the required fields.
+         * of the relevant data, without selecting the required fields. For
+         * ASCII files, the text is parsed to the binary form described in
+         * @ref Reader.
          *
          * @param first,last      %Range of vertices to read.
          * @param buffer          Output buffer.
@@ -131,6 +154,15 @@ public:
          */
         void readRaw(size_type first, size_type last, char *buffer) const;
 
+        /**
+         * Hint that a range of vertices will be read soon (see
+         * @ref BinaryReader::willNeed). This does nothing unless
+         * @ref Reader::canWillNeed is true.
+         *
+         * @pre @a first &lt;= @a last &lt;= @ref size().
+         */
+        void willNeed(size_type first, size_type last) const;
+
         /**
          * Convenience wrapper around @ref Reader::decode.
          *
@@ -167,30 +199,95 @@ public:
      */
     Splat decode(const char *buffer, std::size_t offset) const;
 
+    /**
+     * Extract a run of splats from the raw buffer representation. This gives
+     * the same results as calling @ref decode(const char *, std::size_t) const
+     * for each splat, but converts one property at a time across the whole
+     * run with a loop specialised for its type, so it should be preferred for
+     * bulk loading.
+     *
+     * @param buffer     A buffer returned by @ref Handle::readRaw
+     * @param offset     The number of the first splat within the buffer
+     * @param count      The number of splats to extract
+     * @param[out] out   Receives @a count splats, with computed qualities
+     */
+    void decode(const char *buffer, std::size_t offset, std::size_t count, Splat *out) const;
+
     /// Number of vertices in the file
     size_type size() const { return vertexCount; }
 
     /// Number of bytes per vertex
     size_type getVertexSize() const { return vertexSize; }
 
+    /// Whether the file is in ASCII format
+    bool isAscii() const { return ascii; }
+
+    /**
+     * Whether @ref Handle::willNeed has any effect. It is false for ASCII
+     * files, where the vertex positions in the file are not known in
+     * advance, and for reader types that ignore hints. Callers can use it to
+     * avoid opening a handle just to issue hints.
+     */
+    bool canWillNeed() const { return prefetchable; }
+
+    /**
+     * Whether the file contains normals and radii. If not, @ref decode
+     * returns splats with a zero normal and a radius of @a maxRadius (scaled
+     * by @a smooth), which is only useful for estimating the missing values
+     * (see @ref Normals).
+     */
+    bool hasNormals() const { return normals; }
+
+    /**
+     * The scanner position given in the header, or @c NULL if there was none.
+     */
+    const float *getScanner() const { return haveScanner ? scanner : NULL; }
+
+    /// Number of lines between entries in the line index of an ASCII file
+    static const size_type asciiIndexStride = 4096;
+
+    /**
+     * Information that allows a reader to be constructed without parsing the
+     * file header again. It is obtained from @ref getLayout, and is saved in
+     * the input manifest (see @ref InputManifest) so that later runs do not
+     * need to open every input file at startup.
+     */
+    struct Layout
+    {
+        std::string header;  ///< Raw header, up to and including the @c end_header line
+        bool compressed;     ///< Whether the file is a block-compressed container
+
+        Layout() : compressed(false) {}
+    };
+
+    /// Retrieve the information needed to reconstruct this reader
+    Layout getLayout() const;
+
     /**
      * Construct from a file.
      *
      * This will open the file to parse the header and then close it again.
      * If an exception is thrown, it will have the filename stored in it
-     * using @c boost::errinfo_file_name.
+     * using @c boost::errinfo_file_name. If the file is a block-compressed
+     * container (see @ref writeCompressedContainer), it is transparently
+     * decompressed.
      *
      * @param readerType       Type to use for binary file access
      * @param path             File to open.
      * @param smooth           Scale factor applied to radii as they're read.
      * @param maxRadius        Cap for radius (prior to scaling by @a smooth).
+     * @param cacheIndex       If true and the file is ASCII, the line index is loaded
+     *                         from (or saved to) @a path with @c .idx appended. A cache
+     *                         that does not match the size and modification time of the
+     *                         file is ignored, and failure to write it is not fatal.
      * @throw FormatError if the header is malformed.
      * @throw std::ios::failure if there was an I/O error.
      */
     Reader(
         ReaderType readerType,
         const boost::filesystem::path &path,
-        float smooth, float maxRadius);
+        float smooth, float maxRadius,
+        bool cacheIndex = false);
 
     /**
      * Construct from a filename, using a custom factory to generate the
@@ -201,6 +298,28 @@ public:
         const boost::filesystem::path &path,
         float smooth, float maxRadius);
 
+    /**
+     * Construct from a file whose layout is already known. A binary file is
+     * not opened until it is read. An ASCII file is still opened to index
+     * it, unless the index is cached.
+     *
+     * @param readerType       Type to use for binary file access
+     * @param path             File to read.
+     * @param layout           Layout previously returned by @ref getLayout for
+     *                         this file.
+     * @param smooth           Scale factor applied to radii as they're read.
+     * @param maxRadius        Cap for radius (prior to scaling by @a smooth).
+     * @param cacheIndex       See the other constructor.
+     * @throw FormatError if the header is malformed.
+     * @throw std::ios::failure if there was an I/O error.
+     */
+    Reader(
+        ReaderType readerType,
+        const boost::filesystem::path &path,
+        const Layout &layout,
+        float smooth, float maxRadius,
+        bool cacheIndex = false);
+
 private:
     /// Factory to generate file handles for low-level file access
     boost::function<BinaryReader *()> readerFactory;
@@ -227,6 +346,37 @@ private:
     size_type vertexCount;             ///< Number of vertices
     size_type offsets[numProperties];  ///< Byte offsets of each property within a vertex
 
+    /**
+     * Function that loads a property of a specific type from a run of
+     * vertices spaced @a inStride bytes apart, applies the scale and shift,
+     * and stores it to every eighth float of @a out (i.e. to one member of a
+     * run of @ref Splat).
+     */
+    typedef void (*BlockConverter)(const char *in, std::size_t inStride, std::size_t count,
+                                   double scale, double shift, float *out);
+    BlockConverter converters[numProperties]; ///< Loads each property, chosen from its type when the header is parsed
+    double scales[numProperties];        ///< Scale factor applied to each property
+    double shifts[numProperties];        ///< Offset added to each property after scaling
+
+    bool normals;                      ///< Whether the normal and radius properties are present
+    bool haveScanner;                  ///< Whether @ref scanner is valid
+    float scanner[3];                  ///< Scanner position from the header
+
+    bool ascii;                        ///< Whether the file is in ASCII format
+    bool compressed;                   ///< Whether the file is a block-compressed container
+    bool prefetchable;                 ///< See @ref canWillNeed
+    std::string header;                ///< Raw header text, for @ref getLayout
+    size_type numFields;               ///< Number of values on each vertex line (ASCII only)
+    size_type fields[numProperties];   ///< Position of each property on a vertex line (ASCII only)
+
+    /**
+     * Sparse index of vertex lines in an ASCII file. Each entry gives a
+     * vertex number and the byte offset of the start of its line. It is
+     * sorted and always contains an entry for vertex 0 (if there are any
+     * vertices).
+     */
+    std::vector<std::pair<size_type, size_type> > lineIndex;
+
     /**
      * Does the heavy lifting of parsing the header. This is called by
      * the constructor if it takes a file, otherwise by the subclass
@@ -234,6 +384,51 @@ private:
      */
     void readHeader(std::istream &in);
 
+    /**
+     * Open the file, parse the header, and index it if it is in ASCII format.
+     * This is the common part of the constructors.
+     */
+    void init(bool cacheIndex);
+
+    /**
+     * Load or build the line index of an ASCII file.
+     */
+    void indexAscii(const BinaryReader &reader, bool cacheIndex);
+
+    /**
+     * Populate @ref lineIndex by scanning the file with multiple threads.
+     *
+     * @throw FormatError if the file has fewer lines than vertices.
+     */
+    void buildLineIndex(const BinaryReader &reader);
+
+    /**
+     * Count and record the line starts in a byte range of the file, for
+     * @ref buildLineIndex. The offset of every @ref asciiIndexStride th line
+     * starting in the range (beginning with the first) is appended to
+     * @a starts, and the total number of lines starting in the range is
+     * returned in @a lines. Errors are captured in @a error.
+     */
+    void indexRange(
+        const BinaryReader &reader, size_type first, size_type last,
+        std::vector<size_type> &starts, size_type &lines,
+        boost::exception_ptr &error) const;
+
+    /// Name of the file used to cache @ref lineIndex
+    boost::filesystem::path indexCachePath() const;
+
+    /**
+     * Load @ref lineIndex from the cache, if it exists and is valid.
+     * @return Whether the index was loaded.
+     */
+    bool loadLineIndex(const BinaryReader &reader);
+
+    /// Save @ref lineIndex to the cache, logging a warning on failure
+    void saveLineIndex(const BinaryReader &reader) const;
+
+    /// Implementation of @ref Handle::readRaw for ASCII files
+    void readAscii(const BinaryReader &reader, size_type first, size_type last, char *buffer) const;
+
     /// Return the number of bytes from the beginning of the file to the first vertex
     size_type getHeaderSize() const { return headerSize; }
 };
@@ -429,15 +624,14 @@ OutputIterator Reader::Handle::read(size_type first, size_type last, OutputItera
     const std::size_t bufferSize = std::max(vertexSize, std::size_t(4096));
     const std::size_t blockSize = bufferSize / vertexSize;
     boost::scoped_array<char> buffer(new char[bufferSize]);
+    boost::scoped_array<Splat> splats(new Splat[blockSize]);
 
     for (size_type i = first; i < last; i += blockSize)
     {
         size_type blockEnd = std::min(last, i + blockSize);
         readRaw(i, blockEnd, buffer.get());
-        for (size_type j = i; j < blockEnd; j++)
-        {
-            *out++ = decode(buffer.get(), j - i);
-        }
+        owner.decode(buffer.get(), 0, blockEnd - i, splats.get());
+        out = std::copy(splats.get(), splats.get() + (blockEnd - i), out);
     }
     return out;
 }
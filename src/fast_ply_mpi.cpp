@@ -31,6 +31,7 @@
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <string>
+#include <sstream>
 #include <mpi.h>
 #include "fast_ply.h"
 #include "fast_ply_mpi.h"
@@ -41,13 +42,48 @@
 namespace FastPly
 {
 
-static boost::shared_ptr<BinaryWriter> makeHandle()
+WriterMPI::WriterMPI()
+    : Writer(boost::bind(&WriterMPI::makeHandle, this, MPI_COMM_SELF)),
+    info(MPI_INFO_NULL), blockSize(0)
 {
-    return boost::make_shared<BinaryWriterMPI>(MPI_COMM_SELF);
 }
 
-WriterMPI::WriterMPI() : Writer(makeHandle)
+WriterMPI::~WriterMPI()
 {
+    if (info != MPI_INFO_NULL)
+        MPI_Info_free(&info);
+}
+
+void WriterMPI::setStriping(std::size_t stripeSize, int stripeCount, bool aggregate)
+{
+    if (info != MPI_INFO_NULL)
+        MPI_Info_free(&info);
+    MPI_Info_create(&info);
+    if (stripeSize > 0)
+    {
+        std::ostringstream value;
+        value << stripeSize;
+        MPI_Info_set(info, const_cast<char *>("striping_unit"), const_cast<char *>(value.str().c_str()));
+    }
+    if (stripeCount > 0)
+    {
+        std::ostringstream value;
+        value << stripeCount;
+        MPI_Info_set(info, const_cast<char *>("striping_factor"), const_cast<char *>(value.str().c_str()));
+    }
+    if (aggregate)
+    {
+        // The partial blocks are written collectively, so use two-phase I/O for them
+        MPI_Info_set(info, const_cast<char *>("romio_cb_write"), const_cast<char *>("enable"));
+        blockSize = stripeSize > 0 ? stripeSize : 1024 * 1024;
+    }
+    else
+        blockSize = 0;
+}
+
+boost::shared_ptr<BinaryWriter> WriterMPI::makeHandle(MPI_Comm comm) const
+{
+    return boost::make_shared<BinaryWriterMPI>(comm, info, blockSize);
 }
 
 void WriterMPI::open(const std::string &filename, MPI_Comm comm, int root)
@@ -69,7 +105,7 @@ void WriterMPI::open(const std::string &filename, MPI_Comm comm, int root)
     setNumVertices(sizes[1]);
     setNumTriangles(sizes[2]);
 
-    handle = boost::make_shared<BinaryWriterMPI>(comm);
+    handle = makeHandle(comm);
     handle->open(filename);
     handle->resize(sizes[0] + getNumVertices() * vertexSize + getNumTriangles() * triangleSize);
     if (rank == root)
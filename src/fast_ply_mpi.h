@@ -32,6 +32,7 @@
 #endif
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <string>
+#include <cstddef>
 #include <mpi.h>
 #include "fast_ply.h"
 
@@ -53,6 +54,18 @@ public:
     /// Constructor
     WriterMPI();
 
+    virtual ~WriterMPI();
+
+    /**
+     * Set how files opened subsequently are written.
+     *
+     * @param stripeSize    Striping unit hint for new files, in bytes, or 0 to use the filesystem default.
+     * @param stripeCount   Number of stripes hint for new files, or 0 to use the filesystem default.
+     * @param aggregate     If true, writes are aggregated into blocks aligned to @a stripeSize
+     *                      (see @ref BinaryWriterMPI), or to 1MiB if it is zero.
+     */
+    void setStriping(std::size_t stripeSize, int stripeCount, bool aggregate);
+
     using Writer::open;
 
     /**
@@ -62,6 +75,13 @@ public:
      * @param root            Rank that will write the file header.
      */
     void open(const std::string &filename, MPI_Comm comm, int root);
+
+private:
+    MPI_Info info;          ///< Hints for opening files
+    std::size_t blockSize;  ///< Block size for aggregation, or 0 for none
+
+    /// Create a handle on a communicator
+    boost::shared_ptr<BinaryWriter> makeHandle(MPI_Comm comm) const;
 };
 
 } // namespace FastPly
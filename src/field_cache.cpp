@@ -0,0 +1,511 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Sparse on-disk storage of the signed distance function.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <ios>
+#include <boost/tr1/cmath.hpp>
+#include <boost/exception/all.hpp>
+#include <boost/thread/locks.hpp>
+#include "tr1_cstdint.h"
+#include "field_cache.h"
+#include "compress.h"
+#include "errors.h"
+#include "misc.h"
+#include "statistics.h"
+
+namespace
+{
+
+/// Fixed-size header at the start of a field cache
+struct FileHeader
+{
+    char magic[8];                         ///< Set to @ref fieldMagic
+    std::tr1::uint32_t blockSize;          ///< @ref SparseField::BLOCK_SIZE
+    std::tr1::uint32_t maxCells;           ///< Maximum cells along each side of a bin
+    std::tr1::uint32_t split;              ///< Nonzero if bins belong to separate chunks
+    std::tr1::uint32_t optionsLength;      ///< Bytes of options following the header
+    float reference[3];                    ///< Reference point of the bounding grid
+    float spacing;                         ///< Spacing of the bounding grid
+    std::tr1::int32_t lower[3];            ///< Lower extents of the bounding grid
+    std::tr1::int32_t upper[3];            ///< Upper extents of the bounding grid
+    std::tr1::uint64_t bins;               ///< Number of records
+};
+
+/// Header preceding each bin
+struct RecordHeader
+{
+    std::tr1::uint32_t gen;                ///< Generation of the chunk ID
+    std::tr1::int32_t coords[3];           ///< Coordinates of the chunk ID
+    std::tr1::int32_t lower[3];            ///< Lower extents of the bin, relative to the bounding grid
+    std::tr1::int32_t upper[3];            ///< Upper extents of the bin, relative to the bounding grid
+    std::tr1::uint32_t numBlocks;          ///< Number of stored blocks
+    std::tr1::uint32_t compressed;         ///< Nonzero if the payload is compressed
+    std::tr1::uint64_t storedBytes;        ///< Bytes of payload following this header
+};
+
+/// Signature at the start of a field cache
+const char fieldMagic[8] = {'M', 'L', 'S', 'G', 'P', 'U', 'F', '1'};
+
+/// Uncompressed payload size for a record with @a numBlocks blocks
+std::size_t payloadBytes(std::size_t numBlocks)
+{
+    return numBlocks * (3 * sizeof(SparseField::coord_type) + SparseField::BLOCK_SAMPLES * sizeof(float));
+}
+
+/**
+ * Determine whether a cell generates geometry in @ref Marching. This must
+ * match the test in the @c genOccupied kernel.
+ */
+bool activeCell(const float iso[8])
+{
+    unsigned int outside = 0;
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        if (!(std::tr1::isfinite)(iso[i]))
+            return false;
+        outside += iso[i] >= 0.0f;
+    }
+    return outside != 0 && outside != 8;
+}
+
+} // anonymous namespace
+
+SparseField::SparseField() : nextZ(0)
+{
+    std::fill(size, size + 3, 0);
+    std::fill(blocks, blocks + 3, 0);
+}
+
+void SparseField::reset(const Grid::size_type size[3])
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        this->size[i] = size[i];
+        blocks[i] = divUp(size[i], Grid::size_type(BLOCK_SIZE));
+    }
+    coords.clear();
+    values.clear();
+    index.clear();
+    nextZ = 0;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        layers[i].resize(std::size_t(size[0]) * size[1] * BLOCK_SIZE);
+        keep[i].resize(std::size_t(blocks[0]) * blocks[1]);
+    }
+}
+
+void SparseField::addSlice(const float *data)
+{
+    MLSGPU_ASSERT(nextZ < size[2], state_error);
+
+    const Grid::size_type z = nextZ;
+    const Grid::size_type layer = z / BLOCK_SIZE;
+    const std::size_t sliceSamples = std::size_t(size[0]) * size[1];
+    if (z % BLOCK_SIZE == 0)
+        std::fill(keep[layer % 2].begin(), keep[layer % 2].end(), 0);
+    std::copy(data, data + sliceSamples, layers[layer % 2].begin() + (z % BLOCK_SIZE) * sliceSamples);
+
+    if (z > 0)
+        markCells(z);
+    nextZ++;
+
+    /* The cells between the last slice of a layer and the first slice of the
+     * next one are the last that can touch the earlier layer.
+     */
+    if (z % BLOCK_SIZE == 0 && z > 0)
+        storeLayer(layer - 1);
+    if (complete())
+    {
+        storeLayer(layer);
+        makeIndex();
+    }
+}
+
+void SparseField::markCells(Grid::size_type z)
+{
+    const Grid::size_type w = size[0];
+    const Grid::size_type h = size[1];
+    const std::size_t sliceSamples = std::size_t(w) * h;
+    const Grid::size_type layer0 = (z - 1) / BLOCK_SIZE;
+    const Grid::size_type layer1 = z / BLOCK_SIZE;
+    const float *prev = &layers[layer0 % 2][((z - 1) % BLOCK_SIZE) * sliceSamples];
+    const float *cur = &layers[layer1 % 2][(z % BLOCK_SIZE) * sliceSamples];
+    char *keep0 = &keep[layer0 % 2][0];
+    char *keep1 = &keep[layer1 % 2][0];
+
+    for (Grid::size_type y = 0; y + 1 < h; y++)
+        for (Grid::size_type x = 0; x + 1 < w; x++)
+        {
+            const std::size_t p = std::size_t(y) * w + x;
+            const float iso[8] =
+            {
+                prev[p], prev[p + 1], prev[p + w], prev[p + w + 1],
+                cur[p], cur[p + 1], cur[p + w], cur[p + w + 1]
+            };
+            if (!activeCell(iso))
+                continue;
+            for (Grid::size_type by = y / BLOCK_SIZE; by <= (y + 1) / BLOCK_SIZE; by++)
+                for (Grid::size_type bx = x / BLOCK_SIZE; bx <= (x + 1) / BLOCK_SIZE; bx++)
+                {
+                    keep0[by * blocks[0] + bx] = 1;
+                    keep1[by * blocks[0] + bx] = 1;
+                }
+        }
+}
+
+void SparseField::storeLayer(Grid::size_type layer)
+{
+    const Grid::size_type w = size[0];
+    const Grid::size_type h = size[1];
+    const float *samples = &layers[layer % 2][0];
+    const char *flags = &keep[layer % 2][0];
+    const Grid::size_type depth = std::min(Grid::size_type(BLOCK_SIZE), size[2] - layer * BLOCK_SIZE);
+
+    for (Grid::size_type by = 0; by < blocks[1]; by++)
+        for (Grid::size_type bx = 0; bx < blocks[0]; bx++)
+        {
+            if (!flags[by * blocks[0] + bx])
+                continue;
+            coords.push_back(bx);
+            coords.push_back(by);
+            coords.push_back(layer);
+
+            const std::size_t base = values.size();
+            values.resize(base + BLOCK_SAMPLES, std::numeric_limits<float>::quiet_NaN());
+            const Grid::size_type x0 = bx * BLOCK_SIZE;
+            const Grid::size_type y0 = by * BLOCK_SIZE;
+            const Grid::size_type x1 = std::min(w, x0 + BLOCK_SIZE);
+            const Grid::size_type y1 = std::min(h, y0 + BLOCK_SIZE);
+            for (Grid::size_type dz = 0; dz < depth; dz++)
+                for (Grid::size_type y = y0; y < y1; y++)
+                    std::copy(samples + (std::size_t(dz) * h + y) * w + x0,
+                              samples + (std::size_t(dz) * h + y) * w + x1,
+                              values.begin() + base + (dz * BLOCK_SIZE + (y - y0)) * BLOCK_SIZE);
+        }
+}
+
+void SparseField::makeIndex()
+{
+    index.assign(std::size_t(blocks[0]) * blocks[1] * blocks[2], -1);
+    for (std::size_t i = 0; i < numBlocks(); i++)
+    {
+        const coord_type *c = &coords[3 * i];
+        index[(std::size_t(c[2]) * blocks[1] + c[1]) * blocks[0] + c[0]] = i;
+    }
+}
+
+void SparseField::assign(
+    const Grid::size_type size[3],
+    std::vector<coord_type> &coords, std::vector<float> &values)
+{
+    MLSGPU_ASSERT(coords.size() % 3 == 0, std::length_error);
+    MLSGPU_ASSERT(values.size() == coords.size() / 3 * BLOCK_SAMPLES, std::length_error);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        this->size[i] = size[i];
+        blocks[i] = divUp(size[i], Grid::size_type(BLOCK_SIZE));
+    }
+    for (std::size_t i = 0; i < coords.size(); i++)
+        MLSGPU_ASSERT(coords[i] < blocks[i % 3], std::length_error);
+
+    this->coords.swap(coords);
+    this->values.swap(values);
+    coords.clear();
+    values.clear();
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        layers[i].clear();
+        keep[i].clear();
+    }
+    nextZ = size[2];
+    makeIndex();
+}
+
+void SparseField::getSlice(Grid::size_type z, float *out) const
+{
+    MLSGPU_ASSERT(complete(), state_error);
+    MLSGPU_ASSERT(z < size[2], std::invalid_argument);
+
+    const Grid::size_type w = size[0];
+    const Grid::size_type h = size[1];
+    std::fill(out, out + std::size_t(w) * h, std::numeric_limits<float>::quiet_NaN());
+
+    const Grid::size_type bz = z / BLOCK_SIZE;
+    const Grid::size_type dz = z % BLOCK_SIZE;
+    for (Grid::size_type by = 0; by < blocks[1]; by++)
+        for (Grid::size_type bx = 0; bx < blocks[0]; bx++)
+        {
+            const std::tr1::int32_t idx = index[(std::size_t(bz) * blocks[1] + by) * blocks[0] + bx];
+            if (idx < 0)
+                continue;
+            const float *src = &values[std::size_t(idx) * BLOCK_SAMPLES + dz * BLOCK_SIZE * BLOCK_SIZE];
+            const Grid::size_type x0 = bx * BLOCK_SIZE;
+            const Grid::size_type y0 = by * BLOCK_SIZE;
+            const Grid::size_type x1 = std::min(w, x0 + BLOCK_SIZE);
+            const Grid::size_type y1 = std::min(h, y0 + BLOCK_SIZE);
+            for (Grid::size_type y = y0; y < y1; y++)
+                std::copy(src + (y - y0) * BLOCK_SIZE, src + (y - y0) * BLOCK_SIZE + (x1 - x0),
+                          out + std::size_t(y) * w + x0);
+        }
+}
+
+
+FieldCacheWriter::FieldCacheWriter(
+    WriterType type, const boost::filesystem::path &path,
+    const Grid &grid, Grid::size_type maxCells, bool split,
+    const std::string &options)
+    : file(createWriter(type)), options(options), bins(0),
+    pos(sizeof(FileHeader) + options.size()),
+    grid(grid), maxCells(maxCells), split(split),
+    blocksStat(Statistics::getStatistic<Statistics::Variable>("field.blocks")),
+    bytesStat(Statistics::getStatistic<Statistics::Variable>("field.bytes"))
+{
+    file->open(path);
+    file->resize(0);
+    if (!options.empty() && file->write(options.data(), options.size(), sizeof(FileHeader)) != options.size())
+        throw boost::enable_error_info(std::ios::failure("Short write"))
+            << boost::errinfo_file_name(path.string());
+}
+
+FieldCacheWriter::~FieldCacheWriter()
+{
+    if (file->isOpen())
+    {
+        try
+        {
+            file->close();
+        }
+        catch (std::exception &e)
+        {
+            // Errors cannot be reported from a destructor, and the file is invalid anyway
+        }
+    }
+}
+
+void FieldCacheWriter::write(const ChunkId &chunkId, const Grid &grid, const SparseField &field)
+{
+    MLSGPU_ASSERT(field.complete(), std::invalid_argument);
+
+    RecordHeader record;
+    record.gen = chunkId.gen;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(field.getSize()[i] == grid.numVertices(i), std::invalid_argument);
+        record.coords[i] = chunkId.coords[i];
+        record.lower[i] = grid.getExtent(i).first;
+        record.upper[i] = grid.getExtent(i).second;
+    }
+    record.numBlocks = field.numBlocks();
+    record.compressed = 0;
+
+    const std::size_t rawBytes = payloadBytes(field.numBlocks());
+    const std::size_t coordBytes = field.getCoords().size() * sizeof(SparseField::coord_type);
+    std::vector<char> raw(rawBytes);
+    if (rawBytes > 0)
+    {
+        std::memcpy(&raw[0], &field.getCoords()[0], coordBytes);
+        std::memcpy(&raw[coordBytes], &field.getValues()[0], rawBytes - coordBytes);
+    }
+
+    // Most samples in a block are smooth or NaN, so this usually helps a lot
+    std::vector<char> compressed;
+    const char *data = rawBytes > 0 ? &raw[0] : NULL;
+    std::size_t stored = rawBytes;
+    if (rawBytes > 0 && compressSupported())
+    {
+        compressed.resize(compressBufferBound(rawBytes));
+        const std::size_t bytes = compressBuffer(&raw[0], rawBytes, &compressed[0], compressed.size());
+        if (bytes < rawBytes)
+        {
+            data = &compressed[0];
+            stored = bytes;
+            record.compressed = 1;
+        }
+    }
+    record.storedBytes = stored;
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (file->write(&record, sizeof(record), pos) != sizeof(record)
+            || (stored > 0 && file->write(data, stored, pos + sizeof(record)) != stored))
+            throw boost::enable_error_info(std::ios::failure("Short write"))
+                << boost::errinfo_file_name(file->filename());
+        pos += sizeof(record) + stored;
+        bins++;
+    }
+    blocksStat.add(field.numBlocks());
+    bytesStat.add(stored);
+}
+
+void FieldCacheWriter::close()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    FileHeader header;
+    std::memcpy(header.magic, fieldMagic, sizeof(header.magic));
+    header.blockSize = SparseField::BLOCK_SIZE;
+    header.maxCells = maxCells;
+    header.split = split;
+    header.optionsLength = options.size();
+    std::copy(grid.getReference(), grid.getReference() + 3, header.reference);
+    header.spacing = grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        header.lower[i] = grid.getExtent(i).first;
+        header.upper[i] = grid.getExtent(i).second;
+    }
+    header.bins = bins;
+
+    // The header is written last so that an incomplete file is not recognized
+    if (file->write(&header, sizeof(header), 0) != sizeof(header))
+        throw boost::enable_error_info(std::ios::failure("Short write"))
+            << boost::errinfo_file_name(file->filename());
+    file->close();
+}
+
+
+FieldCacheReader::FieldCacheReader(ReaderType type, const boost::filesystem::path &path)
+    : file(createReader(type)), bins(0), nextBin(0), firstPos(0), pos(0), maxCells(0), split(false)
+{
+    file->open(path);
+
+    FileHeader header;
+    if (file->read(&header, sizeof(header), 0) != sizeof(header)
+        || std::memcmp(header.magic, fieldMagic, sizeof(fieldMagic)) != 0)
+        throw boost::enable_error_info(std::ios::failure("Not a complete field cache"))
+            << boost::errinfo_file_name(path.string());
+    if (header.blockSize != SparseField::BLOCK_SIZE)
+        throw boost::enable_error_info(std::ios::failure("Unsupported field cache block size"))
+            << boost::errinfo_file_name(path.string());
+    for (unsigned int i = 0; i < 3; i++)
+        if (header.lower[i] >= header.upper[i])
+            throw boost::enable_error_info(std::ios::failure("Corrupt field cache header"))
+                << boost::errinfo_file_name(path.string());
+
+    options.resize(header.optionsLength);
+    if (header.optionsLength > 0
+        && file->read(&options[0], header.optionsLength, sizeof(header)) != header.optionsLength)
+        throw boost::enable_error_info(std::ios::failure("Field cache is truncated"))
+            << boost::errinfo_file_name(path.string());
+
+    grid = Grid(header.reference, header.spacing,
+                header.lower[0], header.upper[0],
+                header.lower[1], header.upper[1],
+                header.lower[2], header.upper[2]);
+    maxCells = header.maxCells;
+    split = header.split != 0;
+    bins = header.bins;
+    firstPos = pos = sizeof(header) + header.optionsLength;
+}
+
+FieldCacheReader::~FieldCacheReader()
+{
+    if (file->isOpen())
+        file->close();
+}
+
+void FieldCacheReader::rewind()
+{
+    nextBin = 0;
+    pos = firstPos;
+}
+
+bool FieldCacheReader::next(ChunkId &chunkId, Grid &grid, SparseField &field)
+{
+    if (nextBin == bins)
+        return false;
+
+    RecordHeader record;
+    if (file->read(&record, sizeof(record), pos) != sizeof(record))
+        throw boost::enable_error_info(std::ios::failure("Field cache is truncated"))
+            << boost::errinfo_file_name(file->filename());
+
+    Grid::size_type size[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        if (record.lower[i] >= record.upper[i]
+            || Grid::size_type(record.upper[i] - record.lower[i]) > maxCells)
+            throw boost::enable_error_info(std::ios::failure("Corrupt field cache record"))
+                << boost::errinfo_file_name(file->filename());
+        size[i] = record.upper[i] - record.lower[i] + 1;
+    }
+    const std::size_t rawBytes = payloadBytes(record.numBlocks);
+    if (record.compressed ? record.storedBytes > compressBufferBound(rawBytes) : record.storedBytes != rawBytes)
+        throw boost::enable_error_info(std::ios::failure("Corrupt field cache record"))
+            << boost::errinfo_file_name(file->filename());
+
+    std::vector<char> stored(record.storedBytes);
+    if (record.storedBytes > 0
+        && file->read(&stored[0], record.storedBytes, pos + sizeof(record)) != record.storedBytes)
+        throw boost::enable_error_info(std::ios::failure("Field cache is truncated"))
+            << boost::errinfo_file_name(file->filename());
+    if (record.compressed)
+    {
+        std::vector<char> raw(rawBytes);
+        decompressBuffer(&stored[0], stored.size(), &raw[0], rawBytes);
+        stored.swap(raw);
+    }
+
+    std::vector<SparseField::coord_type> coords(3 * record.numBlocks);
+    std::vector<float> values(std::size_t(record.numBlocks) * SparseField::BLOCK_SAMPLES);
+    const std::size_t coordBytes = coords.size() * sizeof(SparseField::coord_type);
+    if (rawBytes > 0)
+    {
+        std::memcpy(&coords[0], &stored[0], coordBytes);
+        std::memcpy(&values[0], &stored[coordBytes], rawBytes - coordBytes);
+    }
+    try
+    {
+        field.assign(size, coords, values);
+    }
+    catch (std::length_error &e)
+    {
+        throw boost::enable_error_info(std::ios::failure("Corrupt field cache record"))
+            << boost::errinfo_file_name(file->filename());
+    }
+
+    chunkId.gen = record.gen;
+    for (unsigned int i = 0; i < 3; i++)
+        chunkId.coords[i] = record.coords[i];
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    grid = Grid(ref, 1.0f,
+                record.lower[0], record.upper[0],
+                record.lower[1], record.upper[1],
+                record.lower[2], record.upper[2]);
+
+    pos += sizeof(record) + record.storedBytes;
+    nextBin++;
+    return true;
+}
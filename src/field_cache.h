@@ -0,0 +1,278 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Sparse on-disk storage of the signed distance function, so that the
+ * surface can be extracted again without recomputing it.
+ */
+
+#ifndef FIELD_CACHE_H
+#define FIELD_CACHE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/filesystem/path.hpp>
+#include "tr1_cstdint.h"
+#include "grid.h"
+#include "chunk_id.h"
+#include "binary_io.h"
+#include "statistics.h"
+
+class TestSparseField;
+
+/**
+ * Samples of the signed distance function for one bin, keeping only the
+ * blocks that the isosurface passes through.
+ *
+ * A cell produces geometry in @ref Marching only if its eight corners are all
+ * finite and do not all have the same sign. A block of @ref BLOCK_SIZE
+ * corners along each axis is kept if any of its corners belongs to such a
+ * cell, and all other samples are replaced by NaN. Since a cell with a NaN
+ * corner never produces geometry, the extracted surface is unchanged.
+ *
+ * A field is either captured one slice at a time with @ref reset and
+ * @ref addSlice, or loaded with @ref assign, after which @ref getSlice
+ * expands it again.
+ */
+class SparseField
+{
+    friend class TestSparseField;
+public:
+    enum
+    {
+        BLOCK_SIZE = 8   ///< Number of samples along each side of a block
+    };
+    enum
+    {
+        BLOCK_SAMPLES = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE  ///< Number of samples in a block
+    };
+
+    typedef std::tr1::uint32_t coord_type;
+
+    SparseField();
+
+    /**
+     * Start capturing a new field, discarding the current contents.
+     *
+     * @param size     Number of samples along each axis.
+     */
+    void reset(const Grid::size_type size[3]);
+
+    /**
+     * Append the next slice of samples. Blocks are selected as soon as all
+     * the cells touching them have been seen.
+     *
+     * @param data     Samples for the slice, with X varying fastest.
+     *
+     * @pre Fewer than <code>getSize()[2]</code> slices have been added since @ref reset.
+     */
+    void addSlice(const float *data);
+
+    /// Returns whether all slices have been added since the last @ref reset.
+    bool complete() const { return nextZ == size[2]; }
+
+    /**
+     * Replace the contents with previously captured blocks. The vectors
+     * are swapped into the object, so they are empty on return.
+     *
+     * @param size     Number of samples along each axis.
+     * @param coords   Block coordinates, three per block.
+     * @param values   Samples for the blocks, @ref BLOCK_SAMPLES per block, with X varying fastest.
+     *
+     * @throw std::length_error if the vectors have inconsistent lengths or a
+     * block lies outside the field.
+     */
+    void assign(const Grid::size_type size[3],
+                std::vector<coord_type> &coords, std::vector<float> &values);
+
+    /**
+     * Expand one slice. Samples that are not in a stored block are NaN.
+     *
+     * @param z        The slice to expand.
+     * @param[out] out Storage for <code>getSize()[0] * getSize()[1]</code> samples.
+     *
+     * @pre The field is complete.
+     */
+    void getSlice(Grid::size_type z, float *out) const;
+
+    const Grid::size_type *getSize() const { return size; }
+    std::size_t numBlocks() const { return coords.size() / 3; }
+    const std::vector<coord_type> &getCoords() const { return coords; }
+    const std::vector<float> &getValues() const { return values; }
+
+private:
+    Grid::size_type size[3];               ///< Samples along each axis
+    Grid::size_type blocks[3];             ///< Blocks along each axis (rounded up)
+    std::vector<coord_type> coords;        ///< Coordinates of stored blocks
+    std::vector<float> values;             ///< Samples of stored blocks
+
+    /// Next slice expected by @ref addSlice
+    Grid::size_type nextZ;
+    /**
+     * Samples of the two most recent layers of blocks, indexed by layer
+     * parity. Each holds @ref BLOCK_SIZE slices.
+     */
+    std::vector<float> layers[2];
+    /// Flags for the blocks in @ref layers that must be kept
+    std::vector<char> keep[2];
+
+    /**
+     * Index from block position to block number, or -1 for blocks that are
+     * not stored. It is only valid when the field is complete.
+     */
+    std::vector<std::tr1::int32_t> index;
+
+    /// Flag the blocks touching active cells between slices @a z - 1 and @a z.
+    void markCells(Grid::size_type z);
+
+    /// Copy the flagged blocks of a finished layer into @ref coords and @ref values.
+    void storeLayer(Grid::size_type layer);
+
+    /// Rebuild @ref index from @ref coords
+    void makeIndex();
+};
+
+/**
+ * Writes a file of @ref SparseField records, one per bin, which can later be
+ * extracted without the original inputs (see @ref FieldCacheReader). The
+ * records are compressed with @ref compressBuffer where it is supported.
+ *
+ * The file header is only written by @ref close, so a file left behind by a
+ * failed run is not recognized.
+ */
+class FieldCacheWriter : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. It creates the file.
+     *
+     * @param type       Type of writer to use for the file.
+     * @param path       File to create.
+     * @param grid       Bounding grid of the reconstruction.
+     * @param maxCells   Maximum number of cells along each side of a bin.
+     * @param split      Whether the bins belong to separate output chunks.
+     * @param options    Options used for the run, recorded for provenance.
+     *
+     * @throw std::ios::failure if the file could not be created.
+     */
+    FieldCacheWriter(WriterType type, const boost::filesystem::path &path,
+                     const Grid &grid, Grid::size_type maxCells, bool split,
+                     const std::string &options);
+
+    /**
+     * Closes the file without writing the header if @ref close was not called.
+     */
+    ~FieldCacheWriter();
+
+    /**
+     * Append a bin. This may be called from multiple threads.
+     *
+     * @param chunkId    Chunk owning the bin.
+     * @param grid       Region of the bin, relative to the bounding grid.
+     * @param field      Samples of the bin.
+     *
+     * @pre @a field is complete and its size matches the vertices of @a grid.
+     */
+    void write(const ChunkId &chunkId, const Grid &grid, const SparseField &field);
+
+    /**
+     * Write the header and close the file.
+     *
+     * @throw std::ios::failure if the file could not be written.
+     */
+    void close();
+
+private:
+    boost::scoped_ptr<BinaryWriter> file;
+    boost::mutex mutex;                  ///< Protects the members below
+    std::string options;                 ///< Options recorded in the file
+    std::tr1::uint64_t bins;             ///< Number of records written
+    BinaryWriter::offset_type pos;       ///< Position for the next record
+    Grid grid;
+    Grid::size_type maxCells;
+    bool split;
+
+    Statistics::Variable &blocksStat;    ///< Blocks stored per bin
+    Statistics::Variable &bytesStat;     ///< Bytes stored per bin
+};
+
+/**
+ * Reads a file written by @ref FieldCacheWriter.
+ */
+class FieldCacheReader : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. It opens the file and reads the header.
+     *
+     * @throw std::ios::failure if the file could not be read or is not a complete field cache.
+     */
+    FieldCacheReader(ReaderType type, const boost::filesystem::path &path);
+
+    ~FieldCacheReader();
+
+    /// Bounding grid of the reconstruction
+    const Grid &getGrid() const { return grid; }
+    /// Maximum number of cells along each side of a bin
+    Grid::size_type getMaxCells() const { return maxCells; }
+    /// Whether the bins belong to separate output chunks
+    bool isSplit() const { return split; }
+    /// Options used when the file was written
+    const std::string &getOptions() const { return options; }
+    /// Number of bins in the file
+    std::tr1::uint64_t numBins() const { return bins; }
+
+    /// Return to the first bin
+    void rewind();
+
+    /**
+     * Read the next bin.
+     *
+     * @param[out] chunkId    Chunk owning the bin.
+     * @param[out] grid       Region of the bin, relative to the bounding grid.
+     * @param[out] field      Samples of the bin.
+     * @return @c false if there are no more bins.
+     *
+     * @throw std::ios::failure if the file is truncated or corrupt.
+     */
+    bool next(ChunkId &chunkId, Grid &grid, SparseField &field);
+
+private:
+    boost::scoped_ptr<BinaryReader> file;
+    std::string options;
+    std::tr1::uint64_t bins;             ///< Number of records in the file
+    std::tr1::uint64_t nextBin;          ///< Index of the next record
+    BinaryReader::offset_type firstPos;  ///< Position of the first record
+    BinaryReader::offset_type pos;       ///< Position of the next record
+    Grid grid;
+    Grid::size_type maxCells;
+    bool split;
+};
+
+#endif /* !FIELD_CACHE_H */
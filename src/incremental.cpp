@@ -0,0 +1,342 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Record of a reconstruction, used to limit later runs to the chunks that change.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ctime>
+#include <ios>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/exception/all.hpp>
+#include <boost/foreach.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/vector.hpp>
+#include "tr1_cstdint.h"
+#include "incremental.h"
+#include "input_manifest.h"
+#include "logging.h"
+#include "misc.h"
+
+/// Identifies the format of the state file
+static const char * const stateMagic = "mlsgpu-incremental-3";
+
+IncrementalState::Layout::Layout() : spacing(0.0f), chunkCells(0)
+{
+}
+
+bool IncrementalState::Layout::operator==(const Layout &b) const
+{
+    return options == b.options
+        && spacing == b.spacing
+        && chunkCells == b.chunkCells;
+}
+
+template<typename Archive>
+void IncrementalState::Layout::serialize(Archive &ar, const unsigned int version)
+{
+    (void) version;
+    ar & options & spacing & chunkCells;
+}
+
+template<typename Archive>
+void IncrementalState::Box::serialize(Archive &ar, const unsigned int version)
+{
+    (void) version;
+    ar & lower & upper;
+}
+
+template<typename Archive>
+void IncrementalState::Entry::serialize(Archive &ar, const unsigned int version)
+{
+    (void) version;
+    ar & size & mtime & hasBox & box;
+}
+
+IncrementalState::IncrementalState()
+{
+}
+
+IncrementalState::IncrementalState(const Layout &layout) : layout(layout)
+{
+}
+
+bool IncrementalState::load(const boost::filesystem::path &path)
+{
+    boost::filesystem::ifstream in(path);
+    if (!in)
+        return false;
+
+    try
+    {
+        boost::archive::text_iarchive archive(in);
+        std::string magic;
+        archive >> magic;
+        if (magic != stateMagic)
+        {
+            Log::log[Log::warn] << "Ignoring incremental state " << path.string() << " with unknown format\n";
+            return false;
+        }
+
+        // Groups are flattened to avoid depending on serialization of boost::array
+        std::vector<std::vector<Grid::difference_type> > flatGroups;
+        std::vector<std::tr1::uint64_t> groupSizes;
+        archive >> layout >> files >> flatGroups >> groupSizes;
+        if (groupSizes.size() != 3 * flatGroups.size())
+            throw std::runtime_error("group sizes do not match the groups");
+        groups.clear();
+        for (std::size_t g = 0; g < flatGroups.size(); g++)
+        {
+            const std::vector<Grid::difference_type> &flat = flatGroups[g];
+            groups.push_back(Group());
+            Group &group = groups.back();
+            group.chunks.resize(flat.size() / 3);
+            for (std::size_t i = 0; i < flat.size() / 3; i++)
+                std::copy(flat.begin() + 3 * i, flat.begin() + 3 * i + 3, group.chunks[i].begin());
+            group.vertices = groupSizes[3 * g];
+            group.largestPruned = groupSizes[3 * g + 1];
+            group.smallestKept = groupSizes[3 * g + 2];
+        }
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Ignoring invalid incremental state " << path.string() << ": " << e.what() << '\n';
+        *this = IncrementalState();
+        return false;
+    }
+}
+
+void IncrementalState::save(const boost::filesystem::path &path) const
+{
+    const boost::filesystem::path tmpPath = path.string() + boost::filesystem::unique_path(".%%%%-%%%%.tmp").string();
+    try
+    {
+        {
+            boost::filesystem::ofstream out(tmpPath);
+            if (!out)
+                throw std::ios::failure("Could not open file");
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            boost::archive::text_oarchive archive(out);
+
+            std::vector<std::vector<Grid::difference_type> > flatGroups;
+            std::vector<std::tr1::uint64_t> groupSizes;
+            BOOST_FOREACH(const Group &group, groups)
+            {
+                flatGroups.push_back(std::vector<Grid::difference_type>());
+                BOOST_FOREACH(const chunk_coords &coords, group.chunks)
+                    flatGroups.back().insert(flatGroups.back().end(), coords.begin(), coords.end());
+                groupSizes.push_back(group.vertices);
+                groupSizes.push_back(group.largestPruned);
+                groupSizes.push_back(group.smallestKept);
+            }
+            const std::string magic = stateMagic;
+            archive << magic << layout << files << flatGroups << groupSizes;
+        }
+        boost::filesystem::rename(tmpPath, path);
+    }
+    catch (std::exception &e)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmpPath, ec);
+        throw boost::enable_error_info(std::ios::failure(e.what()))
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(errno);
+    }
+}
+
+void IncrementalState::addFile(const boost::filesystem::path &file, const Box *box)
+{
+    Entry entry;
+    if (!InputManifest::stamp(file, entry.size, entry.mtime))
+    {
+        // Recording a stamp that can never match forces a rebuild next time
+        entry.size = 0;
+        entry.mtime = 0;
+    }
+    entry.hasBox = box != NULL;
+    if (box != NULL)
+        entry.box = *box;
+    else
+    {
+        std::fill(entry.box.lower, entry.box.lower + 3, 0);
+        std::fill(entry.box.upper, entry.box.upper + 3, 0);
+    }
+    files[boost::filesystem::absolute(file).string()] = entry;
+}
+
+bool IncrementalState::Group::touches(const std::set<chunk_coords> &chunks) const
+{
+    BOOST_FOREACH(const chunk_coords &coords, this->chunks)
+        if (chunks.count(coords))
+            return true;
+    return false;
+}
+
+void IncrementalState::addGroup(
+    const std::vector<ChunkId> &group,
+    std::tr1::uint64_t vertices,
+    std::tr1::uint64_t largestPruned,
+    std::tr1::uint64_t smallestKept)
+{
+    groups.push_back(Group());
+    BOOST_FOREACH(const ChunkId &id, group)
+        groups.back().chunks.push_back(id.coords);
+    groups.back().vertices = vertices;
+    groups.back().largestPruned = largestPruned;
+    groups.back().smallestKept = smallestKept;
+}
+
+void IncrementalState::keepGroups(const IncrementalState &old, const std::set<chunk_coords> &chunks)
+{
+    BOOST_FOREACH(const Group &group, old.groups)
+        if (!group.touches(chunks))
+            groups.push_back(group);
+}
+
+std::vector<IncrementalState::chunk_coords> IncrementalState::getChunks() const
+{
+    std::vector<chunk_coords> ans;
+    BOOST_FOREACH(const Group &group, groups)
+        ans.insert(ans.end(), group.chunks.begin(), group.chunks.end());
+    return ans;
+}
+
+std::tr1::uint64_t IncrementalState::keptVertices(const std::set<chunk_coords> &chunks) const
+{
+    std::tr1::uint64_t total = 0;
+    BOOST_FOREACH(const Group &group, groups)
+        if (!group.touches(chunks))
+            total += group.vertices;
+    return total;
+}
+
+bool IncrementalState::addPruneChanges(
+    std::tr1::uint64_t thresholdVertices, std::set<chunk_coords> &chunks) const
+{
+    /* A component is kept if it has at least thresholdVertices vertices, so
+     * the output of a group is unchanged provided that the new threshold
+     * still lies above every pruned component and at or below every kept one.
+     */
+    std::set<chunk_coords> changed;
+    BOOST_FOREACH(const Group &group, groups)
+    {
+        if (group.touches(chunks))
+            continue;
+        if ((group.largestPruned > 0 && group.largestPruned >= thresholdVertices)
+            || group.smallestKept < thresholdVertices)
+            changed.insert(group.chunks.begin(), group.chunks.end());
+    }
+    chunks.insert(changed.begin(), changed.end());
+    return !changed.empty();
+}
+
+void IncrementalState::addTouched(const Box &box, std::set<chunk_coords> &chunks) const
+{
+    /* Chunk c covers the vertices from c * chunkCells to (c + 1) * chunkCells
+     * inclusive, so it is touched if that range intersects the vertices
+     * [lower, upper]. Boundary vertices are shared with the neighbouring
+     * chunk, so both are included.
+     */
+    const std::tr1::int64_t size = layout.chunkCells;
+    std::tr1::int64_t first[3], last[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        // -divDown(-a, b) is a rounding-up division that allows negative a
+        first[i] = -divDown(-std::tr1::int64_t(box.lower[i]), size) - 1;
+        last[i] = divDown(std::tr1::int64_t(box.upper[i]), size);
+    }
+
+    chunk_coords coords;
+    for (std::tr1::int64_t x = first[0]; x <= last[0]; x++)
+        for (std::tr1::int64_t y = first[1]; y <= last[1]; y++)
+            for (std::tr1::int64_t z = first[2]; z <= last[2]; z++)
+            {
+                coords[0] = x;
+                coords[1] = y;
+                coords[2] = z;
+                chunks.insert(coords);
+            }
+}
+
+bool IncrementalState::changedChunks(
+    const IncrementalState &old, std::set<chunk_coords> &chunks,
+    std::size_t &changedFiles) const
+{
+    chunks.clear();
+    changedFiles = 0;
+
+    // Find files that are new or modified
+    for (std::map<std::string, Entry>::const_iterator i = files.begin(); i != files.end(); ++i)
+    {
+        std::map<std::string, Entry>::const_iterator j = old.files.find(i->first);
+        if (j != old.files.end()
+            && j->second.size == i->second.size
+            && j->second.mtime == i->second.mtime)
+            continue;
+
+        changedFiles++;
+        if (i->second.hasBox)
+            addTouched(i->second.box, chunks);
+        if (j != old.files.end() && j->second.hasBox)
+            addTouched(j->second.box, chunks);
+    }
+    // Find files that were removed
+    for (std::map<std::string, Entry>::const_iterator j = old.files.begin(); j != old.files.end(); ++j)
+    {
+        if (files.count(j->first))
+            continue;
+        changedFiles++;
+        if (j->second.hasBox)
+            addTouched(j->second.box, chunks);
+    }
+
+    if (layout != old.layout || layout.chunkCells == 0)
+    {
+        chunks.clear();
+        return false;
+    }
+
+    // Extend to whole groups
+    BOOST_FOREACH(const Group &group, old.groups)
+    {
+        if (group.touches(chunks))
+            chunks.insert(group.chunks.begin(), group.chunks.end());
+    }
+    return true;
+}
@@ -0,0 +1,218 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Record of a reconstruction, used to limit later runs to the chunks that change.
+ */
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ctime>
+#include <boost/array.hpp>
+#include <boost/filesystem/path.hpp>
+#include "tr1_cstdint.h"
+#include "grid.h"
+#include "chunk_id.h"
+
+/**
+ * State saved between runs of an incremental reconstruction. It records
+ * where the output chunks lie, which cells each input file touches, and
+ * which chunks are linked by connected components. Comparing it to the state
+ * of the previous run identifies the chunks whose output may have changed.
+ *
+ * All cell coordinates are relative to the world origin, which is the
+ * reference point of the bounding grids computed by @ref SplatSet::FastBlobSet.
+ */
+class IncrementalState
+{
+public:
+    /// Position of a chunk on the lattice of chunks (see @ref ChunkId::coords)
+    typedef boost::array<Grid::difference_type, 3> chunk_coords;
+
+    /**
+     * Everything that determines the positions and contents of the output
+     * chunks, other than the input files. If the layouts of two runs differ,
+     * nothing can be reused. The chunks are anchored at the world origin, so
+     * the layout does not depend on the extent of the model.
+     */
+    struct Layout
+    {
+        /// Options that affect the output, in command-line form
+        std::string options;
+        /// Grid spacing
+        float spacing;
+        /// Side length of the chunks, in cells, or 0 if it is not known (which never matches)
+        Grid::size_type chunkCells;
+
+        Layout();
+
+        bool operator==(const Layout &b) const;
+        bool operator!=(const Layout &b) const { return !(*this == b); }
+
+        template<typename Archive>
+        void serialize(Archive &ar, const unsigned int version);
+    };
+
+    /**
+     * Half-open range of cells touched by the splats of a file, including
+     * their radii.
+     */
+    struct Box
+    {
+        Grid::difference_type lower[3];
+        Grid::difference_type upper[3];
+
+        template<typename Archive>
+        void serialize(Archive &ar, const unsigned int version);
+    };
+
+    /// Constructs a state with no files or chunks, and a default layout.
+    IncrementalState();
+
+    /// Constructs a state with no files or chunks.
+    explicit IncrementalState(const Layout &layout);
+
+    const Layout &getLayout() const { return layout; }
+
+    /**
+     * Load a state previously written by @ref save, replacing the current
+     * contents. Problems are reported as warnings, since the only
+     * consequence is that everything is rebuilt.
+     *
+     * @return Whether a valid state was loaded.
+     */
+    bool load(const boost::filesystem::path &path);
+
+    /**
+     * Write the state to a file. The file is replaced atomically.
+     *
+     * @throw std::ios::failure if the file could not be written.
+     */
+    void save(const boost::filesystem::path &path) const;
+
+    /**
+     * Record an input file, stamped with its current size and modification time.
+     *
+     * @param file  The input file (relative paths are made absolute).
+     * @param box   Cells touched by the file, or @c NULL if it has no splats.
+     */
+    void addFile(const boost::filesystem::path &file, const Box *box);
+
+    /**
+     * Record a set of chunks that are linked by connected components.
+     * See @ref OOCMesher::getChunkGroups.
+     *
+     * @param group          The chunks in the group.
+     * @param vertices       Vertices in the components of the group, before pruning.
+     * @param largestPruned  Vertices in the largest component that was pruned, or 0 if none.
+     * @param smallestKept   Vertices in the smallest component that was kept, or
+     *                       the maximum value if none.
+     */
+    void addGroup(const std::vector<ChunkId> &group,
+                  std::tr1::uint64_t vertices,
+                  std::tr1::uint64_t largestPruned,
+                  std::tr1::uint64_t smallestKept);
+
+    /**
+     * Copy the groups of @a old that do not contain any of @a chunks. This is
+     * used to carry forward the chunks that were not regenerated.
+     */
+    void keepGroups(const IncrementalState &old, const std::set<chunk_coords> &chunks);
+
+    /// All chunks recorded by @ref addGroup or @ref keepGroups
+    std::vector<chunk_coords> getChunks() const;
+
+    /**
+     * Total number of vertices, before pruning, in the groups that do not
+     * contain any of @a chunks. These are the groups carried forward by
+     * @ref keepGroups, and they count towards the prune threshold of a run
+     * that only regenerates @a chunks.
+     */
+    std::tr1::uint64_t keptVertices(const std::set<chunk_coords> &chunks) const;
+
+    /**
+     * Find the groups that do not contain any of @a chunks, but whose output
+     * would change if they were pruned with a threshold of @a thresholdVertices
+     * instead of the threshold of the run that recorded them. Their chunks are
+     * added to @a chunks.
+     *
+     * @return Whether any chunks were added.
+     */
+    bool addPruneChanges(std::tr1::uint64_t thresholdVertices, std::set<chunk_coords> &chunks) const;
+
+    /**
+     * Determine the chunks that must be regenerated to bring the output of
+     * the run recorded in @a old up to date with this state. This comprises
+     * every chunk touched by a file that was added, removed or modified,
+     * together with all chunks in the same group as any of those.
+     *
+     * @param old          The state of the previous run.
+     * @param[out] chunks  The chunks to regenerate.
+     * @param[out] changedFiles The number of files added, removed or modified.
+     * @return @c false if the layouts differ, in which case all chunks must be
+     * regenerated and @a chunks is left empty.
+     */
+    bool changedChunks(const IncrementalState &old, std::set<chunk_coords> &chunks,
+                       std::size_t &changedFiles) const;
+
+private:
+    /// Information about one input file
+    struct Entry
+    {
+        std::tr1::uint64_t size;   ///< File size when recorded
+        std::time_t mtime;         ///< Modification time when recorded
+        bool hasBox;               ///< Whether @ref box is valid
+        Box box;                   ///< Cells touched by the file
+
+        template<typename Archive>
+        void serialize(Archive &ar, const unsigned int version);
+    };
+
+    /// Chunks linked by components, as recorded by @ref addGroup
+    struct Group
+    {
+        std::vector<chunk_coords> chunks;
+        std::tr1::uint64_t vertices;
+        std::tr1::uint64_t largestPruned;
+        std::tr1::uint64_t smallestKept;
+
+        /// Whether any chunk of the group is in @a chunks
+        bool touches(const std::set<chunk_coords> &chunks) const;
+    };
+
+    Layout layout;
+    std::map<std::string, Entry> files;             ///< Input files keyed by absolute path
+    std::vector<Group> groups;                      ///< Chunks linked by components
+
+    /// Add the chunks that overlap @a box to @a chunks.
+    void addTouched(const Box &box, std::set<chunk_coords> &chunks) const;
+};
+
+#endif /* !INCREMENTAL_H */
@@ -0,0 +1,141 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistent cache of input file headers.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <map>
+#include <ctime>
+#include <exception>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/map.hpp>
+#include "tr1_cstdint.h"
+#include "input_manifest.h"
+#include "logging.h"
+
+/// Identifies the format of the manifest file
+static const char * const manifestMagic = "mlsgpu-input-manifest-1";
+
+InputManifest::InputManifest(const boost::filesystem::path &path)
+    : path(path), dirty(false), hits(0)
+{
+    boost::filesystem::ifstream in(path);
+    if (!in)
+        return;
+
+    try
+    {
+        boost::archive::text_iarchive archive(in);
+        std::string magic;
+        archive >> magic;
+        if (magic != manifestMagic)
+        {
+            Log::log[Log::warn] << "Ignoring input manifest " << path.string() << " with unknown format\n";
+            return;
+        }
+        archive >> entries;
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Ignoring invalid input manifest " << path.string() << ": " << e.what() << '\n';
+        entries.clear();
+    }
+}
+
+bool InputManifest::stamp(const boost::filesystem::path &file, std::tr1::uint64_t &size, std::time_t &mtime)
+{
+    boost::system::error_code ec;
+    size = boost::filesystem::file_size(file, ec);
+    if (ec)
+        return false;
+    mtime = boost::filesystem::last_write_time(file, ec);
+    return !ec;
+}
+
+bool InputManifest::lookup(const boost::filesystem::path &file, FastPly::Reader::Layout &layout) const
+{
+    const std::string key = boost::filesystem::absolute(file).string();
+    std::tr1::uint64_t size;
+    std::time_t mtime;
+    if (!stamp(file, size, mtime))
+        return false;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::map<std::string, Entry>::const_iterator pos = entries.find(key);
+    if (pos == entries.end() || pos->second.size != size || pos->second.mtime != mtime)
+        return false;
+    layout = pos->second.layout;
+    hits++;
+    return true;
+}
+
+void InputManifest::record(const boost::filesystem::path &file, const FastPly::Reader::Layout &layout)
+{
+    const std::string key = boost::filesystem::absolute(file).string();
+    Entry entry;
+    if (!stamp(file, entry.size, entry.mtime))
+        return;
+    entry.layout = layout;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    entries[key] = entry;
+    dirty = true;
+}
+
+void InputManifest::save()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!dirty)
+        return;
+
+    // The random suffix prevents concurrent runs from clobbering each other's temporaries
+    const boost::filesystem::path tmpPath = path.string() + boost::filesystem::unique_path(".%%%%-%%%%.tmp").string();
+    try
+    {
+        {
+            boost::filesystem::ofstream out(tmpPath);
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            boost::archive::text_oarchive archive(out);
+            const std::string magic = manifestMagic;
+            archive << magic << entries;
+        }
+        boost::filesystem::rename(tmpPath, path);
+        dirty = false;
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Could not write input manifest " << path.string() << ": " << e.what() << '\n';
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmpPath, ec);
+    }
+}
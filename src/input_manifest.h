@@ -0,0 +1,114 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistent cache of input file headers.
+ */
+
+#ifndef INPUT_MANIFEST_H
+#define INPUT_MANIFEST_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <string>
+#include <map>
+#include <ctime>
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "fast_ply.h"
+
+/**
+ * Cache of the layouts of input files, stored in a single file so that a
+ * later run can construct its readers without opening each input. An entry
+ * is only used if the size and modification time of the file still match.
+ *
+ * Problems reading or writing the manifest are reported as warnings and
+ * otherwise ignored, since it can always be regenerated.
+ *
+ * The @ref lookup and @ref record functions may be called concurrently.
+ */
+class InputManifest : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. The manifest is loaded from @a path if it exists.
+     */
+    explicit InputManifest(const boost::filesystem::path &path);
+
+    /**
+     * Retrieve the layout of a file, if it is known and the file has not
+     * changed since it was recorded.
+     *
+     * @param file         Input file (relative paths are made absolute).
+     * @param[out] layout  The layout, if found.
+     * @return Whether an entry was found.
+     */
+    bool lookup(const boost::filesystem::path &file, FastPly::Reader::Layout &layout) const;
+
+    /**
+     * Add or replace the entry for a file, stamped with its current size and
+     * modification time.
+     */
+    void record(const boost::filesystem::path &file, const FastPly::Reader::Layout &layout);
+
+    /**
+     * Write the manifest back to its file if any entries were recorded. The
+     * file is replaced atomically so that concurrent runs see either the old
+     * or the new version.
+     */
+    void save();
+
+    /// Number of successful calls to @ref lookup
+    std::size_t numHits() const { return hits; }
+
+    /**
+     * Get the size and modification time of a file.
+     * @return Whether the file could be examined.
+     */
+    static bool stamp(const boost::filesystem::path &file, std::tr1::uint64_t &size, std::time_t &mtime);
+
+private:
+    struct Entry
+    {
+        std::tr1::uint64_t size;           ///< File size when recorded
+        std::time_t mtime;                 ///< Modification time when recorded
+        FastPly::Reader::Layout layout;
+
+        template<typename Archive>
+        void serialize(Archive &ar, const unsigned int version)
+        {
+            (void) version;
+            ar & size & mtime & layout.header & layout.compressed;
+        }
+    };
+
+    const boost::filesystem::path path;    ///< Location of the manifest
+    std::map<std::string, Entry> entries;  ///< Entries keyed by absolute path
+    bool dirty;                            ///< Whether @ref record has been called
+    mutable std::size_t hits;              ///< Backing store for @ref numHits
+    mutable boost::mutex mutex;            ///< Protects the other mutable members
+};
+
+#endif /* !INPUT_MANIFEST_H */
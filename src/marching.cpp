@@ -350,6 +350,7 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     overflowStat(Statistics::getStatistic<Statistics::Counter>("marching.overflow")),
     nonemptyStat(Statistics::getStatistic<Statistics::Variable>("marching.slices.nonempty")),
     shipoutsStat(Statistics::getStatistic<Statistics::Variable>("marching.shipouts")),
+    swatheStat(Statistics::getStatistic<Statistics::Variable>("marching.swathe")),
     scanUint(context, device, clogs::TYPE_UINT),
     scanElements(context, device, clogs::Type(clogs::TYPE_UINT, 2)),
     sortVertices(context, device, clogs::TYPE_ULONG, clogs::Type(clogs::TYPE_FLOAT, 4)),
@@ -365,6 +366,12 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     Grid::size_type imageWidth = roundUp(maxWidth, alignment[0]);
     Grid::size_type imageHeight = roundUp(maxHeight, alignment[1]);
     this->maxSwathe = std::min(maxSwathe, maxDepth) / alignment[2] * alignment[2];
+    zAlign = alignment[2];
+    for (int i = 0; i < 2; i++)
+    {
+        sliceDensity[i] = 0.0;
+        peakDensity[i] = 0.0;
+    }
 
     scanUint.setEventCallback(
         &Statistics::timeEventCallback,
@@ -442,6 +449,19 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
 
     reindexKernel.setArg(0, indices);
     reindexKernel.setArg(1, indexRemap);
+
+    cl_uint3 noSlot[2] = { {{ CL_UINT_MAX, CL_UINT_MAX, CL_UINT_MAX }}, {{ 0, 0, 0 }} };
+    noSlots = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(noSlot), noSlot);
+    const cl_uint3 dims = {{ 1, 1, 1 }};
+    setSlotArgs(noSlots, 32, dims);
+}
+
+void Marching::setSlotArgs(const cl::Buffer &slotTable, cl_uint slotShift, const cl_uint3 &slotDims)
+{
+    generateElementsKernel.setArg(14, slotTable);
+    generateElementsKernel.setArg(15, slotShift);
+    generateElementsKernel.setArg(16, slotDims);
+    compactVerticesKernel.setArg(9, cl_uint(slotShift < 32));
 }
 
 void Marching::copySlice(
@@ -645,9 +665,15 @@ Grid::size_type Marching::addSlices(
     {
         // Reduce the per-slice histogam
         cl_uint2 counts = {{ 0, 0 }};
+        const double sliceCells = double(swathe.width - 1) * (swathe.height - 1);
         for (Grid::size_type i = swathe.zFirst; i < swathe.zLast; i++)
             for (int j = 0; j < 2; j++)
+            {
                 counts.s[j] += viReadback[i].s[j];
+                // A slice one vertex wide has no cells, and hence no geometry
+                if (sliceCells > 0.0)
+                    peakDensity[j] = std::max(peakDensity[j], viReadback[i].s[j] / sliceCells);
+            }
 
         if (counts.s[0] > vertexSpace
             || counts.s[1] > indexSpace)
@@ -742,6 +768,23 @@ Grid::size_type Marching::addSlices(
     return shipOuts;
 }
 
+const double Marching::DENSITY_DECAY = 0.75;
+
+Grid::size_type Marching::swatheDepth(Grid::size_type width, Grid::size_type height) const
+{
+    const double sliceCells = double(width - 1) * (height - 1);
+    const std::size_t space[2] = { vertexSpace, indexSpace };
+    Grid::size_type depth = maxSwathe;
+    for (int i = 0; i < 2; i++)
+    {
+        double perSlice = sliceDensity[i] * sliceCells;
+        if (perSlice > 0.0 && perSlice * depth > space[i])
+            depth = Grid::size_type(space[i] / perSlice);
+    }
+    depth = depth / zAlign * zAlign;
+    return std::max(depth, zAlign);
+}
+
 void Marching::generate(
     const cl::CommandQueue &queue,
     Generator &generator,
@@ -749,6 +792,76 @@ void Marching::generate(
     const Grid::size_type size[3],
     const cl_uint3 &keyOffset,
     const std::vector<cl::Event> *events)
+{
+    const cl_uint3 dims = {{ 1, 1, 1 }};
+    setSlotArgs(noSlots, 32, dims);
+    generateVolume(queue, generator, output, size, keyOffset, events);
+}
+
+void Marching::generate(
+    const cl::CommandQueue &queue,
+    Generator &generator,
+    const OutputFunctor &output,
+    const Grid::size_type size[3],
+    const Slots &slots,
+    const std::vector<cl::Event> *events)
+{
+    MLSGPU_ASSERT(slots.shift < 32, std::invalid_argument);
+    const Grid::size_type side = Grid::size_type(1) << slots.shift;
+    std::size_t numSlots = 1;
+    cl_uint3 dims;
+    for (int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(slots.dims[i] * side >= size[i], std::invalid_argument);
+        numSlots *= slots.dims[i];
+        dims.s[i] = slots.dims[i];
+    }
+    MLSGPU_ASSERT(slots.vertices.size() == numSlots, std::invalid_argument);
+    MLSGPU_ASSERT(slots.offsets.size() == numSlots, std::invalid_argument);
+
+    /* Each slot has two entries in the table: the upper corner of its region
+     * relative to the slot, and the offset to apply to its cells.
+     */
+    std::vector<cl_uint3> table(2 * numSlots);
+    for (std::size_t i = 0; i < numSlots; i++)
+    {
+        Grid::size_type base[3] =
+        {
+            i % slots.dims[0] * side,
+            i / slots.dims[0] % slots.dims[1] * side,
+            i / slots.dims[0] / slots.dims[1] * side
+        };
+        bool empty = false;
+        for (int j = 0; j < 3; j++)
+        {
+            MLSGPU_ASSERT(slots.vertices[i].s[j] < side, std::invalid_argument);
+            if (slots.vertices[i].s[j] == 0)
+                empty = true;
+        }
+        for (int j = 0; j < 3; j++)
+        {
+            // Empty slots produce no cells, so the top is never compared
+            table[2 * i].s[j] = empty ? CL_UINT_MAX : 2 * (slots.vertices[i].s[j] - 1);
+            // Wraps around if the region is offset below the slot
+            table[2 * i + 1].s[j] = slots.offsets[i].s[j] - cl_uint(base[j]);
+        }
+    }
+
+    const cl::Context context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    cl::Buffer slotTable(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         table.size() * sizeof(cl_uint3), &table[0]);
+    const cl_uint3 keyOffset = {{ 0, 0, 0 }};
+    setSlotArgs(slotTable, slots.shift, dims);
+    generateVolume(queue, generator, output, size, keyOffset, events);
+}
+
+void Marching::generateVolume(
+    const cl::CommandQueue &queue,
+    Generator &generator,
+    const OutputFunctor &output,
+    const Grid::size_type size[3],
+    const cl_uint3 &keyOffset,
+    const std::vector<cl::Event> *events)
 {
     std::size_t localSize = queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
     // Work group size for kernels that operate on compacted cells.
@@ -779,18 +892,22 @@ void Marching::generate(
     generateElementsKernel.setArg(11, keyOffset);
     generateElementsKernel.setArg(13, CLH_LOCAL(NUM_EDGES * wgsCompacted * sizeof(cl_float3)));
 
+    const Grid::size_type swatheSlices = swatheDepth(swathe.width, swathe.height);
+    swatheStat.add(swatheSlices);
+    peakDensity[0] = peakDensity[1] = 0.0;
+
     Grid::size_type shipOuts = 0;
-    for (Grid::size_type z = 0; z < depth; z += maxSwathe)
+    for (Grid::size_type z = 0; z < depth; z += swatheSlices)
     {
         swathe.zFirst = z;
-        swathe.zLast = std::min(depth, z + maxSwathe) - 1;
+        swathe.zLast = std::min(depth, z + swatheSlices) - 1;
         swathe.zBias = (1 - cl_int(z)) * cl_int(swathe.zStride);
         generateElementsKernel.setArg(10, swathe.zBias);
 
         if (z != 0)
         {
             // Copy end of previous range to start of current one
-            copySlice(queue, image, maxSwathe, 0, swathe, &wait, &last);
+            copySlice(queue, image, swatheSlices, 0, swathe, &wait, &last);
             wait.resize(1);
             wait[0] = last;
         }
@@ -820,5 +937,7 @@ void Marching::generate(
     }
     if (shipOuts > 0)
         shipoutsStat.add(shipOuts);
+    for (int i = 0; i < 2; i++)
+        sliceDensity[i] = std::max(peakDensity[i], sliceDensity[i] * DENSITY_DECAY);
     queue.finish(); // will normally be finished already, but there may be corner cases
 }
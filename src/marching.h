@@ -197,6 +197,39 @@ public:
         Grid::size_type zLast;
     };
 
+    /**
+     * Layout of a volume that is packed with independent regions, for the
+     * second form of @ref generate. The volume is divided into a lattice of
+     * @em slots, each 2<sup>@a shift</sup> cells on a side, and each region
+     * starts at the lower corner of its slot.
+     */
+    struct Slots
+    {
+        unsigned int shift;               ///< Log base 2 of the side length of a slot
+        Grid::size_type dims[3];          ///< Number of slots along each axis
+
+        /**
+         * Number of vertices of the region in each slot along each axis, or
+         * zero for a slot without a region. Slot (x, y, z) is at index
+         * x + dims[0] * (y + dims[1] * z). Each count must be less than the
+         * side length of a slot, so that there is a gap between regions.
+         */
+        std::vector<cl_uint3> vertices;
+
+        /**
+         * Offset of the region in each slot, used in place of the @a keyOffset
+         * of the first form of @ref generate to position its vertices.
+         * Indexed in the same way as @ref vertices.
+         */
+        std::vector<cl_uint3> offsets;
+
+        /// Index in @ref vertices of the slot with lower corner @a origin
+        std::size_t index(const Grid::size_type origin[3]) const
+        {
+            return (origin[0] >> shift) + dims[0] * ((origin[1] >> shift) + dims[1] * (origin[2] >> shift));
+        }
+    };
+
     /**
      * An interface for classes that supply the signed distance function
      * for @ref Marching.
@@ -286,10 +319,28 @@ private:
     Grid::size_type maxWidth, maxHeight, maxDepth;
 
     /**
-     * The number of slices to process in one go.
+     * The largest number of slices to process in one go.
      */
     Grid::size_type maxSwathe;
 
+    /**
+     * Granularity of swathe sizes, from the Z alignment passed to the constructor.
+     */
+    Grid::size_type zAlign;
+
+    /**
+     * Predicted vertices (element 0) and indices (element 1) per cell of a
+     * slice. It is the densest slice seen in the last bin, or a decayed
+     * version of the previous prediction if that is larger. It is used by
+     * @ref swatheDepth to keep swathes from overflowing the mesh buffers.
+     */
+    double sliceDensity[2];
+
+    /**
+     * Densest slice seen during the current call to @ref generate (see @ref sliceDensity).
+     */
+    double peakDensity[2];
+
     /**
      * Space allocated to hold intermediate vertices and indices.
      */
@@ -403,6 +454,13 @@ private:
      */
     cl::Buffer firstExternal;
 
+    /**
+     * Buffer of @c cl_uint3 values with a single slot table entry, which is
+     * passed to @ref generateElementsKernel in place of the slot table when
+     * the volume is not divided into slots.
+     */
+    cl::Buffer noSlots;
+
     /**
      * The image holding slices of the signed distance function.
      */
@@ -447,6 +505,7 @@ private:
     Statistics::Counter &overflowStat;      ///< Number of swathe splits
     Statistics::Variable &nonemptyStat;     ///< Number of @ref addSlices calls that add geometry
     Statistics::Variable &shipoutsStat;     ///< Number of calls to @ref shipOut per bin
+    Statistics::Variable &swatheStat;       ///< Number of slices per swathe chosen for each bin
 
     clogs::Scan scanUint;                   ///< Scanner to scan @c cl_uint values.
     clogs::Scan scanElements;               ///< Scanner to scan @ref viCount.
@@ -607,7 +666,73 @@ public:
                   const cl_uint3 &keyOffset,
                   const std::vector<cl::Event> *events = NULL);
 
+    /**
+     * Generate an isosurface for a volume packed with independent regions
+     * (see @ref Slots). This is equivalent to generating each region on its
+     * own with a @a keyOffset taken from @ref Slots::offsets, except that the
+     * meshes of all the regions are passed to @a output together, and that
+     * keys are not offset. Vertices on the boundary of a region are external,
+     * even if they are inside the volume. Keys are also written for internal
+     * vertices, so that the caller can recover the slot of any vertex from
+     * its key.
+     *
+     * @param queue          Command queue to enqueue the work to.
+     * @param generator      Generates the function (see @ref Generator).
+     * @param output         Functor to receive chunks of output (see @ref OutputFunctor).
+     * @param size           Number of vertices in each dimension to process.
+     * @param slots          Layout of the regions in the volume.
+     * @param events         Previous events to wait for (can be @c NULL).
+     *
+     * @pre
+     * - The preconditions of the other form of @ref generate hold.
+     * - @a slots covers @a size.
+     * - The generator gives non-finite values to the vertices of each slot
+     *   that lie outside its region, so that no cell spans two regions.
+     */
+    void generate(const cl::CommandQueue &queue,
+                  Generator &generator,
+                  const OutputFunctor &output,
+                  const Grid::size_type size[3],
+                  const Slots &slots,
+                  const std::vector<cl::Event> *events = NULL);
+
 private:
+    /**
+     * Factor by which @ref sliceDensity decays towards the density of the
+     * current bin after each bin.
+     */
+    static const double DENSITY_DECAY;
+
+    /**
+     * Pass a slot table (see @ref generateElements) to @ref
+     * generateElementsKernel, and have @ref compactVerticesKernel write keys
+     * for internal vertices if there are slots.
+     */
+    void setSlotArgs(const cl::Buffer &slotTable, cl_uint slotShift, const cl_uint3 &slotDims);
+
+    /**
+     * Implementation of both forms of @ref generate, once the slot layout
+     * has been passed to @ref generateElementsKernel.
+     */
+    void generateVolume(const cl::CommandQueue &queue,
+                        Generator &generator,
+                        const OutputFunctor &output,
+                        const Grid::size_type size[3],
+                        const cl_uint3 &keyOffset,
+                        const std::vector<cl::Event> *events);
+
+    /**
+     * Choose the number of slices to process in one go for a bin, so that
+     * the predicted geometry of a swathe fits in the mesh buffers. This
+     * avoids generating cells for a swathe only to split it when it
+     * overflows. The result is a multiple of @ref zAlign between
+     * @ref zAlign and @ref maxSwathe.
+     *
+     * @param width, height  Number of vertices in each slice of the bin. If either
+     *                       is 1, the slices have no cells and @ref maxSwathe is returned.
+     */
+    Grid::size_type swatheDepth(Grid::size_type width, Grid::size_type height) const;
+
     /**
      * Copy one slice of the image to another.
      *
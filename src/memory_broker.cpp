@@ -0,0 +1,233 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Runtime rebalancing of host memory between pipeline buffers.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "memory_broker.h"
+#include "circular_buffer.h"
+#include "statistics.h"
+#include "thread_name.h"
+#include "timer.h"
+#include "logging.h"
+#include "errors.h"
+
+const double MemoryBroker::HIGH_WAIT = 0.05;
+const double MemoryBroker::LOW_WAIT = 0.01;
+
+MemoryBroker::MemoryBroker(std::size_t budget)
+    : budget(budget), lent(0),
+    rebalanceStat(Statistics::getStatistic<Statistics::Variable>("broker.rebalance")),
+    stopping(false)
+{
+}
+
+MemoryBroker::~MemoryBroker()
+{
+    stop();
+}
+
+void MemoryBroker::add(
+    const std::string &name, CircularBufferBase &buffer,
+    std::size_t elementSize, std::size_t minimum,
+    Statistics::Variable &waitStat)
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    MLSGPU_ASSERT(elementSize > 0, std::invalid_argument);
+    MLSGPU_ASSERT(minimum > 0 && minimum <= buffer.size(), std::invalid_argument);
+    MLSGPU_ASSERT(buffer.size() <= (budget - lent) / elementSize, std::length_error);
+
+    Entry entry;
+    entry.name = name;
+    entry.buffer = &buffer;
+    entry.elementSize = elementSize;
+    entry.minimum = minimum;
+    entry.elements = buffer.size();
+    entry.waitStat = &waitStat;
+    entry.lastWait = waitStat.getSum();
+    entry.cooldown = 0;
+    entries.push_back(entry);
+    lent += entry.elements * elementSize;
+}
+
+void MemoryBroker::applyGrowth()
+{
+    // Bytes occupied at the actual sizes, which lag behind deferred shrinks
+    std::size_t used = 0;
+    for (std::size_t i = 0; i < entries.size(); i++)
+        used += entries[i].buffer->size() * entries[i].elementSize;
+
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        Entry &e = entries[i];
+        const std::size_t size = e.buffer->size();
+        if (size < e.elements && used < budget)
+        {
+            const std::size_t newSize = std::min(e.elements, size + (budget - used) / e.elementSize);
+            if (newSize > size)
+            {
+                e.buffer->resize(newSize);
+                used += (newSize - size) * e.elementSize;
+            }
+        }
+    }
+}
+
+void MemoryBroker::rebalance(double elapsed)
+{
+    applyGrowth();
+    if (!(elapsed > 0.0))
+        return;
+
+    std::vector<double> load(entries.size());
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        Entry &e = entries[i];
+        const double wait = e.waitStat->getSum();
+        load[i] = (wait - e.lastWait) / elapsed;
+        e.lastWait = wait;
+        if (e.cooldown > 0)
+            e.cooldown--;
+    }
+
+    // Find the buffer that spent the most time waiting
+    std::size_t hungry = entries.size();
+    for (std::size_t i = 0; i < entries.size(); i++)
+    {
+        const Entry &e = entries[i];
+        if (e.cooldown == 0 && load[i] > HIGH_WAIT
+            && e.elements < e.buffer->capacity()
+            && (hungry == entries.size() || load[i] > load[hungry]))
+            hungry = i;
+    }
+    if (hungry == entries.size())
+        return;
+    Entry &h = entries[hungry];
+
+    // Take from the unlent budget if possible, otherwise from the idlest buffer
+    std::size_t bytes = budget / STEP_DIVISOR;
+    std::size_t donor = entries.size();
+    if (lent < budget)
+        bytes = std::min(bytes, budget - lent);
+    else
+    {
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            const Entry &e = entries[i];
+            if (i != hungry && e.cooldown == 0 && load[i] < LOW_WAIT
+                && e.elements > e.minimum
+                && (donor == entries.size() || load[i] < load[donor]))
+                donor = i;
+        }
+        if (donor == entries.size())
+            return;
+        const Entry &d = entries[donor];
+        bytes = std::min(bytes, (d.elements - d.minimum) * d.elementSize);
+    }
+    bytes = std::min(bytes, (h.buffer->capacity() - h.elements) * h.elementSize);
+
+    std::size_t shrink = 0;
+    if (donor != entries.size())
+    {
+        Entry &d = entries[donor];
+        shrink = bytes / d.elementSize;
+        bytes = shrink * d.elementSize;
+    }
+    const std::size_t grow = bytes / h.elementSize;
+    if (grow == 0)
+        return;
+
+    if (donor != entries.size())
+    {
+        Entry &d = entries[donor];
+        d.elements -= shrink;
+        // If some of its own growth is still pending, that is simply cancelled
+        d.buffer->resize(std::min(d.elements, d.buffer->size()));
+        d.cooldown = COOLDOWN;
+        lent -= shrink * d.elementSize;
+        Log::log[Log::debug] << "Moved " << bytes << " bytes from " << d.name << " to " << h.name << '\n';
+    }
+    else
+        Log::log[Log::debug] << "Lent " << bytes << " bytes to " << h.name << '\n';
+    h.elements += grow;
+    applyGrowth();
+    h.cooldown = COOLDOWN;
+    lent += grow * h.elementSize;
+    rebalanceStat.add(grow * h.elementSize);
+}
+
+void MemoryBroker::start(double interval)
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    MLSGPU_ASSERT(interval > 0.0, std::invalid_argument);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = false;
+    }
+    thread.reset(new boost::thread(boost::bind(&MemoryBroker::run, this, interval)));
+}
+
+void MemoryBroker::stop()
+{
+    if (thread)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stopping = true;
+        }
+        stopCondition.notify_all();
+        thread->join();
+        thread.reset();
+    }
+}
+
+void MemoryBroker::run(double interval)
+{
+    thread_set_name("broker");
+    const boost::posix_time::time_duration sleepTime =
+        boost::posix_time::microseconds((long) (interval * 1e6));
+
+    Timer::timestamp last = Timer::currentTime();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        stopCondition.timed_wait(lock, sleepTime);
+        if (stopping)
+            break;
+        const Timer::timestamp now = Timer::currentTime();
+        rebalance(Timer::getElapsed(last, now));
+        last = now;
+    }
+}
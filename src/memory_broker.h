@@ -0,0 +1,160 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Runtime rebalancing of host memory between pipeline buffers.
+ */
+
+#ifndef MEMORY_BROKER_H
+#define MEMORY_BROKER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "circular_buffer.h"
+#include "statistics.h"
+
+class TestMemoryBroker;
+
+/**
+ * Owns a single memory budget and lends it out to a set of @ref
+ * CircularBufferBase objects. Each buffer is paired with the statistic
+ * that records time spent waiting in its @c allocate (the @c *.get
+ * statistic of the owning worker group). Periodically, the buffer that
+ * spent the most time waiting is grown at the expense of the buffer that
+ * spent the least, or from any part of the budget not yet lent out.
+ *
+ * To avoid oscillation, a buffer must wait for more than @ref HIGH_WAIT of
+ * the interval to borrow and less than @ref LOW_WAIT to lend, and a buffer
+ * whose size has just changed is left alone for @ref COOLDOWN intervals.
+ *
+ * Shrinking a buffer may be deferred until its live allocations allow it
+ * (see @ref CircularBufferBase::resize). The buffer that borrowed the memory
+ * is only grown once the shrink has happened, so the sizes never sum to more
+ * than the budget and the buffers may share a @ref CircularBufferArena.
+ */
+class MemoryBroker : public boost::noncopyable
+{
+    friend class TestMemoryBroker;
+public:
+    /// Minimum fraction of an interval spent waiting to borrow memory
+    static const double HIGH_WAIT;
+    /// Maximum fraction of an interval spent waiting to lend memory
+    static const double LOW_WAIT;
+    /// Number of intervals a buffer is left alone after it is resized
+    static const unsigned int COOLDOWN = 3;
+    /// Fraction of the budget moved in one step
+    static const unsigned int STEP_DIVISOR = 16;
+
+    /**
+     * Constructor.
+     *
+     * @param budget     Total bytes that may be lent to the buffers.
+     */
+    explicit MemoryBroker(std::size_t budget);
+
+    /// Destructor. Stops the background thread if it is running.
+    ~MemoryBroker();
+
+    /**
+     * Place a buffer under management. Its current size counts against the
+     * budget.
+     *
+     * @param name          Name used in log messages.
+     * @param buffer        Buffer to resize.
+     * @param elementSize   Bytes per element of @a buffer.
+     * @param minimum       Smallest number of elements @a buffer may be given.
+     * @param waitStat      Statistic recording time spent waiting in @a buffer's @c allocate.
+     *
+     * @pre The background thread is not running, and the budget has room for
+     * the current size of @a buffer.
+     */
+    void add(const std::string &name, CircularBufferBase &buffer,
+             std::size_t elementSize, std::size_t minimum,
+             Statistics::Variable &waitStat);
+
+    /**
+     * Examine the waiting time since the last call and move memory between
+     * buffers if warranted. This is called by the background thread, but is
+     * also public for testing.
+     *
+     * @param elapsed      Seconds since the previous call.
+     */
+    void rebalance(double elapsed);
+
+    /**
+     * Start a background thread that calls @ref rebalance periodically.
+     *
+     * @param interval     Seconds between calls.
+     */
+    void start(double interval);
+
+    /// Stop the background thread started by @ref start.
+    void stop();
+
+private:
+    /// A managed buffer
+    struct Entry
+    {
+        std::string name;
+        CircularBufferBase *buffer;
+        std::size_t elementSize;
+        std::size_t minimum;           ///< Minimum elements
+        std::size_t elements;          ///< Elements currently lent, which the buffer may not have been given yet
+        Statistics::Variable *waitStat;
+        double lastWait;               ///< Value of the sum of @ref waitStat at the last rebalance
+        unsigned int cooldown;         ///< Intervals before it may be resized again
+    };
+
+    std::size_t budget;                ///< Total bytes to lend
+    std::size_t lent;                  ///< Bytes currently lent
+    std::vector<Entry> entries;
+
+    /// Bytes moved in each rebalancing decision
+    Statistics::Variable &rebalanceStat;
+
+    boost::scoped_ptr<boost::thread> thread;
+    boost::mutex mutex;                ///< Protects @ref stopping
+    boost::condition_variable stopCondition;
+    bool stopping;
+
+    /**
+     * Grow buffers towards the number of elements lent to them, as far as
+     * the actual sizes of the others allow. This catches up once a deferred
+     * shrink of the lender has happened.
+     */
+    void applyGrowth();
+
+    /// Background thread function
+    void run(double interval);
+};
+
+#endif /* !MEMORY_BROKER_H */
@@ -34,7 +34,9 @@
 
 #include <CL/cl.hpp>
 #include <vector>
+#include <map>
 #include <algorithm>
+#include <cassert>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
 #include "mesh_filter.h"
@@ -65,6 +67,128 @@ void MeshFilterChain::operator()(
     output(queue, *inMesh, events, event);
 }
 
+void MeshSlotRouter::reset(unsigned int slotShift)
+{
+    MLSGPU_ASSERT(slotShift < Marching::KEY_AXIS_BITS, std::invalid_argument);
+    this->slotShift = slotShift;
+    slots.clear();
+    slotIndex.clear();
+}
+
+void MeshSlotRouter::addSlot(
+    const Grid::size_type origin[3], const cl_uint3 &keyOffset,
+    const Marching::OutputFunctor &output)
+{
+    Slot slot;
+    cl_ulong coords = 0;
+    slot.keyDelta = 0;
+    slot.output = output;
+    for (int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(origin[i] % (Grid::size_type(1) << slotShift) == 0, std::invalid_argument);
+        const unsigned int shift = i * Marching::KEY_AXIS_BITS;
+        coords |= cl_ulong(origin[i] >> slotShift) << shift;
+        // Arithmetic is modulo 2^64, so a region below its slot works too
+        slot.keyDelta += (cl_ulong(keyOffset.s[i]) << (shift + 1)) - (cl_ulong(origin[i]) << (shift + 1));
+    }
+    bool added = slotIndex.insert(std::make_pair(coords, slots.size())).second;
+    MLSGPU_ASSERT(added, std::invalid_argument);
+    slots.push_back(slot);
+}
+
+std::size_t MeshSlotRouter::findSlot(cl_ulong key) const
+{
+    const cl_ulong mask = (cl_ulong(1) << Marching::KEY_AXIS_BITS) - 1;
+    cl_ulong coords = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const unsigned int shift = i * Marching::KEY_AXIS_BITS;
+        // Keys are in .1 fixed point, and a vertex belongs to the cell below it
+        const cl_ulong c = ((key >> shift) & mask) >> 1;
+        coords |= (c >> slotShift) << shift;
+    }
+    std::map<cl_ulong, std::size_t>::const_iterator pos = slotIndex.find(coords);
+    MLSGPU_ASSERT(pos != slotIndex.end(), std::invalid_argument);
+    return pos->second;
+}
+
+void MeshSlotRouter::operator()(
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &mesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event) const
+{
+    const std::size_t numVertices = mesh.numVertices();
+    const std::size_t numTriangles = mesh.numTriangles();
+    std::vector<cl_ulong> keys(numVertices);
+    std::vector<cl_float> vertices(3 * numVertices);
+    std::vector<cl_uint> triangles(3 * numTriangles);
+    if (numVertices > 0)
+    {
+        CLH::enqueueReadBuffer(queue, mesh.vertexKeys, CL_FALSE, 0, numVertices * sizeof(cl_ulong),
+                               &keys[0], events, NULL);
+        CLH::enqueueReadBuffer(queue, mesh.vertices, CL_FALSE, 0, numVertices * (3 * sizeof(cl_float)),
+                               &vertices[0], events, NULL);
+    }
+    if (numTriangles > 0)
+        CLH::enqueueReadBuffer(queue, mesh.triangles, CL_FALSE, 0, numTriangles * (3 * sizeof(cl_uint)),
+                               &triangles[0], events, NULL);
+    queue.finish();
+
+    /* Split the mesh by slot. Vertices keep their relative order, so the
+     * internal vertices of each slot remain at the front.
+     */
+    std::vector<std::vector<cl_float> > slotVertices(slots.size());
+    std::vector<std::vector<cl_ulong> > slotKeys(slots.size());
+    std::vector<std::vector<cl_uint> > slotTriangles(slots.size());
+    std::vector<std::size_t> slotInternal(slots.size(), 0);
+    std::vector<std::size_t> vertexSlot(numVertices);
+    std::vector<cl_uint> remap(numVertices);
+    for (std::size_t i = 0; i < numVertices; i++)
+    {
+        const std::size_t s = findSlot(keys[i]);
+        vertexSlot[i] = s;
+        remap[i] = slotKeys[s].size();
+        slotKeys[s].push_back(keys[i] + slots[s].keyDelta);
+        slotVertices[s].insert(slotVertices[s].end(), &vertices[3 * i], &vertices[3 * i + 3]);
+        if (i < mesh.numInternalVertices())
+            slotInternal[s]++;
+    }
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        const std::size_t s = vertexSlot[triangles[3 * i]];
+        for (int j = 0; j < 3; j++)
+        {
+            const cl_uint v = triangles[3 * i + j];
+            // A cell never spans two regions
+            assert(vertexSlot[v] == s);
+            slotTriangles[s].push_back(remap[v]);
+        }
+    }
+
+    const cl::Context context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    std::vector<cl::Event> wait;
+    for (std::size_t s = 0; s < slots.size(); s++)
+    {
+        if (slotKeys[s].empty())
+            continue;
+        const MeshSizes sizes(slotKeys[s].size(), slotTriangles[s].size() / 3, slotInternal[s]);
+        DeviceKeyMesh out(context, CL_MEM_READ_WRITE, sizes);
+        CLH::enqueueWriteBuffer(queue, out.vertices, CL_TRUE, 0, sizes.numVertices() * (3 * sizeof(cl_float)),
+                                &slotVertices[s][0]);
+        CLH::enqueueWriteBuffer(queue, out.vertexKeys, CL_TRUE, 0, sizes.numVertices() * sizeof(cl_ulong),
+                                &slotKeys[s][0]);
+        if (sizes.numTriangles() > 0)
+            CLH::enqueueWriteBuffer(queue, out.triangles, CL_TRUE, 0, sizes.numTriangles() * (3 * sizeof(cl_uint)),
+                                    &slotTriangles[s][0]);
+
+        cl::Event last;
+        slots[s].output(queue, out, NULL, &last);
+        wait.push_back(last);
+    }
+    CLH::enqueueMarkerWithWaitList(queue, wait.empty() ? NULL : &wait, event);
+}
+
 ScaleBiasFilter::ScaleBiasFilter(const cl::Context &context)
     : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.scaleBias.time"))
 {
@@ -35,6 +35,7 @@
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
 #include <vector>
+#include <map>
 #include "mesh.h"
 #include "marching.h"
 #include "statistics.h"
@@ -121,6 +122,71 @@ public:
         cl::Event *event) const;
 };
 
+/**
+ * Output functor that splits a mesh produced by the slot form of @ref
+ * Marching::generate into the meshes of the individual regions, and passes
+ * each one to the output functor for its slot. Vertices are assigned to slots
+ * from their keys (which are written for internal vertices too in that form),
+ * and each triangle follows its vertices. Keys are offset so that they match
+ * those that would have been produced by generating the region on its own.
+ *
+ * The mesh is split on the host, so the output functors receive newly
+ * allocated meshes. This class is not reentrant.
+ */
+class MeshSlotRouter
+{
+private:
+    /// Destination for the part of the mesh in one slot
+    struct Slot
+    {
+        cl_ulong keyDelta;              ///< Value added to the keys of the slot
+        Marching::OutputFunctor output; ///< Output functor for the slot
+    };
+
+    unsigned int slotShift;             ///< See @ref Marching::Slots::shift
+    std::vector<Slot> slots;            ///< Slots passed to @ref addSlot
+    /// Index into @ref slots for each slot, by its coordinates packed in the same way as keys
+    std::map<cl_ulong, std::size_t> slotIndex;
+
+    /// Index into @ref slots for the slot holding the vertex with key @a key
+    std::size_t findSlot(cl_ulong key) const;
+
+public:
+    typedef void result_type;
+
+    MeshSlotRouter() : slotShift(0) {}
+
+    /**
+     * Remove all the slots and set the side length for new ones.
+     * @param slotShift        See @ref Marching::Slots::shift.
+     */
+    void reset(unsigned int slotShift);
+
+    /**
+     * Add a region to the routing table. The output functor is copied; use
+     * @c boost::ref if it should be held by reference.
+     *
+     * @param origin           Lower corner of the slot.
+     * @param keyOffset        The @a keyOffset that would be used to generate the region on its own.
+     * @param output           Output functor for the region.
+     *
+     * @pre @a origin is a multiple of the side length of a slot, and no other slot has the same @a origin.
+     */
+    void addSlot(const Grid::size_type origin[3], const cl_uint3 &keyOffset,
+                 const Marching::OutputFunctor &output);
+
+    /**
+     * Output functor suitable for use as @ref Marching::OutputFunctor.
+     *
+     * @pre Every vertex in @a mesh lies in a slot that has been added.
+     */
+    void operator()(
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &mesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event) const;
+};
+
 /**
  * Mesh filter that applies a scale-and-bias. This class is not reentrant i.e.
  * the @c operator() must not be called from multiple threads simultaneously.
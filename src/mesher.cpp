@@ -64,6 +64,8 @@
 #include <map>
 #include <string>
 #include <ostream>
+#include <limits>
+#include <algorithm>
 #include <iomanip>
 #include <cerrno>
 #include "mesher.h"
@@ -90,7 +92,7 @@ std::string ChunkNamer::operator()(const ChunkId &chunkId) const
     std::ostringstream nameStream;
     nameStream << baseName;
     for (unsigned int i = 0; i < 3; i++)
-        nameStream << '_' << std::setw(4) << std::setfill('0') << chunkId.coords[i];
+        nameStream << '_' << std::setw(4) << std::setfill('0') << std::internal << chunkId.coords[i];
     nameStream << ".ply";
     return nameStream.str();
 }
@@ -142,6 +144,35 @@ void OOCMesher::TmpWriterWorkerGroup::start()
     WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
 }
 
+/**
+ * Truncate an existing temporary file to @a size bytes and open it for
+ * appending.
+ */
+static void reopenTmpFile(
+    const boost::filesystem::path &path, std::tr1::uint64_t size,
+    boost::filesystem::ofstream &out)
+{
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(path, size, ec);
+    if (!ec)
+        out.open(path, std::ios::binary | std::ios::app);
+    if (ec || !out)
+    {
+        int e = ec ? ec.value() : errno;
+        throw boost::enable_error_info(std::ios::failure("Could not reopen temporary file"))
+            << boost::errinfo_file_name(path.string())
+            << boost::errinfo_errno(e);
+    }
+}
+
+void OOCMesher::TmpWriterWorkerGroup::resume(
+    std::tr1::uint64_t verticesSize, std::tr1::uint64_t trianglesSize)
+{
+    reopenTmpFile(verticesPath, verticesSize, verticesFile);
+    reopenTmpFile(trianglesPath, trianglesSize, trianglesFile);
+    WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
+}
+
 void OOCMesher::TmpWriterWorkerGroup::stopPostJoin()
 {
     verticesFile.close();
@@ -185,6 +216,11 @@ OOCMesher::OOCMesher(FastPly::Writer &writer, const Namer &namer)
     tmpNextTriangle("mem.OOCMesher::tmpNextTriangle"),
     clumps("mem.OOCMesher::clumps"),
     clumpIdMap("mem.OOCMesher::clumpIdMap"),
+    regionKeys("mem.OOCMesher::regionKeys"),
+    externalVertices(0),
+    externalVerticesPeak(0),
+    pruneBaseVertices(0),
+    restored(false),
     retainFiles(false),
     tmpWriter(reorderSlots),
     chunks("mem.OOCMesher::chunks")
@@ -277,32 +313,143 @@ void OOCMesher::updateGlobalClumps(
     }
 }
 
+cl_ulong OOCMesher::regionId(const MesherWork &work)
+{
+    // Same encoding as a vertex key for the corner
+    return (cl_ulong(work.regionLower[2]) << (2 * Marching::KEY_AXIS_BITS + 1))
+        | (cl_ulong(work.regionLower[1]) << (Marching::KEY_AXIS_BITS + 1))
+        | (cl_ulong(work.regionLower[0]) << 1);
+}
+
+std::tr1::uint8_t OOCMesher::cellMask(
+    cl_ulong key,
+    const boost::array<Grid::size_type, 3> &lower,
+    const boost::array<Grid::size_type, 3> &upper)
+{
+    /* For each axis, find which of the two neighbouring cells (indexed by 0
+     * and 1) lie within the range. The key coordinates are in .1 fixed-point,
+     * so odd values lie inside a single cell.
+     */
+    unsigned int inside[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const Grid::difference_type c = (key >> (i * Marching::KEY_AXIS_BITS))
+            & ((cl_ulong(1) << Marching::KEY_AXIS_BITS) - 1);
+        const Grid::difference_type lo = lower[i];
+        const Grid::difference_type hi = upper[i];
+        inside[i] = 0;
+        if (c & 1)
+        {
+            const Grid::difference_type cell = (c - 1) / 2;
+            if (cell >= lo && cell < hi)
+                inside[i] = 1;
+        }
+        else
+        {
+            const Grid::difference_type cell = c / 2;
+            if (cell - 1 >= lo && cell - 1 < hi)
+                inside[i] |= 1;
+            if (cell >= lo && cell < hi)
+                inside[i] |= 2;
+        }
+    }
+
+    std::tr1::uint8_t mask = 0;
+    for (unsigned int j = 0; j < 8; j++)
+        if ((inside[0] >> (j & 1) & 1)
+            && (inside[1] >> ((j >> 1) & 1) & 1)
+            && (inside[2] >> ((j >> 2) & 1) & 1))
+            mask |= 1U << j;
+    return mask;
+}
+
+std::tr1::uint8_t OOCMesher::cellMaskAll(cl_ulong key)
+{
+    std::tr1::uint8_t mask = 0xFF;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        if ((key >> (i * Marching::KEY_AXIS_BITS)) & 1)
+        {
+            // Only the 0 cell exists on this axis, so clear cells with bit i set
+            for (unsigned int j = 0; j < 8; j++)
+                if (j & (1U << i))
+                    mask &= ~(1U << j);
+        }
+    }
+    return mask;
+}
+
 void OOCMesher::updateClumpKeyMap(
     std::size_t numVertices,
     std::size_t numExternalVertices,
     const cl_ulong *keys,
-    const Statistics::Container::PODBuffer<clump_id> &clumpId)
+    const Statistics::Container::PODBuffer<clump_id> &clumpId,
+    const MesherWork &work)
 {
     const std::size_t numInternalVertices = numVertices - numExternalVertices;
+    bool tracked = false;
+    for (unsigned int i = 0; i < 3; i++)
+        if (work.regionLower[i] < work.regionUpper[i])
+            tracked = true;
+    std::vector<cl_ulong> *retire = NULL;
+    if (tracked && numExternalVertices > 0)
+    {
+        retire = &regionKeys[regionId(work)];
+    }
 
     for (std::size_t i = 0; i < numExternalVertices; i++)
     {
         cl_ulong key = keys[i];
         clump_id cid = clumpId[i + numInternalVertices];
 
-        std::pair<Statistics::Container::unordered_map<cl_ulong, clump_id>::const_iterator, bool> added;
-        added = clumpIdMap.insert(std::make_pair(key, cid));
+        std::pair<clump_id_map_type::iterator, bool> added;
+        added = clumpIdMap.insert(std::make_pair(key, ExternalVertex(cid)));
+        ExternalVertex &ev = added.first->second;
         if (!added.second)
         {
             // Unified two external vertices. Also need to unify their clumps.
-            clump_id cid2 = added.first->second;
+            clump_id cid2 = ev.clumpId;
             UnionFind::merge(clumps, cid, cid2);
             // They will both have counted the common vertex, so we need to
             // subtract it.
             cid = UnionFind::findRoot(clumps, cid);
             clumps[cid].vertices--;
         }
+        else
+            externalVertices++;
+
+        if (retire != NULL)
+        {
+            /* A bin may produce the same vertex more than once (if the mesh
+             * was split), in which case it will already be accounted for.
+             */
+            std::tr1::uint8_t mask = cellMask(key, work.regionLower, work.regionUpper);
+            if (mask & ~ev.covered)
+            {
+                ev.covered |= mask;
+                ev.pending++;
+                retire->push_back(key);
+            }
+        }
     }
+    externalVerticesPeak = std::max(externalVerticesPeak, std::tr1::uint64_t(clumpIdMap.size()));
+}
+
+void OOCMesher::retireRegion(const MesherWork &work)
+{
+    region_keys_type::iterator pos = regionKeys.find(regionId(work));
+    if (pos == regionKeys.end())
+        return; // bin produced no external vertices
+
+    BOOST_FOREACH(cl_ulong key, pos->second)
+    {
+        clump_id_map_type::iterator ev = clumpIdMap.find(key);
+        assert(ev != clumpIdMap.end());
+        assert(ev->second.pending > 0);
+        if (--ev->second.pending == 0 && ev->second.covered == cellMaskAll(key))
+            clumpIdMap.erase(ev);
+    }
+    regionKeys.erase(pos);
 }
 
 void OOCMesher::flushBuffer(Timeplot::Worker &tworker)
@@ -446,6 +593,12 @@ void OOCMesher::updateLocalClumps(
 
 void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 {
+    if (work.regionDone)
+    {
+        retireRegion(work);
+        return;
+    }
+
     if (work.chunkId.gen >= chunks.size())
         chunks.resize(work.chunkId.gen + 1);
     Chunk &chunk = chunks[work.chunkId.gen];
@@ -461,7 +614,7 @@ void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 
     if (work.hasEvents)
         work.vertexKeysEvent.wait();
-    updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys, tmpClumpId);
+    updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys, tmpClumpId, work);
 
     if (work.hasEvents)
         work.verticesEvent.wait();
@@ -474,9 +627,18 @@ MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
     (void) pass;
     assert(pass == 0);
 
-    writtenVerticesTmp = 0;
-    writtenTrianglesTmp = 0;
-    tmpWriter.start();
+    if (restored)
+    {
+        tmpWriter.resume(writtenVerticesTmp * sizeof(vertex_type),
+                         writtenTrianglesTmp * sizeof(triangle_type));
+        restored = false;
+    }
+    else
+    {
+        writtenVerticesTmp = 0;
+        writtenTrianglesTmp = 0;
+        tmpWriter.start();
+    }
 
     return boost::bind(&OOCMesher::add, this, _1, _2);
 }
@@ -508,7 +670,7 @@ void OOCMesher::getStatistics(
             totalVertices += clump.vertices;
         }
     }
-    thresholdVertices = std::tr1::uint64_t(totalVertices * getPruneThreshold());
+    thresholdVertices = std::tr1::uint64_t((totalVertices + pruneBaseVertices) * getPruneThreshold());
 
     BOOST_FOREACH(const Clump &clump, clumps)
     {
@@ -533,7 +695,8 @@ void OOCMesher::getStatistics(
         registry.getStatistic<Statistics::Variable>("components.triangles.kept").add(keptTriangles);
         registry.getStatistic<Statistics::Variable>("components.total").add(totalComponents);
         registry.getStatistic<Statistics::Variable>("components.kept").add(keptComponents);
-        registry.getStatistic<Statistics::Variable>("externalvertices").add(clumpIdMap.size());
+        registry.getStatistic<Statistics::Variable>("externalvertices").add(externalVertices);
+        registry.getStatistic<Statistics::Variable>("externalvertices.peak").add(externalVerticesPeak);
     }
 }
 
@@ -851,6 +1014,71 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
     return outputFiles;
 }
 
+std::tr1::uint64_t OOCMesher::getThresholdVertices() const
+{
+    std::tr1::uint64_t thresholdVertices;
+    clump_id keptComponents;
+    std::tr1::uint64_t keptVertices, keptTriangles;
+    getStatistics(thresholdVertices, keptComponents, keptVertices, keptTriangles, false);
+    return thresholdVertices;
+}
+
+OOCMesher::ChunkGroup::ChunkGroup()
+    : vertices(0), largestPruned(0),
+    smallestKept(std::numeric_limits<std::tr1::uint64_t>::max())
+{
+}
+
+std::vector<OOCMesher::ChunkGroup> OOCMesher::getChunkGroups() const
+{
+    // Union-find over the chunks, linking each chunk to the first chunk seen in each of its components
+    std::vector<UnionFind::Node<std::tr1::int32_t> > chunkNodes(chunks.size());
+    std::map<clump_id, std::tr1::int32_t> firstChunk;
+    for (std::size_t i = 0; i < chunks.size(); i++)
+    {
+        // Clumps may still be in the reorder buffer if the mesher has not been finalized
+        const Statistics::Container::vector<Chunk::Clump> *lists[2] = { &chunks[i].clumps, &chunks[i].bufferedClumps };
+        for (unsigned int j = 0; j < 2; j++)
+            BOOST_FOREACH(const Chunk::Clump &clump, *lists[j])
+            {
+                const clump_id root = UnionFind::findRoot(clumps, clump.globalId);
+                std::pair<std::map<clump_id, std::tr1::int32_t>::iterator, bool> added
+                    = firstChunk.insert(std::make_pair(root, std::tr1::int32_t(i)));
+                if (!added.second)
+                    UnionFind::merge(chunkNodes, std::tr1::int32_t(i), added.first->second);
+            }
+    }
+
+    std::vector<ChunkGroup> groups;
+    std::map<std::tr1::int32_t, std::size_t> groupIndex;
+    for (std::size_t i = 0; i < chunks.size(); i++)
+    {
+        if (chunks[i].clumps.empty() && chunks[i].bufferedClumps.empty())
+            continue;
+        const std::tr1::int32_t root = UnionFind::findRoot(chunkNodes, std::tr1::int32_t(i));
+        std::pair<std::map<std::tr1::int32_t, std::size_t>::iterator, bool> added
+            = groupIndex.insert(std::make_pair(root, groups.size()));
+        if (added.second)
+            groups.push_back(ChunkGroup());
+        groups[added.first->second].chunks.push_back(chunks[i].chunkId);
+    }
+
+    // Each component lies entirely within the group of its first chunk
+    const std::tr1::uint64_t thresholdVertices = getThresholdVertices();
+    for (std::map<clump_id, std::tr1::int32_t>::const_iterator i = firstChunk.begin(); i != firstChunk.end(); ++i)
+    {
+        const std::tr1::int32_t root = UnionFind::findRoot(chunkNodes, i->second);
+        ChunkGroup &group = groups[groupIndex[root]];
+        const std::tr1::uint64_t vertices = clumps[i->first].vertices;
+        group.vertices += vertices;
+        if (vertices >= thresholdVertices)
+            group.smallestKept = std::min(group.smallestKept, vertices);
+        else
+            group.largestPruned = std::max(group.largestPruned, vertices);
+    }
+    return groups;
+}
+
 void OOCMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path)
 {
     retainFiles = true;
@@ -897,6 +1125,24 @@ std::size_t OOCMesher::resume(
     return write(tworker, progressStream);
 }
 
+void OOCMesher::checkpointPartial(Timeplot::Worker &tworker, boost::archive::text_oarchive &archive)
+{
+    MLSGPU_ASSERT(regionKeys.empty(), state_error);
+    retainFiles = true;
+    // Ensure that everything referenced by the checkpoint is on disk
+    finalize(tworker);
+    serializePartial(archive);
+    tmpWriter.resume(writtenVerticesTmp * sizeof(vertex_type),
+                     writtenTrianglesTmp * sizeof(triangle_type));
+}
+
+void OOCMesher::restorePartial(boost::archive::text_iarchive &archive)
+{
+    retainFiles = true; // to allow the checkpoint to be reused
+    serializePartial(archive);
+    restored = true;
+}
+
 namespace
 {
 
@@ -71,6 +71,7 @@
 #include "progress.h"
 
 class TestTmpWriterWorkerGroup;
+class TestOOCMesher;
 
 namespace boost
 {
@@ -83,6 +84,42 @@ inline void serialize(Archive &ar, Statistics::Container::vector<T, Alloc> &v, c
     ar & boost::serialization::base_object<std::vector<T, Alloc> >(v);
 }
 
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void save(Archive &ar, const Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int)
+{
+    typedef Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> map_type;
+    std::size_t size = m.size();
+    ar << size;
+    for (typename map_type::const_iterator i = m.begin(); i != m.end(); ++i)
+    {
+        ar << i->first;
+        ar << i->second;
+    }
+}
+
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void load(Archive &ar, Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int)
+{
+    std::size_t size;
+    ar >> size;
+    m.clear();
+    m.rehash(size);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        Key key;
+        T value;
+        ar >> key;
+        ar >> value;
+        m.insert(std::make_pair(key, value));
+    }
+}
+
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void serialize(Archive &ar, Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int version)
+{
+    boost::serialization::split_free(ar, m, version);
+}
+
 template<typename Archive>
 inline void save(Archive &ar, const boost::filesystem::path &path, const unsigned int)
 {
@@ -137,6 +174,25 @@ struct MesherWork
     cl::Event verticesEvent;       ///< Signaled when vertices may be read
     cl::Event vertexKeysEvent;     ///< Signaled when vertex keys may be read
     cl::Event trianglesEvent;      ///< Signaled when triangles may be read
+
+    /**
+     * Cells of the global grid covered by the bin that produced this mesh,
+     * as half-open ranges. If the region is empty (the default), the
+     * external vertices of the mesh are never retired by the mesher.
+     */
+    boost::array<Grid::size_type, 3> regionLower, regionUpper;
+
+    /**
+     * If true, the mesh is empty and this item only signals that all meshes
+     * for the region have been delivered.
+     */
+    bool regionDone;
+
+    MesherWork() : hasEvents(false), regionDone(false)
+    {
+        regionLower.assign(0);
+        regionUpper.assign(0);
+    }
 };
 
 /**
@@ -164,7 +220,8 @@ public:
  * The generated name is
  * <i>base</i><code>_</code><i>XXXX</i><code>_</code><i>YYYY</i><code>_</code><i>ZZZZ</i><code>.ply</code>,
  * where @a base is the base name given to the constructor and @a XXXX, @a YYYY
- * and @a ZZZZ are the coordinates.
+ * and @a ZZZZ are the coordinates. Negative coordinates keep the sign in front
+ * of the padding, e.g. <code>-003</code>.
  */
 class ChunkNamer
 {
@@ -353,6 +410,7 @@ private:
 class OOCMesher : public MesherBase
 {
     friend class ::TestTmpWriterWorkerGroup;
+    friend class ::TestOOCMesher;
     friend class boost::serialization::access;
 public:
     typedef boost::array<float, 3> vertex_type;
@@ -597,6 +655,16 @@ protected:
          */
         void start();
 
+        /**
+         * Start the group without creating new temporary files. Instead, the
+         * existing files (as recorded by serialization) are truncated to the
+         * given sizes and reopened for appending.
+         *
+         * @param verticesSize   Size in bytes to retain in the vertices file
+         * @param trianglesSize  Size in bytes to retain in the triangles file
+         */
+        void resume(std::tr1::uint64_t verticesSize, std::tr1::uint64_t trianglesSize);
+
         /**
          * Close the temporary files. This should not be called directly (it is called
          * by @ref WorkerGroup).
@@ -657,10 +725,81 @@ private:
 
     Statistics::Container::vector<Clump> clumps;  ///< All clumps seen so far
 
-    typedef Statistics::Container::unordered_map<cl_ulong, clump_id> clump_id_map_type;
-    /// Maps external vertex keys to global clump IDs
+    /**
+     * Information about an external vertex that may still be shared with
+     * meshes that have not yet been received.
+     *
+     * The cells around a vertex are numbered by three bits, one per axis,
+     * which select the lower (0) or upper (1) neighbouring cell on that axis.
+     * On axes where the vertex is at a half-integer coordinate there is only
+     * one neighbouring cell, and only the 0 bit is used.
+     */
+    struct ExternalVertex
+    {
+        clump_id clumpId;              ///< Global clump containing the vertex
+        std::tr1::uint8_t covered;     ///< Mask of neighbouring cells whose bins have produced the vertex
+        std::tr1::uint8_t pending;     ///< Number of bins that produced the vertex and are not complete
+
+        ExternalVertex() : clumpId(0), covered(0), pending(0) {}
+        explicit ExternalVertex(clump_id clumpId) : clumpId(clumpId), covered(0), pending(0) {}
+
+        template<typename Archive>
+        void serialize(Archive &ar, const unsigned int)
+        {
+            ar & clumpId;
+            ar & covered;
+            ar & pending;
+        }
+    };
+
+    typedef Statistics::Container::unordered_map<cl_ulong, ExternalVertex> clump_id_map_type;
+    /**
+     * Maps external vertex keys to global clump IDs. Keys are removed once
+     * every bin around them has been completed (see @ref retireRegion).
+     */
     clump_id_map_type clumpIdMap;
 
+    typedef Statistics::Container::unordered_map<cl_ulong, std::vector<cl_ulong> > region_keys_type;
+    /**
+     * For each bin that has delivered meshes but is not yet complete, the
+     * external vertex keys that it contributed to @ref clumpIdMap. The bins
+     * are identified by the key of their minimum corner.
+     */
+    region_keys_type regionKeys;
+
+    /// Number of distinct external vertices seen
+    std::tr1::uint64_t externalVertices;
+    /// Largest size reached by @ref clumpIdMap
+    std::tr1::uint64_t externalVerticesPeak;
+
+    /// Vertices outside this mesher that count towards the prune threshold
+    std::tr1::uint64_t pruneBaseVertices;
+
+    /// Identifier for the bin of @a work, used as the key in @ref regionKeys
+    static cl_ulong regionId(const MesherWork &work);
+
+    /**
+     * Determine which of the cells around the vertex identified by @a key
+     * lie in a half-open box of cells.
+     */
+    static std::tr1::uint8_t cellMask(
+        cl_ulong key,
+        const boost::array<Grid::size_type, 3> &lower,
+        const boost::array<Grid::size_type, 3> &upper);
+
+    /**
+     * Mask of all the cells around the vertex identified by @a key. A vertex
+     * may only be retired once its @ref ExternalVertex::covered field is equal
+     * to this.
+     */
+    static std::tr1::uint8_t cellMaskAll(cl_ulong key);
+
+    /**
+     * Process the completion of a bin, removing keys from @ref clumpIdMap
+     * that cannot occur in any future mesh.
+     */
+    void retireRegion(const MesherWork &work);
+
     /**
      * Identifies components with a local set of triangles, and
      * returns a union-find tree for them.
@@ -700,6 +839,7 @@ private:
      * @param numExternalVertices Number of external vertices in @a keys
      * @param keys           Vertex keys in the mesh.
      * @param clumpId        Vertex clump IDs computed by @ref updateGlobalClumps.
+     * @param work           Source of the mesh, used for the bin region.
      *
      * Note that the internal vertices in @a clumpId are ignored, but must still be present.
      */
@@ -707,7 +847,8 @@ private:
         std::size_t numVertices,
         std::size_t numExternalVertices,
         const cl_ulong *keys,
-        const Statistics::Container::PODBuffer<clump_id> &clumpId);
+        const Statistics::Container::PODBuffer<clump_id> &clumpId,
+        const MesherWork &work);
 
     /**
      * Populate the per-chunk clump data and write the geometry to external
@@ -748,6 +889,32 @@ private:
         ar & clumps;
     }
 
+    /**
+     * Serialize everything needed to continue adding geometry to the
+     * reconstituted structure, in addition to the data needed by @ref write.
+     * The reorder buffer must have been flushed beforehand, and there must
+     * not be any bins whose completion has not yet been signalled.
+     */
+    template<typename Archive>
+    void serializePartial(Archive &ar)
+    {
+        ar & *this;
+        for (std::size_t i = 0; i < chunks.size(); i++)
+            ar & chunks[i].vertexIdMap;
+        ar & clumpIdMap;
+        ar & externalVertices;
+        ar & externalVerticesPeak;
+        ar & writtenVerticesTmp;
+        ar & writtenTrianglesTmp;
+    }
+
+    /**
+     * Set by @ref restorePartial to indicate that the next call to @ref
+     * functor must continue from the restored state rather than starting
+     * afresh.
+     */
+    bool restored;
+
 protected:
     /// If set to true, will not delete the temporary files
     bool retainFiles;
@@ -930,6 +1097,64 @@ public:
     virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL);
+
+    /**
+     * Save the state of a pass that is still in progress, so that it can be
+     * continued later by @ref restorePartial. Unlike @ref checkpoint, the
+     * mesher remains usable afterwards and more geometry can be added.
+     *
+     * The temporary files are retained, since the checkpoint refers to them.
+     *
+     * @pre The functor returned by @ref functor is not being called
+     * concurrently, and all geometry passed to it is complete.
+     */
+    void checkpointPartial(Timeplot::Worker &tworker, boost::archive::text_oarchive &archive);
+
+    /**
+     * Restore state saved by @ref checkpointPartial. The next call to @ref
+     * functor continues from this state. Any geometry appended to the
+     * temporary files after the checkpoint was made is discarded.
+     */
+    void restorePartial(boost::archive::text_iarchive &archive);
+
+    /**
+     * Set a number of vertices to add to those received when computing the
+     * prune threshold (see @ref setPruneThreshold). It accounts for
+     * components that belong to the model but are not passed to this mesher,
+     * such as those in the chunks that an incremental run leaves in place.
+     */
+    void setPruneBaseVertices(std::tr1::uint64_t vertices) { pruneBaseVertices = vertices; }
+
+    /**
+     * Number of vertices that a component must have to be kept.
+     *
+     * @pre All the geometry has been received.
+     */
+    std::tr1::uint64_t getThresholdVertices() const;
+
+    /**
+     * A set of chunks linked by connected components, together with the
+     * component sizes that determine how it is affected by pruning.
+     */
+    struct ChunkGroup
+    {
+        std::vector<ChunkId> chunks;       ///< Chunks in the group
+        std::tr1::uint64_t vertices;       ///< Vertices in the components of the group, before pruning
+        std::tr1::uint64_t largestPruned;  ///< Vertices in the largest pruned component, or 0 if none
+        std::tr1::uint64_t smallestKept;   ///< Vertices in the smallest kept component, or the maximum value if none
+
+        ChunkGroup();
+    };
+
+    /**
+     * Partition the chunks that received geometry into groups, such that
+     * chunks sharing a connected component are in the same group. Since
+     * component pruning depends on the whole component, the output file
+     * of a chunk depends on the geometry of all the chunks in its group.
+     *
+     * @pre All the geometry has been received.
+     */
+    std::vector<ChunkGroup> getChunkGroups() const;
 };
 
 /**
@@ -34,6 +34,7 @@
 
 #include <CL/cl.hpp>
 #include <stdexcept>
+#include <vector>
 #include <algorithm>
 #include <boost/math/constants/constants.hpp>
 #include "errors.h"
@@ -69,28 +70,97 @@ MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape)
     cl::Program program = CLH::build(context, "kernels/mls.cl", defines);
     kernel = cl::Kernel(program, "processCorners");
 
+    cl_int3 noSlot[2] = { {{ 0, 0, 0 }}, {{ CL_INT_MAX, CL_INT_MAX, CL_INT_MAX }} };
+    noSlots = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(noSlot), noSlot);
+    const cl_uint3 dims = {{ 1, 1, 1 }};
+    setSlots(noSlots, 32, dims);
     setBoundaryLimit(1.0f);
 }
 
+void MlsFunctor::setSlots(const cl::Buffer &slotTable, cl_uint slotShift, const cl_uint3 &slotDims)
+{
+    kernel.setArg(10, slotTable);
+    kernel.setArg(11, slotShift);
+    kernel.setArg(12, slotDims);
+}
+
 void MlsFunctor::set(const Grid::difference_type offset[3],
+                     const Grid::size_type treeOffset[3],
                      const cl::Buffer &splats,
                      const cl::Buffer &commands,
                      const cl::Buffer &start,
                      unsigned int subsamplingShift)
 {
+    for (int i = 0; i < 3; i++)
+        MLSGPU_ASSERT(treeOffset[i] % (Grid::size_type(1) << subsamplingShift) == 0, std::invalid_argument);
     cl_int3 offset3 = {{ offset[0], offset[1], offset[2] }};
+    cl_int3 treeOffset3 = {{ cl_int(treeOffset[0]), cl_int(treeOffset[1]), cl_int(treeOffset[2]) }};
 
     kernel.setArg(1, splats);
     kernel.setArg(2, commands);
     kernel.setArg(3, start);
     kernel.setArg(4, 3 * subsamplingShift);
     kernel.setArg(5, offset3);
+    kernel.setArg(6, treeOffset3);
+
+    const cl_uint3 dims = {{ 1, 1, 1 }};
+    setSlots(noSlots, 32, dims);
 }
 
 void MlsFunctor::set(const Grid::difference_type offset[3],
                      const SplatTreeCL &tree, unsigned int subsamplingShift)
 {
-    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift);
+    const Grid::size_type treeOffset[3] = {0, 0, 0};
+    set(offset, treeOffset, tree, subsamplingShift);
+}
+
+void MlsFunctor::set(const Grid::difference_type offset[3],
+                     const Grid::size_type treeOffset[3],
+                     const SplatTreeCL &tree, unsigned int subsamplingShift)
+{
+    set(offset, treeOffset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift);
+}
+
+void MlsFunctor::set(const Marching::Slots &slots,
+                     const SplatTreeCL &tree, unsigned int subsamplingShift)
+{
+    MLSGPU_ASSERT(slots.shift >= subsamplingShift && slots.shift < 32, std::invalid_argument);
+    const Grid::size_type side = Grid::size_type(1) << slots.shift;
+    std::size_t numSlots = 1;
+    cl_uint3 dims;
+    for (int i = 0; i < 3; i++)
+    {
+        MLSGPU_ASSERT(side % wgs[i] == 0, std::invalid_argument);
+        numSlots *= slots.dims[i];
+        dims.s[i] = slots.dims[i];
+    }
+    MLSGPU_ASSERT(slots.vertices.size() == numSlots && slots.offsets.size() == numSlots, std::invalid_argument);
+
+    // The offset maps volume coordinates to region coordinates, then to world
+    std::vector<cl_int3> table(2 * numSlots);
+    for (std::size_t i = 0; i < numSlots; i++)
+    {
+        const Grid::size_type base[3] =
+        {
+            i % slots.dims[0] * side,
+            i / slots.dims[0] % slots.dims[1] * side,
+            i / slots.dims[0] / slots.dims[1] * side
+        };
+        for (int j = 0; j < 3; j++)
+        {
+            table[2 * i].s[j] = cl_int(slots.offsets[i].s[j]) - cl_int(base[j]);
+            table[2 * i + 1].s[j] = slots.vertices[i].s[j];
+        }
+    }
+
+    const Grid::difference_type offset[3] = {0, 0, 0};
+    const Grid::size_type treeOffset[3] = {0, 0, 0};
+    set(offset, treeOffset, tree, subsamplingShift);
+
+    const cl::Context context = kernel.getInfo<CL_KERNEL_CONTEXT>();
+    cl::Buffer slotTable(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         table.size() * sizeof(cl_int3), &table[0]);
+    setSlots(slotTable, slots.shift, dims);
 }
 
 const Grid::size_type *MlsFunctor::alignment() const
@@ -115,8 +185,8 @@ void MlsFunctor::enqueue(
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_HEIGHT>() >= swathe.zStride * (swathe.zLast + 1) + swathe.zBias, std::length_error);
 
     kernel.setArg(0, distance);
-    kernel.setArg(6, cl_uint(swathe.zStride));
-    kernel.setArg(7, cl_int(swathe.zBias));
+    kernel.setArg(7, cl_uint(swathe.zStride));
+    kernel.setArg(8, cl_int(swathe.zBias));
 
     const std::size_t wgs3 = wgs[0] * wgs[1] * wgs[2];
     const std::size_t blocks[3] =
@@ -140,5 +210,5 @@ void MlsFunctor::setBoundaryLimit(float limit)
     // uniform distribution of samples and a straight boundary
     const float boundaryScale = (sqrt(6.0f) * 512) / (693 * boost::math::constants::pi<float>());
     const float gamma = boundaryScale * limit;
-    kernel.setArg(8, 1.0f - gamma * gamma);
+    kernel.setArg(9, 1.0f - gamma * gamma);
 }
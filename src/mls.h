@@ -91,12 +91,22 @@ private:
      */
     Statistics::Variable &kernelTime;
 
+    /**
+     * Buffer with a single slot table entry (see @ref processCorners), which
+     * is passed to @ref kernel when the region is not divided into slots.
+     */
+    cl::Buffer noSlots;
+
+    /// Pass a slot table to @ref kernel (see @ref processCorners).
+    void setSlots(const cl::Buffer &slotTable, cl_uint slotShift, const cl_uint3 &slotDims);
+
     /**
      * Specify the parameters. This is a private variant that
      * does not require the buffers to be stored in a @ref SplatTreeCL, and
      * is used for testing.
      */
     void set(const Grid::difference_type offset[3],
+             const Grid::size_type treeOffset[3],
              const cl::Buffer &splats,
              const cl::Buffer &commands,
              const cl::Buffer &start,
@@ -136,6 +146,45 @@ public:
     void set(const Grid::difference_type offset[3],
              const SplatTreeCL &tree, unsigned int subsamplingShift);
 
+    /**
+     * Variant of @ref set for an octree holding several regions (see
+     * @ref SplatTreeCL::Region). The vertices are looked up in the octree
+     * at @a treeOffset plus their region-relative coordinates.
+     *
+     * @param offset           Offset between world coordinates and region-relative coordinates.
+     * @param treeOffset       Position of the region within @a tree.
+     * @param tree             Octree containing input splats.
+     * @param subsamplingShift Subsampling shift passed when building @a tree.
+     *
+     * @pre
+     * - @a tree was built with a region having the same @a offset and with @a treeOffset as its origin.
+     * - @a treeOffset is a multiple of 2<sup>@a subsamplingShift</sup>.
+     */
+    void set(const Grid::difference_type offset[3],
+             const Grid::size_type treeOffset[3],
+             const SplatTreeCL &tree, unsigned int subsamplingShift);
+
+    /**
+     * Variant of @ref set for a volume packed with regions (see @ref
+     * Marching::Slots), for use with the corresponding form of @ref
+     * Marching::generate. Each vertex of the volume is looked up in the
+     * octree at its own position, and is assigned NaN if it lies outside the
+     * region in its slot.
+     *
+     * @param slots            Layout of the regions in the volume.
+     * @param tree             Octree containing input splats.
+     * @param subsamplingShift Subsampling shift passed when building @a tree.
+     *
+     * @pre
+     * - @a tree was built with a region in each non-empty slot, whose origin
+     *   is the lower corner of the slot and whose offset is given by
+     *   @ref Marching::Slots::offsets.
+     * - The side length of a slot is a multiple of 2<sup>@a subsamplingShift</sup>
+     *   and of @ref wgs.
+     */
+    void set(const Marching::Slots &slots,
+             const SplatTreeCL &tree, unsigned int subsamplingShift);
+
     virtual const Grid::size_type *alignment() const;
 
     /**
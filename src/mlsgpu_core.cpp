@@ -39,8 +39,18 @@
 #include <boost/system/error_code.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/ref.hpp>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/ptr_container/nullable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/array.hpp>
 #include <memory>
+#include <new>
+#include <set>
 #include <string>
 #include <iterator>
 #include <vector>
@@ -51,6 +61,8 @@
 #include <cstdlib>
 #include <cassert>
 #include <limits>
+#include <cerrno>
+#include <cmath>
 #include "mlsgpu_core.h"
 #include "options.h"
 #include "mls.h"
@@ -67,6 +79,21 @@
 #include "bucket.h"
 #include "splat_set.h"
 #include "decache.h"
+#include "compress.h"
+#include "normals.h"
+#include "outliers.h"
+#include "input_manifest.h"
+#include "field_cache.h"
+#include "misc.h"
+
+#if HAVE_SYSCONF
+# include <unistd.h>
+#elif HAVE_GLOBALMEMORYSTATUSEX
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+#endif
 
 namespace po = boost::program_options;
 
@@ -103,7 +130,7 @@ static void addStatisticsOptions(po::options_description &opts)
     opts.add(statistics);
 }
 
-static void addAdvancedOptions(po::options_description &opts)
+static void addAdvancedOptions(po::options_description &opts, bool isMPI)
 {
     po::options_description advanced("Advanced options");
     advanced.add_options()
@@ -118,11 +145,59 @@ static void addAdvancedOptions(po::options_description &opts)
         (Option::ompThreads,   po::value<int>(), "Number of threads for OpenMP")
 #endif
         (Option::decache,      "Try to evict input files from OS cache for benchmarking")
+        (Option::asciiIndexCache, "Cache the line index of ASCII input files alongside them")
+        (Option::inputManifest, po::value<std::string>(), "Cache the headers of input files in this file")
+        (Option::inputThreads, po::value<int>()->default_value(16), "Number of threads for opening input files")
         (Option::checkpoint,   po::value<std::string>(), "Checkpoint state prior to writing output")
         (Option::resume,       po::value<std::string>(), "Restart from checkpoint");
+    if (!isMPI)
+        advanced.add_options()
+            (Option::readAhead,    po::value<int>()->default_value(8), "Number of collected bins to ask the OS to prefetch")
+            (Option::binFileOrder, "Sort the bins of each chunk by position in the input files");
     opts.add(advanced);
 }
 
+static void addRegionOptions(po::options_description &opts, bool isMPI)
+{
+    po::options_description region("Region of interest options");
+    region.add_options()
+        (Option::region, po::value<std::string>(), "Only reconstruct inside x0,y0,z0,x1,y1,z1")
+        (Option::chunk,  po::value<std::vector<std::string> >()->composing(), "Only reconstruct output chunk x,y,z (may be repeated)");
+    if (!isMPI)
+        region.add_options()
+            (Option::incremental, po::value<std::string>(), "Only regenerate chunks affected by changed inputs, using state saved in this file");
+    opts.add(region);
+}
+
+static void addFieldOptions(po::options_description &opts)
+{
+    po::options_description field("Field cache options");
+    field.add_options()
+        (Option::saveField,    po::value<std::string>(), "Save the signed distance function near the surface to this file")
+        (Option::extractField, po::value<std::string>(), "Extract the surface from a file written with --save-field instead of the inputs");
+    opts.add(field);
+}
+
+static void addNormalOptions(po::options_description &opts)
+{
+    po::options_description normals("Normal estimation options");
+    normals.add_options()
+        (Option::estimateNormals,  "Estimate normals and radii for inputs that only have positions")
+        (Option::normalNeighbours, po::value<int>()->default_value(16), "Number of neighbours used to estimate each normal")
+        (Option::normalHalo,       po::value<double>(), "Maximum distance to a neighbour [8 x fit-grid]")
+        (Option::normalFile,       po::value<std::string>(), "Keep the splats with estimated normals in this file");
+    opts.add(normals);
+}
+
+static void addOutlierOptions(po::options_description &opts)
+{
+    po::options_description outliers("Outlier removal options");
+    outliers.add_options()
+        (Option::removeOutliers,    "Discard isolated splats before reconstruction")
+        (Option::outlierNeighbours, po::value<int>()->default_value(4), "Number of other splats that must cover a splat to keep it");
+    opts.add(outliers);
+}
+
 static void addMemoryOptions(po::options_description &opts, bool isMPI)
 {
     po::options_description memory("Advanced memory options");
@@ -135,9 +210,29 @@ static void addMemoryOptions(po::options_description &opts, bool isMPI)
     if (isMPI)
         memory.add_options()
             (Option::memGather,   po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for buffering raw mesh data on the slaves");
+    memory.add_options()
+        (Option::memAuto,         "Choose memory options not given explicitly from host and device memory");
+    if (!isMPI)
+        memory.add_options()
+            (Option::memBroker,   "Move memory between the splat and mesh queues at runtime");
     opts.add(memory);
 }
 
+static void addMPIOptions(po::options_description &opts)
+{
+    po::options_description mpi("Advanced MPI options");
+    mpi.add_options()
+        (Option::mpiScatterRun,   po::value<Capacity>()->default_value(1024 * 1024 * 1024), "Splat memory per spatially coherent run of bins sent to one slave (0 for first-come)")
+        (Option::mpiScatterSplats, "Read input files only on the master and send splats to the slaves")
+        (Option::mpiCompress,      "Compress splats sent by --mpi-scatter-splats")
+        (Option::mpiCheckpointInterval, po::value<Capacity>()->default_value(0), "Splat memory to process between checkpoints to the --checkpoint file (0 for none)")
+        (Option::mpiStripeSize,    po::value<Capacity>()->default_value(0), "Stripe size hint for output files (0 for filesystem default)")
+        (Option::mpiStripeCount,   po::value<int>()->default_value(0), "Stripe count hint for output files (0 for filesystem default)")
+        (Option::mpiAggregateWrites, "Aggregate output writes into stripe-aligned blocks")
+        (Option::mpiBlobReaders,   po::value<int>()->default_value(1), "Number of reader threads per node for the bounding box pass");
+    opts.add(mpi);
+}
+
 void usage(std::ostream &o, const po::options_description desc)
 {
     o << "Usage: mlsgpu [options] -o output.ply input.ply [input.ply...]\n\n";
@@ -154,8 +249,17 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
     addCommonOptions(desc);
     addFitOptions(desc);
     addStatisticsOptions(desc);
-    addAdvancedOptions(desc);
+    addAdvancedOptions(desc, isMPI);
+    addRegionOptions(desc, isMPI);
+    if (!isMPI)
+    {
+        addFieldOptions(desc);
+        addNormalOptions(desc);
+        addOutlierOptions(desc);
+    }
     addMemoryOptions(desc, isMPI);
+    if (isMPI)
+        addMPIOptions(desc);
     desc.add_options()
         ("output-file,o",   po::value<std::string>()->required(), "output file")
         (Option::split,     "split output across multiple files")
@@ -215,7 +319,7 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
             std::exit(0);
         }
         /* Using ->required() on the option gives an unhelpful message */
-        if (!vm.count(Option::inputFile))
+        if (!vm.count(Option::inputFile) && !vm.count(Option::extractField))
         {
             std::cerr << "At least one input file must be specified.\n\n";
             usage(std::cerr, desc);
@@ -255,6 +359,51 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
     }
 }
 
+/**
+ * Write a single option in the form it would be given on the command line,
+ * preceded by a space.
+ */
+static void writeOption(std::ostream &opts, const std::string &name, const po::variable_value &param)
+{
+    const boost::any &value = param.value();
+    if (param.empty()
+        || (value.type() == typeid(std::string) && param.as<std::string>().empty()))
+        opts << " --" << name;
+    else if (value.type() == typeid(std::vector<std::string>))
+    {
+        BOOST_FOREACH(const std::string &j, param.as<std::vector<std::string> >())
+        {
+            opts << " --" << name << '=' << j;
+        }
+    }
+    else
+    {
+        opts << " --" << name << '=';
+        if (value.type() == typeid(std::string))
+            opts << param.as<std::string>();
+        else if (value.type() == typeid(double))
+            opts << param.as<double>();
+        else if (value.type() == typeid(int))
+            opts << param.as<int>();
+        else if (value.type() == typeid(unsigned int))
+            opts << param.as<unsigned int>();
+        else if (value.type() == typeid(std::size_t))
+            opts << param.as<std::size_t>();
+        else if (value.type() == typeid(Choice<MesherTypeWrapper>))
+            opts << param.as<Choice<MesherTypeWrapper> >();
+        else if (value.type() == typeid(Choice<WriterTypeWrapper>))
+            opts << param.as<Choice<WriterTypeWrapper> >();
+        else if (value.type() == typeid(Choice<ReaderTypeWrapper>))
+            opts << param.as<Choice<ReaderTypeWrapper> >();
+        else if (value.type() == typeid(Choice<MlsShapeWrapper>))
+            opts << param.as<Choice<MlsShapeWrapper> >();
+        else if (value.type() == typeid(Capacity))
+            opts << param.as<Capacity>();
+        else
+            assert(!"Unhandled parameter type");
+    }
+}
+
 /**
  * Translate the command-line options back into the form they would be given
  * on the command line.
@@ -268,48 +417,31 @@ static std::string makeOptions(const po::variables_map &vm)
             continue; // these are not output because some programs choke
         if (i->first == Option::responseFile)
             continue; // this is not relevant to reproducing the results
-        const po::variable_value &param = i->second;
-        const boost::any &value = param.value();
-        if (param.empty()
-            || (value.type() == typeid(std::string) && param.as<std::string>().empty()))
-            opts << " --" << i->first;
-        else if (value.type() == typeid(std::vector<std::string>))
-        {
-            BOOST_FOREACH(const std::string &j, param.as<std::vector<std::string> >())
-            {
-                opts << " --" << i->first << '=' << j;
-            }
-        }
-        else
-        {
-            opts << " --" << i->first << '=';
-            if (value.type() == typeid(std::string))
-                opts << param.as<std::string>();
-            else if (value.type() == typeid(double))
-                opts << param.as<double>();
-            else if (value.type() == typeid(int))
-                opts << param.as<int>();
-            else if (value.type() == typeid(unsigned int))
-                opts << param.as<unsigned int>();
-            else if (value.type() == typeid(std::size_t))
-                opts << param.as<std::size_t>();
-            else if (value.type() == typeid(Choice<MesherTypeWrapper>))
-                opts << param.as<Choice<MesherTypeWrapper> >();
-            else if (value.type() == typeid(Choice<WriterTypeWrapper>))
-                opts << param.as<Choice<WriterTypeWrapper> >();
-            else if (value.type() == typeid(Choice<ReaderTypeWrapper>))
-                opts << param.as<Choice<ReaderTypeWrapper> >();
-            else if (value.type() == typeid(Choice<MlsShapeWrapper>))
-                opts << param.as<Choice<MlsShapeWrapper> >();
-            else if (value.type() == typeid(Capacity))
-                opts << param.as<Capacity>();
-            else
-                assert(!"Unhandled parameter type");
-        }
+        writeOption(opts, i->first, i->second);
     }
     return opts.str();
 }
 
+/**
+ * Translate the options that affect the output geometry or the division of
+ * the output into chunks into command-line form, for @ref IncrementalBuild.
+ */
+static std::string outputOptions(const po::variables_map &vm)
+{
+    static const char * const names[] =
+    {
+        Option::fitSmooth, Option::maxRadius, Option::fitGrid, Option::fitPrune,
+        Option::fitBoundaryLimit, Option::fitShape, Option::outputFile,
+        Option::splitSize, Option::levels, Option::subsampling,
+        Option::leafCells, Option::maxSplit
+    };
+    std::ostringstream opts;
+    for (std::size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (vm.count(names[i]))
+            writeOption(opts, names[i], vm[names[i]]);
+    return opts.str();
+}
+
 void writeStatistics(const po::variables_map &vm, bool force)
 {
     if (force || vm.count(Option::statistics) || vm.count(Option::statisticsFile))
@@ -395,6 +527,88 @@ static std::size_t getMaxBucketSplats(const po::variables_map &vm)
     return mem / sizeof(Splat);
 }
 
+/**
+ * Total memory shared between the queues by <code>--mem-broker</code>. It is
+ * rounded up so that the mesh queue, which takes the upper end of the
+ * arena, stays aligned.
+ */
+static std::size_t getBrokerBudget(const po::variables_map &vm)
+{
+    return roundUp(getMaxHostSplats(vm) * sizeof(Splat) + std::size_t(vm[Option::memMesh].as<Capacity>()),
+                   sizeof(cl_ulong));
+}
+
+/// Smallest size of the copy queue, which must hold a whole bucket
+static std::size_t getCopyBufferMinimum(const po::variables_map &vm)
+{
+    return getMaxBucketSplats(vm) * sizeof(Splat);
+}
+
+CircularBufferArena *createBrokerArena(const po::variables_map &vm)
+{
+    if (!vm.count(Option::memBroker))
+        return NULL;
+    return new CircularBufferArena("mem.broker.arena", getBrokerBudget(vm));
+}
+
+/**
+ * Parse a comma-separated list of numbers given for an option.
+ *
+ * @param option     Name of the option, for error messages.
+ * @param value      Value given for the option.
+ * @param n          Number of values that must be present.
+ * @throw invalid_option if the value is malformed.
+ */
+template<typename T>
+static std::vector<T> parseList(const char *option, const std::string &value, std::size_t n)
+{
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, value, boost::algorithm::is_any_of(","));
+    std::vector<T> ans;
+    try
+    {
+        BOOST_FOREACH(const std::string &field, fields)
+        {
+            ans.push_back(boost::lexical_cast<T>(boost::algorithm::trim_copy(field)));
+        }
+    }
+    catch (boost::bad_lexical_cast &e)
+    {
+        ans.clear();
+    }
+    if (ans.size() != n)
+    {
+        std::ostringstream msg;
+        msg << "Value of --" << option << " must be " << n << " comma-separated numbers";
+        throw invalid_option(msg.str());
+    }
+    return ans;
+}
+
+/// Parse the value of <code>--region</code>, checking that the box is not inverted
+static std::vector<double> parseRegion(const po::variables_map &vm)
+{
+    std::vector<double> box = parseList<double>(Option::region, vm[Option::region].as<std::string>(), 6);
+    for (unsigned int i = 0; i < 3; i++)
+        if (!(box[i] <= box[i + 3]))
+            throw invalid_option(std::string("Value of --") + Option::region + " must have x0 <= x1, y0 <= y1 and z0 <= z1");
+    return box;
+}
+
+/// Parse the values of <code>--chunk</code>
+static std::set<boost::array<Grid::difference_type, 3> > parseChunks(const po::variables_map &vm)
+{
+    std::set<boost::array<Grid::difference_type, 3> > chunks;
+    BOOST_FOREACH(const std::string &value, vm[Option::chunk].as<std::vector<std::string> >())
+    {
+        std::vector<Grid::difference_type> coords = parseList<Grid::difference_type>(Option::chunk, value, 3);
+        boost::array<Grid::difference_type, 3> chunk;
+        std::copy(coords.begin(), coords.end(), chunk.begin());
+        chunks.insert(chunk);
+    }
+    return chunks;
+}
+
 void validateOptions(const po::variables_map &vm, bool isMPI)
 {
     const int levels = vm[Option::levels].as<int>();
@@ -443,16 +657,79 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
 
     if (deviceThreads < 1)
         throw invalid_option(std::string("Value of --") + Option::deviceThreads + " must be at least 1");
+    if (vm[Option::inputThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::inputThreads + " must be at least 1");
+    if (!isMPI && vm[Option::readAhead].as<int>() < 0)
+        throw invalid_option(std::string("Value of --") + Option::readAhead + " must be non-negative");
     if (!(pruneThreshold >= 0.0 && pruneThreshold <= 1.0))
         throw invalid_option(std::string("Value of --") + Option::fitPrune + " must be in [0, 1]");
 
     if (memMesh < getMeshHostMemory(vm))
         throw invalid_option(std::string("Value of --") + Option::memMesh + " is too small");
+    if (vm.count(Option::memBroker)
+        && getBrokerBudget(vm) < getCopyBufferMinimum(vm) + getMeshHostMemory(vm))
+        throw invalid_option(std::string("--") + Option::memBroker + " needs room for a bucket and a bin of mesh data");
+    if (vm.count(Option::region))
+        parseRegion(vm);
+    if (vm.count(Option::chunk))
+    {
+        if (!vm.count(Option::split))
+            throw invalid_option(std::string("--") + Option::chunk + " requires --" + Option::split);
+        if (vm.count(Option::region))
+            throw invalid_option(std::string("--") + Option::chunk + " and --" + Option::region + " cannot be combined");
+        parseChunks(vm);
+    }
+    if (!isMPI && vm.count(Option::incremental))
+    {
+        if (!vm.count(Option::split))
+            throw invalid_option(std::string("--") + Option::incremental + " requires --" + Option::split);
+        const char * const conflicts[] =
+        {
+            Option::region, Option::chunk, Option::estimateNormals, Option::removeOutliers,
+            Option::checkpoint, Option::resume
+        };
+        for (std::size_t i = 0; i < sizeof(conflicts) / sizeof(conflicts[0]); i++)
+            if (vm.count(conflicts[i]))
+                throw invalid_option(std::string("--") + Option::incremental + " and --"
+                                     + conflicts[i] + " cannot be combined");
+    }
+    if (!isMPI && vm.count(Option::extractField))
+    {
+        const char * const conflicts[] =
+        {
+            Option::saveField, Option::incremental, Option::region, Option::chunk,
+            Option::estimateNormals, Option::removeOutliers, Option::checkpoint, Option::resume
+        };
+        for (std::size_t i = 0; i < sizeof(conflicts) / sizeof(conflicts[0]); i++)
+            if (vm.count(conflicts[i]))
+                throw invalid_option(std::string("--") + Option::extractField + " and --"
+                                     + conflicts[i] + " cannot be combined");
+    }
+    if (!isMPI && vm.count(Option::saveField) && vm.count(Option::incremental))
+        throw invalid_option(std::string("--") + Option::saveField + " and --"
+                             + Option::incremental + " cannot be combined");
+    if (!isMPI)
+    {
+        if (vm[Option::normalNeighbours].as<int>() < 3)
+            throw invalid_option(std::string("Value of --") + Option::normalNeighbours + " must be at least 3");
+        if (vm.count(Option::normalHalo) && !(vm[Option::normalHalo].as<double>() > 0.0))
+            throw invalid_option(std::string("Value of --") + Option::normalHalo + " must be positive");
+        if (vm[Option::outlierNeighbours].as<int>() < 1)
+            throw invalid_option(std::string("Value of --") + Option::outlierNeighbours + " must be at least 1");
+    }
     if (isMPI)
     {
         const std::size_t memGather = vm[Option::memGather].as<Capacity>();
         if (memGather < getMeshHostMemory(vm))
             throw invalid_option(std::string("Value of --") + Option::memGather + " is too small");
+        if (vm.count(Option::mpiCompress) && !compressSupported())
+            throw invalid_option(std::string("--") + Option::mpiCompress + " is not supported in this build");
+        if (vm[Option::mpiCheckpointInterval].as<Capacity>() > 0 && !vm.count(Option::checkpoint))
+            throw invalid_option(std::string("--") + Option::mpiCheckpointInterval + " requires --" + Option::checkpoint);
+        if (vm[Option::mpiStripeCount].as<int>() < 0)
+            throw invalid_option(std::string("Value of --") + Option::mpiStripeCount + " must be non-negative");
+        if (vm[Option::mpiBlobReaders].as<int>() < 1)
+            throw invalid_option(std::string("Value of --") + Option::mpiBlobReaders + " must be at least 1");
     }
 }
 
@@ -466,11 +743,14 @@ void setLogLevel(const po::variables_map &vm)
         Log::log.setLevel(Log::info);
 }
 
-CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
+/**
+ * Estimate the per-device resource usage for a given bucket size, with other
+ * parameters taken from the command-line options.
+ */
+static CLH::ResourceUsage resourceUsage(const po::variables_map &vm, std::size_t maxBucketSplats)
 {
     const int levels = vm[Option::levels].as<int>();
     const int subsampling = vm[Option::subsampling].as<int>();
-    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
     const int deviceThreads = vm[Option::deviceThreads].as<int>();
     const int deviceSpare = getDeviceWorkerGroupSpare(vm);
 
@@ -483,6 +763,212 @@ CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
     return totalUsage;
 }
 
+CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
+{
+    return resourceUsage(vm, getMaxBucketSplats(vm));
+}
+
+std::tr1::uint64_t hostMemoryLimit()
+{
+    std::tr1::uint64_t limit = 0;
+#if HAVE_SYSCONF
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0)
+        limit = std::tr1::uint64_t(pages) * pageSize;
+#elif HAVE_GLOBALMEMORYSTATUSEX
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        limit = status.ullTotalPhys;
+#endif
+
+    /* Containers are frequently given less memory than the machine has. An
+     * unlimited cgroup v2 reads as "max", which fails to parse, while an
+     * unlimited cgroup v1 reads as a huge number, so both are ignored by
+     * taking the minimum.
+     */
+    const char * const cgroupFiles[] =
+    {
+        "/sys/fs/cgroup/memory.max",
+        "/sys/fs/cgroup/memory/memory.limit_in_bytes"
+    };
+    for (std::size_t i = 0; i < sizeof(cgroupFiles) / sizeof(cgroupFiles[0]); i++)
+    {
+        std::ifstream in(cgroupFiles[i]);
+        std::tr1::uint64_t value;
+        if (in >> value && value > 0 && (limit == 0 || value < limit))
+            limit = value;
+    }
+    return limit;
+}
+
+std::tr1::uint64_t deviceBucketLimit(const po::variables_map &vm, const std::vector<cl::Device> &devices)
+{
+    if (devices.empty())
+        return std::numeric_limits<std::tr1::uint64_t>::max();
+
+    std::size_t hi = std::numeric_limits<std::size_t>::max() / sizeof(Splat);
+    BOOST_FOREACH(const cl::Device &device, devices)
+    {
+        const std::tr1::uint64_t maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        hi = std::min(hi, std::size_t(maxAlloc / sizeof(Splat)));
+    }
+
+    /* Usage grows with the bucket size, so binary search for the largest
+     * bucket that fits. lo is always known to fit (treating 0 as fitting).
+     */
+    std::size_t lo = 0;
+    while (lo < hi)
+    {
+        const std::size_t mid = lo + (hi - lo + 1) / 2;
+        const CLH::ResourceUsage usage = resourceUsage(vm, mid);
+        bool fits = true;
+        BOOST_FOREACH(const cl::Device &device, devices)
+        {
+            const std::tr1::uint64_t deviceTotalMemory = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+            const std::tr1::uint64_t deviceMaxMemory = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+            if (usage.getMaxMemory() > deviceMaxMemory
+                || usage.getTotalMemory() > deviceTotalMemory * 0.8)
+            {
+                fits = false;
+                break;
+            }
+        }
+        if (fits)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return std::tr1::uint64_t(lo) * sizeof(Splat);
+}
+
+/**
+ * Round a memory size down to a whole number of MiB, to keep the plan
+ * readable. Sizes under 1MiB are left alone.
+ */
+static std::tr1::uint64_t roundCapacity(std::tr1::uint64_t bytes)
+{
+    const std::tr1::uint64_t MiB = 1024 * 1024;
+    return bytes >= MiB ? bytes / MiB * MiB : bytes;
+}
+
+void planMemory(
+    po::variables_map &vm,
+    std::tr1::uint64_t hostMemory,
+    std::tr1::uint64_t deviceBucketMemory,
+    std::size_t numDevices,
+    bool isMPI)
+{
+    MLSGPU_ASSERT(numDevices > 0, std::invalid_argument);
+    if (hostMemory == 0)
+        throw invalid_option(std::string("--") + Option::memAuto
+                             + " cannot determine the host memory on this platform");
+
+    /* A quarter of host memory is held back for everything not covered by
+     * the options: the OS, file buffers, per-bin scratch and so on.
+     */
+    const std::tr1::uint64_t budget = hostMemory / 4 * 3;
+    const std::tr1::uint64_t meshMin = getMeshHostMemory(vm);
+
+    /* Relative shares of the budget. The mesh pools need only hold a few
+     * bins' worth of output, so they get the smallest shares but never less
+     * than validateOptions requires. With --mem-broker the host splat and
+     * mesh shares become a single arena (see createBrokerArena), so they are
+     * still only counted once.
+     */
+    struct Share
+    {
+        const char *option;
+        double weight;
+        std::tr1::uint64_t minimum;
+    };
+    const Share shares[] =
+    {
+        { Option::memHostSplats, 0.35, 0 },
+        { Option::memLoadSplats, 0.15, 0 },
+        { Option::memMesh,       0.15, meshMin },
+        { Option::memReorder,    0.25, 0 },
+        { Option::memGather,     0.10, meshMin }
+    };
+    const std::size_t numShares = isMPI ? 5 : 4;
+
+    // Options given explicitly come off the top
+    std::tr1::uint64_t fixed = 0;
+    double weights = 0.0;
+    for (std::size_t i = 0; i < numShares; i++)
+    {
+        const po::variable_value &value = vm[shares[i].option];
+        if (value.defaulted())
+            weights += shares[i].weight;
+        else
+            fixed += value.as<Capacity>();
+    }
+    if (!vm[Option::memBucketSplats].defaulted())
+        fixed += vm[Option::memBucketSplats].as<Capacity>();
+
+    const std::tr1::uint64_t remaining = fixed < budget ? budget - fixed : 0;
+    std::tr1::uint64_t total = fixed;
+    for (std::size_t i = 0; i < numShares; i++)
+    {
+        po::variable_value &value = vm.find(shares[i].option)->second;
+        if (value.defaulted())
+        {
+            std::tr1::uint64_t bytes = roundCapacity(std::tr1::uint64_t(remaining * (shares[i].weight / weights)));
+            bytes = std::max(bytes, shares[i].minimum);
+            value.value() = Capacity(bytes);
+            total += bytes;
+        }
+    }
+    if (total > budget)
+    {
+        std::ostringstream msg;
+        msg << "--" << Option::memAuto << " requires at least " << Capacity(total) << " of host memory for the\n"
+            << "given options, but only " << Capacity(budget) << " is available to it.\n"
+            << "Try reducing --levels, or increasing --subsampling.";
+        throw invalid_option(msg.str());
+    }
+
+    /* The bucket size is limited by the devices, by what can be loaded at
+     * once, and by allowing two buckets in flight per device in the host pool.
+     */
+    po::variable_value &bucket = vm.find(Option::memBucketSplats)->second;
+    if (bucket.defaulted())
+    {
+        std::tr1::uint64_t bytes = deviceBucketMemory;
+        bytes = std::min(bytes, std::tr1::uint64_t(vm[Option::memLoadSplats].as<Capacity>()));
+        bytes = std::min(bytes, std::tr1::uint64_t(vm[Option::memHostSplats].as<Capacity>()) / (2 * numDevices));
+        bytes = roundCapacity(bytes);
+        if (bytes < sizeof(Splat))
+            throw invalid_option(std::string("--") + Option::memAuto
+                                 + " could not fit a bucket in the available memory");
+        bucket.value() = Capacity(bytes);
+    }
+}
+
+void logMemoryPlan(const po::variables_map &vm, bool isMPI)
+{
+    const char * const options[] =
+    {
+        Option::memLoadSplats, Option::memHostSplats, Option::memBucketSplats,
+        Option::memMesh, Option::memReorder, Option::memGather
+    };
+    const std::size_t numOptions = isMPI ? 6 : 5;
+    const bool automatic = vm.count(Option::memAuto);
+
+    Log::log[Log::info] << "Memory plan:\n";
+    for (std::size_t i = 0; i < numOptions; i++)
+    {
+        const po::variable_value &value = vm[options[i]];
+        Log::log[Log::info] << "  --" << options[i] << "=" << value.as<Capacity>()
+            << (automatic && value.defaulted() ? " (auto)" : "") << "\n";
+    }
+    if (vm.count(Option::memBroker))
+        Log::log[Log::info] << "  --" << Option::memHostSplats << " and --" << Option::memMesh
+            << " are shared by --" << Option::memBroker << " ("
+            << Capacity(getBrokerBudget(vm)) << " in total)\n";
+}
+
 void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsage)
 {
     const std::string deviceName = "OpenCL device `" + device.getInfo<CL_DEVICE_NAME>() + "'";
@@ -517,7 +1003,185 @@ void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsa
     }
 }
 
-void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float smooth, float maxRadius)
+/**
+ * Add a file to the set of inputs, after checking that it is not too large.
+ *
+ * @param files        Set of inputs.
+ * @param path         Path to the file, for error messages.
+ * @param reader       File to add. Ownership is passed to @a files.
+ * @param totalSplats  Incremented by the number of splats in the file.
+ * @param totalBytes   Incremented by the number of bytes of splat data in the file.
+ */
+static void addInputFile(
+    SplatSet::FileSet &files, const boost::filesystem::path &path,
+    std::auto_ptr<FastPly::Reader> &reader,
+    std::tr1::uint64_t &totalSplats, std::tr1::uint64_t &totalBytes)
+{
+    const FastPly::Reader::size_type size = reader->size();
+    const std::size_t vertexSize = reader->getVertexSize();
+    try
+    {
+        files.addFile(reader.get());
+    }
+    catch (std::length_error &e)
+    {
+        std::ostringstream msg;
+        msg << "Too many input files or samples to number them (adding " << path.string()
+            << " with " << size << " samples)";
+        throw std::runtime_error(msg.str());
+    }
+    reader.release();
+    totalSplats += size;
+    totalBytes += size * vertexSize;
+}
+
+/**
+ * Open the input files at positions @a first, @a first + @a stride, ... in
+ * @a paths. This is run on several threads at once by @ref prepareInputs.
+ * Errors are stored rather than thrown, so that they can be reported in file
+ * order.
+ *
+ * @param paths          All the input files.
+ * @param first,stride   Selection of the files to open.
+ * @param vm             Command-line options.
+ * @param smooth,maxRadius Parameters passed to the reader.
+ * @param manifest       Cache of file headers, or @c NULL to always parse them.
+ * @param readers        Slot for each reader, parallel to @a paths.
+ * @param errors         Slot for each error, parallel to @a paths.
+ */
+static void openInputs(
+    const std::vector<boost::filesystem::path> &paths,
+    std::size_t first, std::size_t stride,
+    const po::variables_map &vm, float smooth, float maxRadius,
+    InputManifest *manifest,
+    boost::ptr_vector<boost::nullable<FastPly::Reader> > &readers,
+    std::vector<boost::exception_ptr> &errors)
+{
+    const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
+    const bool cacheIndex = vm.count(Option::asciiIndexCache);
+    const bool doDecache = vm.count(Option::decache);
+    for (std::size_t i = first; i < paths.size(); i += stride)
+    {
+        try
+        {
+            const boost::filesystem::path &path = paths[i];
+            if (doDecache)
+                decache(path.string());
+
+            FastPly::Reader::Layout layout;
+            std::auto_ptr<FastPly::Reader> reader;
+            if (manifest != NULL && manifest->lookup(path, layout))
+                reader.reset(new FastPly::Reader(readerType, path, layout, smooth, maxRadius, cacheIndex));
+            else
+            {
+                reader.reset(new FastPly::Reader(readerType, path, smooth, maxRadius, cacheIndex));
+                if (manifest != NULL)
+                    manifest->record(path, reader->getLayout());
+            }
+            // Each thread writes to distinct elements, so no locking is needed
+            readers.replace(i, reader.release());
+        }
+        catch (...)
+        {
+            errors[i] = boost::current_exception();
+        }
+    }
+}
+
+/**
+ * Estimate normals and radii for input files that only contain positions, and
+ * write the results to a single splat file.
+ *
+ * @param files     Set to which the splat file is added if it is temporary.
+ * @param paths     Files lacking normals.
+ * @param vm        Command-line options.
+ * @return The path to the splat file.
+ */
+static boost::filesystem::path estimateNormals(
+    SplatSet::FileSet &files,
+    const std::vector<boost::filesystem::path> &paths,
+    const po::variables_map &vm)
+{
+    Statistics::Timer timer("normals.time");
+
+    const float spacing = vm[Option::fitGrid].as<double>();
+    const float halo = vm.count(Option::normalHalo)
+        ? vm[Option::normalHalo].as<double>() : 8.0 * spacing;
+    const unsigned int neighbours = vm[Option::normalNeighbours].as<int>();
+    const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
+    const bool cacheIndex = vm.count(Option::asciiIndexCache);
+    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
+    const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const unsigned int leafCells = vm[Option::leafCells].as<int>();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+    const unsigned int microCells = std::min(leafCells, blockCells);
+
+    /* The points are given the halo as their radius, so that each bucket
+     * also receives the neighbours of the points inside it.
+     */
+    SplatSet::FastBlobSet<SplatSet::FileSet> points;
+    std::vector<const float *> scanners;
+    BOOST_FOREACH(const boost::filesystem::path &path, paths)
+    {
+        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(readerType, path, 1.0f, halo, cacheIndex));
+        scanners.push_back(reader->getScanner());
+        points.addFile(reader.get());
+        reader.release();
+    }
+
+    Log::log[Log::info] << "Estimating normals...\n";
+    try
+    {
+        points.computeBlobs(spacing, microCells, &Log::log[Log::info]);
+    }
+    catch (std::length_error &e)
+    {
+        throw std::runtime_error("At least one input point is required");
+    }
+
+    boost::filesystem::path outPath;
+    boost::filesystem::ofstream out;
+    if (vm.count(Option::normalFile))
+    {
+        outPath = vm[Option::normalFile].as<std::string>();
+        out.open(outPath, std::ios::out | std::ios::binary);
+        if (!out)
+            throw boost::enable_error_info(std::ios::failure("Could not open file"))
+                << boost::errinfo_file_name(outPath.string())
+                << boost::errinfo_errno(errno);
+    }
+    else
+    {
+        createTmpFile(outPath, out);
+        files.addTemporary(outPath);
+    }
+    out.exceptions(std::ios::failbit | std::ios::badbit);
+
+    try
+    {
+        Normals::writeHeader(out, points.numSplats());
+        ProgressDisplay progress(points.numSplats(), Log::log[Log::info]);
+        Normals::Estimator estimator(points, scanners, neighbours, halo, out, &progress);
+        Bucket::bucket(points, points.getBoundingGrid(), maxBucketSplats, blockCells, 0, microCells, maxSplit,
+                       boost::ref(estimator));
+        MLSGPU_ASSERT(estimator.numWritten() == points.numSplats(), std::logic_error);
+        out.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e) << boost::errinfo_file_name(outPath.string());
+    }
+    return outPath;
+}
+
+/**
+ * List the input files named on the command line, expanding directories to
+ * the PLY files they contain.
+ */
+static std::vector<boost::filesystem::path> listInputs(const po::variables_map &vm)
 {
     const std::vector<std::string> &names = vm[Option::inputFile].as<std::vector<std::string> >();
     std::vector<boost::filesystem::path> paths;
@@ -537,32 +1201,82 @@ void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float
         else
             paths.push_back(name);
     }
+    return paths;
+}
 
-    const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
-    if (paths.size() > SplatSet::FileSet::maxFiles)
+void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float smooth, float maxRadius,
+                   InputSources *sources)
+{
+    const std::vector<boost::filesystem::path> paths = listInputs(vm);
+    if (sources != NULL)
+        sources->clear();
+
+    boost::scoped_ptr<InputManifest> manifest;
+    if (vm.count(Option::inputManifest))
+        manifest.reset(new InputManifest(vm[Option::inputManifest].as<std::string>()));
+
+    /* Parsing the headers is mostly latency (particularly on network
+     * filesystems), so it is done with more threads than there are cores.
+     */
+    boost::ptr_vector<boost::nullable<FastPly::Reader> > readers;
+    for (std::size_t i = 0; i < paths.size(); i++)
+        readers.push_back(NULL);
+    std::vector<boost::exception_ptr> errors(paths.size());
     {
-        std::ostringstream msg;
-        msg << "Too many input files (" << paths.size() << " > " << SplatSet::FileSet::maxFiles << ")";
-        throw std::runtime_error(msg.str());
+        const std::size_t numThreads = std::min(
+            std::size_t(vm[Option::inputThreads].as<int>()), std::max(paths.size(), std::size_t(1)));
+        // The calling thread handles the first share
+        boost::ptr_vector<boost::thread> threads;
+        for (std::size_t i = 1; i < numThreads; i++)
+            threads.push_back(new boost::thread(
+                    openInputs, boost::cref(paths), i, numThreads, boost::cref(vm),
+                    smooth, maxRadius, manifest.get(), boost::ref(readers), boost::ref(errors)));
+        openInputs(paths, 0, numThreads, vm, smooth, maxRadius, manifest.get(), readers, errors);
+        for (std::size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+    for (std::size_t i = 0; i < paths.size(); i++)
+        if (errors[i])
+            boost::rethrow_exception(errors[i]);
+
+    if (manifest)
+    {
+        manifest->save();
+        Log::log[Log::debug] << "Found " << manifest->numHits() << " of " << paths.size()
+            << " input files in the manifest\n";
+        Statistics::getStatistic<Statistics::Counter>("files.manifestHits").add(manifest->numHits());
     }
+
     std::tr1::uint64_t totalSplats = 0;
     std::tr1::uint64_t totalBytes = 0;
-    BOOST_FOREACH(const boost::filesystem::path &path, paths)
+    std::vector<boost::filesystem::path> positionPaths;
+    for (std::size_t i = 0; i < paths.size(); i++)
     {
-        if (vm.count(Option::decache))
-            decache(path.string());
-        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(readerType, path.string(), smooth, maxRadius));
-        if (reader->size() > SplatSet::FileSet::maxFileSplats)
+        const boost::filesystem::path &path = paths[i];
+        std::auto_ptr<FastPly::Reader> reader(readers.replace(i, NULL).release());
+        if (!reader->hasNormals())
         {
-            std::ostringstream msg;
-            msg << "Too many samples in " << path << " ("
-                << reader->size() << " > " << SplatSet::FileSet::maxFileSplats << ")";
-            throw std::runtime_error(msg.str());
+            if (!vm.count(Option::estimateNormals))
+                throw boost::enable_error_info(FastPly::FormatError("Normals and radii not found (use --estimate-normals)"))
+                    << boost::errinfo_file_name(path.string());
+            positionPaths.push_back(path);
+        }
+        else
+        {
+            addInputFile(files, path, reader, totalSplats, totalBytes);
+            if (sources != NULL)
+                sources->push_back(std::vector<boost::filesystem::path>(1, path));
         }
-        totalSplats += reader->size();
-        totalBytes += reader->size() * reader->getVertexSize();
-        files.addFile(reader.get());
-        reader.release();
+    }
+
+    if (!positionPaths.empty())
+    {
+        const boost::filesystem::path path = estimateNormals(files, positionPaths, vm);
+        const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
+        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(readerType, path.string(), smooth, maxRadius));
+        addInputFile(files, path, reader, totalSplats, totalBytes);
+        if (sources != NULL)
+            sources->push_back(positionPaths);
     }
 
     Statistics::getStatistic<Statistics::Counter>("files.scans").add(paths.size());
@@ -588,7 +1302,8 @@ void doComputeBlobs(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
     SplatSet::FileSet &splats,
-    boost::function<void(float, unsigned int)> computeBlobs)
+    boost::function<void(float, unsigned int)> computeBlobs,
+    InputSources *sources)
 {
     const float spacing = vm[Option::fitGrid].as<double>();
     const float smooth = vm[Option::fitSmooth].as<double>();
@@ -602,7 +1317,7 @@ void doComputeBlobs(
     const unsigned int blockCells = block - 1;
     const unsigned int microCells = std::min(leafCells, blockCells);
 
-    prepareInputs(splats, vm, smooth, maxRadius);
+    prepareInputs(splats, vm, smooth, maxRadius, sources);
     try
     {
         Timeplot::Action timer("bbox", tworker, "bbox.time");
@@ -614,19 +1329,65 @@ void doComputeBlobs(
     }
 }
 
-unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
+void doRemoveOutliers(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    SplatSet::FastBlobSet<SplatSet::FileSet> &splats)
+{
+    if (!vm.count(Option::removeOutliers))
+        return;
+
+    Timeplot::Action timer("outliers", tworker, "outliers.time");
+
+    const float spacing = vm[Option::fitGrid].as<double>();
+    const unsigned int minCoverage = vm[Option::outlierNeighbours].as<int>();
+    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
+    const std::size_t maxSplit = vm[Option::maxSplit].as<int>();
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const unsigned int leafCells = vm[Option::leafCells].as<int>();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+    const unsigned int microCells = std::min(leafCells, blockCells);
+
+    const SplatSet::splat_id total = splats.numSplats();
+    Log::log[Log::info] << "Removing outliers...\n";
+    ProgressDisplay progress(total, Log::log[Log::info]);
+    Outliers::Filter filter(splats, minCoverage, &progress);
+    Bucket::bucket(splats, splats.getBoundingGrid(), maxBucketSplats, blockCells, 0, microCells, maxSplit,
+                   boost::ref(filter));
+    MLSGPU_ASSERT(filter.numClassified() == total, std::logic_error);
+
+    const Statistics::Container::vector<SplatSet::splat_id> &outliers = filter.getOutliers();
+    BOOST_FOREACH(SplatSet::splat_id id, outliers)
+    {
+        splats.excludeSplat(id);
+    }
+    Statistics::getStatistic<Statistics::Counter>("outliers.removed").add(outliers.size());
+    Log::log[Log::info] << "Removed " << outliers.size() << " of " << total << " splats as outliers\n";
+
+    /* The bounding box may have shrunk, and the blobs must not count the
+     * removed splats or the buckets will be sized for them.
+     */
+    if (!outliers.empty())
+    {
+        try
+        {
+            splats.computeBlobs(spacing, microCells, &Log::log[Log::info], false);
+        }
+        catch (std::length_error &e)
+        {
+            throw std::runtime_error("All input points were removed as outliers");
+        }
+    }
+}
+
+unsigned int postprocessGrid(const po::variables_map &vm, Grid &grid)
 {
     for (unsigned int i = 0; i < 3; i++)
     {
         double size = grid.numCells(i) * grid.getSpacing();
         Statistics::getStatistic<Statistics::Variable>(std::string("bbox") + "XYZ"[i]).add(size);
-        if (grid.numVertices(i) > Marching::MAX_GLOBAL_DIMENSION)
-        {
-            std::ostringstream msg;
-            msg << "The bounding box is too big (" << grid.numVertices(i) << " grid units).\n"
-                << "Perhaps you have used the wrong units for --fit-grid?";
-            throw std::runtime_error(msg.str());
-        }
     }
 
     const bool split = vm.count(Option::split);
@@ -649,17 +1410,130 @@ unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
          */
         chunkCells = (unsigned int) ceil(sqrt(splitSize / 760.0));
         if (chunkCells == 0) chunkCells = 1;
+
+        const int subsampling = vm[Option::subsampling].as<int>();
+        const int levels = vm[Option::levels].as<int>();
+        const unsigned int leafCells = vm[Option::leafCells].as<int>();
+        const unsigned int blockCells = (1U << (levels + subsampling - 1)) - 1;
+        const unsigned int microCells = std::min(leafCells, blockCells);
+        chunkCells = Bucket::chunkSize(chunkCells, microCells);
+
+        /* Extend the grid down to the lattice of chunks, which is anchored at
+         * the world origin, so that the chunks do not move when the extent of
+         * the model changes.
+         */
+        const Grid::difference_type c = chunkCells;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const Grid::extent_type extent = grid.getExtent(i);
+            grid.setExtent(i, divDown(extent.first, c) * c, extent.second);
+        }
+    }
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        if (grid.numVertices(i) > Marching::MAX_GLOBAL_DIMENSION)
+        {
+            std::ostringstream msg;
+            msg << "The bounding box is too big (" << grid.numVertices(i) << " grid units).\n"
+                << "Perhaps you have used the wrong units for --fit-grid?";
+            throw std::runtime_error(msg.str());
+        }
     }
     return chunkCells;
 }
 
+/**
+ * Chunk filter that selects the chunks intersecting a box of cells.
+ */
+class ChunkBoxFilter
+{
+public:
+    typedef bool result_type;
+
+    /**
+     * Constructor.
+     * @param lower,upper  Half-open range of cells, in the same coordinate
+     *                     system as the grid extents.
+     */
+    ChunkBoxFilter(const Grid::difference_type lower[3], const Grid::difference_type upper[3])
+    {
+        std::copy(lower, lower + 3, this->lower);
+        std::copy(upper, upper + 3, this->upper);
+    }
+
+    bool operator()(const boost::array<Grid::difference_type, 3> &chunk, const Grid &chunkGrid) const
+    {
+        (void) chunk;
+        for (unsigned int i = 0; i < 3; i++)
+            if (chunkGrid.getExtent(i).second <= lower[i] || chunkGrid.getExtent(i).first >= upper[i])
+                return false;
+        return true;
+    }
+
+private:
+    Grid::difference_type lower[3], upper[3];
+};
+
+/**
+ * Chunk filter that selects chunks from a list of coordinates.
+ */
+class ChunkListFilter
+{
+public:
+    typedef bool result_type;
+
+    explicit ChunkListFilter(const std::set<boost::array<Grid::difference_type, 3> > &chunks)
+        : chunks(chunks) {}
+
+    bool operator()(const boost::array<Grid::difference_type, 3> &chunk, const Grid &chunkGrid) const
+    {
+        (void) chunkGrid;
+        return chunks.count(chunk) > 0;
+    }
+
+private:
+    std::set<boost::array<Grid::difference_type, 3> > chunks;
+};
+
+/**
+ * Convert a world-space box to the range of cells of @a grid that it
+ * touches, clipped to the extents of @a grid.
+ *
+ * @param grid         Grid whose cells are used.
+ * @param box          Box given as x0, y0, z0, x1, y1, z1.
+ * @param[out] lower,upper Half-open range of cells, in the same coordinate
+ *                     system as the grid extents.
+ * @return Whether the range is non-empty.
+ */
+static bool boxToCells(
+    const Grid &grid, const std::vector<double> &box,
+    Grid::difference_type lower[3], Grid::difference_type upper[3])
+{
+    bool nonEmpty = true;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const Grid::extent_type &extent = grid.getExtent(i);
+        const double ref = grid.getReference()[i];
+        const double lo = std::floor((box[i] - ref) / grid.getSpacing());
+        const double hi = std::floor((box[i + 3] - ref) / grid.getSpacing()) + 1.0;
+        // Clamping in floating point avoids overflow for boxes far outside the grid
+        lower[i] = Grid::difference_type(std::min(std::max(lo, double(extent.first)), double(extent.second)));
+        upper[i] = Grid::difference_type(std::min(std::max(hi, double(extent.first)), double(extent.second)));
+        if (lower[i] >= upper[i])
+            nonEmpty = false;
+    }
+    return nonEmpty;
+}
+
 void doBucket(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
     const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
     const Grid &grid,
     Grid::size_type chunkCells,
-    BucketCollector &collector)
+    BucketCollector &collector,
+    const Bucket::ChunkFilter &incrementalFilter)
 {
     Timeplot::Action bucketTimer("compute", tworker, "bucket.compute");
 
@@ -673,8 +1547,215 @@ void doBucket(
     const unsigned int blockCells = block - 1;
     const unsigned int microCells = std::min(leafCells, blockCells);
 
-    Bucket::bucket(splats, grid, maxBucketSplats, blockCells, chunkCells, microCells, maxSplit,
-                   boost::ref(collector));
+    Grid region = grid;
+    Bucket::ChunkFilter chunkFilter = incrementalFilter;
+    if (vm.count(Option::region))
+    {
+        Grid::difference_type lower[3], upper[3];
+        if (!boxToCells(grid, parseRegion(vm), lower, upper))
+        {
+            Log::log[Log::warn] << "The region of interest does not intersect the input\n";
+            return;
+        }
+        if (chunkCells != 0)
+            chunkFilter = ChunkBoxFilter(lower, upper);
+        else
+        {
+            for (unsigned int i = 0; i < 3; i++)
+                region.setExtent(i, lower[i], upper[i]);
+        }
+    }
+    else if (vm.count(Option::chunk))
+        chunkFilter = ChunkListFilter(parseChunks(vm));
+
+    Bucket::bucket(splats, region, maxBucketSplats, blockCells, chunkCells, microCells, maxSplit,
+                   boost::ref(collector), Bucket::Recursion(), chunkFilter);
+}
+
+IncrementalBuild::IncrementalBuild(
+    const po::variables_map &vm,
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+    const InputSources &sources,
+    const Grid &grid,
+    Grid::size_type chunkCells)
+    : path(vm[Option::incremental].as<std::string>()),
+    namer(getNamer(vm, vm[Option::outputFile].as<std::string>())),
+    full(true)
+{
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const unsigned int leafCells = vm[Option::leafCells].as<int>();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+    const unsigned int microCells = std::min(leafCells, blockCells);
+
+    IncrementalState::Layout layout;
+    layout.options = outputOptions(vm);
+    layout.spacing = grid.getSpacing();
+    layout.chunkCells = chunkCells;
+    current = IncrementalState(layout);
+
+    /* Find the cells touched by each file from the blobs. The blob
+     * coordinates are in units of microblocks relative to the grid, and
+     * are converted to cells relative to the world origin.
+     */
+    std::vector<IncrementalState::Box> boxes(sources.size());
+    std::vector<bool> hasBox(sources.size(), false);
+    boost::scoped_ptr<SplatSet::BlobStream> blobs(splats.makeBlobStream(grid, microCells));
+    while (!blobs->empty())
+    {
+        const SplatSet::BlobInfo blob = **blobs;
+        const std::size_t fileIds[2] = { splats.getFileId(blob.firstSplat), splats.getFileId(blob.lastSplat - 1) };
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            const std::size_t f = fileIds[j];
+            MLSGPU_ASSERT(f < sources.size(), std::logic_error);
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                const Grid::difference_type lower = grid.getExtent(i).first + blob.lower[i] * Grid::difference_type(microCells);
+                const Grid::difference_type upper = grid.getExtent(i).first + (blob.upper[i] + 1) * Grid::difference_type(microCells);
+                boxes[f].lower[i] = hasBox[f] ? std::min(boxes[f].lower[i], lower) : lower;
+                boxes[f].upper[i] = hasBox[f] ? std::max(boxes[f].upper[i], upper) : upper;
+            }
+            hasBox[f] = true;
+        }
+        ++*blobs;
+    }
+    for (std::size_t i = 0; i < sources.size(); i++)
+        BOOST_FOREACH(const boost::filesystem::path &source, sources[i])
+            current.addFile(source, hasBox[i] ? &boxes[i] : NULL);
+
+    std::size_t changedFiles = 0;
+    if (!old.load(path))
+        Log::log[Log::info] << "No previous incremental state found, so all chunks will be generated\n";
+    else if (!current.changedChunks(old, chunks, changedFiles))
+        Log::log[Log::info] << "The options or bounding box have changed, so all chunks will be generated\n";
+    else
+    {
+        full = false;
+        Log::log[Log::info] << changedFiles << " input file(s) changed, so "
+            << chunks.size() << " chunk(s) will be regenerated\n";
+        chunkFilter = ChunkListFilter(chunks);
+        Statistics::getStatistic<Statistics::Counter>("incremental.chunks").add(chunks.size());
+    }
+
+    /* Remove the state, so that if this run fails the next one starts from
+     * scratch, and remove the outputs that will be regenerated so that chunks
+     * that are now empty do not leave stale files behind.
+     */
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+    removeOutputs(full ? old.getChunks()
+                  : std::vector<IncrementalState::chunk_coords>(chunks.begin(), chunks.end()));
+}
+
+void IncrementalBuild::removeOutputs(const std::vector<IncrementalState::chunk_coords> &stale) const
+{
+    boost::system::error_code ec;
+    BOOST_FOREACH(const IncrementalState::chunk_coords &coords, stale)
+    {
+        ChunkId id;
+        id.coords = coords;
+        boost::filesystem::remove(namer(id), ec);
+    }
+}
+
+void IncrementalBuild::setupMesher(OOCMesher &mesher) const
+{
+    mesher.setPruneBaseVertices(full ? 0 : old.keptVertices(chunks));
+}
+
+bool IncrementalBuild::checkPrune(const OOCMesher &mesher)
+{
+    if (full)
+        return true;
+
+    std::set<IncrementalState::chunk_coords> extended = chunks;
+    if (!old.addPruneChanges(mesher.getThresholdVertices(), extended))
+        return true;
+
+    std::vector<IncrementalState::chunk_coords> added;
+    std::set_difference(extended.begin(), extended.end(), chunks.begin(), chunks.end(),
+                        std::back_inserter(added));
+    Log::log[Log::info] << "The prune threshold has changed, so " << added.size()
+        << " more chunk(s) will be regenerated\n";
+    Statistics::getStatistic<Statistics::Counter>("incremental.chunks").add(added.size());
+    removeOutputs(added);
+    chunks.swap(extended);
+    chunkFilter = ChunkListFilter(chunks);
+    return false;
+}
+
+void IncrementalBuild::finish(const OOCMesher &mesher)
+{
+    if (!full)
+        current.keepGroups(old, chunks);
+    const std::vector<OOCMesher::ChunkGroup> groups = mesher.getChunkGroups();
+    BOOST_FOREACH(const OOCMesher::ChunkGroup &group, groups)
+        current.addGroup(group.chunks, group.vertices, group.largestPruned, group.smallestKept);
+    current.save(path);
+}
+
+FieldCacheWriter *createFieldCache(const po::variables_map &vm, const Grid &grid)
+{
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const WriterType writerType = vm[Option::writer].as<Choice<WriterTypeWrapper> >();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+
+    return new FieldCacheWriter(
+        writerType, vm[Option::saveField].as<std::string>(),
+        grid, blockCells, vm.count(Option::split), makeOptions(vm));
+}
+
+void doExtractField(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    const std::pair<cl::Context, cl::Device> &device,
+    FastPly::Writer &writer,
+    MesherBase &mesher)
+{
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const ReaderType readerType = vm[Option::reader].as<Choice<ReaderTypeWrapper> >();
+    const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
+    const unsigned int block = 1U << (levels + subsampling - 1);
+    const unsigned int blockCells = block - 1;
+
+    FieldCacheReader reader(readerType, vm[Option::extractField].as<std::string>());
+    writer.addComment("mlsgpu field options:" + reader.getOptions());
+    if (reader.isSplit() != bool(vm.count(Option::split)))
+        throw std::runtime_error(std::string("--") + Option::split
+                                 + " must match the run that wrote the field cache");
+    if (reader.getMaxCells() > blockCells)
+        throw std::runtime_error(std::string("The field cache has larger bins than --")
+                                 + Option::levels + " and --" + Option::subsampling + " allow");
+    Log::log[Log::info] << "Extracting " << reader.numBins() << " bins from the field cache\n";
+
+    FieldExtractor extractor(device.first, device.second, blockCells, getMeshMemory(vm));
+    MesherGroup mesherGroup(memMesh);
+    for (unsigned int pass = 0; pass < mesher.numPasses(); pass++)
+    {
+        Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher.numPasses() << std::endl;
+        std::ostringstream passName;
+        passName << "pass" << pass + 1 << ".time";
+        Statistics::Timer timer(passName.str());
+
+        ProgressDisplay progress(reader.numBins(), Log::log[Log::info]);
+        mesherGroup.setInputFunctor(mesher.functor(pass));
+        mesherGroup.start();
+        try
+        {
+            extractor(tworker, reader, makeOutputGenerator(mesherGroup), makeBinDone(mesherGroup), &progress);
+        }
+        catch (...)
+        {
+            mesherGroup.stop();
+            throw;
+        }
+        mesherGroup.stop();
+    }
 }
 
 void setWriterComments(const po::variables_map &vm, FastPly::Writer &writer)
@@ -701,59 +1782,201 @@ void setMesherOptions(const po::variables_map &vm, MesherBase &mesher)
     mesher.setReorderCapacity(memReorder);
 }
 
+/**
+ * Capture the exception currently being handled, so that it can be rethrown
+ * in another thread. It must be called from a @c catch block. In addition to
+ * the types known to @c boost::current_exception, it preserves @c cl::Error
+ * and @c std::bad_alloc, which would otherwise be rethrown as
+ * @c boost::unknown_exception and escape the handlers in @c main.
+ */
+static boost::exception_ptr captureException()
+{
+    try
+    {
+        throw;
+    }
+    catch (cl::Error &e)
+    {
+        return boost::copy_exception(e);
+    }
+    catch (std::bad_alloc &e)
+    {
+        return boost::copy_exception(e);
+    }
+    catch (...)
+    {
+        return boost::current_exception();
+    }
+}
+
+/**
+ * Create the @ref DeviceWorkerGroup for one device, for use in a thread per
+ * device by @ref SlaveWorkers::init.
+ *
+ * @param vm               Command-line options
+ * @param device           Device for the group
+ * @param outputGenerator, binDone  Passed to the @ref DeviceWorkerGroup constructor
+ * @param[out] out         The new group, or @c NULL on error
+ * @param[out] error       The error, if any
+ */
+static void makeDeviceWorkerGroup(
+    const po::variables_map &vm,
+    const std::pair<cl::Context, cl::Device> &device,
+    const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+    const DeviceWorkerGroup::BinDone &binDone,
+    DeviceWorkerGroup *&out,
+    boost::exception_ptr &error)
+{
+    try
+    {
+        const int subsampling = vm[Option::subsampling].as<int>();
+        const int levels = vm[Option::levels].as<int>();
+        const unsigned int numDeviceThreads = vm[Option::deviceThreads].as<int>();
+        const float boundaryLimit = vm[Option::fitBoundaryLimit].as<double>();
+        const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
+        const std::size_t deviceSpare = getDeviceWorkerGroupSpare(vm);
+        const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
+
+        const unsigned int block = 1U << (levels + subsampling - 1);
+        const unsigned int blockCells = block - 1;
+
+        Statistics::Timer timer("device.init.time");
+        out = new DeviceWorkerGroup(
+            numDeviceThreads, deviceSpare,
+            outputGenerator, binDone,
+            device.first, device.second,
+            maxBucketSplats, blockCells,
+            getMeshMemory(vm),
+            levels, subsampling,
+            boundaryLimit, shape);
+    }
+    catch (...)
+    {
+        out = NULL;
+        error = captureException();
+    }
+}
+
 SlaveWorkers::SlaveWorkers(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
     const std::vector<std::pair<cl::Context, cl::Device> > &devices,
-    const DeviceWorkerGroup::OutputGenerator &outputGenerator)
+    const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+    const DeviceWorkerGroup::BinDone &binDone,
+    CircularBufferArena *arena)
     : tworker(tworker)
 {
-    const int subsampling = vm[Option::subsampling].as<int>();
-    const int levels = vm[Option::levels].as<int>();
-    const unsigned int numDeviceThreads = vm[Option::deviceThreads].as<int>();
-    const float boundaryLimit = vm[Option::fitBoundaryLimit].as<double>();
-    const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
-    const std::size_t deviceSpare = getDeviceWorkerGroupSpare(vm);
+    // The bound copies of the arguments keep them alive for the thread
+    initThread.reset(new boost::thread(boost::bind(
+                &SlaveWorkers::init, this, vm, devices, outputGenerator, binDone, arena)));
+}
 
-    const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
-    const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
-    const std::size_t maxHostSplats = getMaxHostSplats(vm);
+SlaveWorkers::~SlaveWorkers()
+{
+    if (initThread)
+        initThread->join();
+}
 
-    const unsigned int block = 1U << (levels + subsampling - 1);
-    const unsigned int blockCells = block - 1;
+void SlaveWorkers::init(
+    const po::variables_map &vm,
+    const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+    const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+    const DeviceWorkerGroup::BinDone &binDone,
+    CircularBufferArena *arena)
+{
+    try
+    {
+        const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
+        const std::size_t maxHostSplats = getMaxHostSplats(vm);
 
-    std::vector<DeviceWorkerGroup *> deviceWorkerGroupPtrs;
-    for (std::size_t i = 0; i < devices.size(); i++)
+        std::vector<DeviceWorkerGroup *> groups(devices.size(), NULL);
+        std::vector<boost::exception_ptr> errors(devices.size());
+        {
+            // This thread handles the first device
+            boost::ptr_vector<boost::thread> threads;
+            for (std::size_t i = 1; i < devices.size(); i++)
+                threads.push_back(new boost::thread(
+                        makeDeviceWorkerGroup, boost::cref(vm), boost::cref(devices[i]),
+                        boost::cref(outputGenerator), boost::cref(binDone),
+                        boost::ref(groups[i]), boost::ref(errors[i])));
+            if (!devices.empty())
+                makeDeviceWorkerGroup(vm, devices[0], outputGenerator, binDone, groups[0], errors[0]);
+            for (std::size_t i = 0; i < threads.size(); i++)
+                threads[i].join();
+        }
+        // Take ownership before reporting errors, so that nothing leaks
+        for (std::size_t i = 0; i < groups.size(); i++)
+            if (groups[i] != NULL)
+                deviceWorkerGroups.push_back(groups[i]);
+        for (std::size_t i = 0; i < errors.size(); i++)
+            if (errors[i])
+                boost::rethrow_exception(errors[i]);
+
+        copyGroup.reset(new CopyGroup(groups, maxHostSplats, arena));
+        loader.reset(new BucketLoader(maxLoadSplats, *copyGroup, tworker));
+    }
+    catch (...)
     {
-        DeviceWorkerGroup *dwg = new DeviceWorkerGroup(
-            numDeviceThreads, deviceSpare,
-            outputGenerator,
-            devices[i].first, devices[i].second,
-            maxBucketSplats, blockCells,
-            getMeshMemory(vm),
-            levels, subsampling,
-            boundaryLimit, shape);
-        deviceWorkerGroups.push_back(dwg);
-        deviceWorkerGroupPtrs.push_back(dwg);
+        initError = captureException();
+    }
+}
+
+void SlaveWorkers::wait()
+{
+    if (initThread)
+    {
+        Timeplot::Action timer("wait", tworker, "device.init.wait");
+        initThread->join();
+        initThread.reset();
     }
-    copyGroup.reset(new CopyGroup(deviceWorkerGroupPtrs, maxHostSplats));
-    loader.reset(new BucketLoader(maxLoadSplats, *copyGroup, tworker));
+    if (initError)
+        boost::rethrow_exception(initError);
 }
 
 void SlaveWorkers::start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress)
 {
+    start(grid, progress);
+    loader->start(splats, grid);
+}
+
+void SlaveWorkers::start(const Grid &grid, ProgressMeter *progress)
+{
+    wait();
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].setProgress(progress);
 
-    loader->start(splats, grid);
+    loader->start(grid);
     copyGroup->start();
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].start(grid);
 }
 
+void SlaveWorkers::setFieldCache(FieldCacheWriter *fieldCache)
+{
+    wait();
+    for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
+        deviceWorkerGroups[i].setFieldCache(fieldCache);
+}
+
 void SlaveWorkers::stop()
 {
     copyGroup->stop();
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].stop();
 }
+
+MemoryBroker *createMemoryBroker(
+    const po::variables_map &vm,
+    SlaveWorkers &slaveWorkers, MesherGroup &mesherGroup)
+{
+    // Interval between rebalancing decisions, in seconds
+    const double interval = 0.5;
+
+    std::auto_ptr<MemoryBroker> broker(new MemoryBroker(getBrokerBudget(vm)));
+    broker->add("copy", slaveWorkers.copyGroup->getBuffer(), 1,
+                getCopyBufferMinimum(vm), slaveWorkers.copyGroup->getGetStat());
+    broker->add("mesher", mesherGroup.getBuffer(), 1,
+                getMeshHostMemory(vm), mesherGroup.getGetStat());
+    broker->start(interval);
+    return broker.release();
+}
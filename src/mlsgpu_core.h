@@ -34,10 +34,15 @@
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/exception_ptr.hpp>
 #include <ostream>
 #include <exception>
 #include <vector>
 #include <utility>
+#include <set>
 #include "splat_set.h"
 #include "workers.h"
 #include "bucket.h"
@@ -46,6 +51,9 @@
 #include "grid.h"
 #include "progress.h"
 #include "timeplot.h"
+#include "incremental.h"
+#include "field_cache.h"
+#include "memory_broker.h"
 #include <CL/cl.hpp>
 
 namespace CLH
@@ -53,6 +61,8 @@ namespace CLH
     class ResourceUsage;
 }
 
+class OOCMesher;
+
 namespace Option
 {
     const char * const help = "help";
@@ -87,15 +97,46 @@ namespace Option
     const char * const writer = "writer";
     const char * const ompThreads = "omp-threads";
     const char * const decache = "decache";
+    const char * const asciiIndexCache = "ascii-index-cache";
+    const char * const inputManifest = "input-manifest";
+    const char * const inputThreads = "input-threads";
+    const char * const readAhead = "read-ahead";
+    const char * const binFileOrder = "bin-file-order";
     const char * const checkpoint = "checkpoint";
     const char * const resume = "resume";
 
+    const char * const estimateNormals = "estimate-normals";
+    const char * const normalNeighbours = "normal-neighbours";
+    const char * const normalHalo = "normal-halo";
+    const char * const normalFile = "normal-file";
+
+    const char * const region = "region";
+    const char * const chunk = "chunk";
+    const char * const incremental = "incremental";
+
+    const char * const saveField = "save-field";
+    const char * const extractField = "extract-field";
+
+    const char * const removeOutliers = "remove-outliers";
+    const char * const outlierNeighbours = "outlier-neighbours";
+
     const char * const memLoadSplats = "mem-load-splats";
     const char * const memHostSplats = "mem-host-splats";
     const char * const memBucketSplats = "mem-bucket-splats";
     const char * const memMesh = "mem-mesh";
     const char * const memReorder = "mem-reorder";
     const char * const memGather = "mem-gather";
+    const char * const memAuto = "mem-auto";
+    const char * const memBroker = "mem-broker";
+
+    const char * const mpiScatterRun = "mpi-scatter-run";
+    const char * const mpiScatterSplats = "mpi-scatter-splats";
+    const char * const mpiCompress = "mpi-compress";
+    const char * const mpiCheckpointInterval = "mpi-checkpoint-interval";
+    const char * const mpiStripeSize = "mpi-stripe-size";
+    const char * const mpiStripeCount = "mpi-stripe-count";
+    const char * const mpiAggregateWrites = "mpi-aggregate-writes";
+    const char * const mpiBlobReaders = "mpi-blob-readers";
 };
 
 /**
@@ -140,6 +181,68 @@ std::size_t getMaxLoadSplats(const boost::program_options::variables_map &vm);
  */
 CLH::ResourceUsage resourceUsage(const boost::program_options::variables_map &vm);
 
+/**
+ * Determine how much memory the process may use on the host. This is the
+ * smaller of physical memory and any cgroup limit.
+ *
+ * @return The limit in bytes, or 0 if it cannot be determined on this platform.
+ */
+std::tr1::uint64_t hostMemoryLimit();
+
+/**
+ * Determine the largest value of <code>--mem-bucket-splats</code> for which
+ * @ref resourceUsage fits on every device in @a devices, keeping to the same
+ * limits that @ref validateDevice applies (without exceeding the 80% warning
+ * threshold).
+ *
+ * @return The limit in bytes, or 0 if even a single splat does not fit. If
+ * @a devices is empty there is no limit, and the maximum value is returned.
+ */
+std::tr1::uint64_t deviceBucketLimit(
+    const boost::program_options::variables_map &vm,
+    const std::vector<cl::Device> &devices);
+
+/**
+ * Choose values for the <code>--mem-*</code> options that were not given
+ * explicitly, for <code>--mem-auto</code>. A fixed fraction of @a hostMemory
+ * is divided between the host-side pools (less any that were given
+ * explicitly), and the bucket size is then made as large as the device and
+ * host pools allow while leaving room for two buckets in flight per device.
+ *
+ * The result depends only on the parameters, so under MPI every rank
+ * arrives at the same plan provided that it is given the same values.
+ *
+ * @param vm                   Command-line options, updated in place.
+ * @param hostMemory           Memory available on the host, from @ref hostMemoryLimit.
+ * @param deviceBucketMemory   Largest bucket the devices support, from @ref deviceBucketLimit.
+ * @param numDevices           Number of devices sharing the host memory.
+ * @param isMPI                Whether MPI-related options are expected.
+ *
+ * @throw invalid_option if the available memory is too small.
+ */
+void planMemory(
+    boost::program_options::variables_map &vm,
+    std::tr1::uint64_t hostMemory,
+    std::tr1::uint64_t deviceBucketMemory,
+    std::size_t numDevices,
+    bool isMPI);
+
+/**
+ * Log the values of the <code>--mem-*</code> options, marking those that
+ * were chosen by @ref planMemory.
+ */
+void logMemoryPlan(const boost::program_options::variables_map &vm, bool isMPI);
+
+/**
+ * Allocate the storage shared by the splat queue and the mesh queue for
+ * <code>--mem-broker</code>. It holds the memory given by
+ * <code>--mem-host-splats</code> and <code>--mem-mesh</code> once, and should
+ * be passed to both @ref SlaveWorkers and @ref MesherGroup.
+ *
+ * @return The arena, or @c NULL if <code>--mem-broker</code> was not given.
+ */
+CircularBufferArena *createBrokerArena(const boost::program_options::variables_map &vm);
+
 /**
  * Check that a CL device can safely be used.
  *
@@ -150,12 +253,27 @@ CLH::ResourceUsage resourceUsage(const boost::program_options::variables_map &vm
 void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsage);
 
 /**
- * Put the input files named in @a vm into @a files.
+ * The input files that each file of a @ref SplatSet::FileSet was made from,
+ * indexed by file ID.
+ */
+typedef std::vector<std::vector<boost::filesystem::path> > InputSources;
+
+/**
+ * Put the input files named in @a vm into @a files. Files that only contain
+ * positions are passed through normal estimation if it is enabled (see
+ * @ref Normals), and the resulting splat file is added in their place.
+ *
+ * @param[out] files       File set to which the inputs are added
+ * @param vm               Command-line options
+ * @param smooth, maxRadius Passed to the @ref FastPly::Reader constructor
+ * @param[out] sources     If non-NULL, receives the input files from which
+ *                         each file in @a files was made.
  *
  * @throw boost::exception   if there was a problem reading the files.
  * @throw std::runtime_error if there are too many files or splats.
  */
-void prepareInputs(SplatSet::FileSet &files, const boost::program_options::variables_map &vm, float smooth, float maxRadius);
+void prepareInputs(SplatSet::FileSet &files, const boost::program_options::variables_map &vm, float smooth, float maxRadius,
+                   InputSources *sources = NULL);
 
 /**
  * Dump an error to stderr.
@@ -169,6 +287,8 @@ void reportException(std::exception &e);
  * @param vm               Command-line options
  * @param[out] splats      The input files (must be initially empty)
  * @param computeBlobs     Callback to do the low-level computation
+ * @param[out] sources     If non-NULL, receives the input files of each file
+ *                         in @a splats (see @ref prepareInputs)
  *
  * @throw boost::exception   if there was a problem reading the files.
  * @throw std::runtime_error if there are too many or too few files or splats.
@@ -177,28 +297,55 @@ void doComputeBlobs(
     Timeplot::Worker &tworker,
     const boost::program_options::variables_map &vm,
     SplatSet::FileSet &splats,
-    boost::function<void(float, unsigned int)> computeBlobs);
+    boost::function<void(float, unsigned int)> computeBlobs,
+    InputSources *sources = NULL);
 
 /**
- * Validate the grid size and compute the chunk size.
+ * Remove isolated splats if requested on the command line (see @ref
+ * Outliers). The outliers are excluded from the file set, and the blobs are
+ * recomputed so that the bounding grid and splat count reflect the removal.
+ * If outlier removal is not enabled, this does nothing.
+ *
+ * @param tworker          Worker to attribute time for outlier removal
+ * @param vm               Command-line options
+ * @param splats           Splats from @ref doComputeBlobs
+ */
+void doRemoveOutliers(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    SplatSet::FastBlobSet<SplatSet::FileSet> &splats);
+
+/**
+ * Compute the chunk size, align the grid to the chunks and validate the grid
+ * size. The chunk size depends only on the options, and when the output is
+ * split the lower corner of @a grid is moved down onto the lattice of chunks
+ * anchored at the world origin (see @ref Bucket::chunkSize).
+ *
  * @param vm               Command-line options
- * @param grid             Bounding box grid
- * @return Chunk size for output, in cells
+ * @param[in,out] grid     Bounding box grid, which is extended to the chunk lattice
+ * @return Chunk size for output, in cells, or 0 if output is not split
  * @throw std::runtime_error if the grid is too large
  */
 unsigned int postprocessGrid(
     const boost::program_options::variables_map &vm,
-    const Grid &grid);
+    Grid &grid);
 
 /**
  * An all-in-one helper to call @ref Bucket::bucket with appropriate parameters.
  *
+ * If a region of interest is given with <code>--region</code> or
+ * <code>--chunk</code>, only the buckets inside it are processed. When output
+ * is split into chunks, whole chunks are selected so that the chunk
+ * coordinates (and hence the output file names) match those of a full run.
+ *
  * @param tworker          Worker to which the bucketing time is allocated
  * @param vm               Command-line options
  * @param splats           Splats to bucket
  * @param grid             Bounding box grid from @ref doComputeBlobs
  * @param chunkCells       Chunk side length from @ref postprocessGrid
  * @param collector        Bucket processor passed to @ref Bucket::bucket
+ * @param chunkFilter      Selection of chunks to process, used when no region of
+ *                         interest is given (see @ref IncrementalBuild)
  */
 void doBucket(
     Timeplot::Worker &tworker,
@@ -206,7 +353,117 @@ void doBucket(
     const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
     const Grid &grid,
     Grid::size_type chunkCells,
-    BucketCollector &collector);
+    BucketCollector &collector,
+    const Bucket::ChunkFilter &chunkFilter = Bucket::ChunkFilter());
+
+/**
+ * Support for <code>--incremental</code>. The constructor compares the inputs
+ * to the state saved by the previous run, deletes the outputs of the chunks
+ * that need to be regenerated, and provides a filter for @ref doBucket that
+ * selects those chunks. Once the output has been written, @ref finish
+ * records the new state.
+ *
+ * The saved state is removed by the constructor and only written back by
+ * @ref finish, so that a run that fails part-way causes the next one to
+ * rebuild everything.
+ */
+class IncrementalBuild : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param vm               Command-line options
+     * @param splats           Splats with blobs computed by @ref doComputeBlobs
+     * @param sources          Input files of each file in @a splats, from @ref doComputeBlobs
+     * @param grid             Bounding box grid from @ref doComputeBlobs
+     * @param chunkCells       Chunk side length from @ref postprocessGrid
+     */
+    IncrementalBuild(
+        const boost::program_options::variables_map &vm,
+        const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+        const InputSources &sources,
+        const Grid &grid,
+        Grid::size_type chunkCells);
+
+    /// Filter to pass to @ref doBucket. It is empty if everything is rebuilt.
+    const Bucket::ChunkFilter &getChunkFilter() const { return chunkFilter; }
+
+    /**
+     * Prepare a mesher for this run. The components of the chunks that are
+     * left in place still count towards the prune threshold, so that it is
+     * the same as for a full run.
+     */
+    void setupMesher(OOCMesher &mesher) const;
+
+    /**
+     * Check that the chunks left in place are pruned as they would be in a
+     * full run. The prune threshold is only known once the selected chunks
+     * have been meshed. If it would change the output of any of the other
+     * chunks, they are added to the selection and their outputs are removed.
+     * The caller must then mesh the new selection with a fresh mesher. Since
+     * those chunks are unchanged, this does not alter the threshold again.
+     *
+     * @param mesher  The mesher, once all the geometry has been received.
+     * @return Whether the output of @a mesher is complete.
+     */
+    bool checkPrune(const OOCMesher &mesher);
+
+    /**
+     * Save the state of this run.
+     *
+     * @param mesher  The mesher, after the output has been written.
+     * @throw std::ios::failure if the state could not be saved.
+     */
+    void finish(const OOCMesher &mesher);
+
+private:
+    const boost::filesystem::path path;  ///< Location of the saved state
+    const MesherBase::Namer namer;       ///< Names of the output files
+    IncrementalState old;                ///< State of the previous run
+    IncrementalState current;            ///< State of this run
+    bool full;                           ///< Whether all chunks are regenerated
+    std::set<IncrementalState::chunk_coords> chunks; ///< Chunks regenerated, if not @ref full
+    Bucket::ChunkFilter chunkFilter;     ///< Selects @ref chunks
+
+    /// Delete the output files of some chunks, if they exist
+    void removeOutputs(const std::vector<IncrementalState::chunk_coords> &stale) const;
+};
+
+/**
+ * Create the field cache requested with <code>--save-field</code>. The
+ * caller takes ownership, and must call @ref FieldCacheWriter::close once
+ * all bins have been processed.
+ *
+ * @param vm               Command-line options
+ * @param grid             Bounding box grid from @ref doComputeBlobs
+ * @throw std::ios::failure if the file could not be created.
+ */
+FieldCacheWriter *createFieldCache(
+    const boost::program_options::variables_map &vm,
+    const Grid &grid);
+
+/**
+ * Support for <code>--extract-field</code>. The isosurface is extracted from
+ * a field cache written by a previous run with <code>--save-field</code> and
+ * passed to the mesher, without reading any input files. Only the first
+ * device is used.
+ *
+ * @param tworker          Worker to which the time is allocated
+ * @param vm               Command-line options
+ * @param device           OpenCL context and device to use
+ * @param writer           Output writer, which receives the options of the original run as a comment
+ * @param mesher           Mesher to receive the output
+ *
+ * @throw std::ios::failure if the field cache could not be read.
+ * @throw std::runtime_error if the field cache is incompatible with the current options.
+ */
+void doExtractField(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    const std::pair<cl::Context, cl::Device> &device,
+    FastPly::Writer &writer,
+    MesherBase &mesher);
 
 /**
  * Set comments on the writer showing provenance of the file.
@@ -226,8 +483,13 @@ MesherBase::Namer getNamer(const boost::program_options::variables_map &vm, cons
 /**
  * Collects together the workers that run on the slave side in MPI, without
  * using any MPI-specific code.
+ *
+ * Creating the device worker groups compiles the OpenCL programs, which can
+ * take a while. It is thus done in the background, with one thread per
+ * device, so that it can overlap with reading the input. The public members
+ * other than @ref tworker may only be used once @ref wait has returned.
  */
-class SlaveWorkers
+class SlaveWorkers : public boost::noncopyable
 {
 public:
     Timeplot::Worker &tworker;
@@ -235,15 +497,71 @@ public:
     boost::scoped_ptr<CopyGroup> copyGroup;
     boost::scoped_ptr<BucketLoader> loader;
 
+    /**
+     * Constructor. It starts creating the workers in the background.
+     *
+     * @param arena     Storage for the splat queue, as returned by @ref
+     *                  createBrokerArena (may be @c NULL). It must outlive
+     *                  the workers.
+     */
     SlaveWorkers(
         Timeplot::Worker &tworker,
         const boost::program_options::variables_map &vm,
         const std::vector<std::pair<cl::Context, cl::Device> > &devices,
-        const DeviceWorkerGroup::OutputGenerator &outputGenerator);
+        const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+        const DeviceWorkerGroup::BinDone &binDone,
+        CircularBufferArena *arena = NULL);
+
+    /// Waits for the background initialization to finish, discarding any error.
+    ~SlaveWorkers();
+
+    /**
+     * Wait for the workers to be created. It is safe to call this more than
+     * once. It is called implicitly by @ref start and @ref setFieldCache.
+     *
+     * @throw boost::exception if creating any of the workers failed.
+     */
+    void wait();
 
     void start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress);
 
+    /**
+     * Start the workers for a pass in which the splats will be supplied to
+     * the loader rather than read from files.
+     */
+    void start(const Grid &grid, ProgressMeter *progress);
+
+    /**
+     * Record the signed distance function of every bin to @a fieldCache, or
+     * stop recording if it is @c NULL.
+     */
+    void setFieldCache(FieldCacheWriter *fieldCache);
+
     void stop();
+
+private:
+    boost::scoped_ptr<boost::thread> initThread;  ///< Thread running @ref init
+    boost::exception_ptr initError;               ///< Error raised by @ref init, if any
+
+    /// Create the workers. This runs in @ref initThread.
+    void init(
+        const boost::program_options::variables_map &vm,
+        const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+        const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+        const DeviceWorkerGroup::BinDone &binDone,
+        CircularBufferArena *arena);
 };
 
+/**
+ * Create and start a @ref MemoryBroker for <code>--mem-broker</code>. It
+ * shares the memory given by <code>--mem-host-splats</code> and
+ * <code>--mem-mesh</code> between the splat queue of @a slaveWorkers and the
+ * mesh queue of @a mesherGroup, which must have been created with the
+ * arena from @ref createBrokerArena. The broker must be destroyed before
+ * either of them.
+ */
+MemoryBroker *createMemoryBroker(
+    const boost::program_options::variables_map &vm,
+    SlaveWorkers &slaveWorkers, MesherGroup &mesherGroup);
+
 #endif /* !MLSGPU_CORE_H */
@@ -0,0 +1,255 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Host-side spatial index for neighbourhood queries on the splats of a bucket.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cstdlib>
+#include "neighbour_grid.h"
+#include "splat.h"
+
+NeighbourGrid::NeighbourGrid(const Splat *splats, std::size_t numSplats, unsigned int neighbours, float halo)
+    : halo2(halo * halo)
+{
+    float upper[3];
+    for (unsigned int j = 0; j < 3; j++)
+        lower[j] = upper[j] = numSplats > 0 ? splats[0].position[j] : 0.0f;
+    for (std::size_t i = 1; i < numSplats; i++)
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            lower[j] = std::min(lower[j], splats[i].position[j]);
+            upper[j] = std::max(upper[j], splats[i].position[j]);
+        }
+
+    /* Choose a cell size that puts about as many points in a cell as are
+     * needed for a query, assuming that the points are spread over the
+     * bounding box. The bounding box is padded so that flat data sets do not
+     * give a zero volume. For points spread over a surface this is an
+     * overestimate, which is harmless. It is not useful to have cells bigger
+     * than the halo, or very much smaller.
+     */
+    double volume = 1.0;
+    for (unsigned int j = 0; j < 3; j++)
+        volume *= double(upper[j] - lower[j]) + halo / 8.0;
+    cellSize = std::pow(volume * (neighbours + 1) / std::max(numSplats, std::size_t(1)), 1.0 / 3.0);
+    cellSize = std::min(std::max(cellSize, halo / 64.0f), halo);
+
+    // Limit the memory used by empty cells
+    const double maxCells = 2.0 * numSplats + 64.0;
+    while (true)
+    {
+        double totalCells = 1.0;
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            dims[j] = int((upper[j] - lower[j]) / cellSize) + 1;
+            totalCells *= dims[j];
+        }
+        if (totalCells <= maxCells)
+            break;
+        cellSize *= 1.25f;
+    }
+
+    // Counting sort of the points into cells
+    const std::size_t numCells = std::size_t(dims[0]) * dims[1] * dims[2];
+    std::vector<std::size_t> cellOf(numSplats);
+    cellStart.resize(numCells + 1, 0);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        const float *pos = splats[i].position;
+        cellOf[i] = cellIndex(cellCoord(pos, 0), cellCoord(pos, 1), cellCoord(pos, 2));
+        cellStart[cellOf[i] + 1]++;
+    }
+    for (std::size_t i = 0; i < numCells; i++)
+        cellStart[i + 1] += cellStart[i];
+
+    std::vector<std::size_t> next(cellStart.begin(), cellStart.end() - 1);
+    for (unsigned int j = 0; j < 3; j++)
+        coords[j].resize(numSplats);
+    radii2.resize(numSplats);
+    index.resize(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        std::size_t pos = next[cellOf[i]]++;
+        for (unsigned int j = 0; j < 3; j++)
+            coords[j][pos] = splats[i].position[j];
+        radii2[pos] = splats[i].radius * splats[i].radius;
+        index[pos] = i;
+    }
+}
+
+std::size_t NeighbourGrid::distances(const float pos[3], std::size_t cell, std::vector<float> &scratch) const
+{
+    const std::size_t first = cellStart[cell];
+    const std::size_t n = cellStart[cell + 1] - first;
+    if (n == 0)
+        return 0;
+    if (scratch.size() < n)
+        scratch.resize(n);
+
+    // Kept free of branches and aliasing so that it is vectorized
+    const float *x = &coords[0][first];
+    const float *y = &coords[1][first];
+    const float *z = &coords[2][first];
+    float *d2 = &scratch[0];
+    const float px = pos[0], py = pos[1], pz = pos[2];
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const float dx = x[i] - px;
+        const float dy = y[i] - py;
+        const float dz = z[i] - pz;
+        d2[i] = dx * dx + dy * dy + dz * dz;
+    }
+    return n;
+}
+
+template<typename Visitor>
+void NeighbourGrid::visitShells(const float pos[3], Visitor &visitor) const
+{
+    int c[3];
+    for (unsigned int j = 0; j < 3; j++)
+        c[j] = cellCoord(pos, j);
+
+    /* All points in shell r + 1 or beyond are at least r * cellSize away,
+     * since the query point lies within its own cell.
+     */
+    for (int r = 0; ; r++)
+    {
+        int lo[3], hi[3];
+        bool all = true;
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            lo[j] = std::max(c[j] - r, 0);
+            hi[j] = std::min(c[j] + r, dims[j] - 1);
+            all = all && lo[j] == 0 && hi[j] == dims[j] - 1;
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+            {
+                if (std::abs(z - c[2]) == r || std::abs(y - c[1]) == r)
+                {
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                        visitor.cell(cellIndex(x, y, z));
+                }
+                else
+                {
+                    if (c[0] - r >= 0)
+                        visitor.cell(cellIndex(c[0] - r, y, z));
+                    if (r > 0 && c[0] + r < dims[0])
+                        visitor.cell(cellIndex(c[0] + r, y, z));
+                }
+            }
+
+        if (all || visitor.done(r * cellSize))
+            break;
+    }
+}
+
+struct NeighbourGrid::NearestVisitor
+{
+    const NeighbourGrid &grid;
+    const float *pos;
+    std::size_t k;
+    std::vector<std::pair<float, std::size_t> > &heap;
+    std::vector<float> &scratch;
+
+    float bound() const
+    {
+        return heap.size() == k ? heap.front().first : grid.halo2;
+    }
+
+    void cell(std::size_t cell)
+    {
+        const std::size_t n = grid.distances(pos, cell, scratch);
+        const std::size_t first = grid.cellStart[cell];
+        for (std::size_t i = 0; i < n; i++)
+        {
+            if (scratch[i] <= bound())
+            {
+                if (heap.size() == k)
+                {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                }
+                heap.push_back(std::make_pair(scratch[i], grid.index[first + i]));
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+
+    bool done(float reach) const
+    {
+        return reach * reach >= bound();
+    }
+};
+
+struct NeighbourGrid::CoveringVisitor
+{
+    const NeighbourGrid &grid;
+    const float *pos;
+    std::size_t self;
+    std::size_t limit;
+    std::vector<float> &scratch;
+    std::size_t count;
+
+    void cell(std::size_t cell)
+    {
+        if (count >= limit)
+            return;
+        const std::size_t n = grid.distances(pos, cell, scratch);
+        const std::size_t first = grid.cellStart[cell];
+        for (std::size_t i = 0; i < n; i++)
+            if (scratch[i] < grid.radii2[first + i] && grid.index[first + i] != self)
+                count++;
+    }
+
+    bool done(float reach) const
+    {
+        return count >= limit || reach * reach >= grid.halo2;
+    }
+};
+
+void NeighbourGrid::nearest(
+    const float pos[3], std::size_t k,
+    std::vector<std::pair<float, std::size_t> > &heap,
+    std::vector<float> &scratch) const
+{
+    heap.clear();
+    NearestVisitor visitor = { *this, pos, k, heap, scratch };
+    visitShells(pos, visitor);
+}
+
+std::size_t NeighbourGrid::countCovering(
+    const float pos[3], std::size_t self, std::size_t limit,
+    std::vector<float> &scratch) const
+{
+    CoveringVisitor visitor = { *this, pos, self, limit, scratch, 0 };
+    visitShells(pos, visitor);
+    return std::min(visitor.count, limit);
+}
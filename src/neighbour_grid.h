@@ -0,0 +1,132 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Host-side spatial index for neighbourhood queries on the splats of a bucket.
+ */
+
+#ifndef NEIGHBOUR_GRID_H
+#define NEIGHBOUR_GRID_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include "splat.h"
+
+/**
+ * Uniform grid over a set of splats, used to find neighbours. The positions
+ * are stored as separate coordinate arrays sorted by cell, so that the
+ * distances to all the splats in a cell can be computed with a simple loop
+ * that the compiler can vectorize.
+ *
+ * It is safe for multiple threads to query the grid at the same time.
+ */
+class NeighbourGrid : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. The cell size is chosen so that a cell holds about as many
+     * splats as a typical query needs to examine.
+     *
+     * @param splats       Splats to index. Only the positions and radii are used.
+     * @param numSplats    Number of elements in @a splats.
+     * @param neighbours   Typical number of splats needed by a query.
+     * @param halo         Maximum distance that queries will search.
+     */
+    NeighbourGrid(const Splat *splats, std::size_t numSplats, unsigned int neighbours, float halo);
+
+    /**
+     * Find up to @a k nearest splats within the halo of a position. The
+     * results are stored as a max-heap of (squared distance, index) pairs in
+     * @a heap, where the indices refer to the original splat array.
+     *
+     * @param pos        Query position (usually one of the splats).
+     * @param k          Maximum number of splats to return.
+     * @param[out] heap  Results.
+     * @param scratch    Temporary storage for distances.
+     */
+    void nearest(const float pos[3], std::size_t k,
+                 std::vector<std::pair<float, std::size_t> > &heap,
+                 std::vector<float> &scratch) const;
+
+    /**
+     * Count the splats whose radius of influence contains a position, not
+     * counting the splat with index @a self. Counting stops when @a limit
+     * is reached. Only splats within the halo are considered, so the halo
+     * should be at least the largest radius.
+     *
+     * @param pos        Query position (usually one of the splats).
+     * @param self       Index of the splat to ignore.
+     * @param limit      Maximum count to return.
+     * @param scratch    Temporary storage for distances.
+     */
+    std::size_t countCovering(const float pos[3], std::size_t self, std::size_t limit,
+                              std::vector<float> &scratch) const;
+
+private:
+    float lower[3];               ///< Minimum corner of the bounding box
+    float cellSize;               ///< Side length of each cell
+    float halo2;                  ///< Square of the search radius
+    int dims[3];                  ///< Number of cells along each axis
+    std::vector<std::size_t> cellStart;  ///< Start of each cell in the coordinate arrays (plus a sentinel)
+    std::vector<float> coords[3]; ///< Coordinates sorted by cell
+    std::vector<float> radii2;    ///< Squared radii sorted by cell
+    std::vector<std::size_t> index; ///< Original index of each entry in @ref coords
+
+    /// Cell coordinate of a position along one axis, clamped to the grid
+    int cellCoord(const float pos[3], int axis) const
+    {
+        int c = int((pos[axis] - lower[axis]) / cellSize);
+        return c < 0 ? 0 : (c >= dims[axis] ? dims[axis] - 1 : c);
+    }
+
+    std::size_t cellIndex(int x, int y, int z) const
+    {
+        return (std::size_t(z) * dims[1] + y) * dims[0] + x;
+    }
+
+    /**
+     * Compute squared distances from @a pos to the splats in a cell.
+     *
+     * @return The number of splats in the cell, whose distances are
+     * placed at the start of @a scratch.
+     */
+    std::size_t distances(const float pos[3], std::size_t cell, std::vector<float> &scratch) const;
+
+    /**
+     * Visit the cells around a position in order of increasing Chebyshev
+     * distance. After each shell, @a visitor.done is called with a lower
+     * bound on the distance to any cell not yet visited; the walk stops when
+     * it returns true or when the whole grid has been visited.
+     */
+    template<typename Visitor>
+    void visitShells(const float pos[3], Visitor &visitor) const;
+
+    struct NearestVisitor;
+    struct CoveringVisitor;
+};
+
+#endif /* !NEIGHBOUR_GRID_H */
@@ -0,0 +1,306 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Estimation of normals and radii for point clouds that only have positions.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <boost/scoped_ptr.hpp>
+#include "tr1_cstdint.h"
+#include "normals.h"
+#include "neighbour_grid.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "grid.h"
+#include "errors.h"
+#include "statistics.h"
+
+namespace Normals
+{
+
+namespace
+{
+
+/**
+ * Find the eigenvector of a symmetric 3x3 matrix corresponding to the smallest
+ * eigenvalue. If it is not well-defined (because the two smallest eigenvalues
+ * are equal), the result is NaN.
+ */
+void smallestEigenvector(const double a[3][3], float out[3])
+{
+    // Eigenvalues by the trigonometric method
+    const double p1 = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+    const double q = (a[0][0] + a[1][1] + a[2][2]) / 3.0;
+    const double p2 = (a[0][0] - q) * (a[0][0] - q)
+        + (a[1][1] - q) * (a[1][1] - q)
+        + (a[2][2] - q) * (a[2][2] - q) + 2.0 * p1;
+    const double p = std::sqrt(p2 / 6.0);
+    if (!(p > 0.0))
+    {
+        out[0] = out[1] = out[2] = std::numeric_limits<float>::quiet_NaN();
+        return;
+    }
+
+    double b[3][3];
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            b[i][j] = (a[i][j] - (i == j ? q : 0.0)) / p;
+    const double det = b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1])
+        - b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0])
+        + b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0]);
+    const double r = std::min(std::max(det / 2.0, -1.0), 1.0);
+    const double phi = std::acos(r) / 3.0;
+    const double twoThirdsPi = 2.0943951023931954923;
+    const double lambda = q + 2.0 * p * std::cos(phi + twoThirdsPi);
+
+    /* The eigenvector is orthogonal to the rows of A - lambda I, which span
+     * a plane. Take the most accurate of the cross products of the rows.
+     */
+    double m[3][3];
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            m[i][j] = a[i][j] - (i == j ? lambda : 0.0);
+
+    double best[3] = {0.0, 0.0, 0.0};
+    double bestLen2 = 0.0;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const double *u = m[i];
+        const double *v = m[(i + 1) % 3];
+        const double c[3] =
+        {
+            u[1] * v[2] - u[2] * v[1],
+            u[2] * v[0] - u[0] * v[2],
+            u[0] * v[1] - u[1] * v[0]
+        };
+        const double len2 = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+        if (len2 > bestLen2)
+        {
+            bestLen2 = len2;
+            std::copy(c, c + 3, best);
+        }
+    }
+
+    if (!(bestLen2 > 1e-12 * p2 * p2))
+    {
+        out[0] = out[1] = out[2] = std::numeric_limits<float>::quiet_NaN();
+        return;
+    }
+    const double scale = 1.0 / std::sqrt(bestLen2);
+    for (unsigned int i = 0; i < 3; i++)
+        out[i] = best[i] * scale;
+}
+
+/// Whether the host uses little-endian byte order
+bool cpuLittleEndian()
+{
+    std::tr1::uint32_t x = 0x12345678;
+    std::tr1::uint8_t y[4];
+
+    std::memcpy(y, &x, 4);
+    return y[0] == 0x78;
+}
+
+} // anonymous namespace
+
+void estimate(Splat *splats, std::size_t numCore, std::size_t numSplats,
+              unsigned int neighbours, float halo)
+{
+    MLSGPU_ASSERT(numCore <= numSplats, std::invalid_argument);
+    MLSGPU_ASSERT(neighbours > 0, std::invalid_argument);
+    MLSGPU_ASSERT(halo > 0.0f, std::invalid_argument);
+
+    if (numCore == 0)
+        return;
+
+    NeighbourGrid grid(splats, numSplats, neighbours, halo);
+    std::size_t k = neighbours + 1; // includes the point itself
+
+#ifdef _OPENMP
+#pragma omp parallel shared(grid, splats, numCore, halo, k) default(none)
+#endif
+    {
+        std::vector<std::pair<float, std::size_t> > heap;
+        std::vector<float> scratch;
+        heap.reserve(k);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+        for (std::ptrdiff_t ii = 0; ii < std::ptrdiff_t(numCore); ii++)
+        {
+            const std::size_t i = ii;
+            Splat &splat = splats[i];
+            grid.nearest(splat.position, k, heap, scratch);
+
+            // The furthest neighbour is at the top of the heap
+            const float radius = heap.empty() ? 0.0f : std::sqrt(heap.front().first);
+            if (heap.size() < 4 || !(radius > 0.0f))
+            {
+                splat.normal[0] = splat.normal[1] = splat.normal[2] = std::numeric_limits<float>::quiet_NaN();
+                splat.radius = halo;
+                splat.quality = 1.0f / (halo * halo);
+                continue;
+            }
+
+            /* Compute the covariance matrix relative to the centroid. The
+             * positions are made relative to the query point first to avoid
+             * loss of precision when the coordinates are large.
+             */
+            double mean[3] = {0.0, 0.0, 0.0};
+            for (std::size_t j = 0; j < heap.size(); j++)
+            {
+                const float *pos = splats[heap[j].second].position;
+                for (unsigned int a = 0; a < 3; a++)
+                    mean[a] += pos[a] - splat.position[a];
+            }
+            for (unsigned int a = 0; a < 3; a++)
+                mean[a] /= heap.size();
+
+            double cov[3][3] = {};
+            for (std::size_t j = 0; j < heap.size(); j++)
+            {
+                const float *pos = splats[heap[j].second].position;
+                double d[3];
+                for (unsigned int a = 0; a < 3; a++)
+                    d[a] = (pos[a] - splat.position[a]) - mean[a];
+                for (unsigned int a = 0; a < 3; a++)
+                    for (unsigned int b = a; b < 3; b++)
+                        cov[a][b] += d[a] * d[b];
+            }
+            for (unsigned int a = 0; a < 3; a++)
+                for (unsigned int b = 0; b < a; b++)
+                    cov[a][b] = cov[b][a];
+
+            smallestEigenvector(cov, splat.normal);
+            if (splat.normal[2] < 0.0f)
+                for (unsigned int a = 0; a < 3; a++)
+                    splat.normal[a] = -splat.normal[a];
+            splat.radius = radius;
+            splat.quality = 1.0f / (radius * radius);
+        }
+    }
+}
+
+void orient(Splat &splat, const float scanner[3])
+{
+    float dot = 0.0f;
+    for (unsigned int i = 0; i < 3; i++)
+        dot += splat.normal[i] * (scanner[i] - splat.position[i]);
+    if (dot < 0.0f)
+        for (unsigned int i = 0; i < 3; i++)
+            splat.normal[i] = -splat.normal[i];
+}
+
+void writeHeader(std::ostream &out, std::tr1::uint64_t numSplats)
+{
+    out << "ply\n"
+        << "format " << (cpuLittleEndian() ? "binary_little_endian" : "binary_big_endian") << " 1.0\n"
+        << "element vertex " << numSplats << "\n"
+        << "property float x\n"
+        << "property float y\n"
+        << "property float z\n"
+        << "property float nx\n"
+        << "property float ny\n"
+        << "property float nz\n"
+        << "property float radius\n"
+        << "end_header\n";
+}
+
+Estimator::Estimator(
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &super,
+    const std::vector<const float *> &scanners,
+    unsigned int neighbours, float halo,
+    std::ostream &out,
+    ProgressMeter *progress)
+    : super(super), scanners(scanners), neighbours(neighbours), halo(halo), out(out),
+    progress(progress), written(0),
+    splats("mem.Normals::Estimator::splats"),
+    splatIds("mem.Normals::Estimator::splatIds")
+{
+}
+
+void Estimator::operator()(
+    const SplatSet::SubsetBase &subset,
+    const Grid &grid,
+    const Bucket::Recursion &recursionState)
+{
+    (void) recursionState;
+
+    const std::size_t n = subset.numSplats();
+    splats.resize(n);
+    splatIds.resize(n);
+    std::size_t numSplats = 0;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(super.makeSplatStream(subset.begin(), subset.end()));
+        std::size_t added;
+        while (numSplats < n
+               && (added = stream->read(&splats[numSplats], &splatIds[numSplats], n - numSplats)) > 0)
+            numSplats += added;
+    }
+
+    // Move the splats whose centres lie inside the bucket to the front
+    std::size_t numCore = 0;
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        if (Bucket::ownsPosition(grid, splats[i].position))
+        {
+            std::swap(splats[i], splats[numCore]);
+            std::swap(splatIds[i], splatIds[numCore]);
+            numCore++;
+        }
+    }
+
+    estimate(&splats[0], numCore, numSplats, neighbours, halo);
+
+    std::vector<float> buffer(numCore * 7);
+    for (std::size_t i = 0; i < numCore; i++)
+    {
+        Splat &splat = splats[i];
+        const std::size_t fileId = super.getFileId(splatIds[i]);
+        if (fileId < scanners.size() && scanners[fileId] != NULL)
+            orient(splat, scanners[fileId]);
+        float *rec = &buffer[i * 7];
+        std::copy(splat.position, splat.position + 3, rec);
+        std::copy(splat.normal, splat.normal + 3, rec + 3);
+        rec[6] = splat.radius;
+    }
+    if (numCore > 0)
+        out.write(reinterpret_cast<const char *>(&buffer[0]), buffer.size() * sizeof(float));
+    written += numCore;
+    if (progress != NULL)
+        *progress += numCore;
+    Statistics::getStatistic<Statistics::Variable>("normals.bucket.splats").add(numSplats);
+    Statistics::getStatistic<Statistics::Variable>("normals.bucket.core").add(numCore);
+}
+
+} // namespace Normals
@@ -0,0 +1,139 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Estimation of normals and radii for point clouds that only have positions.
+ */
+
+#ifndef NORMALS_H
+#define NORMALS_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <ostream>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "grid.h"
+#include "bucket.h"
+#include "statistics.h"
+#include "allocator.h"
+#include "progress.h"
+
+/**
+ * Out-of-core estimation of normals and radii.
+ *
+ * The points are treated as splats whose radius is the search radius (the
+ * @em halo), and passed through @ref Bucket::bucket. Since a bucket receives
+ * every splat that touches it, it holds all the neighbours within the halo of
+ * the points whose positions fall inside it. Each point is processed by the
+ * bucket that contains it, so the output contains every point exactly once.
+ */
+namespace Normals
+{
+
+/**
+ * Compute normals and radii for some points, using their nearest neighbours
+ * amongst a larger set.
+ *
+ * The normal is the eigenvector of the neighbourhood covariance matrix with
+ * the smallest eigenvalue, and the radius is the distance to the furthest of
+ * the neighbours. The normals are oriented to have a non-negative z component;
+ * see @ref orient to orient them towards a scanner instead. If fewer than
+ * three neighbours are found, the normal is set to NaN so that the splat will
+ * be discarded.
+ *
+ * @param splats       Points to process, followed by the points that may only
+ *                     be used as neighbours. Only the positions are used.
+ * @param numCore      Number of points at the front of @a splats to process.
+ * @param numSplats    Total number of points in @a splats.
+ * @param neighbours   Number of neighbours to use (not counting the point itself).
+ * @param halo         Maximum distance to a neighbour.
+ *
+ * @pre @a neighbours &gt; 0 and @a halo &gt; 0.
+ */
+void estimate(Splat *splats, std::size_t numCore, std::size_t numSplats,
+              unsigned int neighbours, float halo);
+
+/**
+ * Flip the normal of a splat if necessary so that it points towards @a scanner.
+ */
+void orient(Splat &splat, const float scanner[3]);
+
+/**
+ * Write a PLY header for a file of splats as produced by @ref Estimator.
+ */
+void writeHeader(std::ostream &out, std::tr1::uint64_t numSplats);
+
+/**
+ * Processor for @ref Bucket::bucket that estimates normals and radii for the
+ * splats in each bucket and writes them to a PLY file.
+ */
+class Estimator : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param super        The set from which the buckets are taken. Each file
+     *                     must lack normals and have the halo as the radius.
+     * @param scanners     Scanner position for each file in @a super (@c NULL
+     *                     if not known).
+     * @param neighbours   Number of neighbours to use for each point.
+     * @param halo         Maximum distance to a neighbour.
+     * @param out          Output stream, to which @ref writeHeader has been applied.
+     * @param progress     If non-@c NULL, it is incremented for each splat written.
+     */
+    Estimator(const SplatSet::FastBlobSet<SplatSet::FileSet> &super,
+              const std::vector<const float *> &scanners,
+              unsigned int neighbours, float halo,
+              std::ostream &out,
+              ProgressMeter *progress = NULL);
+
+    void operator()(
+        const SplatSet::SubsetBase &splats,
+        const Grid &grid,
+        const Bucket::Recursion &recursionState);
+
+    /// Number of splats written so far
+    std::tr1::uint64_t numWritten() const { return written; }
+
+private:
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &super;
+    const std::vector<const float *> scanners;
+    const unsigned int neighbours;
+    const float halo;
+    std::ostream &out;
+    ProgressMeter *progress;
+    std::tr1::uint64_t written;
+
+    Statistics::Container::vector<Splat> splats;              ///< Splats in the current bucket
+    Statistics::Container::vector<SplatSet::splat_id> splatIds; ///< IDs for @ref splats
+};
+
+} // namespace Normals
+
+#endif /* !NORMALS_H */
@@ -0,0 +1,143 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Removal of isolated splats before reconstruction.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <vector>
+#include <algorithm>
+#include <boost/scoped_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include "tr1_cstdint.h"
+#include "outliers.h"
+#include "neighbour_grid.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "grid.h"
+#include "errors.h"
+#include "statistics.h"
+
+namespace Outliers
+{
+
+void findIsolated(const Splat *splats, std::size_t numCore, std::size_t numSplats,
+                  unsigned int minCoverage, bool *isolated)
+{
+    MLSGPU_ASSERT(numCore <= numSplats, std::invalid_argument);
+
+    if (numCore == 0)
+        return;
+
+    // Only splats within the largest radius can cover anything
+    float halo = 0.0f;
+    for (std::size_t i = 0; i < numSplats; i++)
+        halo = std::max(halo, splats[i].radius);
+    if (!(halo > 0.0f))
+    {
+        std::fill(isolated, isolated + numCore, minCoverage > 0);
+        return;
+    }
+
+    NeighbourGrid grid(splats, numSplats, minCoverage + 1, halo);
+    std::size_t limit = minCoverage;
+
+#ifdef _OPENMP
+#pragma omp parallel shared(grid, splats, numCore, isolated, limit) default(none)
+#endif
+    {
+        std::vector<float> scratch;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1024)
+#endif
+        for (std::ptrdiff_t ii = 0; ii < std::ptrdiff_t(numCore); ii++)
+        {
+            const std::size_t i = ii;
+            isolated[i] = grid.countCovering(splats[i].position, i, limit, scratch) < limit;
+        }
+    }
+}
+
+Filter::Filter(
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &super,
+    unsigned int minCoverage,
+    ProgressMeter *progress)
+    : super(super), minCoverage(minCoverage), progress(progress), classified(0),
+    splats("mem.Outliers::Filter::splats"),
+    splatIds("mem.Outliers::Filter::splatIds"),
+    outliers("mem.Outliers::Filter::outliers")
+{
+}
+
+void Filter::operator()(
+    const SplatSet::SubsetBase &subset,
+    const Grid &grid,
+    const Bucket::Recursion &recursionState)
+{
+    (void) recursionState;
+
+    const std::size_t n = subset.numSplats();
+    splats.resize(n);
+    splatIds.resize(n);
+    std::size_t numSplats = 0;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(super.makeSplatStream(subset.begin(), subset.end()));
+        std::size_t added;
+        while (numSplats < n
+               && (added = stream->read(&splats[numSplats], &splatIds[numSplats], n - numSplats)) > 0)
+            numSplats += added;
+    }
+
+    // Move the splats whose centres lie inside the bucket to the front
+    std::size_t numCore = 0;
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        if (Bucket::ownsPosition(grid, splats[i].position))
+        {
+            std::swap(splats[i], splats[numCore]);
+            std::swap(splatIds[i], splatIds[numCore]);
+            numCore++;
+        }
+    }
+
+    boost::scoped_array<bool> isolated(new bool[numCore]);
+    findIsolated(&splats[0], numCore, numSplats, minCoverage, isolated.get());
+    std::size_t removed = 0;
+    for (std::size_t i = 0; i < numCore; i++)
+        if (isolated[i])
+        {
+            outliers.push_back(splatIds[i]);
+            removed++;
+        }
+
+    classified += numCore;
+    if (progress != NULL)
+        *progress += numCore;
+    Statistics::getStatistic<Statistics::Variable>("outliers.bucket.splats").add(numSplats);
+    Statistics::getStatistic<Statistics::Variable>("outliers.bucket.removed").add(removed);
+}
+
+} // namespace Outliers
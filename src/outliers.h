@@ -0,0 +1,118 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Removal of isolated splats before reconstruction.
+ */
+
+#ifndef OUTLIERS_H
+#define OUTLIERS_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "splat.h"
+#include "splat_set.h"
+#include "grid.h"
+#include "bucket.h"
+#include "statistics.h"
+#include "allocator.h"
+#include "progress.h"
+
+/**
+ * Detection of outliers, using the bucket decomposition.
+ *
+ * A splat is considered an outlier if its centre lies inside the support of
+ * fewer than a given number of other splats. Such splats come from isolated
+ * scan noise, and would otherwise produce small floating components that cost
+ * as much to reconstruct as real surface before being pruned.
+ *
+ * If splat @em Y covers the centre of splat @em X, then the bounding box of
+ * @em Y intersects the cell containing @em X, and so @em Y is passed to the
+ * bucket that owns @em X. Each bucket thus has all the information needed to
+ * classify the splats it owns.
+ */
+namespace Outliers
+{
+
+/**
+ * Identify splats that are covered by too few other splats.
+ *
+ * @param splats       Splats to classify, followed by the splats that may only
+ *                     be used as coverers.
+ * @param numCore      Number of splats at the front of @a splats to classify.
+ * @param numSplats    Total number of splats in @a splats.
+ * @param minCoverage  Number of other splats that must contain the centre of
+ *                     a splat for it to be kept.
+ * @param[out] isolated Set to @c true for each of the first @a numCore splats
+ *                     that is an outlier, and @c false otherwise.
+ */
+void findIsolated(const Splat *splats, std::size_t numCore, std::size_t numSplats,
+                  unsigned int minCoverage, bool *isolated);
+
+/**
+ * Processor for @ref Bucket::bucket that records the IDs of outliers. The
+ * caller should pass the IDs to @ref SplatSet::FileSet::excludeSplat once the
+ * bucketing is complete.
+ */
+class Filter : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param super        The set from which the buckets are taken.
+     * @param minCoverage  See @ref findIsolated.
+     * @param progress     If non-@c NULL, it is incremented for each splat classified.
+     */
+    Filter(const SplatSet::FastBlobSet<SplatSet::FileSet> &super,
+           unsigned int minCoverage,
+           ProgressMeter *progress = NULL);
+
+    void operator()(
+        const SplatSet::SubsetBase &splats,
+        const Grid &grid,
+        const Bucket::Recursion &recursionState);
+
+    /// IDs of the outliers found so far
+    const Statistics::Container::vector<SplatSet::splat_id> &getOutliers() const { return outliers; }
+
+    /// Number of splats classified so far
+    std::tr1::uint64_t numClassified() const { return classified; }
+
+private:
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &super;
+    const unsigned int minCoverage;
+    ProgressMeter *progress;
+    std::tr1::uint64_t classified;
+
+    Statistics::Container::vector<Splat> splats;              ///< Splats in the current bucket
+    Statistics::Container::vector<SplatSet::splat_id> splatIds; ///< IDs for @ref splats
+    Statistics::Container::vector<SplatSet::splat_id> outliers; ///< IDs of outliers
+};
+
+} // namespace Outliers
+
+#endif /* !OUTLIERS_H */
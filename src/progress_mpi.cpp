@@ -36,7 +36,7 @@
 #include "progress_mpi.h"
 
 ProgressMPI::ProgressMPI(ProgressMeter *parent, size_type total, MPI_Comm comm, int root)
-    : parent(parent), comm(comm), root(root), total(total), thresh(total / 1000), unsent(0)
+    : parent(parent), comm(comm), root(root), total(total), thresh(total / 1000), unsent(0), added(0)
 {
 }
 
@@ -44,6 +44,7 @@ void ProgressMPI::operator+=(size_type inc)
 {
     boost::lock_guard<boost::mutex> lock(mutex);
     unsent += inc;
+    added += inc;
     if (unsent > thresh)
         syncUnlocked();
 }
@@ -64,6 +65,12 @@ void ProgressMPI::sync()
     syncUnlocked();
 }
 
+ProgressMPI::size_type ProgressMPI::count() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return added;
+}
+
 void ProgressMPI::operator()() const
 {
     size_type current = 0;
@@ -78,6 +78,12 @@ public:
      */
     void sync();
 
+    /**
+     * Total progress added on this process with @ref operator+=, whether or
+     * not it has been sent.
+     */
+    size_type count() const;
+
     /**
      * Run the receive code. This will return when the capacity has been reached.
      */
@@ -95,7 +101,8 @@ private:
     const size_type thresh;       ///< Minimum progress before sending updates
 
     size_type unsent;             ///< Unsent increment amount (on slaves)
-    boost::mutex mutex;           ///< Mutex protecting @ref unsent
+    size_type added;              ///< Total increment amount (on slaves)
+    mutable boost::mutex mutex;   ///< Mutex protecting @ref unsent and @ref added
 };
 
 #endif /* !PROGRESS_MPI_H */
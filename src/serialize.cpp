@@ -33,7 +33,11 @@
 #endif
 #include <mpi.h>
 #include <cassert>
+#include <stdexcept>
 #include "grid.h"
+#include "splat.h"
+#include "compress.h"
+#include "errors.h"
 #include "bucket.h"
 #include "tags.h"
 #include "serialize.h"
@@ -132,7 +136,7 @@ static void registerChunkIdType()
     {
         MPI_LB,
         Serialize::mpi_type_traits<ChunkIdPod::gen_type>::type(),
-        Serialize::mpi_type_traits<Grid::size_type>::type(),
+        Serialize::mpi_type_traits<Grid::difference_type>::type(),
         MPI_UB
     };
 
@@ -206,6 +210,25 @@ void recv(Grid &grid, MPI_Comm comm, int source)
                 raw.extents[4], raw.extents[5]);
 }
 
+void broadcast(Grid &grid, MPI_Comm comm, int root)
+{
+    RawGrid raw;
+    raw.spacing = grid.getSpacing();
+    for (int i = 0; i < 3; i++)
+    {
+        raw.reference[i] = grid.getReference()[i];
+        raw.extents[2 * i] = grid.getExtent(i).first;
+        raw.extents[2 * i + 1] = grid.getExtent(i).second;
+    }
+
+    MPI_Bcast(&raw, 1, gridType, root, comm);
+
+    grid = Grid(raw.reference, raw.spacing,
+                raw.extents[0], raw.extents[1],
+                raw.extents[2], raw.extents[3],
+                raw.extents[4], raw.extents[5]);
+}
+
 void send(const ChunkIdPod &chunkId, MPI_Comm comm, int dest)
 {
     MPI_Send(const_cast<ChunkIdPod *>(&chunkId), 1, chunkIdType, dest, MLSGPU_TAG_WORK, comm);
@@ -216,6 +239,109 @@ void recv(ChunkIdPod &chunkId, MPI_Comm comm, int source)
     MPI_Recv(&chunkId, 1, chunkIdType, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
 }
 
+void send(const Splat *splats, std::size_t numSplats, MPI_Comm comm, int dest)
+{
+    MPI_Send(const_cast<Splat *>(splats), numSplats, splatType, dest, MLSGPU_TAG_WORK, comm);
+}
+
+void recv(Splat *splats, std::size_t numSplats, MPI_Comm comm, int source)
+{
+    MPI_Recv(splats, numSplats, splatType, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+}
+
+SplatSender::Slot::Slot()
+    : splats("mem.SplatSender.splats"),
+    compressed("mem.SplatSender.compressed"),
+    request(MPI_REQUEST_NULL)
+{
+}
+
+SplatSender::SplatSender(std::size_t maxSplats, std::size_t slots, bool compress)
+    : maxSplats(maxSplats), compress(compress), cur(0),
+    waitStat(Statistics::getStatistic<Statistics::Variable>("splatsender.wait")),
+    ratioStat(Statistics::getStatistic<Statistics::Variable>("splatsender.ratio"))
+{
+    MLSGPU_ASSERT(slots > 0, std::invalid_argument);
+    MLSGPU_ASSERT(!compress || compressSupported(), std::invalid_argument);
+    for (std::size_t i = 0; i < slots; i++)
+    {
+        this->slots.push_back(new Slot);
+        this->slots.back().splats.reserve(maxSplats);
+        if (compress)
+            this->slots.back().compressed.reserve(compressBufferBound(maxSplats * sizeof(Splat)));
+    }
+    cur = slots - 1;
+}
+
+SplatSender::~SplatSender()
+{
+    flush();
+}
+
+Splat *SplatSender::get()
+{
+    cur = (cur + 1) % slots.size();
+    Slot &slot = slots[cur];
+    if (slot.request != MPI_REQUEST_NULL)
+    {
+        Statistics::Timer timer(waitStat);
+        MPI_Wait(&slot.request, MPI_STATUS_IGNORE);
+    }
+    return slot.splats.data();
+}
+
+void SplatSender::send(std::size_t numSplats, MPI_Comm comm, int dest)
+{
+    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
+    Slot &slot = slots[cur];
+
+    // sizes[1] is the compressed size in bytes, or 0 if uncompressed
+    std::size_t sizes[2] = {numSplats, 0};
+    if (compress && numSplats > 0)
+    {
+        sizes[1] = compressBuffer(slot.splats.data(), numSplats * sizeof(Splat),
+                                  slot.compressed.data(), slot.compressed.capacity());
+        ratioStat.add(double(sizes[1]) / (numSplats * sizeof(Splat)));
+    }
+    MPI_Send(sizes, 2, mpi_type_traits<std::size_t>::type(), dest, MLSGPU_TAG_WORK, comm);
+    if (sizes[1] > 0)
+        MPI_Isend(slot.compressed.data(), sizes[1], MPI_BYTE, dest, MLSGPU_TAG_WORK, comm, &slot.request);
+    else
+        MPI_Isend(slot.splats.data(), numSplats, splatType, dest, MLSGPU_TAG_WORK, comm, &slot.request);
+}
+
+void SplatSender::flush()
+{
+    for (std::size_t i = 0; i < slots.size(); i++)
+    {
+        if (slots[i].request != MPI_REQUEST_NULL)
+        {
+            Statistics::Timer timer(waitStat);
+            MPI_Wait(&slots[i].request, MPI_STATUS_IGNORE);
+        }
+    }
+}
+
+std::size_t recvSplats(
+    Splat *splats, std::size_t maxSplats,
+    Statistics::Container::PODBuffer<char> &scratch,
+    MPI_Comm comm, int source)
+{
+    std::size_t sizes[2];
+    MPI_Recv(sizes, 2, mpi_type_traits<std::size_t>::type(), source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    if (sizes[0] > maxSplats)
+        throw std::length_error("Splat payload is too large");
+    if (sizes[1] > 0)
+    {
+        scratch.reserve(sizes[1], false);
+        MPI_Recv(scratch.data(), sizes[1], MPI_BYTE, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+        decompressBuffer(scratch.data(), sizes[1], splats, sizes[0] * sizeof(Splat));
+    }
+    else
+        recv(splats, sizes[0], comm, source);
+    return sizes[0];
+}
+
 void send(const SplatSet::SubsetBase &subset, MPI_Comm comm, int dest)
 {
     Access::send(subset, comm, dest);
@@ -278,7 +404,16 @@ void send(const MesherWork &work, MPI_Comm comm, int dest)
         work.mesh.numInternalVertices()
     };
 
+    Grid::size_type region[7];
+    for (int i = 0; i < 3; i++)
+    {
+        region[i] = work.regionLower[i];
+        region[i + 3] = work.regionUpper[i];
+    }
+    region[6] = work.regionDone;
+
     send(work.chunkId, comm, dest);
+    MPI_Send(&region, 7, mpi_type_traits<Grid::size_type>::type(), dest, MLSGPU_TAG_WORK, comm);
     MPI_Send(&sizes, 3, mpi_type_traits<std::size_t>::type(), dest, MLSGPU_TAG_WORK, comm);
 
     if (work.hasEvents)
@@ -306,6 +441,16 @@ void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source)
     work.vertexKeysEvent = cl::Event();
 
     recv(work.chunkId, comm, source);
+    Grid::size_type region[7];
+    MPI_Recv(&region, 7, mpi_type_traits<Grid::size_type>::type(),
+             source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    for (int i = 0; i < 3; i++)
+    {
+        work.regionLower[i] = region[i];
+        work.regionUpper[i] = region[i + 3];
+    }
+    work.regionDone = region[6];
+
     std::size_t sizes[3];
     MPI_Recv(&sizes, 3, mpi_type_traits<std::size_t>::type(),
              source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
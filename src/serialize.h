@@ -31,7 +31,10 @@
 # include <config.h>
 #endif
 #include <mpi.h>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include "bucket_collector.h"
+#include "allocator.h"
 
 /* Forward declaration */
 class Grid;
@@ -153,6 +156,83 @@ void recv(ChunkIdPod &chunkId, MPI_Comm comm, int source);
 void send(const Splat *splats, std::size_t numSplats, MPI_Comm comm, int dest);
 void recv(Splat *splats, std::size_t numSplats, MPI_Comm comm, int source);
 
+/**
+ * Pipelined transmission of splat payloads. The caller fills the buffer
+ * returned by @ref get and then calls @ref send. The payload is transmitted
+ * with a non-blocking send, so that the caller can prepare the next payload
+ * in another buffer while it is in flight. The payload may optionally be
+ * compressed (see @ref compressSupported).
+ *
+ * The payloads must be received with @ref recvSplats.
+ */
+class SplatSender : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param maxSplats   Maximum number of splats in a payload.
+     * @param slots       Maximum number of payloads in flight (at least 1).
+     * @param compress    If true, payloads are compressed.
+     *
+     * @pre If @a compress is true, @ref compressSupported must be true.
+     */
+    SplatSender(std::size_t maxSplats, std::size_t slots, bool compress);
+
+    /// Destructor. This waits for all outstanding sends to complete.
+    ~SplatSender();
+
+    /**
+     * Returns a buffer of @a maxSplats splats to be filled. If all buffers
+     * are in flight, this waits for the oldest one to complete.
+     */
+    Splat *get();
+
+    /**
+     * Sends the first @a numSplats splats from the buffer most recently
+     * returned by @ref get.
+     */
+    void send(std::size_t numSplats, MPI_Comm comm, int dest);
+
+    /// Waits for all outstanding sends to complete.
+    void flush();
+
+private:
+    struct Slot
+    {
+        Statistics::Container::PODBuffer<Splat> splats;
+        Statistics::Container::PODBuffer<char> compressed;
+        MPI_Request request;
+
+        Slot();
+    };
+
+    const std::size_t maxSplats;
+    const bool compress;
+    boost::ptr_vector<Slot> slots;
+    std::size_t cur;              ///< Slot returned by the last call to @ref get
+
+    Statistics::Variable &waitStat;
+    Statistics::Variable &ratioStat;
+};
+
+/**
+ * Receives a payload sent by @ref SplatSender.
+ *
+ * @param splats      Buffer to receive the splats.
+ * @param maxSplats   Capacity of @a splats.
+ * @param scratch     Temporary storage used for compressed payloads.
+ * @param comm, source Source of the payload.
+ * @return The number of splats received.
+ *
+ * @throw std::length_error if the payload is larger than @a maxSplats.
+ * @throw std::runtime_error if the payload could not be decompressed.
+ */
+std::size_t recvSplats(
+    Splat *splats, std::size_t maxSplats,
+    Statistics::Container::PODBuffer<char> &scratch,
+    MPI_Comm comm, int source);
+
 void send(const SplatSet::SubsetBase &subset, MPI_Comm comm, int dest);
 void recv(SplatSet::SubsetBase &subset, MPI_Comm comm, int source);
 
@@ -167,6 +247,11 @@ void send(const MesherWork &work, MPI_Comm comm, int dest);
  */
 void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source);
 
+/**
+ * Broadcast a grid to all ranks (like @c MPI_Bcast).
+ */
+void broadcast(Grid &grid, MPI_Comm comm, int root);
+
 /**
  * Broadcast a string to all ranks (like @c MPI_Bcast).
  */
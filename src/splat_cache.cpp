@@ -0,0 +1,144 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref SplatCacheMap.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include "splat_cache.h"
+#include "splat_set.h"
+#include "errors.h"
+
+SplatCacheMap::SplatCacheMap(std::size_t capacity)
+    : cacheCapacity(capacity), cacheSize(0)
+{
+}
+
+void SplatCacheMap::clear()
+{
+    resident.clear();
+    cacheSize = 0;
+}
+
+std::map<SplatSet::splat_id, SplatCacheMap::Resident>::const_iterator
+SplatCacheMap::find(SplatSet::splat_id id) const
+{
+    std::map<SplatSet::splat_id, Resident>::const_iterator p = resident.upper_bound(id);
+    if (p == resident.begin())
+        return resident.end();
+    --p;
+    return p->second.last > id ? p : resident.end();
+}
+
+SplatSet::splat_id SplatCacheMap::missingEnd(SplatSet::splat_id id, SplatSet::splat_id last) const
+{
+    std::map<SplatSet::splat_id, Resident>::const_iterator p = resident.upper_bound(id);
+    if (p != resident.end())
+        last = std::min(last, p->first);
+    return last;
+}
+
+void SplatCacheMap::append(std::vector<Copy> &copies, std::size_t src, std::size_t dst, std::size_t count)
+{
+    if (!copies.empty())
+    {
+        Copy &prev = copies.back();
+        if (prev.src + prev.count == src && prev.dst + prev.count == dst)
+        {
+            prev.count += count;
+            return;
+        }
+    }
+    Copy c;
+    c.src = src;
+    c.dst = dst;
+    c.count = count;
+    copies.push_back(c);
+}
+
+std::size_t SplatCacheMap::missing(const SplatSet::SubsetBase &ranges) const
+{
+    std::size_t ans = 0;
+    for (SplatSet::SubsetBase::const_iterator q = ranges.begin(); q != ranges.end(); ++q)
+    {
+        SplatSet::splat_id id = q->first;
+        while (id < q->second)
+        {
+            std::map<SplatSet::splat_id, Resident>::const_iterator p = find(id);
+            if (p != resident.end())
+                id = std::min(q->second, p->second.last);
+            else
+            {
+                SplatSet::splat_id next = missingEnd(id, q->second);
+                ans += next - id;
+                id = next;
+            }
+        }
+    }
+    return ans;
+}
+
+void SplatCacheMap::add(
+    const SplatSet::SubsetBase &ranges, std::size_t dst,
+    std::vector<Copy> &uploads, std::vector<Copy> &gathers)
+{
+    uploads.clear();
+    std::size_t src = 0;
+    for (SplatSet::SubsetBase::const_iterator q = ranges.begin(); q != ranges.end(); ++q)
+    {
+        SplatSet::splat_id id = q->first;
+        while (id < q->second)
+        {
+            std::size_t count;
+            std::map<SplatSet::splat_id, Resident>::const_iterator p = find(id);
+            if (p != resident.end())
+            {
+                count = std::min(q->second, p->second.last) - id;
+                append(gathers, p->second.pos + (id - p->first), dst, count);
+            }
+            else
+            {
+                SplatSet::splat_id next = missingEnd(id, q->second);
+                count = next - id;
+                MLSGPU_ASSERT(count <= cacheCapacity - cacheSize, std::length_error);
+                Resident r;
+                r.last = next;
+                r.pos = cacheSize;
+                resident[id] = r;
+                append(uploads, src, cacheSize, count);
+                append(gathers, cacheSize, dst, count);
+                cacheSize += count;
+            }
+            id += count;
+            src += count;
+            dst += count;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Bookkeeping for a cache of splats held in device memory.
+ */
+
+#ifndef SPLAT_CACHE_H
+#define SPLAT_CACHE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <vector>
+#include <map>
+#include "splat_set.h"
+
+/**
+ * Tracks which splats are held in a cache of fixed capacity, indexed by
+ * splat ID. It does not hold any storage itself. Instead, it describes
+ * the copies needed to add the splats of a bin to the cache and to
+ * assemble the bin from the cache. Splats are appended to the cache until
+ * it is cleared, and are never evicted individually.
+ */
+class SplatCacheMap
+{
+public:
+    /// A copy of a contiguous range of splats
+    struct Copy
+    {
+        std::size_t src;              ///< Position of the first splat in the source
+        std::size_t dst;              ///< Position of the first splat in the destination
+        std::size_t count;            ///< Number of splats
+    };
+
+private:
+    /// A range of splat IDs held in the cache
+    struct Resident
+    {
+        SplatSet::splat_id last;      ///< One past the last ID of the range
+        std::size_t pos;              ///< Position of the first splat in the cache
+    };
+
+    /// Ranges in the cache, indexed by first ID
+    std::map<SplatSet::splat_id, Resident> resident;
+    std::size_t cacheCapacity;        ///< Maximum number of splats in the cache
+    std::size_t cacheSize;            ///< Number of splats in the cache
+
+    /// Find the resident range containing @a id, or return @c resident.end().
+    std::map<SplatSet::splat_id, Resident>::const_iterator find(SplatSet::splat_id id) const;
+
+    /**
+     * Return the end of the non-resident range starting at @a id, which is at most
+     * @a last.
+     *
+     * @pre @a id is not resident.
+     */
+    SplatSet::splat_id missingEnd(SplatSet::splat_id id, SplatSet::splat_id last) const;
+
+    /// Append a copy to @a copies, merging it with the previous one if possible
+    static void append(std::vector<Copy> &copies, std::size_t src, std::size_t dst, std::size_t count);
+
+public:
+    /// Constructor
+    explicit SplatCacheMap(std::size_t capacity);
+
+    /// Maximum number of splats in the cache
+    std::size_t capacity() const { return cacheCapacity; }
+
+    /// Number of splats in the cache
+    std::size_t size() const { return cacheSize; }
+
+    /// Empty the cache
+    void clear();
+
+    /// Number of splats in @a ranges that are not in the cache
+    std::size_t missing(const SplatSet::SubsetBase &ranges) const;
+
+    /**
+     * Add the splats of a bin to the cache, and describe how to assemble the
+     * bin from it.
+     *
+     * @param ranges          Splat IDs of the bin, in the order they are stored.
+     * @param dst             Position of the bin in the destination of the gathers.
+     * @param[out] uploads    Copies from the bin (indexed from 0) into the cache,
+     *                        for splats that were not already present. It is
+     *                        cleared first.
+     * @param[in,out] gathers Copies from the cache into the destination.
+     *
+     * @pre @ref size() + @ref missing(@a ranges) &lt;= @ref capacity().
+     */
+    void add(const SplatSet::SubsetBase &ranges, std::size_t dst,
+             std::vector<Copy> &uploads, std::vector<Copy> &gathers);
+};
+
+#endif /* !SPLAT_CACHE_H */
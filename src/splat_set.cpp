@@ -31,6 +31,8 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
 #include <algorithm>
 #include <iosfwd>
 #include <utility>
@@ -115,19 +117,75 @@ BlobStream &SimpleBlobStream::operator++()
     return *this;
 }
 
-const unsigned int FileSet::scanIdShift = 40;
-const splat_id FileSet::splatIdMask = (splat_id(1) << scanIdShift) - 1;
 // An extra bit is subtracted because other bits of code use the top bit for a flag
-const std::size_t FileSet::maxFiles = std::size_t(1) << (std::numeric_limits<splat_id>::digits - 1 - scanIdShift);
-/* Would probably be safe to add 1, but I haven't tested the effects of having splats from
- * different files have adjacent IDs. It's a big enough number anyway.
- */
-const std::size_t FileSet::maxFileSplats = FileSet::splatIdMask;
+const unsigned int FileSet::idBits = std::numeric_limits<splat_id>::digits - 1;
+
+unsigned int FileSet::indexBits(FastPly::Reader::size_type maxFileSplats)
+{
+    /* Would probably be safe to allow a file to fill the index space, but I
+     * haven't tested the effects of having splats from different files have
+     * adjacent IDs. So the index must be strictly less than 2^bits.
+     */
+    unsigned int bits = 0;
+    while (bits < std::numeric_limits<FastPly::Reader::size_type>::digits
+           && (maxFileSplats >> bits) != 0)
+        bits++;
+    return bits;
+}
+
+bool FileSet::idsFit(std::size_t numFiles, FastPly::Reader::size_type maxFileSplats)
+{
+    const unsigned int bits = indexBits(maxFileSplats);
+    if (bits > idBits)
+        return false;
+    return numFiles <= (splat_id(1) << (idBits - bits));
+}
 
 void FileSet::addFile(FastPly::Reader *file)
 {
+    const FastPly::Reader::size_type newMax = std::max(maxFileSplats, file->size());
+    if (!idsFit(files.size() + 1, newMax))
+        throw std::length_error("Too many splats to assign IDs");
+
     files.push_back(file);
     nSplats += file->size();
+    maxFileSplats = newMax;
+    scanIdShift = indexBits(maxFileSplats);
+    splatIdMask = (splat_id(1) << scanIdShift) - 1;
+}
+
+void FileSet::addTemporary(const boost::filesystem::path &path)
+{
+    temporaries.push_back(path);
+}
+
+void FileSet::excludeSplat(splat_id id)
+{
+    const std::size_t fileId = id >> scanIdShift;
+    const FastPly::Reader::size_type index = id & splatIdMask;
+    MLSGPU_ASSERT(fileId < files.size() && index < files[fileId].size(), std::out_of_range);
+
+    if (excluded.size() <= fileId)
+        excluded.resize(fileId + 1);
+    std::vector<bool> &mask = excluded[fileId];
+    if (mask.empty())
+        mask.resize(files[fileId].size(), false);
+    if (!mask[index])
+    {
+        mask[index] = true;
+        nExcluded++;
+    }
+}
+
+FileSet::~FileSet()
+{
+    BOOST_FOREACH(const boost::filesystem::path &path, temporaries)
+    {
+        boost::system::error_code ec;
+        remove(path, ec);
+        if (ec)
+            Log::log[Log::warn] << "Could not delete " << path.string() << ": " << ec.message() << std::endl;
+    }
 }
 
 std::pair<splat_id, splat_id> FileSet::partition(int rank, int size) const
@@ -179,6 +237,8 @@ void FileSet::ReaderThreadBase::drain()
     }
 }
 
+const std::size_t FileSet::MySplatStream::decodeBlockSize = 1024;
+
 FileSet::MySplatStream::MySplatStream(
     const FileSet &owner, ReaderThreadBase *reader, bool useOMP)
 :
@@ -202,8 +262,11 @@ std::size_t FileSet::MySplatStream::read(Splat *splats, splat_id *splatIds, std:
             pos = curItem.first;
         }
 
-        const std::size_t fileId = curItem.first >> scanIdShift;
+        const std::size_t fileId = owner.getFileId(curItem.first);
         const FastPly::Reader &file = owner.files[fileId];
+        const std::vector<bool> *excluded = NULL;
+        if (fileId < owner.excluded.size() && !owner.excluded[fileId].empty())
+            excluded = &owner.excluded[fileId];
 
         // Try a parallel load + decode, and fall back if there are non-finites
         const std::size_t n = std::min(curItem.last - pos, (splat_id) count);
@@ -212,28 +275,35 @@ std::size_t FileSet::MySplatStream::read(Splat *splats, splat_id *splatIds, std:
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) if (useOMP && n > 16384) reduction(||:nonFinite) shared(file, splats, splatIds) default(none)
 #endif
-        for (std::size_t i = 0; i < n; i++)
+        for (std::size_t start = 0; start < n; start += decodeBlockSize)
         {
-            splats[i] = file.decode(curItem.ptr, offset + i);
-            if (splatIds != NULL)
-                splatIds[i] = pos + i;
-            nonFinite = nonFinite || !splats[i].isFinite();
+            const std::size_t end = std::min(n, start + decodeBlockSize);
+            file.decode(curItem.ptr, offset + start, end - start, splats + start);
+            for (std::size_t i = start; i < end; i++)
+            {
+                if (splatIds != NULL)
+                    splatIds[i] = pos + i;
+                nonFinite = nonFinite || !splats[i].isFinite();
+            }
         }
 
         std::size_t p;
-        if (nonFinite)
+        if (nonFinite || excluded != NULL)
         {
-            /* Need to compact out the non-finite ones. This could also be parallelised
-             * by keeping a per-thread count and prefix summing it, but it's a rare
-             * event so is probably not worth the cost.
+            /* Need to compact out the non-finite and excluded ones. This could
+             * also be parallelised by keeping a per-thread count and prefix
+             * summing it, but it's a rare event so is probably not worth the
+             * cost.
              */
             p = 0;
             for (std::size_t i = 0; i < n; i++)
             {
-                if (splats[i].isFinite())
+                if (splats[i].isFinite()
+                    && (excluded == NULL || !(*excluded)[(pos + i) & owner.splatIdMask]))
                 {
                     splats[p] = splats[i];
-                    splatIds[p] = splatIds[i];
+                    if (splatIds != NULL)
+                        splatIds[p] = splatIds[i];
                     p++;
                 }
             }
@@ -393,6 +393,9 @@ private:
     {
         std::size_t fileId;  ///< Index into list of files
         FastPly::Reader::size_type start, end;  ///< Indices within @ref fileId
+
+        /// Orders by file only, for grouping ranges with a stable sort
+        bool operator<(const FileRange &other) const { return fileId < other.fileId; }
     };
 
     /**
@@ -467,23 +470,54 @@ public:
         DEFAULT_BUFFER_SIZE = 32 * 1024 * 1024
     };
 
-    /// Number of bits used to store the within-file splat ID
-    static const unsigned int scanIdShift;
-    /// Mask of the bits used to store the within-file splat ID
-    static const splat_id splatIdMask;
-
-    /// Maximum number of files supported;
-    static const std::size_t maxFiles;
+    /**
+     * Number of bits available for splat IDs. An extra bit is reserved
+     * because other bits of code use the top bit for a flag.
+     */
+    static const unsigned int idBits;
 
-    /// Maximum number of splats per file supported
-    static const std::size_t maxFileSplats;
+    /**
+     * Determine whether IDs can be assigned to the splats of some files.
+     *
+     * @param numFiles       Number of files.
+     * @param maxFileSplats  Number of splats in the largest file.
+     */
+    static bool idsFit(std::size_t numFiles, FastPly::Reader::size_type maxFileSplats);
 
     /**
      * Append a new file to the set. The set takes over ownership of the file.
      * This must not be called while a stream is in progress.
+     *
+     * A splat ID holds the index of the file in the upper bits and the index
+     * within the file in the lower bits. The split is chosen to fit the
+     * largest file, so adding a file may change the IDs of existing splats.
+     *
+     * @throw std::length_error if IDs cannot be assigned to the files (see
+     * @ref idsFit). The file is not added and ownership remains with the
+     * caller.
      */
     void addFile(FastPly::Reader *file);
 
+    /// Index of the file containing a splat
+    std::size_t getFileId(splat_id id) const { return id >> scanIdShift; }
+
+    /**
+     * Register a file to be deleted when the set is destroyed. This is used
+     * for intermediate files that are generated from the inputs, such as
+     * those holding estimated normals.
+     */
+    void addTemporary(const boost::filesystem::path &path);
+
+    /**
+     * Exclude a splat from all streams subsequently created from the set, as
+     * if it had non-finite values. This must not be called while a stream is
+     * in progress. Blob information computed from the set is not updated.
+     */
+    void excludeSplat(splat_id id);
+
+    /// Number of distinct splats passed to @ref excludeSplat
+    std::tr1::uint64_t numExcluded() const { return nExcluded; }
+
     SplatStream *makeSplatStream(bool useOMP = true) const
     {
         return makeSplatStream(&detail::rangeAll, &detail::rangeAll + 1, useOMP);
@@ -504,6 +538,18 @@ public:
         return ans;
     }
 
+    /**
+     * Advise the operating system that the splats in some ranges will be
+     * read soon (see @ref FastPly::Reader::Handle::willNeed). Each file that
+     * is touched and can act on the hint (see @ref FastPly::Reader::canWillNeed)
+     * is opened once, briefly, to issue the hints for it.
+     *
+     * @param firstRange, lastRange  Ranges of splat IDs, in the same form as
+     *                               for @ref makeSplatStream.
+     */
+    template<typename RangeIterator>
+    void willNeed(RangeIterator firstRange, RangeIterator lastRange) const;
+
     splat_id maxSplats() const { return nSplats; }
 
     /**
@@ -525,7 +571,10 @@ public:
      */
     void setBufferSize(std::size_t bufferSize) { this->bufferSize = bufferSize; }
 
-    FileSet() : nSplats(0), bufferSize(DEFAULT_BUFFER_SIZE) {}
+    FileSet() : nSplats(0), nExcluded(0), scanIdShift(0), splatIdMask(0), maxFileSplats(0), bufferSize(DEFAULT_BUFFER_SIZE) {}
+
+    /// Destructor, which deletes the files registered with @ref addTemporary.
+    ~FileSet();
 
 private:
     /**
@@ -638,14 +687,40 @@ private:
         boost::scoped_ptr<ReaderThreadBase> readerThread;
         boost::thread thread;
         const bool useOMP;              ///< Whether to use OpenMP for acceleration
+
+        /// Number of splats passed to each call to @ref FastPly::Reader::decode
+        static const std::size_t decodeBlockSize;
     };
 
     /// Backing store of files
     boost::ptr_vector<FastPly::Reader> files;
 
+    /// Files to delete on destruction
+    std::vector<boost::filesystem::path> temporaries;
+
+    /**
+     * Splats removed by @ref excludeSplat, indexed by file and then by
+     * position within the file. The per-file mask is empty if nothing in
+     * that file is excluded.
+     */
+    std::vector<std::vector<bool> > excluded;
+
     /// Number of splats stored in the files (including non-finites)
     splat_id nSplats;
 
+    /// Number of splats marked in @ref excluded
+    std::tr1::uint64_t nExcluded;
+
+    /// Number of bits used to store the within-file splat ID
+    unsigned int scanIdShift;
+    /// Mask of the bits used to store the within-file splat ID
+    splat_id splatIdMask;
+    /// Number of splats in the largest file
+    FastPly::Reader::size_type maxFileSplats;
+
+    /// Number of bits needed to store the within-file IDs for a file size
+    static unsigned int indexBits(FastPly::Reader::size_type maxFileSplats);
+
     /// Buffer sized used by streams
     std::size_t bufferSize;
 };
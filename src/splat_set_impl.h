@@ -48,6 +48,7 @@
 #endif
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <utility>
 #include <iostream>
 #include <boost/smart_ptr/shared_ptr.hpp>
@@ -111,7 +112,7 @@ void FileSet::FileRangeIterator<RangeIterator>::increment()
 {
     MLSGPU_ASSERT(curRange != lastRange, state_error);
     MLSGPU_ASSERT(owner != NULL, state_error);
-    const std::size_t fileId = first >> scanIdShift;
+    const std::size_t fileId = first >> owner->scanIdShift;
     const std::size_t vertexSize = owner->files[fileId].getVertexSize();
     first = std::min(first + maxSize / vertexSize, curRange->second);
     refill();
@@ -124,7 +125,7 @@ void FileSet::FileRangeIterator<RangeIterator>::refill()
     {
         while (true)
         {
-            std::size_t fileId = first >> scanIdShift;
+            std::size_t fileId = first >> owner->scanIdShift;
             if (first >= curRange->second || fileId >= owner->files.size())
             {
                 ++curRange;
@@ -138,9 +139,9 @@ void FileSet::FileRangeIterator<RangeIterator>::refill()
                     first = curRange->first;
                 }
             }
-            else if ((first & splatIdMask) >= owner->files[fileId].size())
+            else if ((first & owner->splatIdMask) >= owner->files[fileId].size())
             {
-                first = (splat_id(fileId) + 1) << scanIdShift; // advance to next file
+                first = (splat_id(fileId) + 1) << owner->scanIdShift; // advance to next file
             }
             else
                 break;
@@ -164,12 +165,12 @@ FileSet::FileRange FileSet::FileRangeIterator<RangeIterator>::dereference() cons
     MLSGPU_ASSERT(owner != NULL, state_error);
     FileRange ans;
 
-    ans.fileId = first >> scanIdShift;
-    ans.start = first & splatIdMask;
+    ans.fileId = first >> owner->scanIdShift;
+    ans.start = first & owner->splatIdMask;
     assert(ans.fileId < owner->files.size());
     ans.end = owner->files[ans.fileId].size();
-    if ((curRange->second >> scanIdShift) == ans.fileId)
-        ans.end = std::min(ans.end, FastPly::Reader::size_type(curRange->second & splatIdMask));
+    if ((curRange->second >> owner->scanIdShift) == ans.fileId)
+        ans.end = std::min(ans.end, FastPly::Reader::size_type(curRange->second & owner->splatIdMask));
     const std::size_t vertexSize = owner->files[ans.fileId].getVertexSize();
     if ((ans.end - ans.start) * vertexSize > maxSize)
         ans.end = ans.start + maxSize / vertexSize;
@@ -215,6 +216,7 @@ void FileSet::ReaderThread<RangeIterator>::operator()()
     Statistics::Variable &readTimeStat = Statistics::getStatistic<Statistics::Variable>("files.read.time");
     Statistics::Variable &readRangeStat = Statistics::getStatistic<Statistics::Variable>("files.read.splats");
     Statistics::Variable &readMergedStat = Statistics::getStatistic<Statistics::Variable>("files.read.merged");
+    Statistics::Counter &readBytesStat = Statistics::getStatistic<Statistics::Counter>("files.read.bytes");
 
     boost::scoped_ptr<FastPly::Reader::Handle> handle;
     std::size_t handleId = 0;
@@ -264,6 +266,7 @@ void FileSet::ReaderThread<RangeIterator>::operator()()
             handle->readRaw(start, end, chunk);
         }
         readMergedStat.add(end - start);
+        readBytesStat.add((end - start) * vertexSize);
 
         {
             Timeplot::Action pushTimer("push", tworker);
@@ -272,7 +275,7 @@ void FileSet::ReaderThread<RangeIterator>::operator()()
                 readRangeStat.add(range.end - range.start);
 
                 Item item;
-                item.first = range.start + (splat_id(range.fileId) << scanIdShift);
+                item.first = range.start + (splat_id(range.fileId) << owner.scanIdShift);
                 item.last = item.first + (range.end - range.start);
                 item.ptr = chunk + (range.start - start) * vertexSize;
                 ++cur;
@@ -290,6 +293,36 @@ void FileSet::ReaderThread<RangeIterator>::operator()()
     outQueue.stop();
 }
 
+template<typename RangeIterator>
+void FileSet::willNeed(RangeIterator firstRange, RangeIterator lastRange) const
+{
+    /* Files that would ignore the hint are skipped without being opened, and
+     * the rest are grouped so that each is opened only once.
+     */
+    std::vector<FileRange> ranges;
+    FileRangeIterator<RangeIterator> cur(*this, firstRange, lastRange,
+                                         std::numeric_limits<FastPly::Reader::size_type>::max());
+    FileRangeIterator<RangeIterator> last(*this, lastRange);
+    for (; cur != last; ++cur)
+    {
+        const FileRange range = *cur;
+        if (files[range.fileId].canWillNeed())
+            ranges.push_back(range);
+    }
+    std::stable_sort(ranges.begin(), ranges.end());
+
+    boost::scoped_ptr<FastPly::Reader::Handle> handle;
+    for (std::size_t i = 0; i < ranges.size(); i++)
+    {
+        if (i == 0 || ranges[i].fileId != ranges[i - 1].fileId)
+        {
+            handle.reset(); // close the old handle
+            handle.reset(new FastPly::Reader::Handle(files[ranges[i].fileId]));
+        }
+        handle->willNeed(ranges[i].start, ranges[i].end);
+    }
+}
+
 static inline std::tr1::int32_t extractUnsigned(std::tr1::uint32_t value, int lbit, int hbit)
 {
     assert(0 <= lbit && lbit < hbit && hbit <= 32);
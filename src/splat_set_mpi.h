@@ -31,19 +31,29 @@
 # include <config.h>
 #endif
 #include <mpi.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 #include <ostream>
 #include <utility>
 #include <memory>
+#include <vector>
+#include <sstream>
+#include <algorithm>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/ref.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/exception_ptr.hpp>
 #include "grid.h"
 #include "splat_set.h"
 #include "progress.h"
 #include "progress_mpi.h"
 #include "errors.h"
 #include "serialize.h"
+#include "statistics.h"
+#include "timer.h"
 
 namespace SplatSet
 {
@@ -56,6 +66,12 @@ public:
      * Computes the blobs for the underlying set collectively across all ranks.
      * The results are broadcast back to the ranks.
      *
+     * Each rank's share of the splats is further divided between @a readers
+     * threads, each of which has its own reader and produces its own blob
+     * file. The reductions of the bounding box and splat count are started
+     * as soon as the local work is done and complete while the blob files
+     * are being exchanged.
+     *
      * @param comm           Communicator for the collective operation.
      * @param root           Master for the collective operation (affects logging only)
      * @param spacing        Grid spacing for grids to be accelerated.
@@ -63,10 +79,13 @@ public:
      * @param progressStream If non-NULL, will be used to report collective progress
      * @param warnNonFinite  If true (the default), a warning will be displayed if
      *                       non-finite splats are encountered.
+     * @param readers        Number of reader threads to use on each rank.
      *
      * @pre
      * - The underlying set of splats is identical at all ranks.
-     * - All ranks specify the same value for @a root, @a spacing and @a bucketSize
+     * - All ranks specify the same value for @a root, @a spacing, @a bucketSize
+     *   and @a readers.
+     * - @a readers is positive.
      *
      * @note The progress is actually written to the stream on the root, but
      * either ranks must pass NULL for @a progressStream or all ranks must pass
@@ -76,16 +95,62 @@ public:
         MPI_Comm comm, int root,
         float spacing, Grid::size_type bucketSize,
         std::ostream *progressStream = NULL,
-        bool warnNonFinite = true);
+        bool warnNonFinite = true,
+        unsigned int readers = 1);
+
+private:
+    /**
+     * Thread body for one reader in @ref computeBlobs. It wraps @ref
+     * FastBlobSet::computeBlobsRange, capturing any exception in @a error
+     * so that it can be rethrown in the calling thread. If @a ompThreads is
+     * positive, it is used to limit the OpenMP threads used by this reader.
+     */
+    void computeBlobsWorker(
+        std::pair<splat_id, splat_id> range,
+        const detail::SplatToBuckets &toBuckets,
+        detail::Bbox &bbox, typename FastBlobSet<Base>::BlobFile &bf, splat_id &nSplats,
+        ProgressMeter *progress, int ompThreads,
+        boost::exception_ptr &error);
 };
 
+template<typename Base>
+void FastBlobSetMPI<Base>::computeBlobsWorker(
+    std::pair<splat_id, splat_id> range,
+    const detail::SplatToBuckets &toBuckets,
+    detail::Bbox &bbox, typename FastBlobSet<Base>::BlobFile &bf, splat_id &nSplats,
+    ProgressMeter *progress, int ompThreads,
+    boost::exception_ptr &error)
+{
+#ifdef _OPENMP
+    if (ompThreads > 0)
+        omp_set_num_threads(ompThreads);
+#else
+    (void) ompThreads;
+#endif
+    try
+    {
+        this->computeBlobsRange(
+            range.first, range.second,
+            toBuckets,
+            bbox, bf, nSplats,
+            progress);
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
 template<typename Base>
 void FastBlobSetMPI<Base>::computeBlobs(
     MPI_Comm comm, int root,
     float spacing, Grid::size_type bucketSize,
     std::ostream *progressStream,
-    bool warnNonFinite)
+    bool warnNonFinite,
+    unsigned int readers)
 {
+    typedef typename FastBlobSet<Base>::BlobFile BlobFile;
+
     int rank, size;
     MPI_Comm_rank(comm, &rank);
     MPI_Comm_size(comm, &size);
@@ -93,9 +158,10 @@ void FastBlobSetMPI<Base>::computeBlobs(
     Statistics::Registry &registry = Statistics::Registry::getInstance();
 
     MLSGPU_ASSERT(bucketSize > 0, std::invalid_argument);
+    MLSGPU_ASSERT(readers > 0, std::invalid_argument);
     this->internalBucketSize = bucketSize;
     this->eraseBlobFiles();
-    this->blobFiles.reserve(size);
+    this->blobFiles.reserve(size * readers);
     this->nSplats = 0;
     detail::Bbox bbox;
 
@@ -115,20 +181,107 @@ void FastBlobSetMPI<Base>::computeBlobs(
             progressThread.reset(new boost::thread(boost::ref(*progress)));
     }
 
-    typename FastBlobSet<Base>::BlobFile blobFile; // TODO: exception safety
+    std::vector<BlobFile> blobFiles(readers); // TODO: exception safety
     try
     {
         const detail::SplatToBuckets toBuckets(spacing, bucketSize);
-        std::pair<splat_id, splat_id> range = Base::partition(rank, size);
-        this->computeBlobsRange(
-            range.first, range.second,
-            toBuckets,
-            bbox, blobFile, this->nSplats,
-            progress.get());
+        std::vector<detail::Bbox> bboxes(readers);
+        std::vector<splat_id> counts(readers);
+        std::vector<boost::exception_ptr> errors(readers);
+#ifdef _OPENMP
+        const int oldOmpThreads = omp_get_max_threads();
+        const int ompThreads = std::max(1, oldOmpThreads / int(readers));
+#else
+        const int ompThreads = 1;
+#endif
+
+        Timer timer;
+        {
+            // The calling thread acts as the first reader
+            boost::ptr_vector<boost::thread> threads;
+            for (unsigned int i = 1; i < readers; i++)
+                threads.push_back(new boost::thread(
+                        &FastBlobSetMPI<Base>::computeBlobsWorker, this,
+                        Base::partition(rank * readers + i, size * readers),
+                        boost::cref(toBuckets),
+                        boost::ref(bboxes[i]), boost::ref(blobFiles[i]), boost::ref(counts[i]),
+                        progress.get(), ompThreads, boost::ref(errors[i])));
+            computeBlobsWorker(
+                Base::partition(rank * readers, size * readers),
+                toBuckets,
+                bboxes[0], blobFiles[0], counts[0],
+                progress.get(), ompThreads, errors[0]);
+            for (std::size_t i = 0; i < threads.size(); i++)
+                threads[i].join();
+#ifdef _OPENMP
+            // Later parallel regions on this thread get the full count again
+            omp_set_num_threads(oldOmpThreads);
+#endif
+        }
+        for (unsigned int i = 0; i < readers; i++)
+            if (errors[i])
+                boost::rethrow_exception(errors[i]);
 
+        const double elapsed = timer.getElapsed();
+        for (unsigned int i = 0; i < readers; i++)
+        {
+            bbox += bboxes[i];
+            this->nSplats += counts[i];
+        }
+        {
+            std::ostringstream name;
+            name << "rank" << rank << ".blobset.throughput";
+            registry.getStatistic<Statistics::Variable>(name.str()).add(
+                elapsed > 0.0 ? this->nSplats / elapsed : 0.0);
+        }
+
+        /* Start the reductions, and let them complete while the blob files
+         * are being exchanged. The maximum is negated so that a single
+         * reduction handles both ends of the bounding box.
+         */
+        float extents[6];
+        for (int i = 0; i < 3; i++)
+        {
+            extents[i] = bbox.bboxMin[i];
+            extents[i + 3] = -bbox.bboxMax[i];
+        }
+        MPI_Request requests[2];
+#if MPI_VERSION >= 3
+        MPI_Iallreduce(MPI_IN_PLACE, &this->nSplats, 1, Serialize::mpi_type_traits<splat_id>::type(), MPI_SUM, comm, &requests[0]);
+        MPI_Iallreduce(MPI_IN_PLACE, extents, 6, MPI_FLOAT, MPI_MIN, comm, &requests[1]);
+#else
         MPI_Allreduce(MPI_IN_PLACE, &this->nSplats, 1, Serialize::mpi_type_traits<splat_id>::type(), MPI_SUM, comm);
-        MPI_Allreduce(MPI_IN_PLACE, &bbox.bboxMin[0], 3, MPI_FLOAT, MPI_MIN, comm);
-        MPI_Allreduce(MPI_IN_PLACE, &bbox.bboxMax[0], 3, MPI_FLOAT, MPI_MAX, comm);
+        MPI_Allreduce(MPI_IN_PLACE, extents, 6, MPI_FLOAT, MPI_MIN, comm);
+        requests[0] = requests[1] = MPI_REQUEST_NULL;
+#endif
+
+        /* Distribute the filenames. This is not done with MPI_Alltoall since that requires
+         * placing all the filenames in a single buffer.
+         */
+        for (int i = 0; i < size; i++)
+            for (unsigned int j = 0; j < readers; j++)
+            {
+                std::tr1::uint64_t nBlobs = blobFiles[j].nBlobs;
+                boost::filesystem::path path = blobFiles[j].path;
+
+                MPI_Bcast(&nBlobs, 1, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
+                          i, comm);
+                Serialize::broadcast(path, comm, i);
+                this->blobFiles.push_back(BlobFile());
+                this->blobFiles.back().path = path;
+                this->blobFiles.back().nBlobs = nBlobs;
+                this->blobFiles.back().owner = (rank == root);
+                MPI_Barrier(comm); // ensures that the master takes ownership before the worker releases it
+                if (i == rank)
+                    blobFiles[j].owner = false;
+            }
+
+        MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+        for (int i = 0; i < 3; i++)
+        {
+            bbox.bboxMin[i] = extents[i];
+            bbox.bboxMax[i] = -extents[i + 3];
+        }
 
         assert(this->nSplats <= Base::maxSplats());
         if (progress)
@@ -150,30 +303,11 @@ void FastBlobSetMPI<Base>::computeBlobs(
             registry.getStatistic<Statistics::Variable>("blobset.nonfinite").add(nonFinite);
         }
         this->boundingGrid = this->makeBoundingGrid(spacing, bucketSize, bbox);
-
-        /* Distribute the filenames. This is not done with MPI_Alltoall since that requires
-         * placing all the filenames in a single buffer.
-         */
-        for (int i = 0; i < size; i++)
-        {
-            std::tr1::uint64_t nBlobs = blobFile.nBlobs;
-            boost::filesystem::path path = blobFile.path;
-
-            MPI_Bcast(&nBlobs, 1, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
-                      i, comm);
-            Serialize::broadcast(path, comm, i);
-            this->blobFiles.push_back(typename FastBlobSet<Base>::BlobFile());
-            this->blobFiles.back().path = path;
-            this->blobFiles.back().nBlobs = nBlobs;
-            this->blobFiles.back().owner = (rank == root);
-            MPI_Barrier(comm); // ensures that the master takes ownership before the worker releases it
-            if (i == rank)
-                blobFile.owner = false;
-        }
     }
     catch (std::exception &e)
     {
-        this->eraseBlobFile(blobFile);
+        for (unsigned int i = 0; i < readers; i++)
+            this->eraseBlobFile(blobFiles[i]);
         throw;
     }
 }
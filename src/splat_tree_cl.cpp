@@ -34,6 +34,7 @@
 #include <CL/cl.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/static_assert.hpp>
+#include <boost/foreach.hpp>
 #include <cstddef>
 #include "tr1_cstdint.h"
 #include <limits>
@@ -145,6 +146,7 @@ void SplatTreeCL::enqueueWriteEntries(
     const cl::Buffer &keys,
     const cl::Buffer &values,
     const cl::Buffer &splats,
+    command_type firstEntry,
     command_type firstSplat,
     command_type numSplats,
     const Grid::difference_type offset[3],
@@ -166,7 +168,7 @@ void SplatTreeCL::enqueueWriteEntries(
 
     CLH::enqueueNDRangeKernel(queue,
                               writeEntriesKernel,
-                              cl::NullRange,
+                              firstEntry != 0 ? cl::NDRange(firstEntry) : cl::NullRange,
                               cl::NDRange(numSplats),
                               cl::NullRange,
                               events, event, &writeEntriesKernelTime);
@@ -274,16 +276,44 @@ void SplatTreeCL::enqueueBuild(
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
-    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
-    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
-    Grid::size_type maxSize = Grid::size_type(1U) << (maxLevels + subsamplingShift - 1);
-    MLSGPU_ASSERT(size[0] <= maxSize && size[1] <= maxSize && size[2] <= maxSize,
-                  std::length_error);
-    unsigned int maxShift = maxLevels + subsamplingShift - 1;
+    std::vector<Region> regions(1);
+    regions[0].firstSplat = firstSplat;
+    regions[0].numSplats = numSplats;
+    for (int i = 0; i < 3; i++)
+    {
+        regions[0].size[i] = size[i];
+        regions[0].offset[i] = offset[i];
+        regions[0].origin[i] = 0;
+    }
+    enqueueBuild(queue, splats, regions, maxLevels, subsamplingShift, events, event);
+}
+
+void SplatTreeCL::enqueueBuild(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats, const std::vector<Region> &regions,
+    unsigned int levels, unsigned int subsamplingShift,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(!regions.empty(), std::invalid_argument);
+    MLSGPU_ASSERT(1 <= levels && levels <= maxLevels, std::invalid_argument);
+    Grid::size_type maxSize = Grid::size_type(1U) << (levels + subsamplingShift - 1);
+    std::size_t numSplats = 0;
+    BOOST_FOREACH(const Region &region, regions)
+    {
+        MLSGPU_ASSERT(region.numSplats <= maxSplats - numSplats, std::length_error);
+        MLSGPU_ASSERT(region.firstSplat < CL_UINT_MAX - region.numSplats, std::length_error);
+        for (int i = 0; i < 3; i++)
+        {
+            MLSGPU_ASSERT(region.origin[i] <= maxSize && region.size[i] <= maxSize - region.origin[i],
+                          std::length_error);
+            MLSGPU_ASSERT(region.origin[i] % (Grid::size_type(1U) << subsamplingShift) == 0,
+                          std::invalid_argument);
+        }
+        numSplats += region.numSplats;
+    }
+    unsigned int maxShift = levels + subsamplingShift - 1;
     unsigned int minShift = std::min(subsamplingShift, maxShift);
-    // TODO: this will always construct a full-size octree, even if size[] only
-    // specifies a much smaller space. At a minimum, it should be possible to make
-    // levelOffsets more compact.
 
     this->numSplats = numSplats;
     std::size_t pos = 0;
@@ -303,9 +333,25 @@ void SplatTreeCL::enqueueBuild(
 
     // TODO: revisit this dependency tracking
     const std::size_t numEntries = numSplats * 8;
-    enqueueWriteEntries(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats, offset, minShift, maxShift, events, &writeEntriesEvent);
-    wait[0] = writeEntriesEvent;
-    sort.enqueue(queue, entryKeys, entryValues, numEntries, 3 * (maxShift - minShift) + 1, &wait, &sortEvent);
+    /* Each region's splats are placed relative to its origin within the
+     * octree. The entries of the regions are written one after the other,
+     * so that a single sort covers all of them.
+     */
+    std::vector<cl::Event> writeEntriesEvents;
+    std::size_t firstEntry = 0;
+    BOOST_FOREACH(const Region &region, regions)
+    {
+        Grid::difference_type bias[3];
+        for (int i = 0; i < 3; i++)
+            bias[i] = region.offset[i] - Grid::difference_type(region.origin[i]);
+        enqueueWriteEntries(queue, entryKeys, entryValues, this->splats,
+                            firstEntry, region.firstSplat, region.numSplats,
+                            bias, minShift, maxShift, events, &writeEntriesEvent);
+        writeEntriesEvents.push_back(writeEntriesEvent);
+        firstEntry += region.numSplats;
+    }
+    sort.enqueue(queue, entryKeys, entryValues, numEntries, 3 * (maxShift - minShift) + 1,
+                 &writeEntriesEvents, &sortEvent);
     wait[0] = sortEvent;
     enqueueCountCommands(queue, commandMap, entryKeys, numEntries, &wait, &countEvent);
     wait[0] = countEvent;
@@ -88,6 +88,19 @@ public:
         MAX_SPLATS = 0x7FFFFFFF / 16
     };
 
+    /**
+     * One of several independent sets of splats placed in disjoint parts of
+     * a single octree (see the batched form of @ref enqueueBuild).
+     */
+    struct Region
+    {
+        std::size_t firstSplat;           ///< Index of the first splat of the region
+        std::size_t numSplats;            ///< Number of splats in the region
+        Grid::size_type size[3];          ///< Number of cells to cover
+        Grid::difference_type offset[3];  ///< Offset of the region within the overall grid
+        Grid::size_type origin[3];        ///< Position of the region within the octree
+    };
+
 private:
     /**
      * @name
@@ -153,6 +166,7 @@ private:
                              const cl::Buffer &keys,
                              const cl::Buffer &values,
                              const cl::Buffer &splats,
+                             command_type firstEntry,
                              command_type firstSplat,
                              command_type numSplats,
                              const Grid::difference_type offset[3],
@@ -271,6 +285,40 @@ public:
                       const std::vector<cl::Event> *events = NULL,
                       cl::Event *event = NULL);
 
+    /**
+     * Asynchronously builds an octree holding several regions, each of which
+     * behaves as if it had its own octree built by the single-region form of
+     * @ref enqueueBuild, translated to start at @ref Region::origin. This
+     * replaces one build per region by a single sort and scan.
+     *
+     * Splats are inserted into every cell they touch, even those of another
+     * region. The caller must thus only batch regions whose splats have no
+     * influence on the vertices of the other regions.
+     *
+     * Building with fewer than the allocated levels is cheaper, and suits
+     * regions that do not need the full extent of the octree.
+     *
+     * @param queue         The command queue for the building operations.
+     * @param splats        The splats to use in the octree.
+     * @param regions       The regions to place in the octree.
+     * @param levels        Number of levels to build.
+     * @param subsamplingShift Number of fine levels to drop.
+     * @param events        Events to wait for (or @c NULL).
+     * @param[out] event    Event that fires when the octree is ready to use (or @c NULL).
+     *
+     * @pre
+     * - @a regions is not empty.
+     * - 1 <= @a levels <= @a maxLevels.
+     * - Each region lies within 2^(levels + subsamplingShift - 1) elements in any direction.
+     * - Each region's origin is a multiple of 2^subsamplingShift.
+     * - The regions hold at most @a maxSplats splats in total.
+     */
+    void enqueueBuild(const cl::CommandQueue &queue,
+                      const cl::Buffer &splats, const std::vector<Region> &regions,
+                      unsigned int levels, unsigned int subsamplingShift,
+                      const std::vector<cl::Event> *events = NULL,
+                      cl::Event *event = NULL);
+
     /**
      * @name Getters for the buffers and images needed to use the octree.
      * These can be called at any time, and remain valid across a call to
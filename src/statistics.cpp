@@ -144,6 +144,12 @@ unsigned long long Variable::getNumSamples() const
     return n;
 }
 
+double Variable::getSum() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return sum;
+}
+
 double Variable::getMean() const
 {
     boost::lock_guard<boost::mutex> lock(mutex);
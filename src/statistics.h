@@ -185,6 +185,7 @@ public:
     void add(double value);
 
     unsigned long long getNumSamples() const;   ///< Return the number of calls to @ref add
+    double getSum() const;                      ///< Return the sum of the samples
     /**
      * Return the mean.
      * @throw std::length_error if no samples have been added.
@@ -201,6 +201,12 @@ public:
         return computeStat;
     }
 
+    /// Obtain the statistic for reporting time spent waiting in @ref get
+    Statistics::Variable &getGetStat() const
+    {
+        return getStat;
+    }
+
 protected:
 
     /**
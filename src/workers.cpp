@@ -33,12 +33,13 @@
 #endif
 
 #include <cstddef>
+#include <cstring>
 #include <vector>
+#include <algorithm>
 #include <CL/cl.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
-#include <boost/thread/locks.hpp>
 #include <boost/ref.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
@@ -57,6 +58,101 @@
 #include "thread_name.h"
 #include "misc.h"
 
+void FieldRecorder::reset(const Grid::size_type size[3])
+{
+    field.reset(size);
+    hasPending = false;
+}
+
+void FieldRecorder::flushPending()
+{
+    if (!hasPending)
+        return;
+    readEvent.wait();
+    const std::size_t rowSamples = pending.width;
+    for (Grid::size_type z = pending.zFirst; z <= pending.zLast; z++)
+        field.addSlice(&staging[(z - pending.zFirst) * pending.zStride * rowSamples]);
+    hasPending = false;
+}
+
+const SparseField &FieldRecorder::finish()
+{
+    flushPending();
+    return field;
+}
+
+void FieldRecorder::enqueue(
+    const cl::CommandQueue &queue,
+    const cl::Image2D &distance,
+    const Marching::Swathe &swathe,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    cl::Event generated;
+    base.enqueue(queue, distance, swathe, events, &generated);
+
+    // Scan the previous swathe while the device computes this one
+    flushPending();
+
+    const Grid::size_type rows = (swathe.zLast - swathe.zFirst) * swathe.zStride + swathe.height;
+    staging.resize(std::size_t(rows) * swathe.width);
+    cl::size_t<3> origin, region;
+    origin[0] = 0;
+    origin[1] = swathe.zFirst * swathe.zStride + swathe.zBias;
+    origin[2] = 0;
+    region[0] = swathe.width;
+    region[1] = rows;
+    region[2] = 1;
+    std::vector<cl::Event> wait(1, generated);
+    queue.enqueueReadImage(distance, CL_FALSE, origin, region,
+                           swathe.width * sizeof(float), 0, &staging[0],
+                           &wait, &readEvent);
+    pending = swathe;
+    hasPending = true;
+    if (event != NULL)
+        *event = readEvent;
+}
+
+const Grid::size_type *FieldReplay::alignment() const
+{
+    static const Grid::size_type align[3] = {1, 1, 1};
+    return align;
+}
+
+void FieldReplay::enqueue(
+    const cl::CommandQueue &queue,
+    const cl::Image2D &distance,
+    const Marching::Swathe &swathe,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(field != NULL, state_error);
+
+    // The previous upload may still be reading from the staging area
+    if (writeEvent())
+        writeEvent.wait();
+
+    const Grid::size_type rows = (swathe.zLast - swathe.zFirst) * swathe.zStride + swathe.height;
+    const std::size_t rowSamples = swathe.width;
+    staging.resize(std::size_t(rows) * rowSamples);
+    for (Grid::size_type z = swathe.zFirst; z <= swathe.zLast; z++)
+        field->getSlice(z, &staging[(z - swathe.zFirst) * swathe.zStride * rowSamples]);
+
+    cl::size_t<3> origin, region;
+    origin[0] = 0;
+    origin[1] = swathe.zFirst * swathe.zStride + swathe.zBias;
+    origin[2] = 0;
+    region[0] = swathe.width;
+    region[1] = rows;
+    region[2] = 1;
+    queue.enqueueWriteImage(distance, CL_FALSE, origin, region,
+                            swathe.width * sizeof(float), 0, &staging[0],
+                            events, &writeEvent);
+    if (event != NULL)
+        *event = writeEvent;
+}
+
+
 MesherGroupBase::Worker::Worker(MesherGroup &owner)
     : WorkerBase("mesher", 0), owner(owner) {}
 
@@ -67,10 +163,10 @@ void MesherGroupBase::Worker::operator()(WorkItem &item)
     owner.meshBuffer.free(item.alloc);
 }
 
-MesherGroup::MesherGroup(std::size_t memMesh)
+MesherGroup::MesherGroup(std::size_t memMesh, CircularBufferArena *arena)
     : WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>(
         "mesher", 1),
-    meshBuffer("mem.MesherGroup.mesh", memMesh)
+    meshBuffer("mem.MesherGroup.mesh", memMesh, arena, CircularBufferArena::UPPER)
 {
     addWorker(new Worker(*this));
 }
@@ -87,6 +183,7 @@ boost::shared_ptr<MesherGroup::WorkItem> MesherGroup::get(Timeplot::Worker &twor
 DeviceWorkerGroup::DeviceWorkerGroup(
     std::size_t numWorkers, std::size_t spare,
     OutputGenerator outputGenerator,
+    BinDone binDone,
     const cl::Context &context, const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
     std::size_t meshMemory,
@@ -94,28 +191,22 @@ DeviceWorkerGroup::DeviceWorkerGroup(
     MlsShape shape)
 :
     Base("device", numWorkers),
-    progress(NULL), outputGenerator(outputGenerator),
+    progress(NULL), outputGenerator(outputGenerator), binDone(binDone), fieldCache(NULL),
     context(context), device(device),
     maxBucketSplats(maxBucketSplats), maxCells(maxCells), meshMemory(meshMemory),
     subsampling(subsampling),
     copyQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE),
-    itemPool(),
-    popMutex(NULL),
-    popCondition(NULL)
+    splatCache(context, CL_MEM_READ_WRITE, maxBucketSplats * sizeof(Splat))
 {
-    for (std::size_t i = 0; i < numWorkers; i++)
+    BOOST_FOREACH(std::size_t splats, poolSplats(numWorkers, spare, device, maxBucketSplats))
     {
-        addWorker(new Worker(*this, context, device, levels, boundaryLimit, shape, i));
+        splatStores.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, splats * sizeof(Splat)));
+        splatPools.push_back(new CircularBufferBase("mem.DeviceWorkerGroup.splatPool", splats));
     }
-    const std::size_t items = numWorkers + spare;
-    const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
-    for (std::size_t i = 0; i < items; i++)
+    for (std::size_t i = 0; i < numWorkers; i++)
     {
-        boost::shared_ptr<WorkItem> item = boost::make_shared<WorkItem>(context, maxItemSplats);
-        itemPool.push(item);
+        addWorker(new Worker(*this, context, device, levels, boundaryLimit, shape, i));
     }
-    unallocated_ = maxItemSplats * items;
-
     CLH::ResourceUsage usage = resourceUsage(
         numWorkers, spare, device,
         maxBucketSplats, maxCells, meshMemory, levels);
@@ -128,42 +219,89 @@ void DeviceWorkerGroup::start(const Grid &fullGrid)
     Base::start();
 }
 
-bool DeviceWorkerGroup::canGet()
-{
-    return !itemPool.empty();
-}
-
 boost::shared_ptr<DeviceWorkerGroup::WorkItem> DeviceWorkerGroup::get(
     Timeplot::Worker &tworker, std::size_t numSplats)
 {
-    Timeplot::Action timer("get", tworker, getStat);
-    timer.setValue(numSplats * sizeof(Splat));
-    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = itemPool.pop();
+    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = boost::make_shared<WorkItem>();
+
+    // The free space is only a hint, since other threads may allocate concurrently
+    std::size_t pool = 0;
+    std::size_t poolFree = 0;
+    for (std::size_t i = 0; i < splatPools.size(); i++)
+    {
+        std::size_t avail = splatPools[i].unallocated();
+        if (avail >= numSplats)
+        {
+            pool = i;
+            break;
+        }
+        else if (avail > poolFree)
+        {
+            pool = i;
+            poolFree = avail;
+        }
+    }
 
-    boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
-    unallocated_ -= numSplats;
+    item->pool = pool;
+    item->splats = splatStores[pool];
+    item->alloc = splatPools[pool].allocate(tworker, numSplats, &getStat);
+    item->firstSplat = item->alloc.get();
     return item;
 }
 
 void DeviceWorkerGroup::freeItem(boost::shared_ptr<WorkItem> item)
 {
-    item->subItems.clear();
-    item->copyEvent = cl::Event(); // release the reference
+    /* The worker has finished with the splats, because Marching::generate
+     * waits for the queue to drain.
+     */
+    splatPools[item->pool].free(item->alloc);
+}
+
+std::vector<std::size_t> DeviceWorkerGroup::poolSplats(
+    std::size_t numWorkers, std::size_t spare,
+    const cl::Device &device, std::size_t maxBucketSplats)
+{
+    const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
+    const std::tr1::uint64_t maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    const std::size_t itemsPerPool = std::max(
+        std::tr1::uint64_t(1), maxAlloc / (std::tr1::uint64_t(maxItemSplats) * sizeof(Splat)));
 
-    if (popCondition != NULL)
+    std::vector<std::size_t> ans;
+    for (std::size_t items = numWorkers + spare; items > 0; )
     {
-        boost::lock_guard<boost::mutex> popLock(*popMutex);
-        itemPool.push(item);
-        popCondition->notify_one();
+        std::size_t poolItems = std::min(items, itemsPerPool);
+        ans.push_back(poolItems * maxItemSplats);
+        items -= poolItems;
     }
-    else
-        itemPool.push(item);
+    return ans;
 }
 
-std::size_t DeviceWorkerGroup::unallocated()
+void DeviceWorkerGroupBase::chooseLevels(
+    const std::vector<SplatTreeCL::Region> &regions, unsigned int radiusShift,
+    unsigned int maxLevels, unsigned int maxSubsampling,
+    unsigned int &levels, unsigned int &subsampling)
 {
-    boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
-    return unallocated_;
+    /* Shift needed for the octree to cover all the regions */
+    Grid::size_type extent = 1;
+    BOOST_FOREACH(const SplatTreeCL::Region &region, regions)
+        for (int i = 0; i < 3; i++)
+            extent = std::max(extent, region.origin[i] + region.size[i]);
+    unsigned int extentShift = 0;
+    while ((Grid::size_type(1) << extentShift) < extent)
+        extentShift++;
+
+    /* Finest cells about the size of the typical splat. They are not made
+     * coarser than the user asked for, which also keeps the batch slot
+     * origins aligned to them.
+     */
+    subsampling = std::max(radiusShift, (unsigned int) MlsFunctor::subsamplingMin);
+    subsampling = std::min(subsampling, maxSubsampling);
+    subsampling = std::min(subsampling, std::max(extentShift, (unsigned int) MlsFunctor::subsamplingMin));
+
+    /* Enough levels to cover the extent, within what was allocated */
+    if (extentShift + 1 > maxLevels + subsampling)
+        subsampling = extentShift + 1 - maxLevels;
+    levels = extentShift + 1 > subsampling ? extentShift + 1 - subsampling : 1;
 }
 
 Grid::size_type DeviceWorkerGroupBase::computeMaxSwathe(
@@ -198,10 +336,11 @@ CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
         maxSwathe, meshMemory, MlsFunctor::wgs);
     workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats);
 
-    const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
-    CLH::ResourceUsage itemUsage;
-    itemUsage.addBuffer("splats", maxItemSplats * sizeof(Splat));
-    return workerUsage * numWorkers + itemUsage * (numWorkers + spare);
+    CLH::ResourceUsage poolUsage;
+    BOOST_FOREACH(std::size_t splats, poolSplats(numWorkers, spare, device, maxBucketSplats))
+        poolUsage.addBuffer("splats", splats * sizeof(Splat));
+    poolUsage.addBuffer("splatCache", maxBucketSplats * sizeof(Splat));
+    return workerUsage * numWorkers + poolUsage;
 }
 
 DeviceWorkerGroupBase::Worker::Worker(
@@ -215,13 +354,27 @@ DeviceWorkerGroupBase::Worker::Worker(
     queue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
     tree(context, device, levels, owner.maxBucketSplats),
     input(context, shape),
+    recorder(input),
     marching(context, device, owner.maxCells + 1, owner.maxCells + 1, owner.maxCells + 1,
              computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, input.alignment()[1], input.alignment()[2]),
              owner.meshMemory, input.alignment()),
-    scaleBias(context)
+    scaleBias(context),
+    maxLevels(levels),
+    levelsStat(Statistics::getStatistic<Statistics::Variable>("tree.levels")),
+    subsamplingStat(Statistics::getStatistic<Statistics::Variable>("tree.subsampling"))
 {
     input.setBoundaryLimit(boundaryLimit);
     filterChain.addFilter(boost::ref(scaleBias));
+
+    /* Slots must be aligned to the octree cells used for MLS lookups, and
+     * the whole batch must fit in the volume that marching can process.
+     */
+    const Grid::size_type treeSize = Grid::size_type(1) << (levels + owner.subsampling - 1);
+    batchSlot = treeSize / BATCH_SLOTS;
+    while (batchSlot > 0 && BATCH_SLOTS * batchSlot > owner.maxCells + 1)
+        batchSlot /= 2;
+    if (batchSlot < (Grid::size_type(1) << owner.subsampling))
+        batchSlot = 0;
 }
 
 void DeviceWorkerGroupBase::Worker::start()
@@ -229,146 +382,336 @@ void DeviceWorkerGroupBase::Worker::start()
     scaleBias.setScaleBias(owner.fullGrid);
 }
 
-void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
+bool DeviceWorkerGroupBase::Worker::fitsSlot(const SubItem &sub) const
 {
-    Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    BOOST_FOREACH(const SubItem &sub, work.subItems)
+    /* The last vertex must be short of the next slot, so that the vertices
+     * in between can be masked out. Since the slot size is a multiple of the
+     * MLS granularity, the rounded-up octree region then fits too.
+     */
+    for (int i = 0; i < 3; i++)
+        if (sub.grid.numVertices(i) >= batchSlot)
+            return false;
+    return true;
+}
+
+bool DeviceWorkerGroupBase::Worker::separated(const SubItem &a, const SubItem &b)
+{
+    /* A splat in a bucket has its center within sqrt(3) radii of the bucket
+     * region, and only affects vertices within one radius of its center.
+     */
+    Grid::difference_type gap = 0;
+    for (int i = 0; i < 3; i++)
     {
-        cl_uint3 keyOffset;
-        for (int i = 0; i < 3; i++)
-            keyOffset.s[i] = sub.grid.getExtent(i).first;
-        // same thing, just as a different type for a different API
-        Grid::difference_type offset[3] =
-        {
-            (Grid::difference_type) keyOffset.s[0],
-            (Grid::difference_type) keyOffset.s[1],
-            (Grid::difference_type) keyOffset.s[2]
-        };
+        Grid::extent_type ea = a.grid.getExtent(i);
+        Grid::extent_type eb = b.grid.getExtent(i);
+        gap = std::max(gap, std::max(eb.first - ea.second, ea.first - eb.second));
+    }
+    return gap > 3.0f * std::max(a.maxRadius, b.maxRadius);
+}
 
-        Grid::size_type size[3];
+void DeviceWorkerGroupBase::Worker::processBatch(WorkItem &work, const std::vector<std::size_t> &batch)
+{
+    regions.resize(batch.size());
+    for (std::size_t b = 0; b < batch.size(); b++)
+    {
+        const SubItem &sub = work.subItems[batch[b]];
+        SplatTreeCL::Region &region = regions[b];
+        region.firstSplat = work.firstSplat + sub.firstSplat;
+        region.numSplats = sub.numSplats;
         for (int i = 0; i < 3; i++)
         {
+            region.offset[i] = sub.grid.getExtent(i).first;
             /* Note: numVertices not numCells, because Marching does per-vertex queries.
              * So we need information about the cell that is just beyond the last vertex,
-             * just to avoid special-casing it.
+             * just to avoid special-casing it. The octree size is rounded up to a
+             * multiple of the granularity used for MLS.
              */
-            size[i] = sub.grid.numVertices(i);
+            region.size[i] = roundUp(sub.grid.numVertices(i), MlsFunctor::wgs[i]);
         }
+        region.origin[0] = (b % BATCH_SLOTS) * batchSlot;
+        region.origin[1] = (b / BATCH_SLOTS % BATCH_SLOTS) * batchSlot;
+        region.origin[2] = (b / (BATCH_SLOTS * BATCH_SLOTS)) * batchSlot;
+    }
 
-        /* We need to round up the octree size to a multiple of the granularity used for MLS. */
-        Grid::size_type expandedSize[3];
-        for (int i = 0; i < 3; i++)
-            expandedSize[i] = roundUp(size[i], MlsFunctor::wgs[i]);
+    unsigned int radiusShift = work.subItems[batch[0]].radiusShift;
+    for (std::size_t b = 1; b < batch.size(); b++)
+        radiusShift = std::min(radiusShift, work.subItems[batch[b]].radiusShift);
+    unsigned int levels, subsampling;
+    chooseLevels(regions, radiusShift, maxLevels, owner.subsampling, levels, subsampling);
+    levelsStat.add(levels);
+    subsamplingStat.add(subsampling);
 
-        filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
+    cl::Event treeBuildEvent;
+    std::vector<cl::Event> wait(1);
 
-        cl::Event treeBuildEvent;
-        std::vector<cl::Event> wait(1);
+    wait[0] = work.copyEvent;
+    tree.enqueueBuild(queue, work.splats, regions, levels, subsampling, &wait, &treeBuildEvent);
+    wait[0] = treeBuildEvent;
 
-        wait[0] = work.copyEvent;
-        tree.enqueueBuild(queue, work.splats, sub.firstSplat, sub.numSplats,
-                          expandedSize, offset, owner.subsampling, &wait, &treeBuildEvent);
-        wait[0] = treeBuildEvent;
+    /* The field cache records the field of each bucket on its own, so
+     * buckets are extracted one at a time when it is in use.
+     */
+    if (batch.size() > 1 && owner.fieldCache == NULL)
+        processSlots(work, batch, subsampling, wait);
+    else
+    {
+        for (std::size_t b = 0; b < batch.size(); b++)
+        {
+            const SubItem &sub = work.subItems[batch[b]];
+            cl_uint3 keyOffset;
+            for (int i = 0; i < 3; i++)
+                keyOffset.s[i] = sub.grid.getExtent(i).first;
 
-        input.set(offset, tree, owner.subsampling);
-        marching.generate(queue, input, filterChain, size, keyOffset, &wait);
+            Grid::size_type size[3];
+            for (int i = 0; i < 3; i++)
+                size[i] = sub.grid.numVertices(i);
 
-        tree.clearSplats();
+            filterChain.setOutput(owner.outputGenerator(sub.chunkId, sub.grid, getTimeplotWorker()));
 
+            input.set(regions[b].offset, regions[b].origin, tree, subsampling);
+            if (owner.fieldCache != NULL)
+            {
+                recorder.reset(size);
+                marching.generate(queue, recorder, filterChain, size, keyOffset, &wait);
+                owner.fieldCache->write(sub.chunkId, sub.grid, recorder.finish());
+            }
+            else
+                marching.generate(queue, input, filterChain, size, keyOffset, &wait);
+            owner.binDone(sub.chunkId, sub.grid, getTimeplotWorker());
+
+            if (owner.progress != NULL)
+                *owner.progress += sub.progressSplats;
+        }
+    }
+
+    tree.clearSplats();
+}
+
+void DeviceWorkerGroupBase::Worker::processSlots(
+    WorkItem &work, const std::vector<std::size_t> &batch,
+    unsigned int subsampling, const std::vector<cl::Event> &wait)
+{
+    Marching::Slots slots;
+    slots.shift = 0;
+    while ((Grid::size_type(1) << slots.shift) < batchSlot)
+        slots.shift++;
+    Grid::size_type size[3];
+    std::size_t numSlots = 1;
+    for (int i = 0; i < 3; i++)
+    {
+        slots.dims[i] = 1;
+        size[i] = 0;
+        for (std::size_t b = 0; b < batch.size(); b++)
+        {
+            const SubItem &sub = work.subItems[batch[b]];
+            slots.dims[i] = std::max(slots.dims[i], (regions[b].origin[i] >> slots.shift) + 1);
+            size[i] = std::max(size[i], regions[b].origin[i] + sub.grid.numVertices(i));
+        }
+        numSlots *= slots.dims[i];
+    }
+
+    const cl_uint3 empty = {{ 0, 0, 0 }};
+    slots.vertices.assign(numSlots, empty);
+    slots.offsets.assign(numSlots, empty);
+    router.reset(slots.shift);
+    for (std::size_t b = 0; b < batch.size(); b++)
+    {
+        const SubItem &sub = work.subItems[batch[b]];
+        const std::size_t s = slots.index(regions[b].origin);
+        for (int i = 0; i < 3; i++)
+        {
+            slots.vertices[s].s[i] = sub.grid.numVertices(i);
+            slots.offsets[s].s[i] = sub.grid.getExtent(i).first;
+        }
+        router.addSlot(regions[b].origin, slots.offsets[s],
+                       owner.outputGenerator(sub.chunkId, sub.grid, getTimeplotWorker()));
+    }
+
+    filterChain.setOutput(boost::ref(router));
+    input.set(slots, tree, subsampling);
+    marching.generate(queue, input, filterChain, size, slots, &wait);
+
+    for (std::size_t b = 0; b < batch.size(); b++)
+    {
+        const SubItem &sub = work.subItems[batch[b]];
+        owner.binDone(sub.chunkId, sub.grid, getTimeplotWorker());
         if (owner.progress != NULL)
             *owner.progress += sub.progressSplats;
+    }
+}
+
+void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
+{
+    Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
 
+    /* Small buckets are packed into slots of a shared octree, as long as
+     * they cannot influence each other. Other buckets get an octree each.
+     */
+    const std::size_t numSubItems = work.subItems.size();
+    const std::size_t maxBatch = BATCH_SLOTS * BATCH_SLOTS * BATCH_SLOTS;
+    std::vector<bool> done(numSubItems, false);
+    std::vector<std::size_t> batch;
+    for (std::size_t i = 0; i < numSubItems; i++)
+    {
+        if (done[i])
+            continue;
+        const SubItem &first = work.subItems[i];
+        batch.clear();
+        batch.push_back(i);
+        if (batchSlot > 0 && fitsSlot(first))
         {
-            boost::lock_guard<boost::mutex> unallocatedLock(owner.unallocatedMutex);
-            owner.unallocated_ += sub.numSplats;
+            std::size_t batchSplats = first.numSplats;
+            std::size_t last = std::min(numSubItems, i + 1 + BATCH_WINDOW);
+            for (std::size_t j = i + 1; j < last && batch.size() < maxBatch; j++)
+            {
+                const SubItem &sub = work.subItems[j];
+                if (done[j] || !fitsSlot(sub) || sub.numSplats > owner.maxBucketSplats - batchSplats)
+                    continue;
+                bool good = true;
+                for (std::size_t k = 0; k < batch.size() && good; k++)
+                    good = separated(sub, work.subItems[batch[k]]);
+                if (good)
+                {
+                    batch.push_back(j);
+                    done[j] = true;
+                    batchSplats += sub.numSplats;
+                }
+            }
         }
+        processBatch(work, batch);
+    }
+}
+
+FieldExtractor::FieldExtractor(
+    const cl::Context &context, const cl::Device &device,
+    Grid::size_type maxCells, std::size_t meshMemory)
+:
+    queue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
+    marching(context, device, maxCells + 1, maxCells + 1, maxCells + 1,
+             computeMaxSwathe(MAX_IMAGE_HEIGHT, maxCells + 1, replay.alignment()[1], replay.alignment()[2]),
+             meshMemory, replay.alignment()),
+    scaleBias(context)
+{
+    filterChain.addFilter(boost::ref(scaleBias));
+}
+
+void FieldExtractor::operator()(
+    Timeplot::Worker &tworker,
+    FieldCacheReader &reader,
+    const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+    const DeviceWorkerGroup::BinDone &binDone,
+    ProgressMeter *progress)
+{
+    Timeplot::Action timer("compute", tworker, "extract.compute");
+    scaleBias.setScaleBias(reader.getGrid());
+    reader.rewind();
+
+    ChunkId chunkId;
+    Grid grid;
+    SparseField field;
+    while (reader.next(chunkId, grid, field))
+    {
+        cl_uint3 keyOffset;
+        for (int i = 0; i < 3; i++)
+            keyOffset.s[i] = grid.getExtent(i).first;
+
+        filterChain.setOutput(outputGenerator(chunkId, grid, tworker));
+        replay.setField(field);
+        marching.generate(queue, replay, filterChain, field.getSize(), keyOffset);
+        binDone(chunkId, grid, tworker);
+
+        if (progress != NULL)
+            ++*progress;
     }
 }
 
 CopyGroup::CopyGroup(
     const std::vector<DeviceWorkerGroup *> &outGroups,
-    std::size_t maxQueueSplats)
+    std::size_t maxQueueSplats,
+    CircularBufferArena *arena)
 :
     WorkerGroup<CopyGroup::WorkItem, CopyGroup::Worker, CopyGroup>(
-        "copy", 1),
-    outGroups(outGroups),
+        "copy", outGroups.size()),
     maxDeviceItemSplats(outGroups[0]->getMaxItemSplats()),
-    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat)),
+    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat), arena, CircularBufferArena::LOWER),
     writeStat(Statistics::getStatistic<Statistics::Variable>("copy.write")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("copy.splats")),
-    sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size"))
+    sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size")),
+    reusedStat(Statistics::getStatistic<Statistics::Variable>("copy.reused"))
 {
-    addWorker(new Worker(*this, outGroups[0]->getContext(), outGroups[0]->getDevice()));
-    BOOST_FOREACH(DeviceWorkerGroup *g, outGroups)
-        g->setPopCondition(&popMutex, &popCondition);
+    for (std::size_t i = 0; i < outGroups.size(); i++)
+        addWorker(new Worker(*this, *outGroups[i], i));
 }
 
 CopyGroupBase::Worker::Worker(
-    CopyGroup &owner, const cl::Context &context, const cl::Device &device)
-    : WorkerBase("copy", 0), owner(owner),
-    pinned("mem.CopyGroup.pinned", context, device, owner.maxDeviceItemSplats),
+    CopyGroup &owner, DeviceWorkerGroup &outGroup, int idx)
+    : WorkerBase("copy", idx), owner(owner), outGroup(outGroup),
+    pinned("mem.CopyGroup.pinned", outGroup.getContext(), outGroup.getDevice(), owner.maxDeviceItemSplats),
     bufferedItems("mem.CopyGroup.bufferedItems"),
-    bufferedSplats(0)
+    bufferedSplats(0),
+    cache(owner.maxDeviceItemSplats), cacheUploaded(0)
 {
 }
 
+void CopyGroupBase::Worker::start()
+{
+    cache.clear();
+    cacheUploaded = 0;
+}
+
 void CopyGroupBase::Worker::flush()
 {
     if (bufferedItems.empty())
         return;
 
-    boost::unique_lock<boost::mutex> popLock(owner.popMutex);
-    DeviceWorkerGroup *outGroup = NULL;
-    while (true)
-    {
-        /* Try all devices for which we can pop immediately, and take the one that
-         * seems likely to run out the soonest. It's a poor guess, but does at
-         * least make sure that we always service totally idle devices before ones
-         * that still have work queued.
-         */
-        std::size_t best = 0;
-        BOOST_FOREACH(DeviceWorkerGroup *g, owner.outGroups)
-        {
-            if (g->canGet())
-            {
-                std::size_t u = g->unallocated();
-                if (u >= best)
-                {
-                    best = u;
-                    outGroup = g;
-                }
-            }
-        }
-        if (outGroup != NULL)
-            break;
+    /* This blocks while the device has no free item. Meanwhile the workers
+     * for other devices continue to take bins from the queue.
+     */
+    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = outGroup.get(getTimeplotWorker(), bufferedSplats);
+    item->subItems.swap(bufferedItems);
 
-        // No spare slots. Wait until there is one
-        {
-            Timeplot::Action timer("get", getTimeplotWorker(), owner.outGroups[0]->getGetStat());
-            owner.popCondition.wait(popLock);
-        }
+    const cl::CommandQueue &queue = outGroup.getCopyQueue();
+    const cl::Buffer &splatCache = outGroup.getSplatCache();
+    const std::size_t uploadSplats = cache.size() - cacheUploaded;
+    std::vector<cl::Event> wait;
+    if (uploadSplats > 0)
+    {
+        cl::Event uploadEvent;
+        queue.enqueueWriteBuffer(
+            splatCache,
+            CL_FALSE,
+            cacheUploaded * sizeof(Splat), uploadSplats * sizeof(Splat),
+            pinned.get(),
+            NULL, &uploadEvent);
+        wait.push_back(uploadEvent);
+        cacheUploaded = cache.size();
     }
-    popLock.release()->unlock();
 
-    // This should now never block
-    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = outGroup->get(getTimeplotWorker(), bufferedSplats);
-    item->subItems.swap(bufferedItems);
-    outGroup->getCopyQueue().enqueueWriteBuffer(
-        item->splats,
-        CL_FALSE,
-        0, bufferedSplats * sizeof(Splat),
-        pinned.get(),
-        NULL, &item->copyEvent);
+    /* The copy queue is out-of-order, so the copies only wait for the upload */
+    std::vector<cl::Event> gatherEvents;
+    gatherEvents.reserve(gathers.size());
+    BOOST_FOREACH(const SplatCacheMap::Copy &g, gathers)
+    {
+        cl::Event gatherEvent;
+        queue.enqueueCopyBuffer(
+            splatCache, item->splats,
+            g.src * sizeof(Splat), (item->firstSplat + g.dst) * sizeof(Splat), g.count * sizeof(Splat),
+            wait.empty() ? NULL : &wait, &gatherEvent);
+        gatherEvents.push_back(gatherEvent);
+    }
+    gathers.clear();
+    CLH::enqueueMarkerWithWaitList(queue, &gatherEvents, &item->copyEvent);
     cl::Event copyEvent = item->copyEvent;
-    outGroup->push(getTimeplotWorker(), item);
+    outGroup.push(getTimeplotWorker(), item);
 
-    /* Ensures that we can start refilling the pinned memory right away. Note
-     * that this is not the same as doing a synchronous transfer, because we
-     * are still overlapping the transfer with enqueuing the item.
+    /* Ensures that we can start refilling the pinned memory right away, and
+     * that the cache can be overwritten once it fills up. Note that this is
+     * not the same as doing a synchronous transfer, because we are still
+     * overlapping the transfer with enqueuing the item.
      */
     {
         Timeplot::Action writeTimer("write", getTimeplotWorker(), owner.getWriteStat());
-        writeTimer.setValue(bufferedSplats * sizeof(Splat));
+        writeTimer.setValue(uploadSplats * sizeof(Splat));
         copyEvent.wait();
     }
     bufferedSplats = 0;
@@ -381,10 +724,19 @@ void CopyGroupBase::Worker::operator()(WorkItem &work)
 
     if (bufferedSplats + work.numSplats > owner.maxDeviceItemSplats)
         flush();
+    std::size_t missing = cache.missing(work.ranges);
+    if (cache.size() + missing > cache.capacity())
+    {
+        /* Start the cache again. The flush waits for all copies out of it. */
+        flush();
+        start();
+        missing = work.numSplats;
+    }
 
     const Splat *in = work.getSplats();
-    Splat *out = pinned.get() + bufferedSplats;
     std::size_t progressSplats = 0;
+    float maxRadius = 0.0f;
+    std::size_t radiusHist[32] = {};
     for (std::size_t i = 0; i < work.numSplats; i++)
     {
         /* Each splat is accounted in the progress meter with the
@@ -400,19 +752,37 @@ void CopyGroupBase::Worker::operator()(WorkItem &work)
             inside = inside && p >= e.first && p < e.second;
         }
         progressSplats += inside;
-        out[i] = in[i];
+        maxRadius = std::max(maxRadius, in[i].radius);
+
+        unsigned int shift = 0;
+        while (shift < 31 && float(1U << shift) < 2.0f * in[i].radius)
+            shift++;
+        radiusHist[shift]++;
     }
+    unsigned int radiusShift = 0;
+    for (std::size_t seen = radiusHist[0]; 2 * seen < work.numSplats; seen += radiusHist[radiusShift])
+        radiusShift++;
+
+    /* Gather the bin from resident ranges, staging the rest for upload */
+    cache.add(work.ranges, bufferedSplats, uploads, gathers);
+    BOOST_FOREACH(const SplatCacheMap::Copy &u, uploads)
+        std::memcpy(pinned.get() + (u.dst - cacheUploaded), in + u.src, u.count * sizeof(Splat));
+
     DeviceWorkerGroup::SubItem subItem;
     subItem.chunkId = work.chunkId;
     subItem.grid = work.grid;
     subItem.numSplats = work.numSplats;
     subItem.firstSplat = bufferedSplats;
     subItem.progressSplats = progressSplats;
+    subItem.maxRadius = maxRadius;
+    subItem.radiusShift = radiusShift;
     bufferedItems.push_back(subItem);
     bufferedSplats += work.numSplats;
 
     owner.splatsStat.add(work.numSplats);
     owner.sizeStat.add(work.grid.numCells());
+    if (work.numSplats > 0)
+        owner.reusedStat.add(double(work.numSplats - missing) / work.numSplats);
 
     owner.splatBuffer.free(work.splats);
 }
@@ -38,11 +38,12 @@
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp>
-#include <boost/thread/locks.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/foreach.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
 #include <cstddef>
 #include <stdexcept>
 #include <utility>
@@ -59,6 +60,8 @@
 #include "grid.h"
 #include "progress.h"
 #include "work_queue.h"
+#include "circular_buffer.h"
+#include "splat_cache.h"
 #include "bucket.h"
 #include "splat.h"
 #include "splat_set.h"
@@ -68,6 +71,7 @@
 #include "allocator.h"
 #include "worker_group.h"
 #include "timeplot.h"
+#include "field_cache.h"
 
 class MesherGroup;
 
@@ -112,9 +116,15 @@ public:
     /**
      * Constructor.
      *
-     * @param memMesh Memory (in bytes) to allocate for holding queued mesh data.
+     * @param memMesh      Memory (in bytes) to use for holding queued mesh data.
+     * @param arena        Storage to share with the splat queue, so that a
+     *                     @ref MemoryBroker can grow the buffer (may be @c NULL).
+     *                     The buffer uses the upper end.
      */
-    explicit MesherGroup(const std::size_t memMesh);
+    explicit MesherGroup(const std::size_t memMesh, CircularBufferArena *arena = NULL);
+
+    /// Buffer holding queued mesh data, for use with @ref MemoryBroker
+    CircularBufferBase &getBuffer() { return meshBuffer.base(); }
 private:
     MesherBase::InputFunctor input;
     CircularBuffer meshBuffer;
@@ -131,10 +141,80 @@ private:
 };
 
 
+/**
+ * Wraps a @ref Marching::Generator to capture the signed distance function
+ * into a @ref SparseField as it is produced. Each swathe is read back
+ * asynchronously, and scanned on the CPU while the device computes the next
+ * swathe.
+ */
+class FieldRecorder : public Marching::Generator
+{
+private:
+    Marching::Generator &base;
+    SparseField field;
+
+    std::vector<float> staging;          ///< Host copy of the last swathe
+    Marching::Swathe pending;            ///< Swathe held in @ref staging
+    bool hasPending;                     ///< Whether @ref staging holds unprocessed slices
+    cl::Event readEvent;                 ///< Signaled when @ref staging is filled
+
+    /// Wait for the pending read and add its slices to @ref field
+    void flushPending();
+
+public:
+    explicit FieldRecorder(Marching::Generator &base) : base(base), hasPending(false) {}
+
+    /// Start capturing a bin with @a size vertices along each axis.
+    void reset(const Grid::size_type size[3]);
+
+    /**
+     * Add the outstanding slices to the field. It must be called after
+     * @ref Marching::generate returns.
+     */
+    const SparseField &finish();
+
+    virtual const Grid::size_type *alignment() const { return base.alignment(); }
+
+    virtual void enqueue(
+        const cl::CommandQueue &queue,
+        const cl::Image2D &distance,
+        const Marching::Swathe &swathe,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+};
+
+/**
+ * Supplies a previously captured @ref SparseField to @ref Marching in place
+ * of computing the signed distance function.
+ */
+class FieldReplay : public Marching::Generator
+{
+private:
+    const SparseField *field;
+    std::vector<float> staging;          ///< Host copy of the swathe being uploaded
+    cl::Event writeEvent;                ///< Signaled when @ref staging may be reused
+
+public:
+    FieldReplay() : field(NULL) {}
+
+    /// Set the field to replay. It must remain valid until the next call.
+    void setField(const SparseField &field) { this->field = &field; }
+
+    virtual const Grid::size_type *alignment() const;
+
+    virtual void enqueue(
+        const cl::CommandQueue &queue,
+        const cl::Image2D &distance,
+        const Marching::Swathe &swathe,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+};
+
 class DeviceWorkerGroup;
 
 class DeviceWorkerGroupBase
 {
+    friend class TestDeviceWorkerGroup;
 protected:
     /**
      * Maximum size we will use for the distance field image. This is set to minimum
@@ -154,30 +234,72 @@ protected:
     static Grid::size_type computeMaxSwathe(
         Grid::size_type yMax, Grid::size_type y, Grid::size_type yAlign, Grid::size_type zAlign);
 
+    /**
+     * Number of slots along each axis of an octree into which small buckets
+     * are packed, so that they share a single octree build and a single
+     * marching pass. A bucket is small if it fits in a slot with a vertex to
+     * spare, so that no cell spans two buckets.
+     */
+    static const unsigned int BATCH_SLOTS = 4;
+
+    /**
+     * Number of following buckets of a work item that are considered for
+     * inclusion in a batch.
+     */
+    static const std::size_t BATCH_WINDOW = 256;
+
+    /**
+     * Choose the octree depth and subsampling for a tree build. The finest
+     * cells are made about as large as the typical splat, but no coarser
+     * than @a maxSubsampling, and the octree just large enough to cover the
+     * regions. The result never needs more levels than @a maxLevels, provided
+     * that the regions fit in an octree of @a maxLevels levels with
+     * subsampling @a maxSubsampling.
+     *
+     * @param regions        Regions to build (only the origins and sizes are used).
+     * @param radiusShift    Smallest @ref SubItem::radiusShift of the buckets in @a regions.
+     * @param maxLevels      Levels allocated for the octree.
+     * @param maxSubsampling Subsampling given by the user, which bounds the subsampling chosen.
+     * @param[out] levels    Number of levels to build.
+     * @param[out] subsampling Subsampling shift to use.
+     */
+    static void chooseLevels(
+        const std::vector<SplatTreeCL::Region> &regions, unsigned int radiusShift,
+        unsigned int maxLevels, unsigned int maxSubsampling,
+        unsigned int &levels, unsigned int &subsampling);
+
 public:
     /// Data about a single bucket.
     struct SubItem
     {
         ChunkId chunkId;               ///< Chunk owning this item
         Grid grid;                     ///< Grid area containing the bucket (pre-transformed)
-        std::size_t firstSplat;        ///< Index of first splat in device buffer
+        std::size_t firstSplat;        ///< Index of first splat, relative to the work item
         std::size_t numSplats;         ///< Number of splats in the bucket
         std::size_t progressSplats;    ///< Splats to count towards the progress meter
+        float maxRadius;               ///< Largest radius of the splats in the bucket
+        /**
+         * Median over the splats of the smallest shift @a s for which the
+         * splat diameter is at most 2<sup>@a s</sup> cells.
+         */
+        unsigned int radiusShift;
     };
 
-    /// Data about multiple buckets that share a single CL buffer.
+    /**
+     * Data about multiple buckets whose splats are stored contiguously in a
+     * range of one of the device's splat buffers.
+     */
     struct WorkItem
     {
         /// Data for individual buckets
         Statistics::Container::vector<SubItem> subItems;
-        cl::Buffer splats;             ///< Backing store for splats
+        cl::Buffer splats;             ///< Splat buffer shared with other items on the device
+        std::size_t firstSplat;        ///< Index of the first splat of this item in @ref splats
+        std::size_t pool;              ///< Index of the pool that @ref alloc comes from
+        CircularBufferBase::Allocation alloc; ///< Range of @ref splats reserved for this item
         cl::Event copyEvent;           ///< Event signaled when the splats are ready to use on device
 
-        WorkItem(const cl::Context &context, std::size_t maxItemSplats)
-            : subItems("mem.DeviceWorkerGroup.subItems"),
-            splats(context, CL_MEM_READ_WRITE, maxItemSplats * sizeof(Splat))
-        {
-        }
+        WorkItem() : subItems("mem.DeviceWorkerGroup.subItems"), firstSplat(0), pool(0) {}
     };
 
     class Worker : public WorkerBase
@@ -188,9 +310,48 @@ public:
         const cl::CommandQueue queue;
         SplatTreeCL tree;
         MlsFunctor input;
+        FieldRecorder recorder;      ///< Wraps @ref input when a field cache is set
         Marching marching;
         ScaleBiasFilter scaleBias;
         MeshFilterChain filterChain;
+        MeshSlotRouter router;       ///< Splits the mesh of a batch between its buckets
+
+        /// Size of a batch slot (a power of 2), or 0 if the octree is too small to batch
+        Grid::size_type batchSlot;
+        std::vector<SplatTreeCL::Region> regions;  ///< Regions of the current batch
+        const unsigned int maxLevels;              ///< Levels allocated for @ref tree
+
+        Statistics::Variable &levelsStat;          ///< Octree levels chosen per build
+        Statistics::Variable &subsamplingStat;     ///< Octree subsampling chosen per build
+
+        /// Whether the bucket fits in a batch slot.
+        bool fitsSlot(const SubItem &sub) const;
+
+        /**
+         * Whether two buckets can share an octree. This is the case if they
+         * are far enough apart that the splats of each cannot affect the
+         * vertices of the other.
+         */
+        static bool separated(const SubItem &a, const SubItem &b);
+
+        /**
+         * Build one octree for some of the buckets of @a work, and extract
+         * them. If there are several, they are extracted in one marching pass
+         * over the slots, unless the field is being recorded.
+         */
+        void processBatch(WorkItem &work, const std::vector<std::size_t> &batch);
+
+        /**
+         * Extract the buckets of a batch with more than one bucket in one
+         * marching pass, once the octree has been built.
+         *
+         * @param work          Work item holding the buckets.
+         * @param batch         Indices of the buckets in @ref WorkItem::subItems.
+         * @param subsampling   Subsampling used to build the octree.
+         * @param wait          Events to wait for before using the octree.
+         */
+        void processSlots(WorkItem &work, const std::vector<std::size_t> &batch,
+                          unsigned int subsampling, const std::vector<cl::Event> &wait);
 
     public:
         typedef void result_type;
@@ -222,13 +383,23 @@ public:
      *
      * @see @ref DeviceWorkerGroup::DeviceWorkerGroup
      */
-    typedef boost::function<Marching::OutputFunctor(const ChunkId &, Timeplot::Worker &)> OutputGenerator;
+    typedef boost::function<Marching::OutputFunctor(const ChunkId &, const Grid &, Timeplot::Worker &)> OutputGenerator;
+
+    /**
+     * Functor that is called once all the output for a bin has been passed to
+     * the output functor. It receives the chunk ID and grid of the bin.
+     *
+     * @see @ref DeviceWorkerGroup::DeviceWorkerGroup
+     */
+    typedef boost::function<void(const ChunkId &, const Grid &, Timeplot::Worker &)> BinDone;
 
 private:
     typedef WorkerGroup<DeviceWorkerGroupBase::WorkItem, DeviceWorkerGroupBase::Worker, DeviceWorkerGroup> Base;
 
     ProgressMeter *progress;
     OutputGenerator outputGenerator;
+    BinDone binDone;
+    FieldCacheWriter *fieldCache;
 
     Grid fullGrid;
     const cl::Context context;
@@ -240,19 +411,29 @@ private:
 
     cl::CommandQueue copyQueue;   ///< Queue for transferring data to the device
 
-    /// Pool of unused buffers to be recycled
-    WorkQueue<boost::shared_ptr<WorkItem> > itemPool;
-
-    /// Mutex held while signaling @ref popCondition
-    boost::mutex *popMutex;
-
-    /// Condition signaled when items are added to the pool (may be @c NULL)
-    boost::condition_variable *popCondition;
+    /**
+     * Device storage for the splats of all work items. It is split into
+     * several buffers if a single one would exceed the maximum allocation
+     * size of the device.
+     */
+    std::vector<cl::Buffer> splatStores;
+    /// Suballocates each of @ref splatStores to work items, in units of splats
+    boost::ptr_vector<CircularBufferBase> splatPools;
+    /**
+     * Device copies of recently uploaded splats, which @ref CopyGroup gathers
+     * into work items instead of uploading them again. It holds
+     * @ref getMaxItemSplats splats.
+     */
+    cl::Buffer splatCache;
 
-    /// Number of spare splats in device buffers.
-    std::size_t unallocated_;
-    /// Mutex protecting @ref unallocated_.
-    boost::mutex unallocatedMutex;
+    /**
+     * Sizes of the buffers in @ref splatStores, in splats. Each holds a
+     * whole number of the largest work items, and as many as fit in the
+     * maximum allocation size of @a device (but at least one).
+     */
+    static std::vector<std::size_t> poolSplats(
+        std::size_t numWorkers, std::size_t spare,
+        const cl::Device &device, std::size_t maxBucketSplats);
 
     friend class DeviceWorkerGroupBase::Worker;
 
@@ -264,10 +445,12 @@ public:
      * Constructor.
      *
      * @param numWorkers         Number of worker threads to use (each with a separate OpenCL queue and state)
-     * @param spare              Number of extra slots (beyond @a numWorkers) for items.
+     * @param spare              Number of extra items of @a maxBucketSplats splats (beyond
+     *                           @a numWorkers) to allow for in the shared splat buffers.
      * @param outputGenerator    Output handler generator. The generator is passed a chunk
-     *                           ID and @ref Timeplot::Worker, and returns a @ref Marching::OutputFunctor which
-     *                           which will receive the output blocks for the corresponding chunk.
+     *                           ID, bin grid and @ref Timeplot::Worker, and returns a @ref Marching::OutputFunctor which
+     *                           which will receive the output blocks for the corresponding bin.
+     * @param binDone            Called after the last output block for each bin.
      * @param context            OpenCL context to run on.
      * @param device             OpenCL device to run on.
      * @param maxBucketSplats    Space to allocate for holding splats for one bucket.
@@ -281,6 +464,7 @@ public:
     DeviceWorkerGroup(
         std::size_t numWorkers, std::size_t spare,
         OutputGenerator outputGenerator,
+        BinDone binDone,
         const cl::Context &context, const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
         std::size_t meshMemory,
@@ -309,44 +493,76 @@ public:
     void setProgress(ProgressMeter *progress) { this->progress = progress; }
 
     /**
-     * Set a condition variable that will be signaled when space becomes
-     * available in the item pool. The condition will be signaled with
-     * the mutex held.
+     * Sets a field cache that will receive the signed distance function of
+     * every bin, or @c NULL to stop recording.
      */
-    void setPopCondition(boost::mutex *mutex, boost::condition_variable *condition)
-    {
-        popMutex = mutex;
-        popCondition = condition;
-    }
+    void setFieldCache(FieldCacheWriter *fieldCache) { this->fieldCache = fieldCache; }
 
     /**
      * @copydoc WorkerGroup::get
+     *
+     * The item reserves space for exactly @a size splats in one of the shared
+     * splat buffers, preferring one with enough free space and otherwise
+     * blocking on the least full one until it is available.
      */
     boost::shared_ptr<WorkItem> get(Timeplot::Worker &tworker, std::size_t size);
 
     /**
-     * Determine whether @ref get will block.
-     */
-    bool canGet();
-
-    /**
-     * Returns the item to the pool. It is called by the base class.
+     * Releases the splat storage of the item. It is called by the base class.
      */
     void freeItem(boost::shared_ptr<WorkItem> item);
 
-    /**
-     * Estimate spare queue capacity. It takes the theoretical maximum capacity
-     * and subtracts splats that are in the queue. It is not necessarily possible
-     * to allocate this many.
-     */
-    std::size_t unallocated();
-
     /// Return the maximum number of splats that can be copied to a work item
     std::size_t getMaxItemSplats() const { return maxBucketSplats; }
     const cl::Context &getContext() const { return context; }
     const cl::Device &getDevice() const { return device; }
     const cl::CommandQueue &getCopyQueue() const { return copyQueue; }
-    Statistics::Variable &getGetStat() const { return getStat; }
+    const cl::Buffer &getSplatCache() const { return splatCache; }
+};
+
+/**
+ * Extracts the isosurface from a file written by @ref FieldCacheWriter,
+ * without recomputing the signed distance function. It runs synchronously
+ * on the calling thread, passing output to the same interfaces as
+ * @ref DeviceWorkerGroup.
+ */
+class FieldExtractor : protected DeviceWorkerGroupBase, public boost::noncopyable
+{
+private:
+    const cl::CommandQueue queue;
+    FieldReplay replay;
+    Marching marching;
+    ScaleBiasFilter scaleBias;
+    MeshFilterChain filterChain;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param context, device    OpenCL context and device to run on.
+     * @param maxCells           Maximum number of cells along each side of a bin.
+     * @param meshMemory         Maximum device bytes to use for mesh-related data.
+     */
+    FieldExtractor(const cl::Context &context, const cl::Device &device,
+                   Grid::size_type maxCells, std::size_t meshMemory);
+
+    /**
+     * Extract every bin in a field cache.
+     *
+     * @param tworker            Worker to which the time is allocated.
+     * @param reader             The field cache. It is rewound first.
+     * @param outputGenerator    See @ref DeviceWorkerGroup::DeviceWorkerGroup.
+     * @param binDone            See @ref DeviceWorkerGroup::DeviceWorkerGroup.
+     * @param progress           Progress display advanced by one per bin (may be @c NULL).
+     *
+     * @throw std::ios::failure if the field cache could not be read.
+     */
+    void operator()(
+        Timeplot::Worker &tworker,
+        FieldCacheReader &reader,
+        const DeviceWorkerGroup::OutputGenerator &outputGenerator,
+        const DeviceWorkerGroup::BinDone &binDone,
+        ProgressMeter *progress);
 };
 
 class CopyGroup;
@@ -359,28 +575,47 @@ public:
     {
         ChunkId chunkId;
         Grid grid;
+        SplatSet::SubsetBase ranges;        ///< IDs of the splats, in the order they are stored
         CircularBuffer::Allocation splats;  ///< Allocation from @ref CopyGroup::splatBuffer
         std::size_t numSplats;              ///< Number of splats in the bin
 
         Splat *getSplats() const { return (Splat *) splats.get(); }
     };
 
+    /**
+     * Copies bins to a single device. Each device has its own worker, so
+     * that uploads to different devices proceed concurrently.
+     *
+     * Neighbouring bins share the splats that straddle their common face.
+     * Splats are uploaded to the device's splat cache (see
+     * @ref DeviceWorkerGroup::getSplatCache) only if their IDs are not
+     * already resident there, and each bin is then assembled from the cache
+     * with device-side copies. The cache is emptied when it fills up.
+     */
     class Worker : public WorkerBase
     {
     private:
         CopyGroup &owner;
-        CLH::PinnedMemory<Splat> pinned;  ///< Staging area for copies
+        DeviceWorkerGroup &outGroup;      ///< Device that receives the bins
+        CLH::PinnedMemory<Splat> pinned;  ///< Staging area for splats not yet uploaded to the cache
         /**
          * Bins that have been saved up but not yet flushed to the device.
          */
         Statistics::Container::vector<DeviceWorkerGroup::SubItem> bufferedItems;
-        std::size_t bufferedSplats;       ///< Number of splats stored in @ref pinned
+        std::size_t bufferedSplats;       ///< Number of splats in @ref bufferedItems
+
+        SplatCacheMap cache;              ///< Splats in the device cache
+        std::size_t cacheUploaded;        ///< Splats in the cache that are on the device (the rest are in @ref pinned)
+        /// Device-side copies from the cache into the work item for @ref bufferedItems
+        std::vector<SplatCacheMap::Copy> gathers;
+        std::vector<SplatCacheMap::Copy> uploads;  ///< Scratch space for staging a bin
 
     public:
         typedef void result_type;
 
-        Worker(CopyGroup &owner, const cl::Context &context, const cl::Device &device);
+        Worker(CopyGroup &owner, DeviceWorkerGroup &outGroup, int idx);
 
+        void start();   ///< Empties the cache, since splats may be transformed differently
         void flush();   ///< Flush items in @ref bufferedItems to the output
         void operator()(WorkItem &work);
         void stop() { flush(); }
@@ -389,7 +624,10 @@ public:
 
 /**
  * A worker object that copies bins of data to the GPU. It receives data from
- * @ref BucketLoader and sends it to the next available @ref DeviceWorkerGroup.
+ * @ref BucketLoader and sends it to the @ref DeviceWorkerGroup objects. There
+ * is one worker per device, and bins are taken from the shared queue by
+ * whichever worker is free, so a device that falls behind receives fewer
+ * bins.
  */
 class CopyGroup :
     protected CopyGroupBase,
@@ -401,12 +639,19 @@ public:
 
     /**
      * Constructor.
-     * @param outGroups       Target devices. The first is used for allocating pinned memory.
+     * @param outGroups       Target devices.
      * @param maxQueueSplats  Splats to store in the internal queue.
+     * @param arena           Storage to share with the mesh queue, so that a
+     *                        @ref MemoryBroker can grow the queue (may be @c NULL).
+     *                        The queue uses the lower end.
      */
     CopyGroup(
         const std::vector<DeviceWorkerGroup *> &outGroups,
-        std::size_t maxQueueSplats);
+        std::size_t maxQueueSplats,
+        CircularBufferArena *arena = NULL);
+
+    /// Buffer holding incoming splats, for use with @ref MemoryBroker
+    CircularBufferBase &getBuffer() { return splatBuffer.base(); }
 
     /**
      * @copydoc WorkerGroup::get
@@ -423,16 +668,13 @@ public:
     Statistics::Variable &getWriteStat() const { return writeStat; }
 
 private:
-    const std::vector<DeviceWorkerGroup *> outGroups;
     const std::size_t maxDeviceItemSplats;     ///< Maximum splats to send to the device in one go
     CircularBuffer splatBuffer;                ///< Buffer holding incoming splats
 
-    boost::mutex popMutex;                     ///< Mutex held while checking for device to target
-    boost::condition_variable popCondition;    ///< Condition signalled by devices when space available
-
     Statistics::Variable &writeStat;           ///< See @ref getWriteStat
     Statistics::Variable &splatsStat;          ///< Number of splats per bin
     Statistics::Variable &sizeStat;            ///< Size of bins
+    Statistics::Variable &reusedStat;          ///< Fraction of each bin's splats found in the device cache
 
     friend class CopyGroupBase::Worker;
 };
@@ -440,7 +682,8 @@ private:
 
 /**
  * Wraps a worker group class to provide the @ref DeviceWorkerGroup::OutputGenerator
- * interface. The returned functor will push the data to the output group.
+ * and @ref DeviceWorkerGroup::BinDone interfaces. The returned functors will push
+ * the data to the output group.
  */
 template<typename OutGroup>
 class OutputGeneratorBuilder
@@ -456,11 +699,12 @@ private:
     private:
         OutGroup &outGroup;
         ChunkId chunkId;
+        Grid grid;
         Timeplot::Worker &tworker;
     public:
         typedef void result_type;
-        Functor(OutGroup &outGroup, const ChunkId &chunkId, Timeplot::Worker &tworker)
-            : outGroup(outGroup), chunkId(chunkId), tworker(tworker)
+        Functor(OutGroup &outGroup, const ChunkId &chunkId, const Grid &grid, Timeplot::Worker &tworker)
+            : outGroup(outGroup), chunkId(chunkId), grid(grid), tworker(tworker)
         {
         }
 
@@ -471,6 +715,9 @@ private:
             cl::Event *event) const;
     };
 
+    /// Copy the cell range of @a grid into the region fields of @a work
+    static void setRegion(MesherWork &work, const Grid &grid);
+
 public:
     typedef Marching::OutputFunctor result_type;
 
@@ -479,12 +726,25 @@ public:
     {
     }
 
-    result_type operator()(const ChunkId &chunkId, Timeplot::Worker &tworker) const
+    result_type operator()(const ChunkId &chunkId, const Grid &grid, Timeplot::Worker &tworker) const
     {
-        return Functor(outGroup, chunkId, tworker);
+        return Functor(outGroup, chunkId, grid, tworker);
     }
+
+    /// Implements @ref DeviceWorkerGroup::BinDone
+    void binDone(const ChunkId &chunkId, const Grid &grid, Timeplot::Worker &tworker) const;
 };
 
+template<typename OutGroup>
+void OutputGeneratorBuilder<OutGroup>::setRegion(MesherWork &work, const Grid &grid)
+{
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        work.regionLower[i] = grid.getExtent(i).first;
+        work.regionUpper[i] = grid.getExtent(i).second;
+    }
+}
+
 template<typename OutGroup>
 void OutputGeneratorBuilder<OutGroup>::Functor::operator()(
             const cl::CommandQueue &queue,
@@ -505,6 +765,25 @@ void OutputGeneratorBuilder<OutGroup>::Functor::operator()(
     item->work.verticesEvent = wait[0];
     item->work.vertexKeysEvent = wait[1];
     item->work.trianglesEvent = wait[2];
+    item->work.regionDone = false;
+    setRegion(item->work, grid);
+    outGroup.push(tworker, item);
+}
+
+template<typename OutGroup>
+void OutputGeneratorBuilder<OutGroup>::binDone(
+    const ChunkId &chunkId, const Grid &grid, Timeplot::Worker &tworker) const
+{
+    // The allocation is not used, but must be non-empty
+    boost::shared_ptr<typename OutGroup::WorkItem> item = outGroup.get(tworker, sizeof(cl_ulong));
+    item->work.mesh = HostKeyMesh(item->alloc.get(), MeshSizes());
+    item->work.chunkId = chunkId;
+    item->work.hasEvents = false;
+    item->work.verticesEvent = cl::Event();
+    item->work.vertexKeysEvent = cl::Event();
+    item->work.trianglesEvent = cl::Event();
+    item->work.regionDone = true;
+    setRegion(item->work, grid);
     outGroup.push(tworker, item);
 }
 
@@ -514,4 +793,10 @@ DeviceWorkerGroup::OutputGenerator makeOutputGenerator(T &outGroup)
     return OutputGeneratorBuilder<T>(outGroup);
 }
 
+template<typename T>
+DeviceWorkerGroup::BinDone makeBinDone(T &outGroup)
+{
+    return boost::bind(&OutputGeneratorBuilder<T>::binDone, OutputGeneratorBuilder<T>(outGroup), _1, _2, _3);
+}
+
 #endif /* !WORKERS_H */
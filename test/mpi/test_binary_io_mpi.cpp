@@ -24,6 +24,7 @@
  * Tests for @ref binary_io_mpi.h.
  */
 
+#include <algorithm>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <boost/filesystem/path.hpp>
@@ -48,6 +49,7 @@ class TestBinaryWriterMPI : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestBinaryWriterMPI);
     CPPUNIT_TEST(testResize);
     CPPUNIT_TEST(testWrite);
+    CPPUNIT_TEST(testWriteAggregate);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -61,6 +63,7 @@ private:
 
     void testResize();
     void testWrite();
+    void testWriteAggregate();  ///< Unaligned writes from several ranks sharing blocks
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBinaryWriterMPI, TestSet::perBuild());
 
@@ -154,3 +157,46 @@ void TestBinaryWriterMPI::testWrite()
         reader->close();
     }
 }
+
+void TestBinaryWriterMPI::testWriteAggregate()
+{
+    const std::size_t blockSize = 64;
+    const std::size_t perRank = 100;
+    const std::size_t piece = 7;
+    const std::size_t tail = 10;
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    writer->close();
+    writer.reset(new BinaryWriterMPI(comm, MPI_INFO_NULL, blockSize));
+    writer->open(testPath);
+    writer->resize(size * perRank + tail);
+
+    // Write our region in pieces, last piece first, so that ranges have to be merged
+    const BinaryWriterMPI::offset_type base = rank * perRank;
+    for (std::size_t end = perRank; end > 0; end -= std::min(end, piece))
+    {
+        std::size_t start = end - std::min(end, piece);
+        char buffer[piece];
+        for (std::size_t i = start; i < end; i++)
+            buffer[i - start] = char((base + i) * 7 + 3);
+        writer->write(buffer, end - start, base + start);
+    }
+    writer->close();
+    MPI_Barrier(comm);
+
+    if (rank == 0)
+    {
+        MLSGPU_ASSERT_EQUAL(size * perRank + tail, boost::filesystem::file_size(testPath));
+        boost::scoped_ptr<BinaryReader> reader(createReader(SYSCALL_READER));
+        reader->open(testPath);
+        boost::scoped_array<char> data(new char[size * perRank]);
+        std::size_t c = reader->read(data.get(), size * perRank, 0);
+        CPPUNIT_ASSERT_EQUAL(size * perRank, c);
+        for (std::size_t i = 0; i < size * perRank; i++)
+            CPPUNIT_ASSERT_EQUAL(int(char(i * 7 + 3)), int(data[i]));
+        reader->close();
+    }
+}
@@ -46,6 +46,8 @@
 #include "../../src/bucket.h"
 #include "../../src/mesher.h"
 #include "../../src/splat_set.h"
+#include "../../src/splat.h"
+#include "../../src/compress.h"
 #include "../../src/tr1_cstdint.h"
 
 #define SERIALIZE_TEST(name) \
@@ -63,8 +65,11 @@ class TestSerialize : public CppUnit::TestFixture
     SERIALIZE_TEST(testChunkId);
     SERIALIZE_TEST(testSubset);
     SERIALIZE_TEST(testMesherWork);
+    SERIALIZE_TEST(testSplats);
+    SERIALIZE_TEST(testSplatsCompressed);
     CPPUNIT_TEST(testBroadcastString);
     CPPUNIT_TEST(testBroadcastPath);
+    CPPUNIT_TEST(testBroadcastGrid);
     CPPUNIT_TEST_SUITE_END();
 private:
     /**
@@ -83,8 +88,18 @@ private:
     void testSubsetRecv(MPI_Comm comm, int source);
     void testMesherWorkSend(MPI_Comm comm, int dest);
     void testMesherWorkRecv(MPI_Comm comm, int source);
+    void testSplatsSend(MPI_Comm comm, int dest);
+    void testSplatsRecv(MPI_Comm comm, int source);
+    void testSplatsCompressedSend(MPI_Comm comm, int dest);
+    void testSplatsCompressedRecv(MPI_Comm comm, int source);
     void testBroadcastString();
     void testBroadcastPath();
+    void testBroadcastGrid();
+
+    /// Sends several payloads through a @ref Serialize::SplatSender
+    void sendSplats(MPI_Comm comm, int dest, bool compress);
+    /// Receives and checks the payloads sent by @ref sendSplats
+    void recvSplats(MPI_Comm comm, int source);
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSerialize, TestSet::perBuild());
 
@@ -215,6 +230,14 @@ void TestSerialize::testMesherWorkSend(MPI_Comm comm, int dest)
     work.mesh.vertexKeys[0] = UINT64_C(0x1234567823456789);
     work.mesh.vertexKeys[1] = UINT64_C(0xFFFFFFFF11111111);
 
+    work.regionLower[0] = 10;
+    work.regionLower[1] = 20;
+    work.regionLower[2] = 30;
+    work.regionUpper[0] = 11;
+    work.regionUpper[1] = 22;
+    work.regionUpper[2] = 33;
+    work.regionDone = true;
+
     work.hasEvents = false;
 
     Serialize::send(work, comm, dest);
@@ -257,9 +280,94 @@ void TestSerialize::testMesherWorkRecv(MPI_Comm comm, int source)
     MLSGPU_ASSERT_EQUAL(UINT64_C(0x1234567823456789), work.mesh.vertexKeys[0]);
     MLSGPU_ASSERT_EQUAL(UINT64_C(0xFFFFFFFF11111111), work.mesh.vertexKeys[1]);
 
+    MLSGPU_ASSERT_EQUAL(10, work.regionLower[0]);
+    MLSGPU_ASSERT_EQUAL(20, work.regionLower[1]);
+    MLSGPU_ASSERT_EQUAL(30, work.regionLower[2]);
+    MLSGPU_ASSERT_EQUAL(11, work.regionUpper[0]);
+    MLSGPU_ASSERT_EQUAL(22, work.regionUpper[1]);
+    MLSGPU_ASSERT_EQUAL(33, work.regionUpper[2]);
+    MLSGPU_ASSERT_EQUAL(true, work.regionDone);
+
     MLSGPU_ASSERT_EQUAL(false, work.hasEvents);
 }
 
+static const std::size_t splatPayloadSizes[] = {5, 0, 1000, 3};
+
+static Splat makePayloadSplat(std::size_t payload, std::size_t i)
+{
+    Splat splat;
+    splat.position[0] = payload;
+    splat.position[1] = i * 0.5f;
+    splat.position[2] = -1.0f * i;
+    splat.radius = 1.0f + i;
+    splat.normal[0] = 0.25f;
+    splat.normal[1] = -0.5f;
+    splat.normal[2] = i % 7;
+    splat.quality = 1.0f / (i + 1);
+    return splat;
+}
+
+void TestSerialize::sendSplats(MPI_Comm comm, int dest, bool compress)
+{
+    const std::size_t numPayloads = sizeof(splatPayloadSizes) / sizeof(splatPayloadSizes[0]);
+    // Fewer slots than payloads, to exercise reuse of the buffers
+    Serialize::SplatSender sender(1000, 2, compress);
+    for (std::size_t p = 0; p < numPayloads; p++)
+    {
+        Splat *splats = sender.get();
+        for (std::size_t i = 0; i < splatPayloadSizes[p]; i++)
+            splats[i] = makePayloadSplat(p, i);
+        sender.send(splatPayloadSizes[p], comm, dest);
+    }
+    sender.flush();
+}
+
+void TestSerialize::recvSplats(MPI_Comm comm, int source)
+{
+    const std::size_t numPayloads = sizeof(splatPayloadSizes) / sizeof(splatPayloadSizes[0]);
+    Statistics::Container::PODBuffer<char> scratch("mem.test.scratch");
+    std::vector<Splat> splats(1000);
+    for (std::size_t p = 0; p < numPayloads; p++)
+    {
+        std::size_t n = Serialize::recvSplats(&splats[0], splats.size(), scratch, comm, source);
+        MLSGPU_ASSERT_EQUAL(splatPayloadSizes[p], n);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const Splat expected = makePayloadSplat(p, i);
+            MLSGPU_ASSERT_EQUAL(expected.position[0], splats[i].position[0]);
+            MLSGPU_ASSERT_EQUAL(expected.position[1], splats[i].position[1]);
+            MLSGPU_ASSERT_EQUAL(expected.position[2], splats[i].position[2]);
+            MLSGPU_ASSERT_EQUAL(expected.radius, splats[i].radius);
+            MLSGPU_ASSERT_EQUAL(expected.normal[0], splats[i].normal[0]);
+            MLSGPU_ASSERT_EQUAL(expected.normal[1], splats[i].normal[1]);
+            MLSGPU_ASSERT_EQUAL(expected.normal[2], splats[i].normal[2]);
+            MLSGPU_ASSERT_EQUAL(expected.quality, splats[i].quality);
+        }
+    }
+}
+
+void TestSerialize::testSplatsSend(MPI_Comm comm, int dest)
+{
+    sendSplats(comm, dest, false);
+}
+
+void TestSerialize::testSplatsRecv(MPI_Comm comm, int source)
+{
+    recvSplats(comm, source);
+}
+
+void TestSerialize::testSplatsCompressedSend(MPI_Comm comm, int dest)
+{
+    if (compressSupported())
+        sendSplats(comm, dest, true);
+}
+
+void TestSerialize::testSplatsCompressedRecv(MPI_Comm comm, int source)
+{
+    if (compressSupported())
+        recvSplats(comm, source);
+}
+
 void TestSerialize::testBroadcastString()
 {
     int rank;
@@ -289,3 +397,28 @@ void TestSerialize::testBroadcastPath()
     Serialize::broadcast(path, MPI_COMM_WORLD, 1);
     CPPUNIT_ASSERT_EQUAL(std::string("test path/with slash"), path.string());
 }
+
+void TestSerialize::testBroadcastGrid()
+{
+    int rank;
+    Grid g;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 1)
+    {
+        const float ref[3] = {1.0f, -2.2f, 3.141f};
+        g = Grid(ref, 2.5f, -1, 100, -1000000000, 1000000000, 50, 52);
+    }
+
+    Serialize::broadcast(g, MPI_COMM_WORLD, 1);
+    MLSGPU_ASSERT_EQUAL(1.0f, g.getReference()[0]);
+    MLSGPU_ASSERT_EQUAL(-2.2f, g.getReference()[1]);
+    MLSGPU_ASSERT_EQUAL(3.141f, g.getReference()[2]);
+    MLSGPU_ASSERT_EQUAL(2.5f, g.getSpacing());
+    MLSGPU_ASSERT_EQUAL(-1, g.getExtent(0).first);
+    MLSGPU_ASSERT_EQUAL(100, g.getExtent(0).second);
+    MLSGPU_ASSERT_EQUAL(-1000000000, g.getExtent(1).first);
+    MLSGPU_ASSERT_EQUAL(1000000000, g.getExtent(1).second);
+    MLSGPU_ASSERT_EQUAL(50, g.getExtent(2).first);
+    MLSGPU_ASSERT_EQUAL(52, g.getExtent(2).second);
+}
@@ -61,6 +61,9 @@ private:
 protected:
     virtual Set *setFactory(const std::vector<std::vector<Splat> > &splatData,
                             float spacing, Grid::size_type bucketSize);
+
+    /// Number of reader threads to pass to @ref FastBlobSetMPI::computeBlobs
+    virtual unsigned int numReaders() const { return 1; }
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -70,6 +73,17 @@ public:
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFastFileSetMPI, TestSet::perBuild());
 
+/// Tests for @ref SplatSet::FastBlobSetMPI <SplatSet::FileSet> with multiple reader threads.
+class TestFastFileSetMPIReaders : public TestFastFileSetMPI
+{
+    CPPUNIT_TEST_SUB_SUITE(TestFastFileSetMPIReaders, TestFastFileSetMPI);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    virtual unsigned int numReaders() const { return 3; }
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFastFileSetMPIReaders, TestSet::perBuild());
+
 void TestFastFileSetMPI::setUp()
 {
     MPI_Barrier(MPI_COMM_WORLD);
@@ -92,14 +106,14 @@ TestFastFileSetMPI::Set *TestFastFileSetMPI::setFactory(
         return NULL; // otherwise computeBlobs will throw
     std::auto_ptr<FastBlobSetMPI<FileSet> > set(new FastBlobSetMPI<FileSet>);
     TestFileSet::populate(*set, splatData, store);
-    set->computeBlobs(comm, 0, spacing, bucketSize, NULL, false);
+    set->computeBlobs(comm, 0, spacing, bucketSize, NULL, false, numReaders());
     return set.release();
 }
 
 void TestFastFileSetMPI::testEmpty()
 {
     boost::scoped_ptr<FastBlobSetMPI<FileSet> > set(new FastBlobSetMPI<FileSet>());
-    CPPUNIT_ASSERT_THROW(set->computeBlobs(comm, 0, 2.5f, 5, NULL, false), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(set->computeBlobs(comm, 0, 2.5f, 5, NULL, false, numReaders()), std::runtime_error);
 }
 
 void TestFastFileSetMPI::testProgress()
@@ -109,5 +123,5 @@ void TestFastFileSetMPI::testProgress()
 
     boost::iostreams::null_sink nullSink;
     boost::iostreams::stream<boost::iostreams::null_sink> nullStream(nullSink);
-    set->computeBlobs(comm, 0, 2.5f, 5, &nullStream, false);
+    set->computeBlobs(comm, 0, 2.5f, 5, &nullStream, false, numReaders());
 }
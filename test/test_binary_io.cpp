@@ -36,10 +36,14 @@
 #include <cctype>
 #include <locale>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include "testutil.h"
 #include "../src/binary_io.h"
 #include "../src/errors.h"
 #include "../src/misc.h"
+#include "../src/compress.h"
 
 static const boost::filesystem::path badPath("/not_a_real_file/");
 #ifdef _WIN32
@@ -100,6 +104,7 @@ class TestBinaryReader : public TestBinaryIO
     CPPUNIT_TEST(testReadPastEnd);
     CPPUNIT_TEST(testReadZero);
     CPPUNIT_TEST(testSize);
+    CPPUNIT_TEST(testWillNeed);
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 
 protected:
@@ -111,6 +116,7 @@ private:
     void testReadPastEnd();   ///< Test a read that does not intersect the file
     void testReadZero();      ///< Test reading zero bytes
     void testSize();          ///< Test @ref BinaryReader::size
+    void testWillNeed();      ///< Test that @ref BinaryReader::willNeed does not disturb reads
 };
 
 /**
@@ -285,6 +291,24 @@ void TestBinaryReader::testSize()
     MLSGPU_ASSERT_EQUAL(seekPos + strlen("big offset"), b->size());
 }
 
+void TestBinaryReader::testWillNeed()
+{
+    char buffer[4096];
+    boost::scoped_ptr<BinaryReader> b(factoryReader());
+
+    // Only the syscall reader can act on the hint, and this is known before opening
+    if (dynamic_cast<TestSyscallReader *>(this) == NULL)
+        CPPUNIT_ASSERT(!b->canWillNeed());
+    b->open(testPath);
+    b->willNeed(1, 8);
+    b->willNeed(seekPos, 4096);
+    b->willNeed(seekPos + 4096, 4096); // beyond the end of the file
+    b->willNeed(0, 0);
+    std::size_t bytes = b->read(buffer, 8, 1);
+    MLSGPU_ASSERT_EQUAL(8, bytes);
+    CPPUNIT_ASSERT_EQUAL(std::string("ello wor"), std::string(buffer, bytes));
+}
+
 
 BinaryWriter *TestBinaryWriter::factoryWriter()
 {
@@ -368,3 +392,202 @@ void TestBinaryWriter::testResize()
 
     MLSGPU_ASSERT_EQUAL(seekPos, file_size(testPath));
 }
+
+/**
+ * Tests for the reader returned by @ref createCompressedReader. They do nothing
+ * if compression is not supported.
+ */
+class TestCompressedReader : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCompressedReader);
+    CPPUNIT_TEST(testDetect);
+    CPPUNIT_TEST(testReadAll);
+    CPPUNIT_TEST(testReadRandom);
+    CPPUNIT_TEST(testReadPastEnd);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testNotContainer);
+    CPPUNIT_TEST(testWillNeed);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Frame size used for the tests, small so that reads span several frames
+    static const std::size_t frameSize = 1000;
+
+    boost::filesystem::path rawPath;        ///< Uncompressed data
+    boost::filesystem::path containerPath;  ///< Compressed version of @ref rawPath
+    std::string content;                    ///< Content of @ref rawPath
+
+    /// Write @a data to @ref rawPath and compress it to @ref containerPath
+    void makeContainer(const std::string &data);
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testDetect();          ///< Test @ref isCompressedContainer
+    void testReadAll();         ///< Read the whole file in one call
+    void testReadRandom();      ///< Random reads, some within a frame and some spanning frames
+    void testReadPastEnd();     ///< Reads that are clipped by the end of the file
+    void testEmpty();           ///< Compress an empty file
+    void testNotContainer();    ///< Opening a file that is not a container
+    void testWillNeed();        ///< Hints are passed to the container reader and do not disturb reads
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCompressedReader, TestSet::perBuild());
+
+void TestCompressedReader::makeContainer(const std::string &data)
+{
+    content = data;
+    {
+        boost::filesystem::ofstream f(rawPath, std::ios::binary);
+        f.exceptions(std::ios::failbit | std::ios::badbit);
+        f << content;
+    }
+    boost::scoped_ptr<BinaryReader> in(createReader(SYSCALL_READER));
+    boost::scoped_ptr<BinaryWriter> out(createWriter(SYSCALL_WRITER));
+    in->open(rawPath);
+    out->open(containerPath);
+    writeCompressedContainer(*in, *out, frameSize);
+    out->close();
+}
+
+void TestCompressedReader::setUp()
+{
+    boost::filesystem::ofstream f;
+    createTmpFile(rawPath, f);
+    f.close();
+    createTmpFile(containerPath, f);
+    f.close();
+
+    if (!compressSupported())
+        return;
+
+    /* Mix compressible text with pseudo-random bytes, so that some frames
+     * are stored uncompressed.
+     */
+    std::string data;
+    unsigned int seed = 1;
+    for (int i = 0; i < 12345; i++)
+    {
+        if ((i / 3000) % 2 == 0)
+            data += char('a' + i % 7);
+        else
+        {
+            seed = seed * 1103515245 + 12345;
+            data += char(seed >> 16);
+        }
+    }
+    makeContainer(data);
+}
+
+void TestCompressedReader::tearDown()
+{
+    boost::filesystem::remove(rawPath);
+    boost::filesystem::remove(containerPath);
+}
+
+void TestCompressedReader::testDetect()
+{
+    if (!compressSupported())
+        return;
+
+    boost::scoped_ptr<BinaryReader> raw(createReader(SYSCALL_READER));
+    raw->open(rawPath);
+    CPPUNIT_ASSERT(!isCompressedContainer(*raw));
+    raw->close();
+    raw->open(containerPath);
+    CPPUNIT_ASSERT(isCompressedContainer(*raw));
+    CPPUNIT_ASSERT(raw->size() < content.size());
+}
+
+void TestCompressedReader::testReadAll()
+{
+    if (!compressSupported())
+        return;
+
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(SYSCALL_READER));
+    b->open(containerPath);
+    MLSGPU_ASSERT_EQUAL(content.size(), b->size());
+    std::vector<char> buffer(content.size());
+    MLSGPU_ASSERT_EQUAL(content.size(), b->read(&buffer[0], buffer.size(), 0));
+    CPPUNIT_ASSERT(content == std::string(buffer.begin(), buffer.end()));
+}
+
+void TestCompressedReader::testReadRandom()
+{
+    if (!compressSupported())
+        return;
+
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(MMAP_READER));
+    b->open(containerPath);
+    std::vector<char> buffer(content.size());
+    unsigned int seed = 2;
+    for (int i = 0; i < 200; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        const std::size_t offset = (seed >> 8) % content.size();
+        seed = seed * 1103515245 + 12345;
+        const std::size_t count = (seed >> 8) % (3 * frameSize);
+        const std::size_t expected = std::min(count, content.size() - offset);
+        MLSGPU_ASSERT_EQUAL(expected, b->read(&buffer[0], count, offset));
+        CPPUNIT_ASSERT(content.substr(offset, expected) == std::string(&buffer[0], expected));
+    }
+}
+
+void TestCompressedReader::testReadPastEnd()
+{
+    if (!compressSupported())
+        return;
+
+    char buffer[64];
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(SYSCALL_READER));
+    b->open(containerPath);
+
+    MLSGPU_ASSERT_EQUAL(5, b->read(buffer, sizeof(buffer), content.size() - 5));
+    CPPUNIT_ASSERT(content.substr(content.size() - 5) == std::string(buffer, 5));
+    MLSGPU_ASSERT_EQUAL(0, b->read(buffer, sizeof(buffer), content.size()));
+    MLSGPU_ASSERT_EQUAL(0, b->read(buffer, sizeof(buffer), content.size() + 1000));
+}
+
+void TestCompressedReader::testEmpty()
+{
+    if (!compressSupported())
+        return;
+
+    makeContainer("");
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(SYSCALL_READER));
+    b->open(containerPath);
+    MLSGPU_ASSERT_EQUAL(0, b->size());
+    char buffer[1];
+    MLSGPU_ASSERT_EQUAL(0, b->read(buffer, 1, 0));
+}
+
+void TestCompressedReader::testNotContainer()
+{
+    if (!compressSupported())
+        return;
+
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(SYSCALL_READER));
+    CPPUNIT_ASSERT_THROW(b->open(rawPath), std::ios::failure);
+    CPPUNIT_ASSERT(!b->isOpen());
+}
+
+void TestCompressedReader::testWillNeed()
+{
+    if (!compressSupported())
+        return;
+
+    boost::scoped_ptr<BinaryReader> mmap(createCompressedReader(MMAP_READER));
+    CPPUNIT_ASSERT(!mmap->canWillNeed());
+    boost::scoped_ptr<BinaryReader> b(createCompressedReader(SYSCALL_READER));
+    MLSGPU_ASSERT_EQUAL(boost::scoped_ptr<BinaryReader>(createReader(SYSCALL_READER))->canWillNeed(),
+                        b->canWillNeed());
+
+    b->open(containerPath);
+    b->willNeed(0, 1);
+    b->willNeed(frameSize - 1, 2 * frameSize);            // spans frames
+    b->willNeed(content.size() - 5, 100);                 // clipped by the end
+    b->willNeed(content.size() + 1000, 100);              // beyond the end
+    std::vector<char> buffer(3 * frameSize);
+    MLSGPU_ASSERT_EQUAL(buffer.size(), b->read(&buffer[0], buffer.size(), frameSize - 1));
+    CPPUNIT_ASSERT(content.substr(frameSize - 1, buffer.size()) == std::string(buffer.begin(), buffer.end()));
+}
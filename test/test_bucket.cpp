@@ -46,6 +46,7 @@
 #include <limits>
 #include <sstream>
 #include <cstring>
+#include <stdexcept>
 #include "../src/tr1_cstdint.h"
 #include <boost/tr1/random.hpp>
 #include "testutil.h"
@@ -267,6 +268,8 @@ class TestBucket : public CppUnit::TestFixture
     CPPUNIT_TEST(testFlat);
     CPPUNIT_TEST(testEmpty);
     CPPUNIT_TEST(testChunkCells);
+    CPPUNIT_TEST(testChunkFilter);
+    CPPUNIT_TEST(testChunkSize);
     CPPUNIT_TEST_SUITE_ADD_CUSTOM_TESTS(addRandom);
     CPPUNIT_TEST_SUITE_END();
 
@@ -278,6 +281,7 @@ private:
         std::size_t numRanges;
         std::vector<SplatSet::splat_id> splatIds;
         std::vector<Splat> splats;
+        boost::array<Grid::difference_type, 3> chunk;
     };
 
     typedef SplatSet::FastBlobSet<SplatSet::VectorsSet> Splats;
@@ -296,6 +300,9 @@ private:
         const Grid &grid,
         const Recursion &recursionState);
 
+    /// Chunk filter for @ref testChunkFilter that selects a checkerboard pattern
+    static bool checkerboard(const boost::array<Grid::difference_type, 3> &chunk, const Grid &grid);
+
     /// Adds random tests to the fixture
     static void addRandom(TestSuiteBuilderContextType &context);
 
@@ -306,6 +313,8 @@ public:
     void testFlat();              ///< Top level already meets the requirements
     void testEmpty();             ///< Edge case with zero splats inside the grid
     void testChunkCells();        ///< Test non-zero @a chunkCells
+    void testChunkFilter();       ///< Test selection of chunks with a @ref Bucket::ChunkFilter
+    void testChunkSize();         ///< Test @ref Bucket::chunkSize
     void testRandom(unsigned long seed); ///< Randomly-generated test case
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBucket, TestSet::perBuild());
@@ -327,7 +336,7 @@ void TestBucket::bucketFunc(
     std::vector<Block> &blocks,
     const typename SplatSet::Traits<T>::subset_type &splats,
     const Grid &grid,
-    const Recursion &)
+    const Recursion &recursionState)
 {
     (void) splats;
     blocks.push_back(Block());
@@ -335,6 +344,7 @@ void TestBucket::bucketFunc(
     block.numSplats = splats.numSplats();
     block.numRanges = splats.numRanges();
     block.grid = grid;
+    block.chunk = recursionState.chunk;
     boost::scoped_ptr<SplatSet::SplatStream> splatStream(splats.makeSplatStream());
     Splat splat;
     SplatSet::splat_id id;
@@ -379,11 +389,12 @@ void TestBucket::validate(
             std::pair<int, int> extent = block.grid.getExtent(i);
             CPPUNIT_ASSERT(fullExtent.first <= extent.first);
             CPPUNIT_ASSERT(fullExtent.second >= extent.second);
-            // Check that chunking is respected
+            // Check that chunking is respected, on the lattice anchored at the reference
             if (chunkCells != 0)
             {
-                CPPUNIT_ASSERT(divDown(extent.first - fullExtent.first, chunkCells)
-                               == divDown(extent.second - fullExtent.first - 1, chunkCells));
+                const Grid::difference_type c = chunkCells;
+                CPPUNIT_ASSERT_EQUAL(divDown(extent.first, c), divDown(extent.second - 1, c));
+                CPPUNIT_ASSERT_EQUAL(divDown(extent.first, c), block.chunk[i]);
             }
         }
 
@@ -551,18 +562,85 @@ void TestBucket::testChunkCells()
 {
     setupSimple();
 
-    // The grid is set up so that the origin is at (0, 0, 0)
+    /* The grid is set up so that the origin is at (0, 0, 0), and extended
+     * so that its lower corner lies on the chunk lattice.
+     */
     const float ref[3] = {-10.0f, 0.0f, 10.0f};
-    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    Grid grid(ref, 2.5f, 0, 20, 0, 20, -16, 4);
     std::vector<Block> blocks;
     const int maxSplats = 20;
     const int maxCells = 8;
     const int maxSplit = 1000000;
-    const int chunkCells = 14;
-    const int chunkCellsRounded = 16;
+    const int chunkCells = Bucket::chunkSize(14, maxCells);
+    MLSGPU_ASSERT_EQUAL(16, chunkCells);
     bucket(splats, grid, maxSplats, INT_MAX, chunkCells, maxCells, maxSplit,
            boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
-    validate(splats, grid, blocks, maxSplats, INT_MAX, chunkCellsRounded);
+    validate(splats, grid, blocks, maxSplats, INT_MAX, chunkCells);
+
+    // A region that does not start on a chunk boundary is rejected
+    Grid unaligned(ref, 2.5f, 4, 20, 0, 20, -16, 4);
+    CPPUNIT_ASSERT_THROW(
+        bucket(splats, unaligned, maxSplats, INT_MAX, chunkCells, maxCells, maxSplit,
+               boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3)),
+        std::invalid_argument);
+}
+
+void TestBucket::testChunkSize()
+{
+    // Same parameters as testChunkCells
+    MLSGPU_ASSERT_EQUAL(16, Bucket::chunkSize(14, 8));
+    // Exact multiples are unchanged
+    MLSGPU_ASSERT_EQUAL(16, Bucket::chunkSize(16, 8));
+    MLSGPU_ASSERT_EQUAL(8, Bucket::chunkSize(8, 8));
+    // Smaller than a microblock
+    MLSGPU_ASSERT_EQUAL(8, Bucket::chunkSize(5, 8));
+    // Rounding to a power-of-two multiple of the microblock size
+    MLSGPU_ASSERT_EQUAL(32, Bucket::chunkSize(17, 4));
+    MLSGPU_ASSERT_EQUAL(24, Bucket::chunkSize(17, 3));
+    MLSGPU_ASSERT_EQUAL(32, Bucket::chunkSize(30, 8));
+    MLSGPU_ASSERT_EQUAL(1008, Bucket::chunkSize(1000, 63));
+    CPPUNIT_ASSERT_THROW(Bucket::chunkSize(0, 8), std::invalid_argument);
+}
+
+bool TestBucket::checkerboard(const boost::array<Grid::difference_type, 3> &chunk, const Grid &grid)
+{
+    (void) grid;
+    return (chunk[0] + chunk[1] + chunk[2]) % 2 == 0;
+}
+
+void TestBucket::testChunkFilter()
+{
+    setupSimple();
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 0, 20, 0, 20, -16, 4);
+    const int maxSplats = 20;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    const int chunkCells = 16;
+    std::vector<Block> all, filtered;
+    bucket(splats, grid, maxSplats, INT_MAX, chunkCells, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(all), _1, _2, _3));
+    bucket(splats, grid, maxSplats, INT_MAX, chunkCells, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(filtered), _1, _2, _3),
+           Recursion(), &TestBucket::checkerboard);
+
+    std::vector<Block> expected;
+    BOOST_FOREACH(const Block &block, all)
+    {
+        if (checkerboard(block.chunk, block.grid))
+            expected.push_back(block);
+    }
+    CPPUNIT_ASSERT(!expected.empty());
+    CPPUNIT_ASSERT(expected.size() < all.size());
+    CPPUNIT_ASSERT_EQUAL(expected.size(), filtered.size());
+    for (std::size_t i = 0; i < expected.size(); i++)
+    {
+        CPPUNIT_ASSERT(expected[i].chunk == filtered[i].chunk);
+        CPPUNIT_ASSERT(expected[i].splatIds == filtered[i].splatIds);
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT(expected[i].grid.getExtent(j) == filtered[i].grid.getExtent(j));
+    }
 }
 
 static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
@@ -603,7 +681,7 @@ void TestBucket::testRandom(unsigned long seed)
     unsigned int maxScan = simpleRandomInt(engine, 1, 2000); // maximum splats in one scan
     unsigned int maxSplit = simpleRandomInt(engine, 64, 1000);
     unsigned int maxCells = simpleRandomInt(engine, 40, 100);
-    unsigned int chunkCells = simpleRandomInt(engine, 80, 513);
+    unsigned int chunkCells = Bucket::chunkSize(simpleRandomInt(engine, 80, 513), maxCells);
     if (bernoulli_distribution(0.5)(engine))
         chunkCells = 0;
     unsigned int maxSplats = simpleRandomInt(engine, 20, 10000);
@@ -649,13 +727,23 @@ void TestBucket::testRandom(unsigned long seed)
         // Harmless: caused if there are no splats
         return;
     }
-    const Grid grid = splats.getBoundingGrid();
+    Grid grid = splats.getBoundingGrid();
+    if (chunkCells != 0)
+    {
+        // Align the lower corner to the chunk lattice, as postprocessGrid does
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const Grid::difference_type c = chunkCells;
+            std::pair<Grid::difference_type, Grid::difference_type> extent = grid.getExtent(i);
+            grid.setExtent(i, divDown(extent.first, c) * c, extent.second);
+        }
+    }
     std::vector<Block> blocks;
     try
     {
         bucket(splats, grid, maxSplats, maxCells, chunkCells, maxCells, maxSplit,
                boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
-        validate(splats, grid, blocks, maxSplats, maxCells, 0);
+        validate(splats, grid, blocks, maxSplats, maxCells, chunkCells);
     }
     catch (DensityError &e)
     {
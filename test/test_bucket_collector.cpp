@@ -0,0 +1,169 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref BucketCollector.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/bind.hpp>
+#include <vector>
+#include "testutil.h"
+#include "../src/bucket_collector.h"
+#include "../src/bucket.h"
+#include "../src/splat_set.h"
+
+class TestBucketCollector : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestBucketCollector);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testReadAhead);
+    CPPUNIT_TEST(testFileOrder);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// First splat ID of each bin passed to the functor, one vector per call
+    std::vector<std::vector<SplatSet::splat_id> > batches;
+    /// Chunk generation of each bin passed to the functor
+    std::vector<ChunkId::gen_type> gens;
+    /// First splat ID of each bin passed to the hint functor
+    std::vector<SplatSet::splat_id> hints;
+
+    void collect(const Statistics::Container::vector<BucketCollector::Bin> &bins);
+    void hint(const BucketCollector::Bin &bin);
+
+    /// Pass a bin holding splats [first, last) in chunk (x, 0, 0) to @a collector
+    static void add(BucketCollector &collector, SplatSet::splat_id first, SplatSet::splat_id last,
+                    Grid::size_type x = 0);
+
+public:
+    virtual void setUp();
+
+    void testBatch();         ///< Bins are passed on when the splat limit is reached
+    void testReadAhead();     ///< The first bins between flushes are hinted
+    void testFileOrder();     ///< Bins are sorted within, but not across, chunks
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBucketCollector, TestSet::perBuild());
+
+void TestBucketCollector::setUp()
+{
+    batches.clear();
+    gens.clear();
+    hints.clear();
+}
+
+void TestBucketCollector::collect(const Statistics::Container::vector<BucketCollector::Bin> &bins)
+{
+    batches.push_back(std::vector<SplatSet::splat_id>());
+    for (std::size_t i = 0; i < bins.size(); i++)
+    {
+        batches.back().push_back(bins[i].ranges.begin()->first);
+        gens.push_back(bins[i].chunkId.gen);
+    }
+}
+
+void TestBucketCollector::hint(const BucketCollector::Bin &bin)
+{
+    hints.push_back(bin.ranges.begin()->first);
+}
+
+void TestBucketCollector::add(
+    BucketCollector &collector, SplatSet::splat_id first, SplatSet::splat_id last,
+    Grid::size_type x)
+{
+    SplatSet::SubsetBase ranges;
+    ranges.addRange(first, last);
+    ranges.flush();
+    Bucket::Recursion recursionState;
+    recursionState.chunk[0] = x;
+    collector(ranges, Grid(), recursionState);
+}
+
+void TestBucketCollector::testBatch()
+{
+    BucketCollector collector(100, boost::bind(&TestBucketCollector::collect, this, _1));
+    add(collector, 500, 560);
+    add(collector, 0, 30);
+    add(collector, 200, 220);
+    add(collector, 100, 150);
+    collector.flush();
+
+    MLSGPU_ASSERT_EQUAL(2, batches.size());
+    MLSGPU_ASSERT_EQUAL(2, batches[0].size());
+    MLSGPU_ASSERT_EQUAL(500, batches[0][0]);
+    MLSGPU_ASSERT_EQUAL(0, batches[0][1]);
+    MLSGPU_ASSERT_EQUAL(2, batches[1].size());
+    MLSGPU_ASSERT_EQUAL(200, batches[1][0]);
+    MLSGPU_ASSERT_EQUAL(100, batches[1][1]);
+}
+
+void TestBucketCollector::testReadAhead()
+{
+    BucketCollector collector(100, boost::bind(&TestBucketCollector::collect, this, _1));
+    collector.setReadAhead(2, boost::bind(&TestBucketCollector::hint, this, _1));
+    add(collector, 0, 10);
+    add(collector, 20, 30);
+    add(collector, 40, 50);
+    MLSGPU_ASSERT_EQUAL(2, hints.size());
+    MLSGPU_ASSERT_EQUAL(0, hints[0]);
+    MLSGPU_ASSERT_EQUAL(20, hints[1]);
+
+    collector.flush();
+    add(collector, 60, 70);
+    MLSGPU_ASSERT_EQUAL(3, hints.size());
+    MLSGPU_ASSERT_EQUAL(60, hints[2]);
+}
+
+void TestBucketCollector::testFileOrder()
+{
+    BucketCollector collector(100, boost::bind(&TestBucketCollector::collect, this, _1));
+    collector.setFileOrder(true);
+    add(collector, 500, 560, 0);
+    add(collector, 0, 30, 0);
+    add(collector, 200, 220, 0);
+    add(collector, 100, 150, 0);
+    add(collector, 50, 60, 1);
+    add(collector, 10, 20, 1);
+    collector.flush();
+
+    MLSGPU_ASSERT_EQUAL(3, batches.size());
+    MLSGPU_ASSERT_EQUAL(3, batches[0].size());
+    MLSGPU_ASSERT_EQUAL(0, batches[0][0]);
+    MLSGPU_ASSERT_EQUAL(100, batches[0][1]);
+    MLSGPU_ASSERT_EQUAL(200, batches[0][2]);
+    MLSGPU_ASSERT_EQUAL(1, batches[1].size());
+    MLSGPU_ASSERT_EQUAL(500, batches[1][0]);
+    // The second chunk is not mixed with the first
+    MLSGPU_ASSERT_EQUAL(2, batches[2].size());
+    MLSGPU_ASSERT_EQUAL(10, batches[2][0]);
+    MLSGPU_ASSERT_EQUAL(50, batches[2][1]);
+
+    for (std::size_t i = 0; i < 4; i++)
+        MLSGPU_ASSERT_EQUAL(0, gens[i]);
+    for (std::size_t i = 4; i < 6; i++)
+        MLSGPU_ASSERT_EQUAL(1, gens[i]);
+}
@@ -59,6 +59,10 @@ class TestCircularBuffer : public CppUnit::TestFixture
     CPPUNIT_TEST(testZero);
 #endif
     CPPUNIT_TEST(testUnallocated);
+    CPPUNIT_TEST(testGrow);
+    CPPUNIT_TEST(testShrink);
+    CPPUNIT_TEST(testAllocateTooLarge);
+    CPPUNIT_TEST(testArena);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -70,6 +74,10 @@ private:
     void testOverflow();        ///< Test exception handling when total size overflows
     void testZero();            ///< Test that an exception is thrown when asking for zero elements
     void testUnallocated();     ///< Test @ref CircularBufferBase::unallocated
+    void testGrow();            ///< Test growing with @ref CircularBufferBase::resize
+    void testShrink();          ///< Test that shrinking waits for live allocations
+    void testAllocateTooLarge(); ///< Test that an allocation larger than the size is rejected
+    void testArena();           ///< Test two buffers sharing a @ref CircularBufferArena
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCircularBuffer, TestSet::perBuild());
 
@@ -298,3 +306,95 @@ void TestCircularBuffer::testUnallocated()
     buffer.free(a4);
     MLSGPU_ASSERT_EQUAL(10, buffer.unallocated());
 }
+
+void TestCircularBuffer::testGrow()
+{
+    Timeplot::Worker worker("test");
+    CircularBuffer buffer("test", 10, 20);
+    MLSGPU_ASSERT_EQUAL(20, buffer.capacity());
+
+    CircularBuffer::Allocation a1 = buffer.allocate(worker, 8);
+    MLSGPU_ASSERT_EQUAL(2, buffer.unallocated());
+    buffer.resize(20);
+    MLSGPU_ASSERT_EQUAL(20, buffer.size());
+    MLSGPU_ASSERT_EQUAL(12, buffer.unallocated());
+
+    CircularBuffer::Allocation a2 = buffer.allocate(worker, 12);
+    MLSGPU_ASSERT_EQUAL(8, static_cast<char *>(a2.get()) - static_cast<char *>(a1.get()));
+    buffer.free(a1);
+    buffer.free(a2);
+    MLSGPU_ASSERT_EQUAL(20, buffer.unallocated());
+}
+
+void TestCircularBuffer::testShrink()
+{
+    Timeplot::Worker worker("test");
+    CircularBuffer buffer("test", 20);
+
+    CircularBuffer::Allocation a1 = buffer.allocate(worker, 5);
+    CircularBuffer::Allocation a2 = buffer.allocate(worker, 10);
+    buffer.resize(10);
+    // a2 extends past the new end, so the shrink is deferred
+    MLSGPU_ASSERT_EQUAL(20, buffer.size());
+
+    buffer.free(a1);
+    // New allocations wrap rather than extending past the new end
+    CircularBuffer::Allocation a3 = buffer.allocate(worker, 4);
+    MLSGPU_ASSERT_EQUAL(0, static_cast<char *>(a3.get()) - static_cast<char *>(a1.get()));
+    MLSGPU_ASSERT_EQUAL(20, buffer.size());
+
+    buffer.free(a2);
+    MLSGPU_ASSERT_EQUAL(10, buffer.size());
+    MLSGPU_ASSERT_EQUAL(6, buffer.unallocated());
+    buffer.free(a3);
+    MLSGPU_ASSERT_EQUAL(10, buffer.unallocated());
+}
+
+void TestCircularBuffer::testAllocateTooLarge()
+{
+    Timeplot::Worker worker("test");
+    CircularBuffer buffer("test", 10, 20);
+    buffer.resize(5);
+    MLSGPU_ASSERT_EQUAL(5, buffer.size());
+    CPPUNIT_ASSERT_THROW(buffer.allocate(worker, 8), std::out_of_range);
+    MLSGPU_ASSERT_EQUAL(5, buffer.size());
+
+    // A pending shrink also limits the allocation size
+    buffer.resize(10);
+    CircularBuffer::Allocation a1 = buffer.allocate(worker, 8);
+    buffer.resize(6);
+    MLSGPU_ASSERT_EQUAL(10, buffer.size());
+    CPPUNIT_ASSERT_THROW(buffer.allocate(worker, 7), std::out_of_range);
+    buffer.free(a1);
+    MLSGPU_ASSERT_EQUAL(6, buffer.size());
+}
+
+void TestCircularBuffer::testArena()
+{
+    Timeplot::Worker worker("test");
+    CircularBufferArena arena("test", 20);
+    CircularBuffer lower("test", 8, &arena, CircularBufferArena::LOWER);
+    CircularBuffer upper("test", 12, &arena, CircularBufferArena::UPPER);
+    MLSGPU_ASSERT_EQUAL(20, lower.capacity());
+    MLSGPU_ASSERT_EQUAL(20, upper.capacity());
+
+    CircularBuffer::Allocation a1 = lower.allocate(worker, 8);
+    CircularBuffer::Allocation a2 = upper.allocate(worker, 4);
+    CircularBuffer::Allocation a3 = upper.allocate(worker, 8);
+    MLSGPU_ASSERT_EQUAL(0, static_cast<char *>(a1.get()) - arena.get());
+    MLSGPU_ASSERT_EQUAL(16, static_cast<char *>(a2.get()) - arena.get());
+    MLSGPU_ASSERT_EQUAL(8, static_cast<char *>(a3.get()) - arena.get());
+    upper.free(a2);
+    upper.free(a3);
+
+    // Move memory from the upper buffer to the lower one
+    upper.resize(8);
+    lower.resize(12);
+    CircularBuffer::Allocation a4 = upper.allocate(worker, 8);
+    MLSGPU_ASSERT_EQUAL(12, static_cast<char *>(a4.get()) - arena.get());
+    lower.free(a1);
+    CircularBuffer::Allocation a5 = lower.allocate(worker, 12);
+    MLSGPU_ASSERT_EQUAL(0, static_cast<char *>(a5.get()) - arena.get());
+    lower.free(a5);
+    upper.free(a4);
+}
@@ -0,0 +1,117 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Test code for @ref compress.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <stdexcept>
+#include "../src/compress.h"
+#include "testutil.h"
+
+class TestCompress : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCompress);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testWrongSize);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    std::vector<char> makeInput(std::size_t size) const;
+
+public:
+    void testRoundTrip();     ///< Compress and decompress some data
+    void testEmpty();         ///< Compress and decompress an empty buffer
+    void testWrongSize();     ///< Decompress with the wrong expected size
+    void testCorrupt();       ///< Decompress garbage
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCompress, TestSet::perBuild());
+
+std::vector<char> TestCompress::makeInput(std::size_t size) const
+{
+    std::vector<char> in(size);
+    for (std::size_t i = 0; i < size; i++)
+        in[i] = (i * i / 7) % 13;
+    return in;
+}
+
+void TestCompress::testRoundTrip()
+{
+    if (!compressSupported())
+        return;
+
+    const std::size_t size = 100000;
+    std::vector<char> in = makeInput(size);
+    std::vector<char> compressed(compressBufferBound(size));
+    std::size_t compressedSize = compressBuffer(&in[0], size, &compressed[0], compressed.size());
+    CPPUNIT_ASSERT(compressedSize > 0);
+    CPPUNIT_ASSERT(compressedSize < size);
+
+    std::vector<char> out(size);
+    decompressBuffer(&compressed[0], compressedSize, &out[0], size);
+    CPPUNIT_ASSERT(in == out);
+}
+
+void TestCompress::testEmpty()
+{
+    if (!compressSupported())
+        return;
+
+    char dummy = 0;
+    std::vector<char> compressed(compressBufferBound(0));
+    std::size_t compressedSize = compressBuffer(&dummy, 0, &compressed[0], compressed.size());
+    decompressBuffer(&compressed[0], compressedSize, &dummy, 0);
+}
+
+void TestCompress::testWrongSize()
+{
+    if (!compressSupported())
+        return;
+
+    const std::size_t size = 1000;
+    std::vector<char> in = makeInput(size);
+    std::vector<char> compressed(compressBufferBound(size));
+    std::size_t compressedSize = compressBuffer(&in[0], size, &compressed[0], compressed.size());
+
+    std::vector<char> out(2 * size);
+    CPPUNIT_ASSERT_THROW(decompressBuffer(&compressed[0], compressedSize, &out[0], size - 1), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(decompressBuffer(&compressed[0], compressedSize, &out[0], size + 1), std::runtime_error);
+}
+
+void TestCompress::testCorrupt()
+{
+    if (!compressSupported())
+        return;
+
+    std::vector<char> in = makeInput(1000);
+    std::vector<char> out(1000);
+    CPPUNIT_ASSERT_THROW(decompressBuffer(&in[0], in.size(), &out[0], out.size()), std::runtime_error);
+}
@@ -50,8 +50,10 @@
 #include <boost/ref.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/filesystem.hpp>
+#include "../src/tr1_cstdint.h"
 #include "../src/fast_ply.h"
 #include "../src/splat.h"
+#include "../src/misc.h"
 #include "memory_reader.h"
 #include "memory_writer.h"
 #include "testutil.h"
@@ -87,8 +89,11 @@ class TestFastPlyReader : public CppUnit::TestFixture
     TEST_EXCEPTION_FILENAME(testMissingEnd, FormatError, testFilename);
     TEST_EXCEPTION_FILENAME(testShortFile, boost::exception, testFilename);
     TEST_EXCEPTION_FILENAME(testList, FormatError, testFilename);
-    TEST_EXCEPTION_FILENAME(testNotFloat, FormatError, testFilename);
-    TEST_EXCEPTION_FILENAME(testFormatAscii, FormatError, testFilename);
+    TEST_EXCEPTION_FILENAME(testBadScale, FormatError, testFilename);
+    TEST_EXCEPTION_FILENAME(testBadScanner, FormatError, testFilename);
+    TEST_EXCEPTION_FILENAME(testPartialNormals, FormatError, testFilename);
+    TEST_EXCEPTION_FILENAME(testAsciiShort, FormatError, testFilename);
+    TEST_EXCEPTION_FILENAME(testAsciiBadNumber, FormatError, testFilename);
     TEST_EXCEPTION_FILENAME(testFormatMissing, FormatError, testFilename);
 #endif
 
@@ -96,6 +101,14 @@ class TestFastPlyReader : public CppUnit::TestFixture
     CPPUNIT_TEST(testRead);
     CPPUNIT_TEST(testReadZero);
     CPPUNIT_TEST(testReadIterator);
+    CPPUNIT_TEST(testReadAscii);
+    CPPUNIT_TEST(testReadAsciiIterator);
+    CPPUNIT_TEST(testAsciiNumbers);
+    CPPUNIT_TEST(testReadConvert);
+    CPPUNIT_TEST(testAsciiScale);
+    CPPUNIT_TEST(testPositionsOnly);
+    CPPUNIT_TEST(testPositionsOnlyAscii);
+    CPPUNIT_TEST(testCanWillNeed);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -105,6 +118,9 @@ protected:
     /// Populates content with some useful data for a read test
     void setupRead(int numVertices);
 
+    /// Populates content with the same data as @ref setupRead, but in ASCII format
+    void setupReadAscii(int numVertices);
+
     /**
      * Check that data read from the output of @ref setupRead is correct.
      *
@@ -158,8 +174,11 @@ public:
     void testMissingEnd();             ///< Header ends without @c end_header
     void testShortFile();              ///< File too small to hold all the vertex data
     void testList();                   ///< Vertex element contains a list
-    void testNotFloat();               ///< Vertex property is not a float
-    void testFormatAscii();            ///< Ascii format file
+    void testBadScale();               ///< Scale comment does not contain a number
+    void testBadScanner();             ///< Scanner comment does not contain numbers
+    void testPartialNormals();         ///< Some but not all of the normal and radius properties
+    void testAsciiShort();             ///< Ascii format file with too few lines
+    void testAsciiBadNumber();         ///< Ascii format file with a non-numeric value
     void testFormatMissing();          ///< No format line
     /** @} */
 
@@ -171,6 +190,14 @@ public:
     void testRead();                   ///< Tests @ref FastPly::Reader::Handle::read with a pointer
     void testReadZero();               ///< Tests a zero-splat read
     void testReadIterator();           ///< Tests @ref FastPly::Reader::Handle::read with an output iterator
+    void testReadAscii();              ///< Tests reading an ASCII file
+    void testReadAsciiIterator();      ///< Tests reading an ASCII file across several index entries
+    void testAsciiNumbers();           ///< Tests parsing of different number formats in an ASCII file
+    void testReadConvert();            ///< Tests reading properties that are not FLOAT32, with scales and offsets
+    void testAsciiScale();             ///< Tests scales and offsets in an ASCII file
+    void testPositionsOnly();          ///< Tests a file without normals or radii
+    void testPositionsOnlyAscii();     ///< Tests an ASCII file without normals or radii
+    void testCanWillNeed();            ///< Tests @ref FastPly::Reader::canWillNeed
     /** @} */
 
     /**
@@ -347,30 +374,38 @@ void TestFastPlyReader::testList()
     boost::scoped_ptr<Reader> r(factory(content));
 }
 
-void TestFastPlyReader::testNotFloat()
+void TestFastPlyReader::testBadScale()
 {
     setContent(
         "ply\n"
         "format binary_little_endian 1.0\n"
+        "comment scale x large\n"
         "element vertex 5\n"
         "property float32 x\n"
         "property float32 y\n"
         "property float32 z\n"
-        "property uint32 nx\n"
+        "property float32 nx\n"
         "property float32 ny\n"
         "property float32 nz\n"
         "property float32 radius\n"
-        "property uint8 foo\n"
         "end_header\n");
     boost::scoped_ptr<Reader> r(factory(content));
 }
 
-void TestFastPlyReader::testFormatAscii()
+void TestFastPlyReader::testAsciiShort()
 {
-    setContent(
+    setupReadAscii(5);
+    // Drop the face and the last vertex
+    content.erase(content.rfind('\n', content.rfind('\n', content.size() - 2) - 1) + 1);
+    boost::scoped_ptr<Reader> r(factory(content));
+}
+
+void TestFastPlyReader::testAsciiBadNumber()
+{
+    content =
         "ply\n"
         "format ascii 1.0\n"
-        "element vertex 5\n"
+        "element vertex 1\n"
         "property float32 x\n"
         "property float32 y\n"
         "property float32 z\n"
@@ -378,9 +413,12 @@ void TestFastPlyReader::testFormatAscii()
         "property float32 ny\n"
         "property float32 nz\n"
         "property float32 radius\n"
-        "property uint8 foo\n"
-        "end_header\n");
+        "end_header\n"
+        "1 2 3 4 5 six 7\n";
     boost::scoped_ptr<Reader> r(factory(content));
+    Reader::Handle h(*r);
+    Splat out[1];
+    h.read(0, 1, out);
 }
 
 void TestFastPlyReader::testFormatMissing()
@@ -458,6 +496,38 @@ void TestFastPlyReader::setupRead(int numVertices)
          content.begin() + header.size());
 }
 
+void TestFastPlyReader::setupReadAscii(int numVertices)
+{
+    std::ostringstream out;
+    out << "ply\n"
+        "format ascii 1.0\n"
+        "comment generated by test_fast_ply\n"
+        "element vertex " << numVertices << "\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property uint8 foo\n"
+        "property float32 x\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float64 nz\n"
+        "property int32 radius\n"
+        "property float32 bar\n"
+        "element face 1\n"
+        "property list uint8 uint32 vertex_indices\n"
+        "end_header\n";
+    for (int i = 0; i < numVertices; i++)
+    {
+        out << i * 100 << ".0 " << i * 100 + 1 << " 7 " << i * 100 + 2;
+        for (int j = 3; j < 7; j++)
+            out << ' ' << i * 100 + j;
+        out << " 0.5";
+        // Exercise both line ending styles
+        out << (i % 2 ? "\r\n" : "\n");
+    }
+    out << "3 0 1 2\n";
+    content = out.str();
+}
+
 template<typename ForwardIterator>
 void TestFastPlyReader::verify(int offset, ForwardIterator first, ForwardIterator last)
 {
@@ -520,6 +590,303 @@ void TestFastPlyReader::testReadIterator()
 #endif
 }
 
+void TestFastPlyReader::testReadAscii()
+{
+    setupReadAscii(5);
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    CPPUNIT_ASSERT(r->isAscii());
+    CPPUNIT_ASSERT_EQUAL(Reader::size_type(5), r->size());
+    Reader::Handle h(*r);
+
+    Splat out[4] = {};
+    h.read(1, 4, out);
+    CPPUNIT_ASSERT_EQUAL(0.0f, out[3].position[0]); // check for overwriting
+    verify(1, out, out + 3);
+
+    h.read(4, 5, out);
+    verify(4, out, out + 1);
+}
+
+void TestFastPlyReader::testCanWillNeed()
+{
+    setupRead(5);
+    boost::filesystem::path path;
+    {
+        boost::filesystem::ofstream out;
+        createTmpFile(path, out);
+        out.write(content.data(), content.size());
+    }
+
+    try
+    {
+        const bool syscall = boost::scoped_ptr<BinaryReader>(createReader(SYSCALL_READER))->canWillNeed();
+        Reader r1(SYSCALL_READER, path, 2.0f, 250.0f);
+        MLSGPU_ASSERT_EQUAL(syscall, r1.canWillNeed());
+        Reader r2(SYSCALL_READER, path, r1.getLayout(), 2.0f, 250.0f);
+        MLSGPU_ASSERT_EQUAL(syscall, r2.canWillNeed());
+        Reader r3(MMAP_READER, path, 2.0f, 250.0f);
+        CPPUNIT_ASSERT(!r3.canWillNeed());
+
+        Reader::Handle h(r1);
+        h.willNeed(1, 4);
+        Splat out[3];
+        h.read(1, 4, out);
+        verify(1, out, out + 3);
+    }
+    catch (...)
+    {
+        boost::filesystem::remove(path);
+        throw;
+    }
+    boost::filesystem::remove(path);
+
+    setupReadAscii(5);
+    boost::scoped_ptr<Reader> r(factory(content));
+    CPPUNIT_ASSERT(!r->canWillNeed());
+}
+
+void TestFastPlyReader::testReadAsciiIterator()
+{
+    setupReadAscii(10000);
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    Reader::Handle h(*r);
+
+    std::vector<Splat> out;
+    h.read(2, 9500, back_inserter(out));
+    CPPUNIT_ASSERT_EQUAL(9500 - 2, int(out.size()));
+    verify(2, out.begin(), out.end());
+
+    out.clear();
+    h.read(Reader::asciiIndexStride, Reader::asciiIndexStride + 1, back_inserter(out));
+    verify(Reader::asciiIndexStride, out.begin(), out.end());
+}
+
+void TestFastPlyReader::testAsciiNumbers()
+{
+    content =
+        "ply\n"
+        "format ascii 1.0\n"
+        "element vertex 2\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n"
+        "-1.5e-3 +2 1.0E+1 .5 -7 0.000123456789012345678901 1e30\n"
+        "  3.25\t-0.0   1234567890123456789012 5. 1e-3 inf 0.1";
+    boost::scoped_ptr<Reader> r(factory(content));
+    Reader::Handle h(*r);
+    Splat out[2];
+    h.read(0, 2, out);
+
+    CPPUNIT_ASSERT_EQUAL(-1.5e-3f, out[0].position[0]);
+    CPPUNIT_ASSERT_EQUAL(2.0f, out[0].position[1]);
+    CPPUNIT_ASSERT_EQUAL(10.0f, out[0].position[2]);
+    CPPUNIT_ASSERT_EQUAL(0.5f, out[0].normal[0]);
+    CPPUNIT_ASSERT_EQUAL(-7.0f, out[0].normal[1]);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.000123456789012345678901, out[0].normal[2], 1e-10);
+    CPPUNIT_ASSERT_EQUAL(1e30f, out[0].radius);
+
+    CPPUNIT_ASSERT_EQUAL(3.25f, out[1].position[0]);
+    CPPUNIT_ASSERT_EQUAL(0.0f, out[1].position[1]);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1234567890123456789012.0, out[1].position[2], 1e14);
+    CPPUNIT_ASSERT_EQUAL(5.0f, out[1].normal[0]);
+    CPPUNIT_ASSERT_EQUAL(1e-3f, out[1].normal[1]);
+    CPPUNIT_ASSERT_EQUAL(std::numeric_limits<float>::infinity(), out[1].normal[2]);
+    CPPUNIT_ASSERT_EQUAL(0.1f, out[1].radius);
+}
+
+/// Append the bytes of @a value to @a out
+template<typename T>
+static void appendBinary(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void TestFastPlyReader::testBadScanner()
+{
+    setContent(
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "comment scanner 1 2 high\n"
+        "element vertex 5\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "end_header\n");
+    boost::scoped_ptr<Reader> r(factory(content));
+}
+
+void TestFastPlyReader::testPartialNormals()
+{
+    setContent(
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 5\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "end_header\n");
+    boost::scoped_ptr<Reader> r(factory(content));
+}
+
+void TestFastPlyReader::testReadConvert()
+{
+    content =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "comment scale nx 0.5\n"
+        "comment offset x -1000000\n"
+        "comment scale radius 0.25\n"
+        "comment offset radius 1\n"
+        "comment scale unrelated 2\n"
+        "element vertex 2\n"
+        "property float64 x\n"
+        "property int32 y\n"
+        "property uint16 z\n"
+        "property int8 nx\n"
+        "property uint8 ny\n"
+        "property int16 nz\n"
+        "property uint32 radius\n"
+        "property float32 foo\n"
+        "end_header\n";
+    for (int i = 0; i < 2; i++)
+    {
+        appendBinary(content, 1000000.25 + i);
+        appendBinary(content, std::tr1::int32_t(-100000 - i));
+        appendBinary(content, std::tr1::uint16_t(65535 - i));
+        appendBinary(content, std::tr1::int8_t(-128 + i));
+        appendBinary(content, std::tr1::uint8_t(255 - i));
+        appendBinary(content, std::tr1::int16_t(-32768 + i));
+        appendBinary(content, std::tr1::uint32_t(8 + i));
+        appendBinary(content, 1.0f);
+    }
+
+    boost::scoped_ptr<Reader> r(factory(content));
+    Reader::Handle h(*r);
+    Splat out[2];
+    h.read(0, 2, out);
+    for (int i = 0; i < 2; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(0.25f + i, out[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(-100000.0f - i, out[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(65535.0f - i, out[i].position[2]);
+        CPPUNIT_ASSERT_EQUAL(-64.0f + 0.5f * i, out[i].normal[0]);
+        CPPUNIT_ASSERT_EQUAL(255.0f - i, out[i].normal[1]);
+        CPPUNIT_ASSERT_EQUAL(-32768.0f + i, out[i].normal[2]);
+        CPPUNIT_ASSERT_EQUAL(3.0f + 0.25f * i, out[i].radius);
+    }
+}
+
+void TestFastPlyReader::testAsciiScale()
+{
+    content =
+        "ply\n"
+        "format ascii 1.0\n"
+        "element vertex 1\n"
+        "comment scale y 0.001\n"
+        "comment offset z 10\n"
+        "property float32 x\n"
+        "property int32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n"
+        "1 2500 3 0 0 1 0.5\n";
+    boost::scoped_ptr<Reader> r(factory(content));
+    Reader::Handle h(*r);
+    Splat out[1];
+    h.read(0, 1, out);
+    CPPUNIT_ASSERT_EQUAL(1.0f, out[0].position[0]);
+    CPPUNIT_ASSERT_EQUAL(2.5f, out[0].position[1]);
+    CPPUNIT_ASSERT_EQUAL(13.0f, out[0].position[2]);
+    CPPUNIT_ASSERT_EQUAL(0.5f, out[0].radius);
+}
+
+void TestFastPlyReader::testPositionsOnly()
+{
+    content =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "comment scanner 1.5 -2 1e3\n"
+        "element vertex 2\n"
+        "property float32 x\n"
+        "property uint8 intensity\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "end_header\n";
+    for (int i = 0; i < 2; i++)
+    {
+        appendBinary(content, 1.0f + i);
+        appendBinary(content, std::tr1::uint8_t(200));
+        appendBinary(content, 2.0f + i);
+        appendBinary(content, 3.0f + i);
+    }
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 0.25f));
+    CPPUNIT_ASSERT(!r->hasNormals());
+    CPPUNIT_ASSERT_EQUAL(Reader::size_type(13), r->getVertexSize());
+    const float *scanner = r->getScanner();
+    CPPUNIT_ASSERT(scanner != NULL);
+    CPPUNIT_ASSERT_EQUAL(1.5f, scanner[0]);
+    CPPUNIT_ASSERT_EQUAL(-2.0f, scanner[1]);
+    CPPUNIT_ASSERT_EQUAL(1000.0f, scanner[2]);
+
+    Reader::Handle h(*r);
+    Splat out[2];
+    h.read(0, 2, out);
+    for (int i = 0; i < 2; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(1.0f + i, out[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(2.0f + i, out[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(3.0f + i, out[i].position[2]);
+        CPPUNIT_ASSERT_EQUAL(0.0f, out[i].normal[0]);
+        CPPUNIT_ASSERT_EQUAL(0.0f, out[i].normal[1]);
+        CPPUNIT_ASSERT_EQUAL(0.0f, out[i].normal[2]);
+        CPPUNIT_ASSERT_EQUAL(0.5f, out[i].radius);
+    }
+}
+
+void TestFastPlyReader::testPositionsOnlyAscii()
+{
+    content =
+        "ply\n"
+        "format ascii 1.0\n"
+        "element vertex 2\n"
+        "property float32 z\n"
+        "property float32 y\n"
+        "property float32 x\n"
+        "end_header\n"
+        "3 2 1\n"
+        "6 5 4\n";
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 1.0f, 0.5f));
+    CPPUNIT_ASSERT(!r->hasNormals());
+    CPPUNIT_ASSERT(r->getScanner() == NULL);
+
+    Reader::Handle h(*r);
+    Splat out[2];
+    h.read(0, 2, out);
+    for (int i = 0; i < 2; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(1.0f + 3 * i, out[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(2.0f + 3 * i, out[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(3.0f + 3 * i, out[i].position[2]);
+        CPPUNIT_ASSERT_EQUAL(0.0f, out[i].normal[2]);
+        CPPUNIT_ASSERT_EQUAL(0.5f, out[i].radius);
+    }
+}
+
 /**
  * Tests error handling for @ref FastPly::Reader when file errors occur
  */
@@ -528,11 +895,27 @@ class TestFastPlyReaderFile : public TestFastPlyReader
     CPPUNIT_TEST_SUITE(TestFastPlyReaderFile);
     TEST_EXCEPTION_FILENAME(testFileNotFound, std::ios_base::failure, "not_a_real_file.ply");
     TEST_EXCEPTION_FILENAME(testFileRemoved, std::ios_base::failure, testFilename);
+    CPPUNIT_TEST(testAsciiIndexCache);
+    CPPUNIT_TEST(testLayout);
+    CPPUNIT_TEST(testLayoutAscii);
     CPPUNIT_TEST_SUITE_END();
 
+private:
+    /// Write the current content to @ref testFilename
+    void writeContent();
+
+    /**
+     * Check that a reader constructed from the layout of another reads the
+     * same splats.
+     */
+    void checkLayout(int numVertices);
+
 public:
     void testFileNotFound();           ///< PLY file does not exist
     void testFileRemoved();            ///< File removed after the header is read
+    void testAsciiIndexCache();        ///< Line index of an ASCII file is saved and reused
+    void testLayout();                 ///< Reader reconstructed from the layout of a binary file
+    void testLayoutAscii();            ///< Reader reconstructed from the layout of an ASCII file
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFastPlyReaderFile, TestSet::perBuild());
 
@@ -552,6 +935,75 @@ void TestFastPlyReaderFile::testFileRemoved()
     Reader::Handle handle(r);
 }
 
+void TestFastPlyReaderFile::testAsciiIndexCache()
+{
+    const std::string indexFilename = testFilename + ".idx";
+    setupReadAscii(10000);
+    {
+        std::ofstream out(testFilename.c_str(), std::ios::binary);
+        out << getContent();
+    }
+    boost::filesystem::remove(indexFilename);
+
+    {
+        Reader r(SYSCALL_READER, testFilename, 2.0f, 250.0f, true);
+        CPPUNIT_ASSERT(boost::filesystem::exists(indexFilename));
+    }
+    {
+        Reader r(SYSCALL_READER, testFilename, 2.0f, 250.0f, true);
+        Reader::Handle h(r);
+        std::vector<Splat> out;
+        h.read(5000, 9000, back_inserter(out));
+        verify(5000, out.begin(), out.end());
+    }
+
+    boost::filesystem::remove(testFilename);
+    boost::filesystem::remove(indexFilename);
+}
+
+void TestFastPlyReaderFile::writeContent()
+{
+    std::ofstream out(testFilename.c_str(), std::ios::binary);
+    out << getContent();
+}
+
+void TestFastPlyReaderFile::checkLayout(int numVertices)
+{
+    Reader::Layout layout;
+    {
+        Reader r(SYSCALL_READER, testFilename, 2.0f, 250.0f);
+        layout = r.getLayout();
+    }
+    CPPUNIT_ASSERT(!layout.compressed);
+    CPPUNIT_ASSERT_EQUAL(getContent().substr(0, layout.header.size()), layout.header);
+    CPPUNIT_ASSERT(layout.header.size() >= 11);
+    CPPUNIT_ASSERT_EQUAL(std::string("end_header\n"), layout.header.substr(layout.header.size() - 11));
+
+    Reader r(SYSCALL_READER, testFilename, layout, 2.0f, 250.0f);
+    MLSGPU_ASSERT_EQUAL(numVertices, r.size());
+    Reader::Handle h(r);
+    std::vector<Splat> out;
+    h.read(0, numVertices, back_inserter(out));
+    MLSGPU_ASSERT_EQUAL(numVertices, out.size());
+    verify(0, out.begin(), out.end());
+}
+
+void TestFastPlyReaderFile::testLayout()
+{
+    setupRead(100);
+    writeContent();
+    checkLayout(100);
+    boost::filesystem::remove(testFilename);
+}
+
+void TestFastPlyReaderFile::testLayoutAscii()
+{
+    setupReadAscii(100);
+    writeContent();
+    checkLayout(100);
+    boost::filesystem::remove(testFilename);
+}
+
 /**
  * Tests for @ref FastPly::Writer.
  */
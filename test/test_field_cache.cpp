@@ -0,0 +1,347 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref SparseField, @ref FieldCacheWriter and @ref FieldCacheReader.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <ios>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <boost/tr1/cmath.hpp>
+#include <boost/filesystem/operations.hpp>
+#include "testutil.h"
+#include "../src/field_cache.h"
+#include "../src/grid.h"
+#include "../src/chunk_id.h"
+
+static const std::string cacheFilename = "test_field_cache.field";
+
+class TestSparseField : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSparseField);
+    CPPUNIT_TEST(testCapture);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testAssign);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /**
+     * Sample a sphere of radius 7 centred at (10, 9, 8), with NaN in a
+     * corner to exercise undefined samples.
+     */
+    static void makeSphere(const Grid::size_type size[3], std::vector<float> &samples);
+
+    /// Capture @a samples into @a field one slice at a time
+    static void capture(const Grid::size_type size[3], const std::vector<float> &samples, SparseField &field);
+
+public:
+    void testCapture();       ///< Every active cell survives capture and expansion unchanged
+    void testEmpty();         ///< A field with no surface stores no blocks
+    void testAssign();        ///< Loading blocks directly
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSparseField, TestSet::perBuild());
+
+void TestSparseField::makeSphere(const Grid::size_type size[3], std::vector<float> &samples)
+{
+    samples.resize(size[0] * size[1] * size[2]);
+    for (Grid::size_type z = 0; z < size[2]; z++)
+        for (Grid::size_type y = 0; y < size[1]; y++)
+            for (Grid::size_type x = 0; x < size[0]; x++)
+            {
+                float dx = x - 10.0f, dy = y - 9.0f, dz = z - 8.0f;
+                float v = std::sqrt(dx * dx + dy * dy + dz * dz) - 7.0f;
+                if (x < 4 && y < 4 && z < 4)
+                    v = std::numeric_limits<float>::quiet_NaN();
+                samples[(z * size[1] + y) * size[0] + x] = v;
+            }
+}
+
+void TestSparseField::capture(
+    const Grid::size_type size[3], const std::vector<float> &samples, SparseField &field)
+{
+    field.reset(size);
+    for (Grid::size_type z = 0; z < size[2]; z++)
+    {
+        CPPUNIT_ASSERT(!field.complete());
+        field.addSlice(&samples[z * size[0] * size[1]]);
+    }
+    CPPUNIT_ASSERT(field.complete());
+}
+
+void TestSparseField::testCapture()
+{
+    const Grid::size_type size[3] = {21, 19, 17};
+    std::vector<float> samples;
+    makeSphere(size, samples);
+    SparseField field;
+    capture(size, samples, field);
+
+    // The shell of the sphere does not reach every block
+    CPPUNIT_ASSERT(field.numBlocks() > 0);
+    CPPUNIT_ASSERT(field.numBlocks() < 3 * 3 * 3);
+
+    std::vector<float> expanded(samples.size());
+    for (Grid::size_type z = 0; z < size[2]; z++)
+        field.getSlice(z, &expanded[z * size[0] * size[1]]);
+
+    // Stored samples are exact
+    for (std::size_t i = 0; i < samples.size(); i++)
+        if (!(std::tr1::isnan)(expanded[i]))
+            CPPUNIT_ASSERT_EQUAL(samples[i], expanded[i]);
+
+    // Every cell that generates geometry is fully stored
+    const Grid::size_type w = size[0], h = size[1];
+    for (Grid::size_type z = 0; z + 1 < size[2]; z++)
+        for (Grid::size_type y = 0; y + 1 < h; y++)
+            for (Grid::size_type x = 0; x + 1 < w; x++)
+            {
+                unsigned int finite = 0, outside = 0;
+                for (unsigned int i = 0; i < 8; i++)
+                {
+                    const std::size_t p = ((z + (i >> 2)) * h + y + ((i >> 1) & 1)) * w + x + (i & 1);
+                    finite += (std::tr1::isfinite)(samples[p]);
+                    outside += samples[p] >= 0.0f;
+                }
+                if (finite == 8 && outside != 0 && outside != 8)
+                {
+                    for (unsigned int i = 0; i < 8; i++)
+                    {
+                        const std::size_t p = ((z + (i >> 2)) * h + y + ((i >> 1) & 1)) * w + x + (i & 1);
+                        CPPUNIT_ASSERT_EQUAL(samples[p], expanded[p]);
+                    }
+                }
+            }
+}
+
+void TestSparseField::testEmpty()
+{
+    const Grid::size_type size[3] = {9, 9, 9};
+    std::vector<float> samples(9 * 9 * 9, 1.0f);
+    SparseField field;
+    capture(size, samples, field);
+    MLSGPU_ASSERT_EQUAL(0, field.numBlocks());
+
+    std::vector<float> slice(9 * 9);
+    field.getSlice(4, &slice[0]);
+    for (std::size_t i = 0; i < slice.size(); i++)
+        CPPUNIT_ASSERT((std::tr1::isnan)(slice[i]));
+}
+
+void TestSparseField::testAssign()
+{
+    const Grid::size_type size[3] = {10, 3, 9};
+    std::vector<SparseField::coord_type> coords(3);
+    coords[0] = 1; coords[1] = 0; coords[2] = 1;
+    std::vector<float> values(SparseField::BLOCK_SAMPLES);
+    for (std::size_t i = 0; i < values.size(); i++)
+        values[i] = i;
+
+    SparseField field;
+    field.assign(size, coords, values);
+    CPPUNIT_ASSERT(coords.empty());
+    CPPUNIT_ASSERT(values.empty());
+    CPPUNIT_ASSERT(field.complete());
+    MLSGPU_ASSERT_EQUAL(1, field.numBlocks());
+
+    // Slice 8 is the first of block layer 1, and x = 8, 9 are the first of block column 1
+    std::vector<float> slice(10 * 3);
+    field.getSlice(8, &slice[0]);
+    for (Grid::size_type y = 0; y < 3; y++)
+        for (Grid::size_type x = 0; x < 10; x++)
+        {
+            const float v = slice[y * 10 + x];
+            if (x >= 8)
+                CPPUNIT_ASSERT_EQUAL(float(y * SparseField::BLOCK_SIZE + x - 8), v);
+            else
+                CPPUNIT_ASSERT((std::tr1::isnan)(v));
+        }
+
+    // A block outside the field is rejected
+    coords.resize(3);
+    coords[0] = 2; coords[1] = 0; coords[2] = 0;
+    values.resize(SparseField::BLOCK_SAMPLES);
+    CPPUNIT_ASSERT_THROW(field.assign(size, coords, values), std::length_error);
+    // Inconsistent lengths are rejected
+    coords[0] = 0;
+    values.resize(1);
+    CPPUNIT_ASSERT_THROW(field.assign(size, coords, values), std::length_error);
+}
+
+class TestFieldCache : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestFieldCache);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testIncomplete);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Full grid used for the tests
+    static Grid makeGrid();
+
+    /// Create a field for a bin with @a size vertices, with the surface a plane at x = @a offset
+    static void makeField(const Grid::size_type size[3], float offset, SparseField &field);
+
+    /// Check that two fields store the same blocks, comparing NaN padding bitwise
+    static void checkSame(const SparseField &expected, const SparseField &actual);
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testRoundTrip();     ///< Bins survive being written and read
+    void testIncomplete();    ///< A file that was never closed is rejected
+    void testCorrupt();       ///< A file that is not a field cache is rejected
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFieldCache, TestSet::perBuild());
+
+Grid TestFieldCache::makeGrid()
+{
+    const float ref[3] = {1.0f, 2.0f, 3.0f};
+    return Grid(ref, 0.25f, -10, 30, 0, 20, 5, 25);
+}
+
+void TestFieldCache::makeField(const Grid::size_type size[3], float offset, SparseField &field)
+{
+    std::vector<float> slice(size[0] * size[1]);
+    for (Grid::size_type y = 0; y < size[1]; y++)
+        for (Grid::size_type x = 0; x < size[0]; x++)
+            slice[y * size[0] + x] = x - offset;
+    field.reset(size);
+    for (Grid::size_type z = 0; z < size[2]; z++)
+        field.addSlice(&slice[0]);
+}
+
+void TestFieldCache::checkSame(const SparseField &expected, const SparseField &actual)
+{
+    CPPUNIT_ASSERT(expected.getCoords() == actual.getCoords());
+    MLSGPU_ASSERT_EQUAL(expected.getValues().size(), actual.getValues().size());
+    if (!expected.getValues().empty())
+        CPPUNIT_ASSERT(0 == std::memcmp(&expected.getValues()[0], &actual.getValues()[0],
+                                        expected.getValues().size() * sizeof(float)));
+}
+
+void TestFieldCache::setUp()
+{
+    boost::filesystem::remove(cacheFilename);
+}
+
+void TestFieldCache::tearDown()
+{
+    boost::filesystem::remove(cacheFilename);
+}
+
+void TestFieldCache::testRoundTrip()
+{
+    const Grid::size_type size0[3] = {21, 21, 21};
+    const Grid::size_type size1[3] = {11, 21, 6};
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    const Grid bin0(ref, 1.0f, 0, 20, 0, 20, 0, 20);
+    const Grid bin1(ref, 1.0f, 20, 30, 0, 20, 15, 20);
+    ChunkId id0, id1;
+    id1.gen = 3;
+    id1.coords[0] = 1;
+    id1.coords[2] = 2;
+
+    SparseField field0, field1;
+    makeField(size0, 12.5f, field0);
+    makeField(size1, 3.5f, field1);
+    {
+        FieldCacheWriter writer(STREAM_WRITER, cacheFilename, makeGrid(), 20, true, " --fit-grid=0.25");
+        writer.write(id0, bin0, field0);
+        writer.write(id1, bin1, field1);
+        writer.close();
+    }
+
+    FieldCacheReader reader(MMAP_READER, cacheFilename);
+    CPPUNIT_ASSERT_EQUAL(std::string(" --fit-grid=0.25"), reader.getOptions());
+    MLSGPU_ASSERT_EQUAL(20, reader.getMaxCells());
+    CPPUNIT_ASSERT(reader.isSplit());
+    MLSGPU_ASSERT_EQUAL(2, reader.numBins());
+    const Grid &grid = reader.getGrid();
+    CPPUNIT_ASSERT_EQUAL(0.25f, grid.getSpacing());
+    CPPUNIT_ASSERT_EQUAL(2.0f, grid.getReference()[1]);
+    for (unsigned int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT(makeGrid().getExtent(i) == grid.getExtent(i));
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        ChunkId id;
+        Grid bin;
+        SparseField field;
+
+        CPPUNIT_ASSERT(reader.next(id, bin, field));
+        MLSGPU_ASSERT_EQUAL(id0.gen, id.gen);
+        CPPUNIT_ASSERT(id0.coords == id.coords);
+        for (unsigned int i = 0; i < 3; i++)
+            CPPUNIT_ASSERT(bin0.getExtent(i) == bin.getExtent(i));
+        checkSame(field0, field);
+
+        CPPUNIT_ASSERT(reader.next(id, bin, field));
+        MLSGPU_ASSERT_EQUAL(id1.gen, id.gen);
+        CPPUNIT_ASSERT(id1.coords == id.coords);
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            CPPUNIT_ASSERT(bin1.getExtent(i) == bin.getExtent(i));
+            MLSGPU_ASSERT_EQUAL(size1[i], field.getSize()[i]);
+        }
+        checkSame(field1, field);
+
+        CPPUNIT_ASSERT(!reader.next(id, bin, field));
+        reader.rewind();
+    }
+}
+
+void TestFieldCache::testIncomplete()
+{
+    const Grid::size_type size[3] = {9, 9, 9};
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    SparseField field;
+    makeField(size, 4.5f, field);
+    {
+        FieldCacheWriter writer(STREAM_WRITER, cacheFilename, makeGrid(), 20, false, "");
+        writer.write(ChunkId(), Grid(ref, 1.0f, 0, 8, 0, 8, 0, 8), field);
+    }
+    CPPUNIT_ASSERT(boost::filesystem::exists(cacheFilename));
+    CPPUNIT_ASSERT_THROW(FieldCacheReader(MMAP_READER, cacheFilename), std::ios::failure);
+}
+
+void TestFieldCache::testCorrupt()
+{
+    {
+        std::ofstream out(cacheFilename.c_str());
+        out << "this is not a field cache\n";
+    }
+    CPPUNIT_ASSERT_THROW(FieldCacheReader(MMAP_READER, cacheFilename), std::ios::failure);
+}
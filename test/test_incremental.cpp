@@ -0,0 +1,393 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref IncrementalState.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <limits>
+#include <boost/filesystem/operations.hpp>
+#include "testutil.h"
+#include "../src/incremental.h"
+#include "../src/chunk_id.h"
+#include "../src/tr1_cstdint.h"
+
+static const std::string stateFilename = "test_incremental.state";
+static const std::string inputFilenames[2] = { "test_incremental0.ply", "test_incremental1.ply" };
+
+class TestIncremental : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestIncremental);
+    CPPUNIT_TEST(testUnchanged);
+    CPPUNIT_TEST(testAdded);
+    CPPUNIT_TEST(testRemoved);
+    CPPUNIT_TEST(testModified);
+    CPPUNIT_TEST(testGroups);
+    CPPUNIT_TEST(testNegative);
+    CPPUNIT_TEST(testPrune);
+    CPPUNIT_TEST(testLayout);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef IncrementalState::chunk_coords chunk_coords;
+
+    /// Layout with chunks of 10 cells
+    static IncrementalState::Layout makeLayout();
+
+    /// Make a box from its corners
+    static IncrementalState::Box makeBox(int x0, int y0, int z0, int x1, int y1, int z1);
+
+    /// Make chunk coordinates
+    static chunk_coords coords(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z);
+
+    /// Make a chunk ID
+    static ChunkId chunkId(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z);
+
+    /// Write @a content to one of the input files
+    static void writeInput(int idx, const std::string &content);
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testUnchanged();     ///< No changes require no chunks
+    void testAdded();         ///< Chunks touched by an added file
+    void testNegative();      ///< Chunks below the world origin
+    void testRemoved();       ///< Chunks touched by a removed file
+    void testModified();      ///< Chunks touched by the old and new contents of a modified file
+    void testGroups();        ///< Chunks linked by components are regenerated together
+    void testPrune();         ///< Kept groups count towards the threshold and are checked against it
+    void testLayout();        ///< A changed layout requires a full rebuild
+    void testSaveLoad();      ///< State survives being saved and loaded
+    void testCorrupt();       ///< A damaged state file is ignored
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestIncremental, TestSet::perBuild());
+
+IncrementalState::Layout TestIncremental::makeLayout()
+{
+    IncrementalState::Layout layout;
+    layout.options = " --fit-grid=0.1";
+    layout.spacing = 0.1f;
+    layout.chunkCells = 10;
+    return layout;
+}
+
+IncrementalState::Box TestIncremental::makeBox(int x0, int y0, int z0, int x1, int y1, int z1)
+{
+    IncrementalState::Box box;
+    box.lower[0] = x0; box.lower[1] = y0; box.lower[2] = z0;
+    box.upper[0] = x1; box.upper[1] = y1; box.upper[2] = z1;
+    return box;
+}
+
+IncrementalState::chunk_coords TestIncremental::coords(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z)
+{
+    chunk_coords ans = {{ x, y, z }};
+    return ans;
+}
+
+ChunkId TestIncremental::chunkId(Grid::difference_type x, Grid::difference_type y, Grid::difference_type z)
+{
+    ChunkId id;
+    id.coords = coords(x, y, z);
+    return id;
+}
+
+void TestIncremental::writeInput(int idx, const std::string &content)
+{
+    std::ofstream out(inputFilenames[idx].c_str(), std::ios::binary);
+    out << content;
+}
+
+void TestIncremental::setUp()
+{
+    boost::filesystem::remove(stateFilename);
+    writeInput(0, "first");
+    writeInput(1, "second");
+}
+
+void TestIncremental::tearDown()
+{
+    boost::filesystem::remove(stateFilename);
+    boost::filesystem::remove(inputFilenames[0]);
+    boost::filesystem::remove(inputFilenames[1]);
+}
+
+void TestIncremental::testUnchanged()
+{
+    const IncrementalState::Box box = makeBox(5, 0, 0, 25, 5, 5);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &box);
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &box);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    CPPUNIT_ASSERT(chunks.empty());
+    MLSGPU_ASSERT_EQUAL(0, changedFiles);
+}
+
+void TestIncremental::testAdded()
+{
+    const IncrementalState::Box box0 = makeBox(5, 0, 0, 25, 5, 5);
+    // Vertices 6 to 14 in x, so chunks 0 and 1 in x
+    const IncrementalState::Box box1 = makeBox(6, 2, 12, 14, 5, 15);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &box0);
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &box0);
+    current.addFile(inputFilenames[1], &box1);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    MLSGPU_ASSERT_EQUAL(1, changedFiles);
+    std::set<chunk_coords> expected;
+    expected.insert(coords(0, 0, 1));
+    expected.insert(coords(1, 0, 1));
+    CPPUNIT_ASSERT(expected == chunks);
+}
+
+void TestIncremental::testNegative()
+{
+    const IncrementalState::Box box0 = makeBox(5, 0, 0, 25, 5, 5);
+    // Vertices -15 to -10 in x and -1 to 2 in z
+    const IncrementalState::Box box1 = makeBox(-15, 2, -1, -10, 5, 2);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &box0);
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &box0);
+    current.addFile(inputFilenames[1], &box1);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    MLSGPU_ASSERT_EQUAL(1, changedFiles);
+    std::set<chunk_coords> expected;
+    for (Grid::difference_type x = -2; x <= -1; x++)
+        for (Grid::difference_type z = -1; z <= 0; z++)
+            expected.insert(coords(x, 0, z));
+    CPPUNIT_ASSERT(expected == chunks);
+}
+
+void TestIncremental::testRemoved()
+{
+    const IncrementalState::Box box0 = makeBox(5, 0, 0, 25, 5, 5);
+    const IncrementalState::Box box1 = makeBox(30, 10, 0, 31, 11, 1);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &box0);
+    old.addFile(inputFilenames[1], &box1);
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &box0);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    MLSGPU_ASSERT_EQUAL(1, changedFiles);
+    // Vertex 30 in x and 10 in y are shared by neighbouring chunks
+    std::set<chunk_coords> expected;
+    for (Grid::difference_type x = 2; x <= 3; x++)
+        for (Grid::difference_type y = 0; y <= 1; y++)
+            expected.insert(coords(x, y, 0));
+    CPPUNIT_ASSERT(expected == chunks);
+}
+
+void TestIncremental::testModified()
+{
+    const IncrementalState::Box oldBox = makeBox(11, 1, 1, 12, 2, 2);
+    const IncrementalState::Box newBox = makeBox(31, 1, 1, 32, 2, 2);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &oldBox);
+
+    writeInput(0, "modified");
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &newBox);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    MLSGPU_ASSERT_EQUAL(1, changedFiles);
+    std::set<chunk_coords> expected;
+    expected.insert(coords(1, 0, 0));
+    expected.insert(coords(3, 0, 0));
+    CPPUNIT_ASSERT(expected == chunks);
+}
+
+void TestIncremental::testGroups()
+{
+    IncrementalState old(makeLayout());
+    std::vector<ChunkId> group;
+    group.push_back(chunkId(1, 0, 0));
+    group.push_back(chunkId(5, 5, 5));
+    old.addGroup(group, 10, 0, 10);
+    group.clear();
+    group.push_back(chunkId(7, 7, 7));
+    old.addGroup(group, 10, 0, 10);
+
+    const IncrementalState::Box box = makeBox(11, 1, 1, 12, 2, 2);
+    IncrementalState current(makeLayout());
+    current.addFile(inputFilenames[0], &box);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(current.changedChunks(old, chunks, changedFiles));
+    std::set<chunk_coords> expected;
+    expected.insert(coords(1, 0, 0));
+    expected.insert(coords(5, 5, 5));
+    CPPUNIT_ASSERT(expected == chunks);
+
+    // Only the untouched group is carried forward
+    current.keepGroups(old, chunks);
+    const std::vector<chunk_coords> kept = current.getChunks();
+    MLSGPU_ASSERT_EQUAL(1, kept.size());
+    CPPUNIT_ASSERT(coords(7, 7, 7) == kept[0]);
+}
+
+void TestIncremental::testPrune()
+{
+    const std::tr1::uint64_t noneKept = std::numeric_limits<std::tr1::uint64_t>::max();
+    IncrementalState old(makeLayout());
+    std::vector<ChunkId> group;
+    // Components of 4 and 10 vertices, pruned with a threshold of 5
+    group.push_back(chunkId(1, 0, 0));
+    old.addGroup(group, 14, 4, 10);
+    // A single component of 3 vertices, pruned
+    group.clear();
+    group.push_back(chunkId(2, 0, 0));
+    group.push_back(chunkId(3, 0, 0));
+    old.addGroup(group, 3, 3, noneKept);
+    // A single component of 20 vertices, kept
+    group.clear();
+    group.push_back(chunkId(4, 0, 0));
+    old.addGroup(group, 20, 0, 20);
+
+    std::set<chunk_coords> chunks;
+    chunks.insert(coords(4, 0, 0));
+    MLSGPU_ASSERT_EQUAL(17, old.keptVertices(chunks));
+    MLSGPU_ASSERT_EQUAL(37, old.keptVertices(std::set<chunk_coords>()));
+
+    // Thresholds of 5 to 10 prune the same components
+    for (std::tr1::uint64_t threshold = 5; threshold <= 10; threshold++)
+    {
+        std::set<chunk_coords> unchanged = chunks;
+        CPPUNIT_ASSERT(!old.addPruneChanges(threshold, unchanged));
+        CPPUNIT_ASSERT(chunks == unchanged);
+    }
+
+    // A threshold of 4 keeps the component of 4 vertices but not that of 3
+    std::set<chunk_coords> lower = chunks;
+    CPPUNIT_ASSERT(old.addPruneChanges(4, lower));
+    std::set<chunk_coords> expected = chunks;
+    expected.insert(coords(1, 0, 0));
+    CPPUNIT_ASSERT(expected == lower);
+
+    // A threshold of 3 also keeps the component of 3 vertices
+    lower = chunks;
+    CPPUNIT_ASSERT(old.addPruneChanges(3, lower));
+    expected.insert(coords(2, 0, 0));
+    expected.insert(coords(3, 0, 0));
+    CPPUNIT_ASSERT(expected == lower);
+
+    // A threshold of 11 prunes the component of 10, but the group of 20 is already selected
+    std::set<chunk_coords> higher = chunks;
+    CPPUNIT_ASSERT(old.addPruneChanges(11, higher));
+    expected = chunks;
+    expected.insert(coords(1, 0, 0));
+    CPPUNIT_ASSERT(expected == higher);
+}
+
+void TestIncremental::testLayout()
+{
+    const IncrementalState::Box box = makeBox(11, 1, 1, 12, 2, 2);
+    IncrementalState old(makeLayout());
+    old.addFile(inputFilenames[0], &box);
+
+    IncrementalState::Layout layout = makeLayout();
+    layout.chunkCells = 20;
+    IncrementalState current(layout);
+    current.addFile(inputFilenames[0], &box);
+
+    std::set<chunk_coords> chunks;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(!current.changedChunks(old, chunks, changedFiles));
+    CPPUNIT_ASSERT(chunks.empty());
+
+    // An unknown chunk size never matches
+    layout = makeLayout();
+    layout.chunkCells = 0;
+    IncrementalState unknown1(layout), unknown2(layout);
+    CPPUNIT_ASSERT(!unknown1.changedChunks(unknown2, chunks, changedFiles));
+}
+
+void TestIncremental::testSaveLoad()
+{
+    const IncrementalState::Box box = makeBox(11, 1, 1, 12, 2, 2);
+    IncrementalState state(makeLayout());
+    state.addFile(inputFilenames[0], &box);
+    state.addFile(inputFilenames[1], NULL);
+    std::vector<ChunkId> group;
+    group.push_back(chunkId(-1, 2, -3));
+    group.push_back(chunkId(4, 5, 6));
+    state.addGroup(group, 100, 3, 50);
+    state.save(stateFilename);
+
+    IncrementalState loaded;
+    CPPUNIT_ASSERT(loaded.load(stateFilename));
+    CPPUNIT_ASSERT(makeLayout() == loaded.getLayout());
+    const std::vector<chunk_coords> chunks = loaded.getChunks();
+    MLSGPU_ASSERT_EQUAL(2, chunks.size());
+    CPPUNIT_ASSERT(coords(-1, 2, -3) == chunks[0]);
+    CPPUNIT_ASSERT(coords(4, 5, 6) == chunks[1]);
+    MLSGPU_ASSERT_EQUAL(100, loaded.keptVertices(std::set<chunk_coords>()));
+    std::set<chunk_coords> pruneChanged;
+    CPPUNIT_ASSERT(!loaded.addPruneChanges(50, pruneChanged));
+    CPPUNIT_ASSERT(loaded.addPruneChanges(51, pruneChanged));
+
+    std::set<chunk_coords> changed;
+    std::size_t changedFiles;
+    CPPUNIT_ASSERT(state.changedChunks(loaded, changed, changedFiles));
+    MLSGPU_ASSERT_EQUAL(0, changedFiles);
+}
+
+void TestIncremental::testCorrupt()
+{
+    {
+        std::ofstream out(stateFilename.c_str());
+        out << "this is not a state file\n";
+    }
+    IncrementalState state;
+    CPPUNIT_ASSERT(!state.load(stateFilename));
+    CPPUNIT_ASSERT(!state.load("not_a_real_file.state"));
+}
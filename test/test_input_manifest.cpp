@@ -0,0 +1,161 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref InputManifest.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <fstream>
+#include <boost/filesystem/operations.hpp>
+#include "testutil.h"
+#include "../src/input_manifest.h"
+#include "../src/fast_ply.h"
+
+static const std::string manifestFilename = "test_input_manifest.manifest";
+static const std::string inputFilename = "test_input_manifest.ply";
+
+class TestInputManifest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestInputManifest);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testModified);
+    CPPUNIT_TEST(testResized);
+    CPPUNIT_TEST(testCorrupt);
+    CPPUNIT_TEST(testUnknown);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Write @a content to the input file
+    static void writeInput(const std::string &content);
+
+    /// Create a manifest file that records the input file with a known layout
+    static void makeManifest();
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testRoundTrip();      ///< An entry survives being saved and loaded
+    void testModified();       ///< An entry is ignored if the modification time changes
+    void testResized();        ///< An entry is ignored if the size changes
+    void testCorrupt();        ///< A damaged manifest is ignored
+    void testUnknown();        ///< Lookup of a file that was never recorded
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestInputManifest, TestSet::perBuild());
+
+void TestInputManifest::writeInput(const std::string &content)
+{
+    std::ofstream out(inputFilename.c_str(), std::ios::binary);
+    out << content;
+}
+
+void TestInputManifest::makeManifest()
+{
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    layout.header = "ply\nformat ascii 1.0\nend_header\n";
+    layout.compressed = true;
+    manifest.record(inputFilename, layout);
+    manifest.save();
+}
+
+void TestInputManifest::setUp()
+{
+    boost::filesystem::remove(manifestFilename);
+    writeInput("0123456789");
+}
+
+void TestInputManifest::tearDown()
+{
+    boost::filesystem::remove(manifestFilename);
+    boost::filesystem::remove(inputFilename);
+}
+
+void TestInputManifest::testRoundTrip()
+{
+    makeManifest();
+    CPPUNIT_ASSERT(boost::filesystem::exists(manifestFilename));
+
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    CPPUNIT_ASSERT(manifest.lookup(inputFilename, layout));
+    CPPUNIT_ASSERT_EQUAL(std::string("ply\nformat ascii 1.0\nend_header\n"), layout.header);
+    CPPUNIT_ASSERT(layout.compressed);
+    MLSGPU_ASSERT_EQUAL(1, manifest.numHits());
+}
+
+void TestInputManifest::testModified()
+{
+    makeManifest();
+    const std::time_t mtime = boost::filesystem::last_write_time(inputFilename);
+    boost::filesystem::last_write_time(inputFilename, mtime + 10);
+
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    CPPUNIT_ASSERT(!manifest.lookup(inputFilename, layout));
+    MLSGPU_ASSERT_EQUAL(0, manifest.numHits());
+}
+
+void TestInputManifest::testResized()
+{
+    makeManifest();
+    const std::time_t mtime = boost::filesystem::last_write_time(inputFilename);
+    writeInput("01234567890");
+    boost::filesystem::last_write_time(inputFilename, mtime);
+
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    CPPUNIT_ASSERT(!manifest.lookup(inputFilename, layout));
+}
+
+void TestInputManifest::testCorrupt()
+{
+    {
+        std::ofstream out(manifestFilename.c_str());
+        out << "this is not a manifest\n";
+    }
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    CPPUNIT_ASSERT(!manifest.lookup(inputFilename, layout));
+
+    // It must be possible to replace the damaged manifest
+    manifest.record(inputFilename, layout);
+    manifest.save();
+    InputManifest manifest2(manifestFilename);
+    CPPUNIT_ASSERT(manifest2.lookup(inputFilename, layout));
+}
+
+void TestInputManifest::testUnknown()
+{
+    makeManifest();
+    InputManifest manifest(manifestFilename);
+    FastPly::Reader::Layout layout;
+    CPPUNIT_ASSERT(!manifest.lookup("not_a_real_file.ply", layout));
+    CPPUNIT_ASSERT(!manifest.lookup(manifestFilename, layout));
+}
@@ -35,13 +35,16 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <cstddef>
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <string>
 #include <cmath>
+#include <stdexcept>
 #include <fstream>
 #include <boost/array.hpp>
 #include <boost/ref.hpp>
+#include <boost/tr1/cmath.hpp>
 #include <CL/cl.hpp>
 #include "testutil.h"
 #include "test_clh.h"
@@ -189,6 +192,8 @@ class TestMarching : public CLH::Test::TestFixture
     CPPUNIT_TEST(testSphere);
     CPPUNIT_TEST(testTruncatedSphere);
     CPPUNIT_TEST(testAlternating);
+    CPPUNIT_TEST(testSwatheDepth);
+    CPPUNIT_TEST(testDegenerate);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -202,10 +207,14 @@ private:
 
     /// Build a vertex key
     static cl_ulong makeKey(cl_uint x, cl_uint y, cl_uint z, bool external);
-    /// Wrapper that calls @ref computeKey and returns result
+    /**
+     * Wrapper that calls @ref computeKey and returns result. If @a slotBase and
+     * @a slotTop are @c NULL, the vertex is not in a slot.
+     */
     cl_ulong callComputeKey(cl::Kernel &kernel,
                             cl_uint cx, cl_uint cy, cl_uint cz,
-                            cl_uint tx, cl_uint ty, cl_uint tz);
+                            cl_uint tx, cl_uint ty, cl_uint tz,
+                            const cl_uint *slotBase = NULL, const cl_uint *slotTop = NULL);
 
     /**
      * Wrapper that calls @ref compactVertices and returns the results in host memory.
@@ -245,6 +254,8 @@ private:
     void testSphere();          ///< Builds a sphere
     void testTruncatedSphere(); ///< Builds a sphere that is truncated by the bounding box
     void testAlternating();     ///< Build a structure with lots of geometry
+    void testSwatheDepth();     ///< Test @ref Marching::swatheDepth, including degenerate and maximum slice sizes
+    void testDegenerate();      ///< Generate bins that are one vertex wide or high
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMarching, TestSet::perCommit());
 
@@ -315,16 +326,25 @@ cl_ulong TestMarching::makeKey(cl_uint x, cl_uint y, cl_uint z, bool external)
 cl_ulong TestMarching::callComputeKey(
     cl::Kernel &kernel,
     cl_uint cx, cl_uint cy, cl_uint cz,
-    cl_uint tx, cl_uint ty, cl_uint tz)
+    cl_uint tx, cl_uint ty, cl_uint tz,
+    const cl_uint *slotBase, const cl_uint *slotTop)
 {
     cl_ulong ans = 0;
     cl_uint3 coords = {{ cx, cy, cz }};
     cl_uint3 top = {{ tx, ty, tz }};
+    cl_uint3 base = {{ CL_UINT_MAX, CL_UINT_MAX, CL_UINT_MAX }};
+    cl_uint3 slotTop3 = base;
+    if (slotBase != NULL)
+        std::copy(slotBase, slotBase + 3, base.s);
+    if (slotTop != NULL)
+        std::copy(slotTop, slotTop + 3, slotTop3.s);
     cl::Buffer out(context, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_ulong), &ans);
 
     kernel.setArg(0, out);
     kernel.setArg(1, coords);
     kernel.setArg(2, top);
+    kernel.setArg(3, base);
+    kernel.setArg(4, slotTop3);
     queue.enqueueTask(kernel);
     queue.enqueueReadBuffer(out, CL_TRUE, 0, sizeof(cl_ulong), &ans);
     return ans;
@@ -348,6 +368,16 @@ void TestMarching::testComputeKey()
     CPPUNIT_ASSERT_EQUAL(makeKey(1, 2, 40, false),  callComputeKey(kernel, 1, 2, 40, 30, 40, 50));
     CPPUNIT_ASSERT_EQUAL(makeKey(1, 2, 30, false),  callComputeKey(kernel, 1, 2, 30, 30, 40, 50));
     CPPUNIT_ASSERT_EQUAL(makeKey(30, 40, 50, true), callComputeKey(kernel, 30, 40, 50, 30, 40, 50));
+
+    // Faces of the region in a slot
+    const cl_uint slotBase[3] = {32, 64, 0};
+    const cl_uint slotTop[3] = {42, 84, 20};
+    CPPUNIT_ASSERT_EQUAL(makeKey(33, 65, 1, false),  callComputeKey(kernel, 33, 65, 1, 128, 128, 128, slotBase, slotTop));
+    CPPUNIT_ASSERT_EQUAL(makeKey(32, 65, 1, true),   callComputeKey(kernel, 32, 65, 1, 128, 128, 128, slotBase, slotTop));
+    CPPUNIT_ASSERT_EQUAL(makeKey(33, 64, 1, true),   callComputeKey(kernel, 33, 64, 1, 128, 128, 128, slotBase, slotTop));
+    CPPUNIT_ASSERT_EQUAL(makeKey(42, 65, 1, true),   callComputeKey(kernel, 42, 65, 1, 128, 128, 128, slotBase, slotTop));
+    CPPUNIT_ASSERT_EQUAL(makeKey(33, 84, 1, true),   callComputeKey(kernel, 33, 84, 1, 128, 128, 128, slotBase, slotTop));
+    CPPUNIT_ASSERT_EQUAL(makeKey(33, 65, 20, true),  callComputeKey(kernel, 33, 65, 20, 128, 128, 128, slotBase, slotTop));
 }
 
 void TestMarching::callCompactVertices(
@@ -380,6 +410,7 @@ void TestMarching::callCompactVertices(
     kernel.setArg(6, dInKeys);
     kernel.setArg(7, minExternalKey);
     kernel.setArg(8, cl_ulong(0));
+    kernel.setArg(9, cl_uint(0));
     CLH::enqueueNDRangeKernel(queue,
                               kernel,
                               cl::NullRange,
@@ -630,3 +661,72 @@ void TestMarching::testAlternating()
     testGenerate(width, height, depth, width, height, depth,
                  generator, "alternating.ply");
 }
+
+void TestMarching::testSwatheDepth()
+{
+    const Grid::size_type maxWidth = 64;
+    const Grid::size_type maxHeight = 64;
+    const Grid::size_type maxDepth = 64;
+
+    AlternatingGenerator generator(context, maxWidth, maxHeight, maxDepth);
+    const Grid::size_type zAlign = generator.alignment()[2];
+    Marching marching(context, device, maxWidth, maxHeight, maxDepth, maxDepth,
+                      (maxWidth - 1) * (maxHeight - 1) * Marching::MAX_CELL_BYTES,
+                      generator.alignment());
+    const Grid::size_type maxSwathe = marching.maxSwathe;
+    MLSGPU_ASSERT_EQUAL(maxDepth / zAlign * zAlign, maxSwathe);
+
+    // Nothing seen yet, so anything fits
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(maxWidth, maxHeight));
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(1, 1));
+
+    // Dense geometry: the largest slices get the minimum depth
+    marching.sliceDensity[0] = 1e6;
+    marching.sliceDensity[1] = 1e6;
+    MLSGPU_ASSERT_EQUAL(zAlign, marching.swatheDepth(maxWidth, maxHeight));
+    // Slices one vertex wide or high have no cells
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(1, maxHeight));
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(maxWidth, 1));
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(1, 1));
+
+    // Enough space for 30.5 full-sized slices of vertices, rounded down to the alignment
+    const double sliceCells = double(maxWidth - 1) * (maxHeight - 1);
+    marching.sliceDensity[0] = marching.vertexSpace / (30.5 * sliceCells);
+    marching.sliceDensity[1] = 0.0;
+    MLSGPU_ASSERT_EQUAL(30 / zAlign * zAlign, marching.swatheDepth(maxWidth, maxHeight));
+    // Half-height slices fit twice as many
+    MLSGPU_ASSERT_EQUAL(maxSwathe, marching.swatheDepth(maxWidth, (maxHeight - 1) / 2 + 1));
+}
+
+void TestMarching::testDegenerate()
+{
+    Timeplot::Worker tworker("test");
+    const Grid::size_type maxWidth = 16;
+    const Grid::size_type maxHeight = 16;
+    const Grid::size_type maxDepth = 16;
+    const Grid::size_type sizes[3][3] =
+    {
+        { 1, maxHeight, maxDepth },
+        { maxWidth, 1, maxDepth },
+        { 1, 1, maxDepth }
+    };
+
+    AlternatingGenerator generator(context, maxWidth, maxHeight, maxDepth);
+    Marching marching(context, device, maxWidth, maxHeight, maxDepth,
+                      generator.alignment()[2],
+                      (maxWidth - 1) * (maxHeight - 1) * Marching::MAX_CELL_BYTES,
+                      generator.alignment());
+    cl_uint3 keyOffset = {{ 0, 0, 0 }};
+    for (int i = 0; i < 3; i++)
+    {
+        MemoryWriterPly writer;
+        OOCMesher mesher(writer, TrivialNamer("degenerate.ply"));
+        marching.generate(queue, generator, deviceMesher(mesher.functor(0), ChunkId(), tworker),
+                          sizes[i], keyOffset, NULL);
+        mesher.write(tworker);
+        // No cells, so no triangles and no file
+        CPPUNIT_ASSERT_THROW(writer.getOutput("degenerate.ply"), std::invalid_argument);
+        for (int j = 0; j < 2; j++)
+            CPPUNIT_ASSERT((std::tr1::isfinite)(marching.sliceDensity[j]));
+    }
+}
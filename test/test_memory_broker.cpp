@@ -0,0 +1,199 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref MemoryBroker.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "testutil.h"
+#include "../src/memory_broker.h"
+#include "../src/circular_buffer.h"
+#include "../src/timeplot.h"
+#include "../src/statistics.h"
+
+class TestMemoryBroker : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestMemoryBroker);
+    CPPUNIT_TEST(testLendSpare);
+    CPPUNIT_TEST(testMove);
+    CPPUNIT_TEST(testIdle);
+    CPPUNIT_TEST(testMinimum);
+    CPPUNIT_TEST(testCooldown);
+    CPPUNIT_TEST(testDeferredShrink);
+    CPPUNIT_TEST(testStartStop);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::scoped_ptr<CircularBufferBase> buffers[2];
+    boost::scoped_ptr<Statistics::Variable> waits[2];
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testLendSpare();     ///< Unlent budget is given to a waiting buffer first
+    void testMove();          ///< Memory moves from an idle buffer to a waiting one
+    void testIdle();          ///< Nothing moves if no buffer waits for long
+    void testMinimum();       ///< A buffer is not shrunk below its minimum
+    void testCooldown();      ///< A resized buffer is left alone for a while
+    void testDeferredShrink(); ///< A buffer only grows once the lender has shrunk
+    void testStartStop();     ///< The background thread can be started and stopped
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMemoryBroker, TestSet::perBuild());
+
+void TestMemoryBroker::setUp()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].reset(new CircularBufferBase("mem.TestMemoryBroker", 800, 1600));
+        waits[i].reset(new Statistics::Variable("TestMemoryBroker.wait"));
+    }
+}
+
+void TestMemoryBroker::tearDown()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].reset();
+        waits[i].reset();
+    }
+}
+
+void TestMemoryBroker::testLendSpare()
+{
+    MemoryBroker broker(1600 + 64);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    waits[0]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(864, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+}
+
+void TestMemoryBroker::testMove()
+{
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    waits[1]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(700, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(900, buffers[1]->size());
+}
+
+void TestMemoryBroker::testIdle()
+{
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    // Both below the threshold for borrowing
+    waits[0]->add(0.02);
+    waits[1]->add(0.001);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(800, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+
+    // Both waiting, so neither can lend
+    waits[0]->add(0.5);
+    waits[1]->add(0.2);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(800, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+}
+
+void TestMemoryBroker::testMinimum()
+{
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 750, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    waits[1]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(750, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(850, buffers[1]->size());
+}
+
+void TestMemoryBroker::testCooldown()
+{
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    waits[1]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(900, buffers[1]->size());
+
+    // The roles reverse immediately, but both buffers are cooling down
+    for (unsigned int i = 1; i < MemoryBroker::COOLDOWN; i++)
+    {
+        waits[0]->add(0.5);
+        broker.rebalance(1.0);
+        MLSGPU_ASSERT_EQUAL(700, buffers[0]->size());
+    }
+
+    waits[0]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(800, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+}
+
+void TestMemoryBroker::testDeferredShrink()
+{
+    Timeplot::Worker worker("test");
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.add("b", *buffers[1], 1, 100, *waits[1]);
+
+    // The live allocation keeps a from shrinking, so b cannot grow yet
+    CircularBufferBase::Allocation alloc = buffers[0]->allocate(worker, 750);
+    waits[1]->add(0.5);
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(800, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+
+    buffers[0]->free(alloc);
+    MLSGPU_ASSERT_EQUAL(700, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(800, buffers[1]->size());
+    broker.rebalance(1.0);
+    MLSGPU_ASSERT_EQUAL(700, buffers[0]->size());
+    MLSGPU_ASSERT_EQUAL(900, buffers[1]->size());
+}
+
+void TestMemoryBroker::testStartStop()
+{
+    MemoryBroker broker(1600);
+    broker.add("a", *buffers[0], 1, 100, *waits[0]);
+    broker.start(0.001);
+    broker.stop();
+    broker.start(0.001);
+    // The destructor stops it
+}
@@ -359,3 +359,110 @@ void TestScaleBiasFilter::testEmpty()
     MLSGPU_ASSERT_EQUAL(0, outMesh.numInternalVertices());
     MLSGPU_ASSERT_EQUAL(0, outMesh.numTriangles());
 }
+
+class TestMeshSlotRouter : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestMeshSlotRouter);
+    CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Key for a vertex at @a x, @a y, @a z in .1 fixed-point format
+    static cl_ulong makeKey(cl_ulong x, cl_ulong y, cl_ulong z);
+
+    void testSimple();        ///< Splits a mesh between two slots
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMeshSlotRouter, TestSet::perCommit());
+
+cl_ulong TestMeshSlotRouter::makeKey(cl_ulong x, cl_ulong y, cl_ulong z)
+{
+    return x | (y << Marching::KEY_AXIS_BITS) | (z << (2 * Marching::KEY_AXIS_BITS));
+}
+
+void TestMeshSlotRouter::testSimple()
+{
+    const unsigned int N = 6;
+    const unsigned int T = 3;
+    /* Vertices 0, 1 and 3 are in the slot at the origin, and the others in
+     * the slot at (16, 0, 0). The first three are internal.
+     */
+    const cl_float inVertices[N][3] =
+    {
+        { 1.0f, 2.0f, 3.0f },
+        { 2.5f, 2.0f, 3.0f },
+        { 17.0f, 1.0f, 1.0f },
+        { 0.0f, 4.0f, 3.0f },
+        { 20.0f, 0.5f, 1.0f },
+        { 18.0f, 3.0f, 0.0f }
+    };
+    const cl_uint inTriangles[T][3] =
+    {
+        { 0, 1, 3 },
+        { 2, 4, 5 },
+        { 5, 4, 2 }
+    };
+    const cl_ulong inVertexKeys[N] =
+    {
+        makeKey(2, 4, 6),
+        makeKey(5, 4, 6),
+        makeKey(34, 2, 2),
+        makeKey(0, 8, 6),
+        makeKey(40, 1, 2),
+        makeKey(36, 6, 0)
+    };
+
+    DeviceKeyMesh inMesh;
+    inMesh.assign(N, T, 3);
+    inMesh.vertices = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * 3 * sizeof(cl_float),
+                                 const_cast<cl_float *>(&inVertices[0][0]));
+    inMesh.triangles = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, T * 3 * sizeof(cl_uint),
+                                  const_cast<cl_uint *>(&inTriangles[0][0]));
+    inMesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(cl_ulong),
+                                   const_cast<cl_ulong *>(&inVertexKeys[0]));
+
+    const MeshSizes maxSizes(N, T, 0);
+    boost::scoped_array<char> buffers[2];
+    HostKeyMesh results[2];
+    for (int i = 0; i < 2; i++)
+    {
+        buffers[i].reset(new char[maxSizes.getHostBytes()]);
+        results[i] = HostKeyMesh(buffers[i].get(), maxSizes);
+    }
+
+    const Grid::size_type origins[2][3] = { { 0, 0, 0 }, { 16, 0, 0 } };
+    const cl_uint3 keyOffsets[2] = { {{ 100, 200, 300 }}, {{ 5, 6, 7 }} };
+    MeshSlotRouter router;
+    router.reset(4);
+    for (int i = 0; i < 2; i++)
+        router.addSlot(origins[i], keyOffsets[i], CollectOutput(&results[i]));
+
+    cl::Event done;
+    router(queue, inMesh, NULL, &done);
+    queue.flush();
+    done.wait();
+
+    MLSGPU_ASSERT_EQUAL(3, results[0].numVertices());
+    MLSGPU_ASSERT_EQUAL(2, results[0].numInternalVertices());
+    MLSGPU_ASSERT_EQUAL(1, results[0].numTriangles());
+    const unsigned int vertices0[3] = { 0, 1, 3 };
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+        {
+            MLSGPU_ASSERT_EQUAL(inVertices[vertices0[i]][j], results[0].vertices[i][j]);
+            MLSGPU_ASSERT_EQUAL(cl_uint(j), results[0].triangles[0][j]);
+        }
+    MLSGPU_ASSERT_EQUAL(makeKey(200, 408, 606), results[0].vertexKeys[0]);
+
+    MLSGPU_ASSERT_EQUAL(3, results[1].numVertices());
+    MLSGPU_ASSERT_EQUAL(1, results[1].numInternalVertices());
+    MLSGPU_ASSERT_EQUAL(2, results[1].numTriangles());
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+        {
+            MLSGPU_ASSERT_EQUAL(inVertices[i == 0 ? 2 : i + 3][j], results[1].vertices[i][j]);
+            MLSGPU_ASSERT_EQUAL(cl_uint(j), results[1].triangles[0][j]);
+            MLSGPU_ASSERT_EQUAL(cl_uint(2 - j), results[1].triangles[1][j]);
+        }
+    MLSGPU_ASSERT_EQUAL(makeKey(18, 13, 16), results[1].vertexKeys[0]);
+    MLSGPU_ASSERT_EQUAL(makeKey(14, 18, 14), results[1].vertexKeys[1]);
+}
@@ -35,9 +35,11 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <string>
+#include <sstream>
 #include <vector>
 #include <utility>
 #include <stdexcept>
+#include <limits>
 #include <cstring>
 #include "../src/tr1_cstdint.h"
 #include <boost/tr1/random.hpp>
@@ -91,10 +93,12 @@ class TestChunkNamer : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestChunkNamer);
     CPPUNIT_TEST(testSimple);
     CPPUNIT_TEST(testBig);
+    CPPUNIT_TEST(testNegative);
     CPPUNIT_TEST_SUITE_END();
 public:
     void testSimple();   ///< Test normal usage
     void testBig();      ///< Test with values that overflow field width
+    void testNegative(); ///< Test with chunks below the world origin
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestChunkNamer, TestSet::perBuild());
 
@@ -120,6 +124,17 @@ void TestChunkNamer::testBig()
     CPPUNIT_ASSERT_EQUAL(string("foo_0100_123456_2345678.ply"), namer(chunkId));
 }
 
+void TestChunkNamer::testNegative()
+{
+    ChunkId chunkId;
+    chunkId.gen = 123;
+    chunkId.coords[0] = -3;
+    chunkId.coords[1] = 7;
+    chunkId.coords[2] = -12345;
+    ChunkNamer namer("foo");
+    CPPUNIT_ASSERT_EQUAL(string("foo_-003_0007_-12345.ply"), namer(chunkId));
+}
+
 /**
  * Tests that are shared across all the @ref MesherBase subclasses.
  */
@@ -1217,9 +1232,33 @@ class TestMesherBaseSlow : public TestMesherBase
 class TestOOCMesher : public TestMesherBase
 {
     CPPUNIT_TEST_SUB_SUITE(TestOOCMesher, TestMesherBase);
+    CPPUNIT_TEST(testCheckpointPartial);
+    CPPUNIT_TEST(testCellMask);
+    CPPUNIT_TEST(testRetire);
+    CPPUNIT_TEST(testChunkGroups);
+    CPPUNIT_TEST(testPruneBase);
     CPPUNIT_TEST_SUITE_END();
+private:
+    /// Add blocks [@a first, @a last) of the data used by @ref testWeld
+    void addWeld(const MesherBase::InputFunctor &functor, int first, int last);
+
+    /**
+     * Add a single triangle with external vertices, tagged as coming from the
+     * bin [@a lower, @a upper), followed by the completion marker for the bin.
+     */
+    void addRegion(
+        const MesherBase::InputFunctor &functor,
+        const cl_ulong *keys,
+        const boost::array<Grid::size_type, 3> &lower,
+        const boost::array<Grid::size_type, 3> &upper);
 protected:
     virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+public:
+    void testCheckpointPartial(); ///< Tests continuing from a checkpoint taken part-way through
+    void testCellMask();          ///< Tests @ref OOCMesher::cellMask and @ref OOCMesher::cellMaskAll
+    void testRetire();            ///< Tests that external vertices are dropped once all bins around them complete
+    void testChunkGroups();       ///< Tests @ref OOCMesher::getChunkGroups
+    void testPruneBase();         ///< Tests @ref OOCMesher::setPruneBaseVertices against a full run
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestOOCMesher, TestSet::perBuild());
 
@@ -1382,3 +1421,293 @@ MesherBase *TestOOCMesher::mesherFactory(FastPly::Writer &writer, const MesherBa
 {
     return new OOCMesher(writer, namer);
 }
+
+void TestOOCMesher::addWeld(const MesherBase::InputFunctor &functor, int first, int last)
+{
+    for (int i = first; i < last; i++)
+    {
+        switch (i)
+        {
+        case 0:
+            add(ChunkId(), functor,
+                boost::size(internalVertices0), 0, boost::size(indices0),
+                internalVertices0, NULL, NULL, indices0);
+            break;
+        case 1:
+            add(ChunkId(), functor,
+                0, boost::size(externalVertices1), boost::size(indices1),
+                NULL, externalVertices1, externalKeys1, indices1);
+            break;
+        case 2:
+            add(ChunkId(), functor,
+                boost::size(internalVertices2),
+                boost::size(externalVertices2),
+                boost::size(indices2),
+                internalVertices2, externalVertices2, externalKeys2, indices2);
+            break;
+        case 3:
+            add(ChunkId(), functor,
+                boost::size(internalVertices3),
+                boost::size(externalVertices3),
+                boost::size(indices3),
+                internalVertices3, externalVertices3, externalKeys3, indices3);
+            break;
+        }
+    }
+}
+
+void TestOOCMesher::testCheckpointPartial()
+{
+    Timeplot::Worker tworker("test");
+
+    MemoryWriterPly expectedWriter;
+    {
+        OOCMesher mesher(expectedWriter, TrivialNamer(""));
+        addWeld(mesher.functor(0), 0, 4);
+        mesher.write(tworker);
+    }
+
+    MemoryWriterPly writer;
+    std::stringstream state;
+    boost::filesystem::path verticesPath, trianglesPath;
+    {
+        OOCMesher mesher(writer, TrivialNamer(""));
+        const MesherBase::InputFunctor functor = mesher.functor(0);
+        addWeld(functor, 0, 2);
+        {
+            boost::archive::text_oarchive archive(state);
+            mesher.checkpointPartial(tworker, archive);
+        }
+        // Geometry added after the checkpoint must be discarded on resume
+        addWeld(functor, 2, 3);
+        {
+            std::ostringstream dummy;
+            boost::archive::text_oarchive archive(dummy);
+            mesher.checkpointPartial(tworker, archive);
+        }
+    }
+    {
+        OOCMesher mesher(writer, TrivialNamer(""));
+        {
+            boost::archive::text_iarchive archive(state);
+            mesher.restorePartial(archive);
+        }
+        addWeld(mesher.functor(0), 2, 4);
+        mesher.write(tworker);
+        verticesPath = mesher.tmpWriter.getVerticesPath();
+        trianglesPath = mesher.tmpWriter.getTrianglesPath();
+    }
+    boost::filesystem::remove(verticesPath);
+    boost::filesystem::remove(trianglesPath);
+
+    CPPUNIT_ASSERT_EQUAL(expectedWriter.getOutput(""), writer.getOutput(""));
+}
+
+/// Builds a vertex key from .1 fixed-point coordinates
+static cl_ulong makeKey(cl_ulong x, cl_ulong y, cl_ulong z)
+{
+    return x | (y << Marching::KEY_AXIS_BITS) | (z << (2 * Marching::KEY_AXIS_BITS));
+}
+
+void TestOOCMesher::addRegion(
+    const MesherBase::InputFunctor &functor,
+    const cl_ulong *keys,
+    const boost::array<Grid::size_type, 3> &lower,
+    const boost::array<Grid::size_type, 3> &upper)
+{
+    Timeplot::Worker tworker("test");
+
+    MeshSizes sizes(3, 1, 0);
+    boost::scoped_array<char> buffer(new char[sizes.getHostBytes()]);
+    MesherWork work;
+    work.mesh = HostKeyMesh(buffer.get(), sizes);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        work.mesh.vertices[i][0] = i;
+        work.mesh.vertices[i][1] = 0.0f;
+        work.mesh.vertices[i][2] = 0.0f;
+        work.mesh.vertexKeys[i] = keys[i];
+        work.mesh.triangles[0][i] = i;
+    }
+    work.regionLower = lower;
+    work.regionUpper = upper;
+    functor(work, tworker);
+
+    MesherWork done;
+    done.mesh = HostKeyMesh(buffer.get(), MeshSizes());
+    done.regionLower = lower;
+    done.regionUpper = upper;
+    done.regionDone = true;
+    functor(done, tworker);
+}
+
+void TestOOCMesher::testCellMask()
+{
+    boost::array<Grid::size_type, 3> lower = {{ 1, 2, 3 }};
+    boost::array<Grid::size_type, 3> upper = {{ 2, 4, 6 }};
+
+    // Inside a single cell on all axes
+    CPPUNIT_ASSERT_EQUAL(0x01, int(OOCMesher::cellMask(makeKey(3, 5, 7), lower, upper)));
+    CPPUNIT_ASSERT_EQUAL(0x00, int(OOCMesher::cellMask(makeKey(5, 5, 7), lower, upper)));
+    CPPUNIT_ASSERT_EQUAL(0x01, int(OOCMesher::cellMaskAll(makeKey(3, 5, 7))));
+
+    // On the lower x face of the box: only the upper cell on x is inside
+    CPPUNIT_ASSERT_EQUAL(0x02, int(OOCMesher::cellMask(makeKey(2, 5, 7), lower, upper)));
+    // On the upper x face: only the lower cell
+    CPPUNIT_ASSERT_EQUAL(0x01, int(OOCMesher::cellMask(makeKey(4, 5, 7), lower, upper)));
+    CPPUNIT_ASSERT_EQUAL(0x03, int(OOCMesher::cellMaskAll(makeKey(4, 5, 7))));
+
+    // Interior of the box on y, lower face on z
+    CPPUNIT_ASSERT_EQUAL(0x50, int(OOCMesher::cellMask(makeKey(3, 6, 6), lower, upper)));
+    CPPUNIT_ASSERT_EQUAL(0x55, int(OOCMesher::cellMaskAll(makeKey(3, 6, 6))));
+    CPPUNIT_ASSERT_EQUAL(0xFF, int(OOCMesher::cellMaskAll(makeKey(2, 6, 6))));
+
+    // Grid origin has no lower neighbour
+    boost::array<Grid::size_type, 3> zero = {{ 0, 0, 0 }};
+    boost::array<Grid::size_type, 3> one = {{ 1, 1, 1 }};
+    CPPUNIT_ASSERT_EQUAL(0x80, int(OOCMesher::cellMask(makeKey(0, 0, 0), zero, one)));
+}
+
+void TestOOCMesher::testRetire()
+{
+    MemoryWriterPly writer;
+    OOCMesher mesher(writer, TrivialNamer(""));
+    const MesherBase::InputFunctor functor = mesher.functor(0);
+
+    // Vertices on the plane x = 1, shared by cells 0 and 1 on x
+    const cl_ulong keys[3] =
+    {
+        makeKey(2, 1, 1),
+        makeKey(2, 3, 1),
+        makeKey(2, 1, 3)
+    };
+    boost::array<Grid::size_type, 3> lowerA = {{ 0, 0, 0 }};
+    boost::array<Grid::size_type, 3> upperA = {{ 1, 2, 2 }};
+    boost::array<Grid::size_type, 3> lowerB = {{ 1, 0, 0 }};
+    boost::array<Grid::size_type, 3> upperB = {{ 2, 2, 2 }};
+
+    addRegion(functor, keys, lowerA, upperA);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), mesher.clumpIdMap.size());
+    CPPUNIT_ASSERT(mesher.regionKeys.empty());
+
+    addRegion(functor, keys, lowerB, upperB);
+    CPPUNIT_ASSERT(mesher.clumpIdMap.empty());
+    CPPUNIT_ASSERT(mesher.regionKeys.empty());
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(3), mesher.externalVertices);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(3), mesher.externalVerticesPeak);
+}
+
+void TestOOCMesher::testChunkGroups()
+{
+    MemoryWriterPly writer;
+    OOCMesher mesher(writer, ChunkNamer("chunk"));
+    const MesherBase::InputFunctor functor = mesher.functor(0);
+
+    /* The blocks from testWeld are placed in separate chunks. Block 3 shares
+     * vertices with blocks 1 and 2, while block 0 is isolated. Generation 2 is
+     * skipped, to leave an empty chunk.
+     */
+    ChunkId chunkId[4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        chunkId[i].gen = i < 2 ? i : i + 1;
+        chunkId[i].coords[0] = i;
+    }
+    add(chunkId[0], functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(chunkId[1], functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(chunkId[2], functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
+    add(chunkId[3], functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
+
+    mesher.setPruneThreshold(0.4);
+    const std::vector<OOCMesher::ChunkGroup> groups = mesher.getChunkGroups();
+    MLSGPU_ASSERT_EQUAL(2, groups.size());
+    MLSGPU_ASSERT_EQUAL(1, groups[0].chunks.size());
+    MLSGPU_ASSERT_EQUAL(0, groups[0].chunks[0].coords[0]);
+    MLSGPU_ASSERT_EQUAL(3, groups[1].chunks.size());
+    for (unsigned int i = 0; i < 3; i++)
+        MLSGPU_ASSERT_EQUAL(i + 1, groups[1].chunks[i].coords[0]);
+
+    // 16 vertices in total, so the threshold is 6
+    MLSGPU_ASSERT_EQUAL(6, mesher.getThresholdVertices());
+    MLSGPU_ASSERT_EQUAL(5, groups[0].vertices);
+    MLSGPU_ASSERT_EQUAL(5, groups[0].largestPruned);
+    MLSGPU_ASSERT_EQUAL(std::numeric_limits<std::tr1::uint64_t>::max(), groups[0].smallestKept);
+    MLSGPU_ASSERT_EQUAL(11, groups[1].vertices);
+    MLSGPU_ASSERT_EQUAL(0, groups[1].largestPruned);
+    MLSGPU_ASSERT_EQUAL(11, groups[1].smallestKept);
+}
+
+void TestOOCMesher::testPruneBase()
+{
+    Timeplot::Worker tworker("test");
+    const std::string name = "chunk_0000_0000_0000.ply";
+
+    ChunkId chunkId[4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        chunkId[i].gen = i;
+        chunkId[i].coords[0] = i;
+    }
+
+    // Full run: chunk 0 holds 5 of the 16 vertices, and is pruned
+    MemoryWriterPly fullWriter;
+    OOCMesher full(fullWriter, ChunkNamer("chunk"));
+    full.setPruneThreshold(0.4);
+    const MesherBase::InputFunctor functor = full.functor(0);
+    add(chunkId[0], functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(chunkId[1], functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(chunkId[2], functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
+    add(chunkId[3], functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
+    full.write(tworker);
+    CPPUNIT_ASSERT_THROW(fullWriter.getOutput(name), std::invalid_argument);
+
+    /* Incremental run that only regenerates chunk 0. Without accounting for
+     * the 11 vertices left in place, the threshold would drop to 2 and the
+     * component would be kept.
+     */
+    MemoryWriterPly partialWriter;
+    OOCMesher partial(partialWriter, ChunkNamer("chunk"));
+    partial.setPruneThreshold(0.4);
+    partial.setPruneBaseVertices(11);
+    add(chunkId[0], partial.functor(0),
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    MLSGPU_ASSERT_EQUAL(full.getThresholdVertices(), partial.getThresholdVertices());
+    partial.write(tworker);
+    CPPUNIT_ASSERT_THROW(partialWriter.getOutput(name), std::invalid_argument);
+
+    MemoryWriterPly unbasedWriter;
+    OOCMesher unbased(unbasedWriter, ChunkNamer("chunk"));
+    unbased.setPruneThreshold(0.4);
+    add(chunkId[0], unbased.functor(0),
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    unbased.write(tworker);
+    checkIsomorphic(boost::size(internalVertices0),
+                    boost::size(indices0),
+                    internalVertices0, indices0, unbasedWriter.getOutput(name));
+}
@@ -37,6 +37,7 @@
 #include <vector>
 #include <cstddef>
 #include <limits>
+#include <algorithm>
 #include <boost/tr1/random.hpp>
 #include <boost/math/constants/constants.hpp>
 #include <boost/foreach.hpp>
@@ -65,6 +66,7 @@ class TestMls : public CLH::Test::TestFixture
     CPPUNIT_TEST(testFitSphere);
     CPPUNIT_TEST(testProjectDistOriginSphere);
     CPPUNIT_TEST(testProcessCorners);
+    CPPUNIT_TEST(testProcessCornersTreeOffset);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -113,6 +115,15 @@ private:
      */
     std::vector<float> callFitSphere(const std::vector<Splat> &splats);
 
+    /**
+     * Implementation of @ref testProcessCorners and
+     * @ref testProcessCornersTreeOffset.
+     *
+     * @param treeShift  If non-zero, the region is placed two cells of the start
+     *                   level along x in the octree, instead of at its origin.
+     */
+    void processCorners(unsigned int treeShift);
+
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -124,6 +135,7 @@ public:
     void testFitSphere();          ///< Test @ref fitSphere in @ref mls.cl.
 
     void testProcessCorners();     ///< Test the @ref processCorners kernel.
+    void testProcessCornersTreeOffset(); ///< Test @ref processCorners with a region placed away from the octree origin.
 
     // TODO: test boundary handling
 };
@@ -414,6 +426,16 @@ static inline double sqr(double x)
 }
 
 void TestMls::testProcessCorners()
+{
+    processCorners(0);
+}
+
+void TestMls::testProcessCornersTreeOffset()
+{
+    processCorners(1);
+}
+
+void TestMls::processCorners(unsigned int treeShift)
 {
     const std::size_t N = 50;
     const float center[3] = {10.0f, 20.0f, 35.0f};
@@ -456,6 +478,10 @@ void TestMls::testProcessCorners()
      * - insufficient but non-zero hits
      * - zero hits
      */
+    /* The region covers 2x2x2 cells at the start level. When treeShift is
+     * non-zero, it is placed two cells along x in the octree, and the start
+     * table is laid out so that it sees the same cells as at the origin.
+     */
     std::vector<SplatTreeCL::command_type> hStart(8, 0);
     std::vector<SplatTreeCL::command_type> hCommands;
 
@@ -472,6 +498,14 @@ void TestMls::testProcessCorners()
     hCommands.push_back(N - 1);
     hCommands.push_back(-1);
 
+    if (treeShift > 0)
+    {
+        // makeCode(x + 2, y, z) = makeCode(x, y, z) + 8 for x, y, z in {0, 1}
+        std::vector<SplatTreeCL::command_type> shifted(16, -1);
+        std::copy(hStart.begin(), hStart.end(), shifted.begin() + 8);
+        hStart.swap(shifted);
+    }
+
     cl::Buffer dSplats(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                        N * sizeof(Splat), &hSplats[0]);
     cl::Buffer dStart(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
@@ -482,7 +516,8 @@ void TestMls::testProcessCorners()
     cl::Image2D dCorners = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
                                        imageWidth, imageDepth * swathe.zStride + swathe.zBias);
 
-    generator.set(offset, dSplats, dCommands, dStart, subsampling);
+    const Grid::size_type treeOffset[3] = {treeShift ? Grid::size_type(2) << subsampling : 0, 0, 0};
+    generator.set(offset, treeOffset, dSplats, dCommands, dStart, subsampling);
     generator.enqueue(queue, dCorners, swathe, NULL, NULL);
     queue.finish();
 
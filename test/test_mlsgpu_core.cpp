@@ -0,0 +1,88 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref mlsgpu_core.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/program_options.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+#include "../src/clh.h"
+#include "../src/timeplot.h"
+#include "../src/mlsgpu_core.h"
+#include "testutil.h"
+
+namespace po = boost::program_options;
+
+/**
+ * Parse a command line, which must name at least one input file.
+ */
+static po::variables_map makeOptions(const std::vector<std::string> &args)
+{
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>("mlsgpu"));
+    for (std::size_t i = 0; i < args.size(); i++)
+        argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(NULL);
+    return processOptions(argv.size() - 1, &argv[0], false);
+}
+
+class TestSlaveWorkers : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSlaveWorkers);
+    CPPUNIT_TEST(testInitError);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    void testInitError();     ///< A @c cl::Error raised while creating the workers is rethrown by @c wait
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSlaveWorkers, TestSet::perBuild());
+
+void TestSlaveWorkers::testInitError()
+{
+    std::vector<std::string> args;
+    args.push_back("-o");
+    args.push_back("out.ply");
+    args.push_back("in.ply");
+    const po::variables_map vm = makeOptions(args);
+
+    // Null handles make creating the command queue fail
+    std::vector<std::pair<cl::Context, cl::Device> > devices;
+    devices.push_back(std::make_pair(cl::Context(), cl::Device()));
+    Timeplot::Worker tworker("test");
+    SlaveWorkers slaveWorkers(tworker, vm, devices,
+                              DeviceWorkerGroup::OutputGenerator(),
+                              DeviceWorkerGroup::BinDone());
+    CPPUNIT_ASSERT_THROW(slaveWorkers.wait(), cl::Error);
+}
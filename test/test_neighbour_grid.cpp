@@ -0,0 +1,165 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref NeighbourGrid.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/tr1/random.hpp>
+#include "testutil.h"
+#include "../src/neighbour_grid.h"
+#include "../src/splat.h"
+
+using namespace std;
+
+class TestNeighbourGrid : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestNeighbourGrid);
+    CPPUNIT_TEST(testNearest);
+    CPPUNIT_TEST(testCovering);
+    CPPUNIT_TEST(testCoveringLimit);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /**
+     * Create random splats in a slab that is thin in z, with radii in [0.5, 2).
+     */
+    static vector<Splat> makeRandom(std::size_t n);
+
+    /// Squared distance between two splat centres
+    static float dist2(const Splat &a, const Splat &b);
+
+public:
+    void testNearest();        ///< Compare @ref NeighbourGrid::nearest to brute force
+    void testCovering();       ///< Compare @ref NeighbourGrid::countCovering to brute force
+    void testCoveringLimit();  ///< Test the early exit of @ref NeighbourGrid::countCovering
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestNeighbourGrid, TestSet::perBuild());
+
+vector<Splat> TestNeighbourGrid::makeRandom(std::size_t n)
+{
+    using std::tr1::mt19937;
+    using std::tr1::uniform_real;
+    using std::tr1::variate_generator;
+
+    mt19937 engine;
+    variate_generator<mt19937 &, uniform_real<float> > coord(engine, uniform_real<float>(0.0f, 20.0f));
+    variate_generator<mt19937 &, uniform_real<float> > z(engine, uniform_real<float>(0.0f, 1.0f));
+    variate_generator<mt19937 &, uniform_real<float> > radius(engine, uniform_real<float>(0.5f, 2.0f));
+
+    vector<Splat> splats(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        splats[i].position[0] = coord();
+        splats[i].position[1] = coord();
+        splats[i].position[2] = z();
+        splats[i].normal[0] = splats[i].normal[1] = 0.0f;
+        splats[i].normal[2] = 1.0f;
+        splats[i].radius = radius();
+        splats[i].quality = 1.0f;
+    }
+    return splats;
+}
+
+float TestNeighbourGrid::dist2(const Splat &a, const Splat &b)
+{
+    float ans = 0.0f;
+    for (unsigned int j = 0; j < 3; j++)
+    {
+        const float d = b.position[j] - a.position[j];
+        ans += d * d;
+    }
+    return ans;
+}
+
+void TestNeighbourGrid::testNearest()
+{
+    const vector<Splat> splats = makeRandom(2000);
+    const float halo = 3.0f;
+    const std::size_t k = 9;
+    NeighbourGrid grid(&splats[0], splats.size(), k, halo);
+
+    vector<pair<float, std::size_t> > heap;
+    vector<float> scratch;
+    for (std::size_t i = 0; i < splats.size(); i += 7)
+    {
+        grid.nearest(splats[i].position, k, heap, scratch);
+
+        vector<float> expected;
+        for (std::size_t j = 0; j < splats.size(); j++)
+        {
+            const float d2 = dist2(splats[i], splats[j]);
+            if (d2 <= halo * halo)
+                expected.push_back(d2);
+        }
+        sort(expected.begin(), expected.end());
+        expected.resize(min(expected.size(), k));
+
+        vector<float> actual;
+        for (std::size_t j = 0; j < heap.size(); j++)
+        {
+            CPPUNIT_ASSERT_EQUAL(dist2(splats[i], splats[heap[j].second]), heap[j].first);
+            actual.push_back(heap[j].first);
+        }
+        sort(actual.begin(), actual.end());
+        CPPUNIT_ASSERT(expected == actual);
+    }
+}
+
+void TestNeighbourGrid::testCovering()
+{
+    const vector<Splat> splats = makeRandom(2000);
+    NeighbourGrid grid(&splats[0], splats.size(), 5, 2.0f);
+
+    vector<float> scratch;
+    for (std::size_t i = 0; i < splats.size(); i += 7)
+    {
+        std::size_t expected = 0;
+        for (std::size_t j = 0; j < splats.size(); j++)
+            if (j != i && dist2(splats[i], splats[j]) < splats[j].radius * splats[j].radius)
+                expected++;
+        MLSGPU_ASSERT_EQUAL(expected, grid.countCovering(splats[i].position, i, splats.size(), scratch));
+    }
+}
+
+void TestNeighbourGrid::testCoveringLimit()
+{
+    const vector<Splat> splats = makeRandom(2000);
+    NeighbourGrid grid(&splats[0], splats.size(), 5, 2.0f);
+
+    vector<float> scratch;
+    for (std::size_t i = 0; i < splats.size(); i += 7)
+    {
+        const std::size_t all = grid.countCovering(splats[i].position, i, splats.size(), scratch);
+        MLSGPU_ASSERT_EQUAL(min(all, std::size_t(3)), grid.countCovering(splats[i].position, i, 3, scratch));
+        MLSGPU_ASSERT_EQUAL(0, grid.countCovering(splats[i].position, i, 0, scratch));
+    }
+}
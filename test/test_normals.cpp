@@ -0,0 +1,166 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref Normals.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <boost/tr1/cmath.hpp>
+#include "testutil.h"
+#include "../src/normals.h"
+#include "../src/splat.h"
+
+using namespace std;
+
+class TestNormals : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestNormals);
+    CPPUNIT_TEST(testPlane);
+    CPPUNIT_TEST(testCore);
+    CPPUNIT_TEST(testIsolated);
+    CPPUNIT_TEST(testOrient);
+    CPPUNIT_TEST(testWriteHeader);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /**
+     * Create a grid of points on the plane z = 0.5x + 0.25y + 3, with spacing 1
+     * in x and y.
+     */
+    static vector<Splat> makePlane(int size);
+
+public:
+    void testPlane();          ///< Normals and radii of points on a plane
+    void testCore();           ///< Only the core points are modified
+    void testIsolated();       ///< Points without enough neighbours get NaN normals
+    void testOrient();         ///< Test @ref Normals::orient
+    void testWriteHeader();    ///< Test @ref Normals::writeHeader
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestNormals, TestSet::perBuild());
+
+vector<Splat> TestNormals::makePlane(int size)
+{
+    vector<Splat> splats;
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            Splat s;
+            s.position[0] = x;
+            s.position[1] = y;
+            s.position[2] = 0.5f * x + 0.25f * y + 3.0f;
+            s.normal[0] = s.normal[1] = s.normal[2] = 0.0f;
+            s.radius = 1.0f;
+            s.quality = 1.0f;
+            splats.push_back(s);
+        }
+    return splats;
+}
+
+void TestNormals::testPlane()
+{
+    vector<Splat> splats = makePlane(20);
+    Normals::estimate(&splats[0], splats.size(), splats.size(), 8, 5.0f);
+
+    const float len = std::sqrt(0.5f * 0.5f + 0.25f * 0.25f + 1.0f);
+    const float expected[3] = { -0.5f / len, -0.25f / len, 1.0f / len };
+    for (std::size_t i = 0; i < splats.size(); i++)
+    {
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[j], splats[i].normal[j], 1e-4);
+        /* The 8 nearest neighbours of an interior point are the 3x3 block
+         * around it, the furthest of which are diagonal.
+         */
+        const int x = splats[i].position[0];
+        const int y = splats[i].position[1];
+        if (x > 0 && x < 19 && y > 0 && y < 19)
+        {
+            const float dz = 0.5f + 0.25f;
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(std::sqrt(2.0f + dz * dz), splats[i].radius, 1e-4);
+        }
+        CPPUNIT_ASSERT(splats[i].radius <= 5.0f);
+    }
+}
+
+void TestNormals::testCore()
+{
+    vector<Splat> splats = makePlane(10);
+    Normals::estimate(&splats[0], 30, splats.size(), 8, 5.0f);
+    for (std::size_t i = 0; i < 30; i++)
+        CPPUNIT_ASSERT(splats[i].normal[2] > 0.5f);
+    for (std::size_t i = 30; i < splats.size(); i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(0.0f, splats[i].normal[2]);
+        CPPUNIT_ASSERT_EQUAL(1.0f, splats[i].radius);
+    }
+}
+
+void TestNormals::testIsolated()
+{
+    vector<Splat> splats = makePlane(10);
+    Splat far = splats[0];
+    far.position[0] = 100.0f;
+    splats.insert(splats.begin(), far);
+
+    Normals::estimate(&splats[0], splats.size(), splats.size(), 8, 5.0f);
+    CPPUNIT_ASSERT(!splats[0].isFinite());
+    CPPUNIT_ASSERT_EQUAL(5.0f, splats[0].radius);
+    for (std::size_t i = 1; i < splats.size(); i++)
+        CPPUNIT_ASSERT(splats[i].isFinite());
+}
+
+void TestNormals::testOrient()
+{
+    Splat s;
+    s.position[0] = 1.0f;
+    s.position[1] = 2.0f;
+    s.position[2] = 3.0f;
+    s.normal[0] = 0.0f;
+    s.normal[1] = 0.0f;
+    s.normal[2] = 1.0f;
+
+    const float below[3] = { 0.0f, 0.0f, -10.0f };
+    const float above[3] = { 50.0f, 50.0f, 4.0f };
+    Normals::orient(s, below);
+    CPPUNIT_ASSERT_EQUAL(-1.0f, s.normal[2]);
+    Normals::orient(s, above);
+    CPPUNIT_ASSERT_EQUAL(1.0f, s.normal[2]);
+}
+
+void TestNormals::testWriteHeader()
+{
+    ostringstream out;
+    Normals::writeHeader(out, 1234);
+    const string header = out.str();
+    CPPUNIT_ASSERT_EQUAL(string("ply\n"), header.substr(0, 4));
+    CPPUNIT_ASSERT(header.find("element vertex 1234\n") != string::npos);
+    CPPUNIT_ASSERT(header.find("property float radius\nend_header\n") != string::npos);
+}
@@ -0,0 +1,140 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref Outliers.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include "testutil.h"
+#include "../src/outliers.h"
+#include "../src/splat.h"
+
+using namespace std;
+
+class TestOutliers : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestOutliers);
+    CPPUNIT_TEST(testPlane);
+    CPPUNIT_TEST(testCluster);
+    CPPUNIT_TEST(testCore);
+    CPPUNIT_TEST(testZeroRadius);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    static Splat makeSplat(float x, float y, float z, float radius);
+
+    /// Create a square grid of splats on the plane z = 0, with spacing 1
+    static vector<Splat> makePlane(int size, float radius);
+
+public:
+    void testPlane();          ///< Splats on a plane are kept and a distant one is removed
+    void testCluster();        ///< A small isolated cluster depends on the threshold
+    void testCore();           ///< Non-core splats are used for coverage only
+    void testZeroRadius();     ///< Splats with zero radius cover nothing
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestOutliers, TestSet::perBuild());
+
+Splat TestOutliers::makeSplat(float x, float y, float z, float radius)
+{
+    Splat s;
+    s.position[0] = x;
+    s.position[1] = y;
+    s.position[2] = z;
+    s.normal[0] = 0.0f;
+    s.normal[1] = 0.0f;
+    s.normal[2] = 1.0f;
+    s.radius = radius;
+    s.quality = 1.0f;
+    return s;
+}
+
+vector<Splat> TestOutliers::makePlane(int size, float radius)
+{
+    vector<Splat> splats;
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            splats.push_back(makeSplat(x, y, 0.0f, radius));
+    return splats;
+}
+
+void TestOutliers::testPlane()
+{
+    vector<Splat> splats = makePlane(10, 2.5f);
+    splats.push_back(makeSplat(50.0f, 50.0f, 0.0f, 2.5f));
+    boost::scoped_array<bool> isolated(new bool[splats.size()]);
+
+    Outliers::findIsolated(&splats[0], splats.size(), splats.size(), 4, isolated.get());
+    for (std::size_t i = 0; i + 1 < splats.size(); i++)
+        CPPUNIT_ASSERT(!isolated[i]);
+    CPPUNIT_ASSERT(isolated[splats.size() - 1]);
+}
+
+void TestOutliers::testCluster()
+{
+    vector<Splat> splats = makePlane(10, 2.5f);
+    for (int i = 0; i < 3; i++)
+        splats.push_back(makeSplat(50.0f + i, 50.0f, 0.0f, 2.5f));
+    boost::scoped_array<bool> isolated(new bool[splats.size()]);
+
+    Outliers::findIsolated(&splats[0], splats.size(), splats.size(), 3, isolated.get());
+    for (std::size_t i = 100; i < splats.size(); i++)
+        CPPUNIT_ASSERT(isolated[i]);
+
+    Outliers::findIsolated(&splats[0], splats.size(), splats.size(), 2, isolated.get());
+    for (std::size_t i = 0; i < splats.size(); i++)
+        CPPUNIT_ASSERT(!isolated[i]);
+}
+
+void TestOutliers::testCore()
+{
+    /* A splat whose only coverers are outside the core must still be
+     * kept, since the coverers are present in the bucket.
+     */
+    vector<Splat> splats;
+    splats.push_back(makeSplat(0.0f, 0.0f, 0.0f, 0.1f));
+    for (int i = 0; i < 4; i++)
+        splats.push_back(makeSplat(i + 1.0f, 0.0f, 0.0f, 10.0f));
+    boost::scoped_array<bool> isolated(new bool[1]);
+
+    Outliers::findIsolated(&splats[0], 1, splats.size(), 4, isolated.get());
+    CPPUNIT_ASSERT(!isolated[0]);
+    Outliers::findIsolated(&splats[0], 1, splats.size(), 5, isolated.get());
+    CPPUNIT_ASSERT(isolated[0]);
+}
+
+void TestOutliers::testZeroRadius()
+{
+    vector<Splat> splats = makePlane(3, 0.0f);
+    boost::scoped_array<bool> isolated(new bool[splats.size()]);
+
+    Outliers::findIsolated(&splats[0], splats.size(), splats.size(), 1, isolated.get());
+    for (std::size_t i = 0; i < splats.size(); i++)
+        CPPUNIT_ASSERT(isolated[i]);
+}
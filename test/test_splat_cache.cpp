@@ -0,0 +1,208 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref SplatCacheMap.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include "testutil.h"
+#include "../src/splat_cache.h"
+#include "../src/splat_set.h"
+
+/// Tests for @ref SplatCacheMap
+class TestSplatCache : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSplatCache);
+    CPPUNIT_TEST(testRepeat);
+    CPPUNIT_TEST(testOverlap);
+    CPPUNIT_TEST(testDisjoint);
+    CPPUNIT_TEST(testClear);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef SplatSet::splat_id splat_id;
+
+    /// Build a subset from @a n ranges given as [first, last) pairs
+    static SplatSet::SubsetBase makeRanges(const splat_id (*ranges)[2], std::size_t n);
+
+    /// The splat IDs of @a ranges in order, which is what a bin holds without the cache
+    static std::vector<splat_id> uncached(const SplatSet::SubsetBase &ranges);
+
+    /**
+     * Add a bin to the cache, and simulate the copies it requests. Each
+     * simulated splat is represented by its ID.
+     *
+     * @param map             The cache map.
+     * @param[in,out] cache   Simulated contents of the cache.
+     * @param ranges          Splat IDs of the bin.
+     * @param[out] uploaded   Number of splats uploaded to the cache.
+     * @return The bin as assembled from the cache.
+     */
+    static std::vector<splat_id> add(
+        SplatCacheMap &map, std::vector<splat_id> &cache,
+        const SplatSet::SubsetBase &ranges, std::size_t &uploaded);
+
+public:
+    void testRepeat();      ///< A repeated bin is served entirely from the cache
+    void testOverlap();     ///< A bin sharing some splats only uploads the rest
+    void testDisjoint();    ///< A bin with different splats does not reuse any
+    void testClear();       ///< Clearing the cache forgets all splats
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSplatCache, TestSet::perBuild());
+
+SplatSet::SubsetBase TestSplatCache::makeRanges(const splat_id (*ranges)[2], std::size_t n)
+{
+    SplatSet::SubsetBase ans;
+    for (std::size_t i = 0; i < n; i++)
+        ans.addRange(ranges[i][0], ranges[i][1]);
+    ans.flush();
+    return ans;
+}
+
+std::vector<SplatSet::splat_id> TestSplatCache::uncached(const SplatSet::SubsetBase &ranges)
+{
+    std::vector<splat_id> ans;
+    for (SplatSet::SubsetBase::const_iterator i = ranges.begin(); i != ranges.end(); ++i)
+        for (splat_id id = i->first; id < i->second; id++)
+            ans.push_back(id);
+    return ans;
+}
+
+std::vector<SplatSet::splat_id> TestSplatCache::add(
+    SplatCacheMap &map, std::vector<splat_id> &cache,
+    const SplatSet::SubsetBase &ranges, std::size_t &uploaded)
+{
+    const std::vector<splat_id> bin = uncached(ranges);
+    std::vector<SplatCacheMap::Copy> uploads, gathers;
+    map.add(ranges, 0, uploads, gathers);
+    CPPUNIT_ASSERT(map.size() <= map.capacity());
+
+    uploaded = 0;
+    cache.resize(map.capacity(), splat_id(-1));
+    BOOST_FOREACH(const SplatCacheMap::Copy &c, uploads)
+    {
+        CPPUNIT_ASSERT(c.src + c.count <= bin.size());
+        CPPUNIT_ASSERT(c.dst + c.count <= map.size());
+        std::copy(bin.begin() + c.src, bin.begin() + c.src + c.count, cache.begin() + c.dst);
+        uploaded += c.count;
+    }
+
+    std::vector<splat_id> ans(bin.size(), splat_id(-1));
+    BOOST_FOREACH(const SplatCacheMap::Copy &c, gathers)
+    {
+        CPPUNIT_ASSERT(c.src + c.count <= map.size());
+        CPPUNIT_ASSERT(c.dst + c.count <= ans.size());
+        std::copy(cache.begin() + c.src, cache.begin() + c.src + c.count, ans.begin() + c.dst);
+    }
+    return ans;
+}
+
+void TestSplatCache::testRepeat()
+{
+    const splat_id ranges[][2] = { {10, 20}, {30, 35} };
+    const SplatSet::SubsetBase bin = makeRanges(ranges, 2);
+    SplatCacheMap map(100);
+    std::vector<splat_id> cache;
+    std::size_t uploaded;
+
+    MLSGPU_ASSERT_EQUAL(15, map.missing(bin));
+    CPPUNIT_ASSERT(uncached(bin) == add(map, cache, bin, uploaded));
+    MLSGPU_ASSERT_EQUAL(15, uploaded);
+    MLSGPU_ASSERT_EQUAL(15, map.size());
+
+    MLSGPU_ASSERT_EQUAL(0, map.missing(bin));
+    CPPUNIT_ASSERT(uncached(bin) == add(map, cache, bin, uploaded));
+    MLSGPU_ASSERT_EQUAL(0, uploaded);
+    MLSGPU_ASSERT_EQUAL(15, map.size());
+}
+
+void TestSplatCache::testOverlap()
+{
+    const splat_id rangesA[][2] = { {10, 20}, {30, 35} };
+    const splat_id rangesB[][2] = { {5, 12}, {18, 32}, {40, 42} };
+    const SplatSet::SubsetBase binA = makeRanges(rangesA, 2);
+    const SplatSet::SubsetBase binB = makeRanges(rangesB, 3);
+    SplatCacheMap map(100);
+    std::vector<splat_id> cache;
+    std::size_t uploaded;
+
+    add(map, cache, binA, uploaded);
+    // [5, 10), [20, 30) and [40, 42) are new
+    MLSGPU_ASSERT_EQUAL(17, map.missing(binB));
+    CPPUNIT_ASSERT(uncached(binB) == add(map, cache, binB, uploaded));
+    MLSGPU_ASSERT_EQUAL(17, uploaded);
+    MLSGPU_ASSERT_EQUAL(32, map.size());
+
+    // Both bins are now entirely resident
+    MLSGPU_ASSERT_EQUAL(0, map.missing(binA));
+    CPPUNIT_ASSERT(uncached(binA) == add(map, cache, binA, uploaded));
+    MLSGPU_ASSERT_EQUAL(0, uploaded);
+}
+
+void TestSplatCache::testDisjoint()
+{
+    const splat_id rangesA[][2] = { {10, 20} };
+    const splat_id rangesB[][2] = { {0, 10}, {20, 25} };
+    const SplatSet::SubsetBase binA = makeRanges(rangesA, 1);
+    const SplatSet::SubsetBase binB = makeRanges(rangesB, 2);
+    SplatCacheMap map(100);
+    std::vector<splat_id> cache;
+    std::size_t uploaded;
+
+    add(map, cache, binA, uploaded);
+    MLSGPU_ASSERT_EQUAL(15, map.missing(binB));
+    CPPUNIT_ASSERT(uncached(binB) == add(map, cache, binB, uploaded));
+    MLSGPU_ASSERT_EQUAL(15, uploaded);
+    MLSGPU_ASSERT_EQUAL(25, map.size());
+}
+
+void TestSplatCache::testClear()
+{
+    const splat_id ranges[][2] = { {10, 20}, {30, 35} };
+    const SplatSet::SubsetBase bin = makeRanges(ranges, 2);
+    SplatCacheMap map(15);
+    std::vector<splat_id> cache;
+    std::size_t uploaded;
+
+    add(map, cache, bin, uploaded);
+    map.clear();
+    MLSGPU_ASSERT_EQUAL(0, map.size());
+    MLSGPU_ASSERT_EQUAL(15, map.missing(bin));
+
+    // The splats are uploaded again, from the start of the cache
+    std::vector<SplatCacheMap::Copy> uploads, gathers;
+    map.add(bin, 0, uploads, gathers);
+    CPPUNIT_ASSERT(!uploads.empty());
+    MLSGPU_ASSERT_EQUAL(0, uploads[0].dst);
+    MLSGPU_ASSERT_EQUAL(15, map.size());
+}
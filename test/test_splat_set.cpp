@@ -257,6 +257,109 @@ void TestFileSet::populate(
     }
 }
 
+void TestFileSet::testExclude()
+{
+    boost::scoped_ptr<Set> set(setFactory(splatData, 2.5f, 5));
+    std::vector<Splat> splats;
+    std::vector<SplatSet::splat_id> ids;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+        Splat splat;
+        SplatSet::splat_id id;
+        while (stream->read(&splat, &id, 1) > 0)
+        {
+            splats.push_back(splat);
+            ids.push_back(id);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(flatSplats.size(), splats.size());
+
+    std::vector<Splat> expected;
+    std::vector<SplatSet::splat_id> expectedIds;
+    for (std::size_t i = 0; i < splats.size(); i++)
+    {
+        if (i % 3 == 1)
+        {
+            set->excludeSplat(ids[i]);
+            set->excludeSplat(ids[i]); // excluding twice must not double-count
+        }
+        else
+        {
+            expected.push_back(splats[i]);
+            expectedIds.push_back(ids[i]);
+        }
+    }
+    MLSGPU_ASSERT_EQUAL(splats.size() - expected.size(), set->numExcluded());
+
+    std::vector<Splat> actual;
+    std::vector<SplatSet::splat_id> actualIds;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+        Splat buffer[5];
+        SplatSet::splat_id bufferIds[5];
+        std::size_t n;
+        while ((n = stream->read(buffer, bufferIds, 5)) > 0)
+        {
+            actual.insert(actual.end(), buffer, buffer + n);
+            actualIds.insert(actualIds.end(), bufferIds, bufferIds + n);
+        }
+    }
+    CPPUNIT_ASSERT(expectedIds == actualIds);
+    MLSGPU_ASSERT_EQUAL(expected.size(), actual.size());
+    for (std::size_t i = 0; i < expected.size(); i++)
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_EQUAL(expected[i].position[j], actual[i].position[j]);
+
+    // Reading without IDs must give the same splats
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+        Splat buffer[5];
+        std::size_t total = 0;
+        std::size_t n;
+        while ((n = stream->read(buffer, NULL, 5)) > 0)
+            total += n;
+        CPPUNIT_ASSERT_EQUAL(expected.size(), total);
+    }
+}
+
+void TestFileSet::testIds()
+{
+    boost::scoped_ptr<Set> set(setFactory(splatData, 2.5f, 5));
+    std::size_t maxFileSplats = 0;
+    for (std::size_t i = 0; i < splatData.size(); i++)
+        maxFileSplats = std::max(maxFileSplats, splatData[i].size());
+    unsigned int bits = 0;
+    while ((maxFileSplats >> bits) != 0)
+        bits++;
+
+    boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+    Splat splat;
+    SplatSet::splat_id id;
+    std::size_t lastFile = 0;
+    while (stream->read(&splat, &id, 1) > 0)
+    {
+        const std::size_t fileId = set->getFileId(id);
+        CPPUNIT_ASSERT(fileId < splatData.size());
+        CPPUNIT_ASSERT(fileId >= lastFile);
+        const SplatSet::splat_id index = id - (SplatSet::splat_id(fileId) << bits);
+        CPPUNIT_ASSERT(index < splatData[fileId].size());
+        CPPUNIT_ASSERT(splatData[fileId][index].position[0] == splat.position[0]);
+        lastFile = fileId;
+    }
+}
+
+void TestFileSet::testIdsFit()
+{
+    const SplatSet::splat_id one = 1;
+    CPPUNIT_ASSERT(SplatSet::FileSet::idsFit(1, 0));
+    CPPUNIT_ASSERT(SplatSet::FileSet::idsFit(one << 40, (one << 23) - 1));
+    CPPUNIT_ASSERT(!SplatSet::FileSet::idsFit((one << 40) + 1, (one << 23) - 1));
+    CPPUNIT_ASSERT(!SplatSet::FileSet::idsFit(one << 40, one << 23));
+    CPPUNIT_ASSERT(SplatSet::FileSet::idsFit(1, (one << 63) - 1));
+    CPPUNIT_ASSERT(!SplatSet::FileSet::idsFit(2, (one << 63) - 1));
+    CPPUNIT_ASSERT(!SplatSet::FileSet::idsFit(1, one << 63));
+}
+
 SplatSet::FileSet *TestFileSet::setFactory(
     const std::vector<std::vector<Splat> > &splatData,
     float spacing, Grid::size_type bucketSize)
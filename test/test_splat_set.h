@@ -440,6 +440,9 @@ protected:
 class TestFileSet : public TestSplatSubsettable<SplatSet::FileSet>
 {
     CPPUNIT_TEST_SUB_SUITE(TestFileSet, TestSplatSubsettable<SplatSet::FileSet>);
+    CPPUNIT_TEST(testExclude);
+    CPPUNIT_TEST(testIds);
+    CPPUNIT_TEST(testIdsFit);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -450,6 +453,10 @@ protected:
     virtual Set *setFactory(const std::vector<std::vector<Splat> > &splatData,
                             float spacing, Grid::size_type bucketSize);
 public:
+    void testExclude();          ///< Test @ref SplatSet::FileSet::excludeSplat
+    void testIds();              ///< Test that splat IDs are sized to the files
+    void testIdsFit();           ///< Test @ref SplatSet::FileSet::idsFit
+
     /**
      * Adds all splats in @a splatData to the set. Each element of @a splatData is
      * converted to PLY format and appended as a new @ref FastPly::Reader to @a set.
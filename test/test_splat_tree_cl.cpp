@@ -37,6 +37,8 @@
 #include <cstddef>
 #include <vector>
 #include <cmath>
+#include <set>
+#include <boost/tr1/random.hpp>
 #include "testutil.h"
 #include "test_clh.h"
 #include "test_splat_tree.h"
@@ -51,6 +53,7 @@ class TestSplatTreeCL : public TestSplatTree, public CLH::Test::Mixin
     CPPUNIT_TEST(testLevelShift);
     CPPUNIT_TEST(testPointBoxDist2);
     CPPUNIT_TEST(testMakeCode);
+    CPPUNIT_TEST(testBatched);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -69,9 +72,13 @@ private:
     float callPointBoxDist2(float px, float py, float pz, float lx, float ly, float lz, float hx, float hy, float hz);
     int callMakeCode(cl_int x, cl_int y, cl_int z);
 
+    /// Read back the splats reachable from each finest-level cell of @a tree
+    void readCells(const SplatTreeCL &tree, std::vector<std::set<SplatTree::command_type> > &cells);
+
     void testLevelShift();     ///< Test @ref levelShift in @ref octree.cl.
     void testPointBoxDist2();  ///< Test @ref pointBoxDist2 in @ref octree.cl.
     void testMakeCode();       ///< Test @ref makeCode in @ref octree.cl.
+    void testBatched();        ///< Test the batched form of @ref SplatTreeCL::enqueueBuild.
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -202,3 +209,108 @@ void TestSplatTreeCL::testMakeCode()
     CPPUNIT_ASSERT_EQUAL(174, callMakeCode(2, 5, 3));
     CPPUNIT_ASSERT_EQUAL(511, callMakeCode(7, 7, 7));
 }
+
+void TestSplatTreeCL::readCells(const SplatTreeCL &tree, std::vector<std::set<SplatTree::command_type> > &cells)
+{
+    typedef SplatTree::command_type command_type;
+    std::vector<command_type> commands(tree.getCommands().getInfo<CL_MEM_SIZE>() / sizeof(command_type));
+    std::vector<command_type> start(tree.getStart().getInfo<CL_MEM_SIZE>() / sizeof(command_type));
+    queue.enqueueReadBuffer(tree.getCommands(), CL_TRUE, 0, commands.size() * sizeof(command_type), &commands[0]);
+    queue.enqueueReadBuffer(tree.getStart(), CL_TRUE, 0, start.size() * sizeof(command_type), &start[0]);
+
+    cells.clear();
+    cells.resize(start.size());
+    for (std::size_t code = 0; code < start.size(); code++)
+    {
+        command_type pos = start[code];
+        std::size_t steps = 0; // for detecting loops
+        while (pos != -1 && steps <= commands.size())
+        {
+            CPPUNIT_ASSERT(pos >= 0 && std::size_t(pos) < commands.size());
+            command_type end = commands[pos++];
+            CPPUNIT_ASSERT(end >= pos && std::size_t(end) < commands.size());
+            for (command_type i = pos; i < end; i++)
+            {
+                cells[code].insert(commands[i]);
+                steps++;
+            }
+            pos = commands[end];
+            steps++;
+        }
+        CPPUNIT_ASSERT_MESSAGE("Infinite loop in command list", steps <= commands.size());
+    }
+}
+
+void TestSplatTreeCL::testBatched()
+{
+    const int maxLevels = 6;
+    const Grid::size_type size[3] = {8, 8, 8};
+    const Grid::difference_type offsets[2][3] = { {100, -20, 5}, {-40, 7, 61} };
+    const Grid::size_type origins[2][3] = { {16, 0, 0}, {0, 0, 16} };
+
+    /* Region 1 takes the first splats and region 0 the rest, so that the
+     * entries of each region are written away from the position of its
+     * splats in the buffer. Splats stay within a few cells of their own
+     * region, so that each region sees only its own splats.
+     */
+    const std::size_t splitSplat = 7;
+    const std::size_t numSplats = 17;
+    std::tr1::mt19937 engine;
+    std::tr1::uniform_real<float> posDist(-1.0f, 9.0f);
+    std::tr1::uniform_real<float> radiusDist(0.25f, 2.0f);
+    std::vector<Splat> splats(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        const int r = i < splitSplat ? 1 : 0;
+        for (int j = 0; j < 3; j++)
+            splats[i].position[j] = offsets[r][j] + posDist(engine);
+        splats[i].radius = radiusDist(engine);
+        splats[i].normal[0] = 1.0f;
+        splats[i].normal[1] = 0.0f;
+        splats[i].normal[2] = 0.0f;
+        splats[i].quality = 1.0f;
+    }
+    cl::Buffer splatBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                           numSplats * sizeof(Splat), &splats[0]);
+
+    std::vector<SplatTreeCL::Region> regions(2);
+    regions[0].firstSplat = splitSplat;
+    regions[0].numSplats = numSplats - splitSplat;
+    regions[1].firstSplat = 0;
+    regions[1].numSplats = splitSplat;
+    for (int r = 0; r < 2; r++)
+        for (int j = 0; j < 3; j++)
+        {
+            regions[r].size[j] = size[j];
+            regions[r].offset[j] = offsets[r][j];
+            regions[r].origin[j] = origins[r][j];
+        }
+
+    SplatTreeCL batched(context, device, maxLevels, numSplats);
+    batched.enqueueBuild(queue, splatBuffer, regions, maxLevels, 0);
+    queue.finish();
+    std::vector<std::set<SplatTree::command_type> > batchedCells;
+    readCells(batched, batchedCells);
+
+    for (int r = 0; r < 2; r++)
+    {
+        SplatTreeCL single(context, device, maxLevels, numSplats);
+        single.enqueueBuild(queue, splatBuffer, regions[r].firstSplat, regions[r].numSplats,
+                            size, offsets[r], 0);
+        queue.finish();
+        std::vector<std::set<SplatTree::command_type> > singleCells;
+        readCells(single, singleCells);
+
+        for (Grid::size_type z = 0; z < size[2]; z++)
+            for (Grid::size_type y = 0; y < size[1]; y++)
+                for (Grid::size_type x = 0; x < size[0]; x++)
+                {
+                    const std::size_t code = SplatTree::makeCode(x, y, z);
+                    const std::size_t batchedCode = SplatTree::makeCode(
+                        x + origins[r][0], y + origins[r][1], z + origins[r][2]);
+                    CPPUNIT_ASSERT(code < singleCells.size());
+                    CPPUNIT_ASSERT(batchedCode < batchedCells.size());
+                    CPPUNIT_ASSERT(singleCells[code] == batchedCells[batchedCode]);
+                }
+    }
+}
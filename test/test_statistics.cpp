@@ -75,6 +75,7 @@ class TestVariable : public TestStatistic
     CPPUNIT_TEST(testGetStddev);
     CPPUNIT_TEST(testGetVariance);
     CPPUNIT_TEST(testGetNumSamples);
+    CPPUNIT_TEST(testGetSum);
     CPPUNIT_TEST(testStream);
     CPPUNIT_TEST(testSerialize);
     CPPUNIT_TEST_SUITE_END();
@@ -90,6 +91,7 @@ private:
     void testGetStddev();      ///< Test @ref Statistics::Variable::getStddev
     void testGetVariance();    ///< Test @ref Statistics::Variable::getVariance
     void testGetNumSamples();  ///< Test @ref Statistics::Variable::getNumSamples
+    void testGetSum();         ///< Test @ref Statistics::Variable::getSum
     void testStream();         ///< Test stream output of @ref Statistics::Variable
     void testSerialize();      ///< Test that serialization and deserialization works
 
@@ -233,6 +235,14 @@ void TestVariable::testGetNumSamples()
     CPPUNIT_ASSERT_EQUAL(2ULL, stat2s->getNumSamples());
 }
 
+void TestVariable::testGetSum()
+{
+    CPPUNIT_ASSERT_EQUAL(0.0, stat0->getSum());
+    CPPUNIT_ASSERT_EQUAL(1.0, stat1->getSum());
+    CPPUNIT_ASSERT_EQUAL(5.0, stat2->getSum());
+    CPPUNIT_ASSERT_EQUAL(9.0, stat2s->getSum());
+}
+
 void TestVariable::testStream()
 {
     {
@@ -0,0 +1,184 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for helper functions in @ref DeviceWorkerGroup.
+ */
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include "testutil.h"
+#include "../src/workers.h"
+#include "../src/splat_tree_cl.h"
+#include "../src/grid.h"
+#include "../src/mls.h"
+
+/// Tests for @ref DeviceWorkerGroupBase
+class TestDeviceWorkerGroup : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestDeviceWorkerGroup);
+    CPPUNIT_TEST(testChooseLevelsFull);
+    CPPUNIT_TEST(testChooseLevelsSmall);
+    CPPUNIT_TEST(testChooseLevelsClamp);
+    CPPUNIT_TEST(testChooseLevelsBatch);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Make a region of @a size cells on each axis, placed at @a origin in the octree
+    static SplatTreeCL::Region makeRegion(Grid::size_type size, Grid::size_type origin = 0);
+
+    /**
+     * Call @ref DeviceWorkerGroupBase::chooseLevels and check that the
+     * result is legal.
+     */
+    static void chooseLevels(
+        const std::vector<SplatTreeCL::Region> &regions, unsigned int radiusShift,
+        unsigned int maxLevels, unsigned int maxSubsampling,
+        unsigned int &levels, unsigned int &subsampling);
+
+public:
+    void testChooseLevelsFull();   ///< Regions as large as the allocated octree
+    void testChooseLevelsSmall();  ///< Regions of a few cells
+    void testChooseLevelsClamp();  ///< Large splats do not push the subsampling past the user's choice
+    void testChooseLevelsBatch();  ///< Several regions placed in one octree
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestDeviceWorkerGroup, TestSet::perBuild());
+
+SplatTreeCL::Region TestDeviceWorkerGroup::makeRegion(Grid::size_type size, Grid::size_type origin)
+{
+    SplatTreeCL::Region region;
+    region.firstSplat = 0;
+    region.numSplats = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        region.size[i] = size;
+        region.offset[i] = 0;
+        region.origin[i] = origin;
+    }
+    return region;
+}
+
+void TestDeviceWorkerGroup::chooseLevels(
+    const std::vector<SplatTreeCL::Region> &regions, unsigned int radiusShift,
+    unsigned int maxLevels, unsigned int maxSubsampling,
+    unsigned int &levels, unsigned int &subsampling)
+{
+    DeviceWorkerGroupBase::chooseLevels(regions, radiusShift, maxLevels, maxSubsampling, levels, subsampling);
+    CPPUNIT_ASSERT(1 <= levels && levels <= maxLevels);
+    CPPUNIT_ASSERT(subsampling >= (unsigned int) MlsFunctor::subsamplingMin);
+    CPPUNIT_ASSERT(subsampling <= maxSubsampling);
+    const Grid::size_type treeSize = Grid::size_type(1) << (levels + subsampling - 1);
+    for (std::size_t r = 0; r < regions.size(); r++)
+        for (int i = 0; i < 3; i++)
+            CPPUNIT_ASSERT(regions[r].origin[i] + regions[r].size[i] <= treeSize);
+}
+
+void TestDeviceWorkerGroup::testChooseLevelsFull()
+{
+    std::vector<SplatTreeCL::Region> regions(1, makeRegion(256));
+    unsigned int levels, subsampling;
+
+    // Exactly the allocated size
+    for (unsigned int radiusShift = 0; radiusShift < 12; radiusShift++)
+    {
+        chooseLevels(regions, radiusShift, 6, 3, levels, subsampling);
+        MLSGPU_ASSERT_EQUAL(6, levels);
+        MLSGPU_ASSERT_EQUAL(3, subsampling);
+    }
+
+    // Coarser subsampling allowed: the finest level is taken from the splats
+    chooseLevels(regions, 4, 4, 5, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(5, subsampling);
+    MLSGPU_ASSERT_EQUAL(4, levels);
+
+    // Just over a power of two needs another level
+    regions[0] = makeRegion(129);
+    chooseLevels(regions, 0, 6, 3, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(6, levels);
+    MLSGPU_ASSERT_EQUAL(3, subsampling);
+    regions[0] = makeRegion(128);
+    chooseLevels(regions, 0, 6, 3, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(5, levels);
+    MLSGPU_ASSERT_EQUAL(3, subsampling);
+}
+
+void TestDeviceWorkerGroup::testChooseLevelsSmall()
+{
+    std::vector<SplatTreeCL::Region> regions(1);
+    unsigned int levels, subsampling;
+
+    const Grid::size_type sizes[] = { 1, 2, 7, 8 };
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        regions[0] = makeRegion(sizes[i]);
+        chooseLevels(regions, 0, 6, 3, levels, subsampling);
+        MLSGPU_ASSERT_EQUAL(1, levels);
+        MLSGPU_ASSERT_EQUAL(MlsFunctor::subsamplingMin, subsampling);
+    }
+
+    regions[0] = makeRegion(9);
+    chooseLevels(regions, 0, 6, 3, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(2, levels);
+    MLSGPU_ASSERT_EQUAL(3, subsampling);
+}
+
+void TestDeviceWorkerGroup::testChooseLevelsClamp()
+{
+    std::vector<SplatTreeCL::Region> regions(1, makeRegion(64));
+    unsigned int levels, subsampling;
+
+    // Splats spanning 2^7 cells would ask for subsampling 6, but only 5 is allowed
+    chooseLevels(regions, 7, 4, 5, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(5, subsampling);
+    MLSGPU_ASSERT_EQUAL(2, levels);
+
+    chooseLevels(regions, 4, 4, 5, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(4, subsampling);
+    MLSGPU_ASSERT_EQUAL(3, levels);
+}
+
+void TestDeviceWorkerGroup::testChooseLevelsBatch()
+{
+    // Four slots of 64 cells along each axis
+    std::vector<SplatTreeCL::Region> regions;
+    regions.push_back(makeRegion(40, 0));
+    regions.push_back(makeRegion(40, 64));
+    unsigned int levels, subsampling;
+
+    chooseLevels(regions, 5, 6, 3, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(3, subsampling);
+    MLSGPU_ASSERT_EQUAL(5, levels);
+
+    regions.push_back(makeRegion(64, 192));
+    chooseLevels(regions, 0, 6, 3, levels, subsampling);
+    MLSGPU_ASSERT_EQUAL(3, subsampling);
+    MLSGPU_ASSERT_EQUAL(6, levels);
+}